@@ -0,0 +1,18 @@
+"""
+RIAPS Timesync Service
+======================
+
+The native extension (_riaps_ts) is used when it is available, the ctypes
+based implementation (riaps_ts.riaps_ts) otherwise. Both provide the same
+interface.
+
+Copyright (C) Vanderbilt University, ISIS 2016-2024
+"""
+try:
+    from ._riaps_ts import *
+    NATIVE = True
+except ImportError:
+    from .riaps_ts import *
+    NATIVE = False
+
+from .aio import sleep_until, status_async, set_endpoint
@@ -0,0 +1,307 @@
+/*
+    RIAPS Timesync Service - Native Python extension
+
+    Same interface as the ctypes based riaps_ts module, but the results are
+    built directly (no intermediate structures), blocking calls release the
+    GIL and blocks of timestamps can be taken in a single call.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "riaps_ts.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+
+static inline long long timespec_ns(const struct riaps_ts_timespec* ts)
+{
+    return (long long)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+
+/* Fill a buffer with consecutive timestamps, returns non-zero on failure */
+static int fill_ns(int64_t* buf, Py_ssize_t n)
+{
+    struct riaps_ts_timespec ts;
+    Py_ssize_t i;
+
+    for (i = 0; i < n; i++) {
+        if (riaps_ts_gettime(&ts)) {
+            return -1;
+        }
+        buf[i] = timespec_ns(&ts);
+    }
+    return 0;
+}
+
+
+/* A (sec, nsec) sequence or a number of seconds */
+static int parse_timespec(PyObject* obj, struct riaps_ts_timespec* ts)
+{
+    if (PyTuple_Check(obj) || PyList_Check(obj)) {
+        PyObject* seq = PySequence_Fast(obj, "timespec must be a (sec, nsec) sequence");
+        if (!seq) {
+            return -1;
+        }
+        if (PySequence_Fast_GET_SIZE(seq) != 2) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_ValueError, "timespec must be a (sec, nsec) sequence");
+            return -1;
+        }
+        ts->tv_sec = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, 0));
+        ts->tv_nsec = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, 1));
+        Py_DECREF(seq);
+    }
+    else if (PyLong_Check(obj)) {
+        ts->tv_sec = PyLong_AsLong(obj);
+        ts->tv_nsec = 0;
+    }
+    else {
+        double secs = PyFloat_AsDouble(obj);
+        if (secs == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+        ts->tv_sec = (long)secs;
+        ts->tv_nsec = (long)(1e9 * (secs - ts->tv_sec));
+    }
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+
+PyDoc_STRVAR(gettime_doc,
+"gettime()\n\n"
+"Get the current system / synchronized time as a (sec, nsec) integer tuple.");
+
+static PyObject* riaps_ts_py_gettime(PyObject* self, PyObject* args)
+{
+    struct riaps_ts_timespec ts;
+
+    if (riaps_ts_gettime(&ts)) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return Py_BuildValue("(ll)", ts.tv_sec, ts.tv_nsec);
+}
+
+
+PyDoc_STRVAR(gettime_ns_doc,
+"gettime_ns()\n\n"
+"Get the current system / synchronized time as an integer number of nanoseconds.");
+
+static PyObject* riaps_ts_py_gettime_ns(PyObject* self, PyObject* args)
+{
+    struct riaps_ts_timespec ts;
+
+    if (riaps_ts_gettime(&ts)) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return PyLong_FromLongLong(timespec_ns(&ts));
+}
+
+
+PyDoc_STRVAR(gettime_ns_array_doc,
+"gettime_ns_array(n)\n\n"
+"Take n consecutive timestamps (nanoseconds) and return them in an array('q').");
+
+static PyObject* riaps_ts_py_gettime_ns_array(PyObject* self, PyObject* arg)
+{
+    PyObject* module;
+    PyObject* data;
+    PyObject* array;
+    Py_ssize_t n;
+    int ret;
+
+    n = PyLong_AsSsize_t(arg);
+    if (n == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (n < 0 || n > PY_SSIZE_T_MAX / (Py_ssize_t)sizeof(int64_t)) {
+        PyErr_SetString(PyExc_ValueError, "invalid number of timestamps");
+        return NULL;
+    }
+
+    data = PyBytes_FromStringAndSize(NULL, n * sizeof(int64_t));
+    if (!data) {
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ret = fill_ns((int64_t*)PyBytes_AS_STRING(data), n);
+    Py_END_ALLOW_THREADS
+    if (ret) {
+        Py_DECREF(data);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    module = PyImport_ImportModule("array");
+    if (!module) {
+        Py_DECREF(data);
+        return NULL;
+    }
+    array = PyObject_CallMethod(module, "array", "sO", "q", data);
+    Py_DECREF(module);
+    Py_DECREF(data);
+    return array;
+}
+
+
+PyDoc_STRVAR(gettime_ns_into_doc,
+"gettime_ns_into(buffer)\n\n"
+"Fill a writable, contiguous buffer of 64-bit integers (e.g. a numpy.int64 array)\n"
+"with consecutive timestamps (nanoseconds). Returns the number of timestamps.");
+
+static PyObject* riaps_ts_py_gettime_ns_into(PyObject* self, PyObject* arg)
+{
+    Py_buffer view;
+    const char* format;
+    Py_ssize_t n;
+    int ret;
+
+    if (PyObject_GetBuffer(arg, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)) {
+        return NULL;
+    }
+    format = view.format ? view.format : "B";
+    if (*format == '@' || *format == '=' || *format == '<') {
+        format++;
+    }
+    if (view.itemsize != sizeof(int64_t) || !*format || !strchr("qQlL", *format) || format[1]) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_TypeError, "buffer of 64-bit integers expected");
+        return NULL;
+    }
+
+    n = view.len / view.itemsize;
+    Py_BEGIN_ALLOW_THREADS
+    ret = fill_ns((int64_t*)view.buf, n);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if (ret) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return PyLong_FromSsize_t(n);
+}
+
+
+PyDoc_STRVAR(sleep_doc,
+"sleep(timespec, flags=RIAPS_TS_RELTIME)\n\n"
+"Sleep for the specified amount of time (other threads keep running).\n\n"
+"flags is either RIAPS_TS_RELTIME or RIAPS_TS_ABSTIME.\n"
+"timespec is a (sec, nsec) integer sequence or single number (sec)");
+
+static PyObject* riaps_ts_py_sleep(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    static char* keywords[] = {"timespec", "flags", NULL};
+    struct riaps_ts_timespec request;
+    PyObject* timespec;
+    int flags = RIAPS_TS_RELTIME;
+    int ret;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i:sleep", keywords, &timespec, &flags) ||
+        parse_timespec(timespec, &request)) {
+        return NULL;
+    }
+    if (flags != RIAPS_TS_RELTIME && flags != RIAPS_TS_ABSTIME) {
+        PyErr_SetString(PyExc_ValueError, "flags must be RIAPS_TS_RELTIME or RIAPS_TS_ABSTIME");
+        return NULL;
+    }
+
+    /* Interrupted sleeps are resumed (after the signal handlers), so it is done in absolute time */
+    if (flags == RIAPS_TS_RELTIME) {
+        struct riaps_ts_timespec now;
+        long long deadline;
+
+        if (riaps_ts_gettime(&now)) {
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        deadline = timespec_ns(&now) + timespec_ns(&request);
+        request.tv_sec = deadline / NSEC_PER_SEC;
+        request.tv_nsec = deadline % NSEC_PER_SEC;
+    }
+
+    for (;;) {
+        Py_BEGIN_ALLOW_THREADS
+        ret = riaps_ts_sleep(RIAPS_TS_ABSTIME, &request);
+        Py_END_ALLOW_THREADS
+        if (ret != EINTR) {
+            break;
+        }
+        if (PyErr_CheckSignals()) {
+            return NULL;
+        }
+    }
+    if (ret) {
+        errno = ret;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_RETURN_NONE;
+}
+
+
+PyDoc_STRVAR(status_doc,
+"status()\n\n"
+"Get the current status of the time synchronization service.\n\n"
+"The result is a tuple with the following elements:\n"
+"(role, reference, ref_time, last_offset, rms_offset, ppm)");
+
+static PyObject* riaps_ts_py_status(PyObject* self, PyObject* args)
+{
+    struct riap_ts_status stat;
+    int ret;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = riaps_ts_status(&stat);
+    Py_END_ALLOW_THREADS
+    if (ret) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return Py_BuildValue("(ii(ll)ddd)", stat.role, stat.reference, stat.now.tv_sec, stat.now.tv_nsec,
+                         stat.last_offset, stat.rms_offset, stat.ppm);
+}
+
+
+static PyMethodDef riaps_ts_methods[] = {
+    {"gettime", riaps_ts_py_gettime, METH_NOARGS, gettime_doc},
+    {"gettime_ns", riaps_ts_py_gettime_ns, METH_NOARGS, gettime_ns_doc},
+    {"gettime_ns_array", riaps_ts_py_gettime_ns_array, METH_O, gettime_ns_array_doc},
+    {"gettime_ns_into", riaps_ts_py_gettime_ns_into, METH_O, gettime_ns_into_doc},
+    {"sleep", (PyCFunction)(void(*)(void))riaps_ts_py_sleep, METH_VARARGS | METH_KEYWORDS, sleep_doc},
+    {"status", riaps_ts_py_status, METH_NOARGS, status_doc},
+    {NULL, NULL, 0, NULL}
+};
+
+
+static struct PyModuleDef riaps_ts_module = {
+    PyModuleDef_HEAD_INIT,
+    "_riaps_ts",
+    "RIAPS Timesync Service (native extension)",
+    -1,
+    riaps_ts_methods
+};
+
+
+PyMODINIT_FUNC PyInit__riaps_ts(void)
+{
+    PyObject* module = PyModule_Create(&riaps_ts_module);
+
+    if (!module) {
+        return NULL;
+    }
+    if (PyModule_AddIntConstant(module, "RIAPS_TS_RELTIME", RIAPS_TS_RELTIME) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_ABSTIME", RIAPS_TS_ABSTIME) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_MASTER", RIAPS_TS_MASTER) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_SLAVE", RIAPS_TS_SLAVE) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_REF_NONE", RIAPS_TS_REF_NONE) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_REF_GPS", RIAPS_TS_REF_GPS) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_REF_NTP", RIAPS_TS_REF_NTP) ||
+        PyModule_AddIntConstant(module, "RIAPS_TS_REF_PTP", RIAPS_TS_REF_PTP)) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,219 @@
+"""
+RIAPS Timesync Service - asyncio integration
+============================================
+
+Awaitable synchronized-time sleeps and status queries. Every event loop gets
+a timer set of the service (a single timerfd on the synchronized clock for any
+number of sleeping coroutines) and a client context, whose non-blocking chrony
+socket is registered with the selector of the loop. So timed coroutines do not
+need helper threads or executors.
+
+Copyright (C) Vanderbilt University, ISIS 2016-2024
+"""
+import os
+import errno
+import ctypes
+import asyncio
+import time
+import weakref
+import itertools
+
+from .riaps_ts import riaps_ts_timespec, riaps_ts_status
+
+lib_riaps_ts = ctypes.CDLL("libriaps_ts.so", use_errno=True)
+
+_timer_cb_t = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.POINTER(riaps_ts_timespec),
+                               ctypes.c_ulong, ctypes.c_void_p)
+
+_timers_create = lib_riaps_ts.riaps_ts_timers_create
+_timers_create.restype = ctypes.c_void_p
+_timers_create.argtypes = []
+_timers_destroy = lib_riaps_ts.riaps_ts_timers_destroy
+_timers_destroy.argtypes = [ctypes.c_void_p]
+_timers_fd = lib_riaps_ts.riaps_ts_timers_fd
+_timers_fd.argtypes = [ctypes.c_void_p]
+_timers_dispatch = lib_riaps_ts.riaps_ts_timers_dispatch
+_timers_dispatch.argtypes = [ctypes.c_void_p]
+_timer_add_oneshot = lib_riaps_ts.riaps_ts_timer_add_oneshot
+_timer_add_oneshot.restype = ctypes.c_void_p
+_timer_add_oneshot.argtypes = [ctypes.c_void_p, ctypes.POINTER(riaps_ts_timespec), _timer_cb_t,
+                               ctypes.c_void_p]
+_timer_cancel = lib_riaps_ts.riaps_ts_timer_cancel
+_timer_cancel.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+
+_ctx_create = lib_riaps_ts.riaps_ts_ctx_create
+_ctx_create.restype = ctypes.c_void_p
+_ctx_create.argtypes = [ctypes.c_char_p]
+_ctx_destroy = lib_riaps_ts.riaps_ts_ctx_destroy
+_ctx_destroy.argtypes = [ctypes.c_void_p]
+_status_begin = lib_riaps_ts.riaps_ts_status_begin
+_status_begin.argtypes = [ctypes.c_void_p]
+_status_complete = lib_riaps_ts.riaps_ts_status_complete
+_status_complete.argtypes = [ctypes.c_void_p, ctypes.POINTER(riaps_ts_status)]
+
+
+_set_endpoint = lib_riaps_ts.riaps_ts_set_endpoint
+_set_endpoint.argtypes = [ctypes.c_char_p]
+
+# Endpoint of the loop contexts (None: automatic) and its generation
+_endpoint = None
+_endpoint_gen = 0
+
+
+def _os_error():
+    errno_ = ctypes.get_errno()
+    return OSError(errno_, os.strerror(errno_))
+
+
+class _Resources:
+    """Native resources of a loop, released with the loop."""
+
+    def __init__(self):
+        self.timers = None
+        self.ctx = None
+
+    def release(self):
+        if self.timers:
+            _timers_destroy(self.timers)
+        if self.ctx:
+            _ctx_destroy(self.ctx)
+
+
+class _LoopState:
+    """Timer set and client context of an event loop."""
+
+    def __init__(self, loop):
+        # No reference to the loop, the state is released with the loop
+        self._res = _Resources()
+        weakref.finalize(self, self._res.release)
+        self._res.timers = self._timers = _timers_create()
+        if not self._timers:
+            raise _os_error()
+        self._ctx_gen = -1
+
+        # Sleeping coroutines by timer key: (future, timer)
+        self._sleepers = {}
+        self._keys = itertools.count(1)
+        self._expired_cb = _timer_cb_t(self._expired)
+        loop.add_reader(_timers_fd(self._timers), _timers_dispatch, self._timers)
+
+        self._status = None
+        self._status_fd = -1
+
+    def sleep_until(self, deadline):
+        key = next(self._keys)
+        fut = asyncio.get_running_loop().create_future()
+        timer = _timer_add_oneshot(self._timers, ctypes.byref(deadline), self._expired_cb, key)
+        if not timer:
+            raise _os_error()
+        self._sleepers[key] = (fut, timer)
+        fut.add_done_callback(lambda fut: self._cancel(key))
+        return fut
+
+    def _expired(self, timer, deadline, overruns, key):
+        fut, _ = self._sleepers.pop(key, (None, None))
+        if fut is not None and not fut.done():
+            fut.set_result(None)
+
+    def _cancel(self, key):
+        # The timer is still pending only if the sleeping coroutine was cancelled
+        _, timer = self._sleepers.pop(key, (None, None))
+        if timer is not None:
+            _timer_cancel(self._timers, timer)
+
+    def status(self):
+        # Concurrent callers share the pending query (a new one would cancel it)
+        if self._status is None:
+            if self._ctx_gen != _endpoint_gen:
+                self._open_ctx()
+            fd = _status_begin(self._res.ctx)
+            if fd < 0:
+                raise _os_error()
+            loop = asyncio.get_running_loop()
+            self._status = loop.create_future()
+            self._status_fd = fd
+            loop.add_reader(fd, self._status_ready)
+        return self._status
+
+    def _open_ctx(self):
+        if self._res.ctx:
+            _ctx_destroy(self._res.ctx)
+            self._res.ctx = None
+        self._res.ctx = _ctx_create(_endpoint.encode() if _endpoint else None)
+        if not self._res.ctx:
+            raise _os_error()
+        self._ctx_gen = _endpoint_gen
+
+    def _status_ready(self):
+        stat = riaps_ts_status()
+        if _status_complete(self._res.ctx, ctypes.byref(stat)):
+            error = _os_error()
+            if error.errno == errno.EAGAIN:
+                return
+            result = None
+        else:
+            error = None
+            result = (stat.role,
+                      stat.reference,
+                      (stat.now.tv_sec, stat.now.tv_nsec),
+                      stat.last_offset,
+                      stat.rms_offset,
+                      stat.ppm)
+
+        fut = self._status
+        asyncio.get_running_loop().remove_reader(self._status_fd)
+        self._status = None
+        if fut.done():
+            return
+        if error is not None:
+            fut.set_exception(error)
+        else:
+            fut.set_result(result)
+
+
+_loop_states = weakref.WeakKeyDictionary()
+
+
+def _loop_state():
+    loop = asyncio.get_running_loop()
+    state = _loop_states.get(loop)
+    if state is None:
+        state = _LoopState(loop)
+        _loop_states[loop] = state
+    return state
+
+
+def set_endpoint(endpoint=None):
+    """Select how to communicate with chrony.
+
+    Applies to the status queries of the event loops and to the blocking
+    status() of the native and ctypes modules. endpoint is the path of a
+    Unix domain socket, a "host[:port]" UDP address or None (automatic).
+    """
+    global _endpoint, _endpoint_gen
+    if _set_endpoint(endpoint.encode() if endpoint else None):
+        raise ValueError('invalid endpoint: %r' % (endpoint,))
+    _endpoint = endpoint
+    _endpoint_gen += 1
+
+
+async def sleep_until(sec, nsec=0):
+    """Sleep until the given absolute synchronized time.
+
+    The wake-up is driven by the timer set of the running loop, so any number
+    of coroutines can wait for their own instants on one thread.
+    """
+    if sec * 1000000000 + nsec <= time.time_ns():
+        # The synchronized clock is the system clock, a past deadline needs no timer
+        await asyncio.sleep(0)
+        return
+    await _loop_state().sleep_until(riaps_ts_timespec(sec, nsec))
+
+
+async def status_async():
+    """Get the current status of the time synchronization service.
+
+    Same result as riaps_ts.status(): the tuple
+    (role, reference, ref_time, last_offset, rms_offset, ppm)
+    """
+    return await asyncio.shield(_loop_state().status())
@@ -5,6 +5,7 @@ RIAPS Timesync Service
 Copyright (C) Vanderbilt University, ISIS 2016-2024
 """
 import os
+import array
 import ctypes
 import numbers
 
@@ -49,6 +50,24 @@ def gettime():
         raise OSError(errno_, os.strerror(errno_))
     return (res.tv_sec, res.tv_nsec)
 
+def gettime_ns():
+    """Get the current system / synchronized time as an integer number of nanoseconds."""
+    sec, nsec = gettime()
+    return sec * 1000000000 + nsec
+
+def gettime_ns_array(n):
+    """Take n consecutive timestamps (nanoseconds) and return them in an array('q')."""
+    return array.array('q', (gettime_ns() for _ in range(n)))
+
+def gettime_ns_into(buffer):
+    """Fill a writable buffer of 64-bit integers (e.g. a numpy.int64 array)
+    with consecutive timestamps (nanoseconds). Returns the number of timestamps.
+    """
+    view = memoryview(buffer).cast('B').cast('q')
+    for i in range(len(view)):
+        view[i] = gettime_ns()
+    return len(view)
+
 _riaps_ts_sleep = lib_riaps_ts.riaps_ts_sleep
 _riaps_ts_sleep.argtypes = [ctypes.c_int, ctypes.POINTER(riaps_ts_timespec)]
 
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+"""Simple asyncio test for the RIAPS Timesync Service."""
+import asyncio
+import riaps_ts
+
+async def ticker(name, period_ns):
+    """Wake up on the multiples of the period and report the lateness."""
+    while True:
+        now = riaps_ts.gettime_ns()
+        deadline = (now // period_ns + 1) * period_ns
+        await riaps_ts.sleep_until(deadline // 1000000000, deadline % 1000000000)
+        late = riaps_ts.gettime_ns() - deadline
+        if period_ns >= 1000000000:
+            print('%s wake: %d.%09d secs (late: %d us)' %
+                  (name, deadline // 1000000000, deadline % 1000000000, late // 1000))
+
+async def reporter():
+    while True:
+        try:
+            status = await riaps_ts.status_async()
+            print(('\trole: %d\n' +
+                   '\treference: %d\n' +
+                   '\tnow: %d.%09d secs\n' +
+                   '\tlast_offset: %.9f secs\n' +
+                   '\trms_offset: %.9f secs\n' +
+                   '\tppm: %.6f') % (status[0], status[1], *status[2], *status[3:]))
+        except OSError as e:
+            print('\tstatus: %s' % e)
+        await asyncio.sleep(10)
+
+async def run():
+    # Many fast tickers share the loop with the (second boundary) reporter
+    tasks = [ticker('t%d' % i, 10000000) for i in range(100)]
+    tasks.append(ticker('pps', 1000000000))
+    tasks.append(reporter())
+    await asyncio.gather(*tasks)
+
+def main():
+    asyncio.run(run())
+
+if __name__ == '__main__':
+    main()
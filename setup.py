@@ -0,0 +1,20 @@
+"""
+Build of the native extension of the riaps_ts package (the metadata is in pyproject.toml).
+
+The extension links against the installed libriaps_ts. If it cannot be built
+(e.g. no compiler or Python headers), the package falls back to the ctypes
+based implementation.
+"""
+from setuptools import setup, Extension
+
+setup(
+    ext_modules=[
+        Extension(
+            'riaps_ts._riaps_ts',
+            sources=['python/riaps_ts/_riaps_ts.c'],
+            include_dirs=['src'],
+            libraries=['riaps_ts'],
+            optional=True,
+        )
+    ]
+)
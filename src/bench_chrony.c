@@ -0,0 +1,120 @@
+/*
+    RIAPS Timesync Service - chrony transport benchmark
+
+    Measures the round-trip latency of tracking requests over the Unix domain
+    and UDP command sockets of chrony.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "riaps_ts.h"
+#include "chrony.h"
+
+#define DEFAULT_ITERATIONS 10000
+
+static int cmp_double(const void* a, const void* b)
+{
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static double elapsed_us(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static int bench(const char* endpoint, int iterations, double* samples)
+{
+    chrony_client client;
+    chrony_req req;
+    chrony_rep rep;
+    struct timespec start, end;
+    double sum = 0.0;
+    int failed = 0;
+    int n = 0;
+    int i;
+
+    if (chrony_client_init(&client, endpoint)) {
+        fprintf(stderr, "ERROR: invalid endpoint: %s\n", endpoint);
+        return -1;
+    }
+
+    for (i = 0; i < iterations; i++) {
+        req.command = htons(REQ_TRACKING);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (chrony_request(&client, &req, REQ_LENGTH(tracking), &rep, REP_LENGTH(tracking), RPY_TRACKING)) {
+            failed++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[n] = elapsed_us(&start, &end);
+        sum += samples[n++];
+    }
+
+    printf("%-28s %-5s ", endpoint,
+           chrony_client_transport(&client) == CHRONY_TRANSPORT_UNIX ? "unix" :
+           chrony_client_transport(&client) == CHRONY_TRANSPORT_UDP ? "udp" : "none");
+    chrony_client_close(&client);
+    if (n == 0) {
+        printf("all %d requests failed\n", failed);
+        return -1;
+    }
+
+    qsort(samples, n, sizeof(double), cmp_double);
+    printf("%10.1f %10.1f %10.1f %10.1f %10.1f %8d\n",
+           samples[0], sum / n, samples[n / 2], samples[(int)(n * 0.99)], samples[n - 1], failed);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* default_endpoints[] = {RIAPS_TS_ENDPOINT_UNIX, RIAPS_TS_ENDPOINT_UDP};
+    const char** endpoints = default_endpoints;
+    int n_endpoints = 2;
+    int iterations = DEFAULT_ITERATIONS;
+    double* samples;
+    int ret = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [endpoint...]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    if (optind < argc) {
+        endpoints = (const char**)&argv[optind];
+        n_endpoints = argc - optind;
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "ERROR: invalid number of iterations\n");
+        exit(-1);
+    }
+
+    samples = malloc(iterations * sizeof(double));
+    if (!samples) {
+        perror("ERROR: malloc()");
+        exit(-1);
+    }
+
+    printf("%-28s %-5s %10s %10s %10s %10s %10s %8s\n", "endpoint", "via",
+           "min[us]", "mean[us]", "p50[us]", "p99[us]", "max[us]", "failed");
+    for (i = 0; i < n_endpoints; i++) {
+        if (bench(endpoints[i], iterations, samples)) {
+            ret = -1;
+        }
+    }
+
+    free(samples);
+    return ret;
+}
@@ -0,0 +1,128 @@
+/*
+    RIAPS Timesync Service - timestamp source benchmark
+
+    Compares the per-call cost of riaps_ts_gettime() and the cycle counter
+    based fast timestamps, and reports the quality of the counter mapping.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "riaps_ts.h"
+#include "riaps_ts_fast.h"
+
+#define DEFAULT_ITERATIONS 10000000
+
+static volatile long long sink;
+
+static double now_ns()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1e9 + tp.tv_nsec;
+}
+
+static double bench_gettime(long iterations)
+{
+    struct riaps_ts_timespec ts;
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        riaps_ts_gettime(&ts);
+        sink += ts.tv_nsec;
+    }
+    return (now_ns() - start) / iterations;
+}
+
+static double bench_fast_gettime(long iterations)
+{
+    struct riaps_ts_timespec ts;
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        riaps_ts_fast_gettime(&ts);
+        sink += ts.tv_nsec;
+    }
+    return (now_ns() - start) / iterations;
+}
+
+static double bench_fast_ns(long iterations)
+{
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        sink += riaps_ts_fast_ns();
+    }
+    return (now_ns() - start) / iterations;
+}
+
+/* Largest difference between the fast timestamps and the system clock */
+static double max_error_ns(long iterations)
+{
+    double max_error = 0.0;
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        struct riaps_ts_timespec ts;
+        long long before, fast, after, error;
+
+        riaps_ts_gettime(&ts);
+        before = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        fast = riaps_ts_fast_ns();
+        riaps_ts_gettime(&ts);
+        after = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+        error = fast < before ? before - fast : (fast > after ? fast - after : 0);
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+    return max_error;
+}
+
+int main(int argc, char* argv[])
+{
+    struct riaps_ts_fast_info info;
+    long iterations = DEFAULT_ITERATIONS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "ERROR: invalid number of iterations\n");
+        exit(-1);
+    }
+
+    riaps_ts_fast_init();
+
+    printf("%-24s %10s\n", "source", "ns/call");
+    printf("%-24s %10.1f\n", "riaps_ts_gettime", bench_gettime(iterations));
+    printf("%-24s %10.1f\n", "riaps_ts_fast_gettime", bench_fast_gettime(iterations));
+    printf("%-24s %10.1f\n", "riaps_ts_fast_ns", bench_fast_ns(iterations));
+
+    printf("\nmax error vs. system clock: %.0f ns\n", max_error_ns(iterations / 10));
+
+    riaps_ts_fast_info(&info);
+    printf("mode: %s%s%s\n", info.mode == RIAPS_TS_FAST_COUNTER ? "counter" : "fallback",
+           info.fallback_reason ? " - " : "", info.fallback_reason ? info.fallback_reason : "");
+    printf("counter: %.0f Hz\n"
+           "cpu skew: %.0f ns\n"
+           "residual: %.0f ns (max: %.0f ns, %lu recalibrations)\n",
+           info.counter_hz, info.cpu_skew * 1e9,
+           info.residual * 1e9, info.max_residual * 1e9, info.calibrations);
+    return 0;
+}
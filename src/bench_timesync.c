@@ -0,0 +1,387 @@
+/*
+    RIAPS Timesync Service - client API benchmark
+
+    Measures the cost of riaps_ts_gettime(), the round-trip latency of
+    riaps_ts_status() and the wake-up error of riaps_ts_sleep() under 1..N
+    concurrent threads, and reports latency histograms in JSON.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "riaps_ts.h"
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_GETTIME_SAMPLES 100000
+#define DEFAULT_STATUS_SAMPLES 2000
+#define DEFAULT_SLEEP_SAMPLES 200
+#define DEFAULT_SLEEP_PERIOD_MS 10
+
+#define OVERHEAD_SAMPLES 100000 /* Back-to-back timer reads to measure their cost */
+
+#define HIST_SUB_BITS 4         /* 16 sub-buckets per power of two (~6% resolution) */
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BINS (64 * HIST_SUB)
+
+#define TEST_GETTIME 0
+#define TEST_STATUS 1
+#define TEST_SLEEP 2
+
+static const char* test_names[] = {
+    "gettime",
+    "status",
+    "sleep"
+};
+
+struct histogram {
+    uint64_t bins[HIST_BINS];
+    uint64_t count;
+    uint64_t failed;
+    int64_t min;
+    int64_t max;
+    double sum;
+};
+
+struct worker {
+    pthread_t thread;
+    int test;
+    int samples;
+    struct histogram hist;
+};
+
+static pthread_barrier_t start_barrier;
+static int sleep_period_ms = DEFAULT_SLEEP_PERIOD_MS;
+static int64_t timer_overhead_ns = 0;   /* Subtracted from the gettime samples */
+
+static int64_t now_ns(clockid_t clock_id)
+{
+    struct timespec tp;
+    clock_gettime(clock_id, &tp);
+    return (int64_t)tp.tv_sec * 1000000000LL + tp.tv_nsec;
+}
+
+/* Log-linear bucket of a (non-negative) value */
+static int hist_bin(uint64_t value)
+{
+    int msb;
+
+    if (value < HIST_SUB) {
+        return value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Upper edge of a bucket */
+static uint64_t hist_edge(int bin)
+{
+    int shift;
+
+    if (bin < HIST_SUB) {
+        return bin;
+    }
+    shift = bin / HIST_SUB - 1;
+    return ((uint64_t)(HIST_SUB + bin % HIST_SUB + 1) << shift) - 1;
+}
+
+static void hist_init(struct histogram* h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = INT64_MAX;
+    h->max = INT64_MIN;
+}
+
+static void hist_add(struct histogram* h, int64_t value)
+{
+    h->bins[hist_bin(value > 0 ? value : 0)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+static void hist_merge(struct histogram* h, const struct histogram* other)
+{
+    int i;
+
+    for (i = 0; i < HIST_BINS; i++) {
+        h->bins[i] += other->bins[i];
+    }
+    h->count += other->count;
+    h->failed += other->failed;
+    h->sum += other->sum;
+    if (other->min < h->min) {
+        h->min = other->min;
+    }
+    if (other->max > h->max) {
+        h->max = other->max;
+    }
+}
+
+static int64_t hist_percentile(const struct histogram* h, double p)
+{
+    uint64_t rank = (uint64_t)(h->count * p);
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < HIST_BINS; i++) {
+        seen += h->bins[i];
+        if (seen > rank) {
+            int64_t edge = hist_edge(i);
+            return edge < h->max ? edge : h->max;
+        }
+    }
+    return h->max;
+}
+
+/* Median cost of reading the timer (comparable to a riaps_ts_gettime() call) */
+static int64_t measure_timer_overhead()
+{
+    struct histogram h;
+    int i;
+
+    hist_init(&h);
+    for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+        int64_t start = now_ns(CLOCK_MONOTONIC);
+        hist_add(&h, now_ns(CLOCK_MONOTONIC) - start);
+    }
+    return hist_percentile(&h, 0.5);
+}
+
+/* Every call is timed on its own, so the tail percentiles show the preempted calls */
+static void bench_gettime(struct worker* w)
+{
+    struct riaps_ts_timespec ts;
+    int i;
+
+    for (i = 0; i < w->samples; i++) {
+        int64_t start = now_ns(CLOCK_MONOTONIC);
+        if (riaps_ts_gettime(&ts)) {
+            w->hist.failed++;
+            continue;
+        }
+        hist_add(&w->hist, now_ns(CLOCK_MONOTONIC) - start - timer_overhead_ns);
+    }
+}
+
+static void bench_status(struct worker* w)
+{
+    struct riap_ts_status status;
+    int i;
+
+    for (i = 0; i < w->samples; i++) {
+        int64_t start = now_ns(CLOCK_MONOTONIC);
+        if (riaps_ts_status(&status)) {
+            w->hist.failed++;
+            continue;
+        }
+        hist_add(&w->hist, now_ns(CLOCK_MONOTONIC) - start);
+    }
+}
+
+static void bench_sleep(struct worker* w)
+{
+    struct riaps_ts_timespec deadline;
+    int64_t period = sleep_period_ms * 1000000LL;
+    int64_t next;
+    int i;
+
+    /* Wake-ups are aligned to the period (as periodic components do) */
+    next = (now_ns(CLOCK_REALTIME) / period + 2) * period;
+    for (i = 0; i < w->samples; i++, next += period) {
+        deadline.tv_sec = next / 1000000000LL;
+        deadline.tv_nsec = next % 1000000000LL;
+        if (riaps_ts_sleep(RIAPS_TS_ABSTIME, &deadline)) {
+            w->hist.failed++;
+            continue;
+        }
+        hist_add(&w->hist, now_ns(CLOCK_REALTIME) - next);
+    }
+}
+
+static void* run_worker(void* arg)
+{
+    struct worker* w = arg;
+
+    pthread_barrier_wait(&start_barrier);
+    switch (w->test) {
+    case TEST_GETTIME:
+        bench_gettime(w);
+        break;
+    case TEST_STATUS:
+        bench_status(w);
+        break;
+    case TEST_SLEEP:
+        bench_sleep(w);
+        break;
+    }
+    return NULL;
+}
+
+static int run_test(int test, int threads, int samples, struct histogram* result)
+{
+    struct worker* workers;
+    int i;
+
+    workers = calloc(threads, sizeof(struct worker));
+    if (!workers) {
+        return -1;
+    }
+    pthread_barrier_init(&start_barrier, NULL, threads);
+    for (i = 0; i < threads; i++) {
+        workers[i].test = test;
+        workers[i].samples = samples;
+        hist_init(&workers[i].hist);
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+            fprintf(stderr, "ERROR: pthread_create(): %s\n", strerror(errno));
+            exit(-1);
+        }
+    }
+
+    hist_init(result);
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        hist_merge(result, &workers[i].hist);
+    }
+    pthread_barrier_destroy(&start_barrier);
+    free(workers);
+    return 0;
+}
+
+static void print_result(FILE* out, int test, int threads, const struct histogram* h, int last)
+{
+    int first_bin = 1;
+    int i;
+
+    fprintf(out, "    {\"test\": \"%s\", \"threads\": %d, \"unit\": \"ns\", "
+            "\"samples\": %llu, \"failed\": %llu",
+            test_names[test], threads,
+            (unsigned long long)h->count, (unsigned long long)h->failed);
+    if (h->count) {
+        fprintf(out, ", \"min\": %lld, \"mean\": %.1f, \"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld",
+                (long long)h->min, h->sum / h->count,
+                (long long)hist_percentile(h, 0.5), (long long)hist_percentile(h, 0.99),
+                (long long)hist_percentile(h, 0.999), (long long)h->max);
+    }
+    /* Non-empty buckets as [upper edge, count] pairs */
+    fprintf(out, ",\n     \"histogram\": [");
+    for (i = 0; i < HIST_BINS; i++) {
+        if (h->bins[i]) {
+            fprintf(out, "%s[%llu, %llu]", first_bin ? "" : ", ",
+                    (unsigned long long)hist_edge(i), (unsigned long long)h->bins[i]);
+            first_bin = 0;
+        }
+    }
+    fprintf(out, "]}%s\n", last ? "" : ",");
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-t max_threads] [-g gettime_samples] [-s status_samples] "
+            "[-w sleep_samples] [-p sleep_period_ms] [-e endpoint] [-o output.json]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    int samples[] = {DEFAULT_GETTIME_SAMPLES, DEFAULT_STATUS_SAMPLES, DEFAULT_SLEEP_SAMPLES};
+    int max_threads = DEFAULT_THREADS;
+    const char* output = NULL;
+    struct histogram result;
+    struct utsname uts;
+    FILE* out = stdout;
+    int n_runs = 0, run = 0;
+    int test, threads;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:g:s:w:p:e:o:h")) != -1) {
+        switch (opt) {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'g':
+            samples[TEST_GETTIME] = atoi(optarg);
+            break;
+        case 's':
+            samples[TEST_STATUS] = atoi(optarg);
+            break;
+        case 'w':
+            samples[TEST_SLEEP] = atoi(optarg);
+            break;
+        case 'p':
+            sleep_period_ms = atoi(optarg);
+            break;
+        case 'e':
+            if (riaps_ts_set_endpoint(optarg)) {
+                fprintf(stderr, "ERROR: invalid endpoint: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+    if (max_threads <= 0 || sleep_period_ms <= 0 ||
+        samples[TEST_GETTIME] < 0 || samples[TEST_STATUS] < 0 || samples[TEST_SLEEP] < 0) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            fprintf(stderr, "ERROR: %s: %s\n", output, strerror(errno));
+            exit(-1);
+        }
+    }
+
+    /* Thread counts: 1, 2, 4, ... max_threads */
+    for (threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        n_runs++;
+        if (threads == max_threads) {
+            break;
+        }
+    }
+    n_runs *= 3;
+
+    timer_overhead_ns = measure_timer_overhead();
+
+    uname(&uts);
+    fprintf(out, "{\n  \"benchmark\": \"bench_timesync\",\n"
+            "  \"machine\": \"%s\",\n  \"kernel\": \"%s\",\n  \"cpus\": %ld,\n"
+            "  \"timestamp\": %lld,\n  \"timer_overhead_ns\": %lld,\n  \"results\": [\n",
+            uts.machine, uts.release, sysconf(_SC_NPROCESSORS_ONLN), (long long)time(NULL),
+            (long long)timer_overhead_ns);
+
+    for (test = TEST_GETTIME; test <= TEST_SLEEP; test++) {
+        for (threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+            fprintf(stderr, "%s with %d thread(s)...\n", test_names[test], threads);
+            run_test(test, threads, samples[test], &result);
+            print_result(out, test, threads, &result, ++run == n_runs);
+            if (threads == max_threads) {
+                break;
+            }
+        }
+    }
+
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
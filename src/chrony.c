@@ -26,115 +26,568 @@
  */
 
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "chrony.h"
+#include "riaps_ts_io.h"
 
-static int chrony_socket = -1;
-static int chrony_seq = 0;
+/* Serial number for unique client socket paths */
+static _Atomic int chrony_sock_serial = 0;
 
-static int close_chrony_socket()
+/* Clients with bound Unix domain socket paths, removed at exit */
+static pthread_mutex_t chrony_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t chrony_registry_once = PTHREAD_ONCE_INIT;
+static chrony_client* chrony_registry = NULL;
+
+static void cleanup_registry()
+{
+    chrony_client* client;
+
+    pthread_mutex_lock(&chrony_registry_lock);
+    for (client = chrony_registry; client; client = client->next) {
+        unlink(client->client_path);
+    }
+    chrony_registry = NULL;
+    pthread_mutex_unlock(&chrony_registry_lock);
+}
+
+static void init_registry()
+{
+    atexit(cleanup_registry);
+}
+
+static void register_client(chrony_client* client)
 {
-    close(chrony_socket);
-    chrony_socket = -1;
+    pthread_once(&chrony_registry_once, init_registry);
+    pthread_mutex_lock(&chrony_registry_lock);
+    client->next = chrony_registry;
+    chrony_registry = client;
+    pthread_mutex_unlock(&chrony_registry_lock);
+}
+
+static void unregister_client(chrony_client* client)
+{
+    chrony_client** link;
+
+    pthread_mutex_lock(&chrony_registry_lock);
+    for (link = &chrony_registry; *link; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&chrony_registry_lock);
+    client->next = NULL;
+}
+
+
+static int open_unix_socket(chrony_client* client, const char* path)
+{
+    struct sockaddr_un server_addr, client_addr;
+    const char* dir_end;
+    int dir_len;
+    int sock_fd;
+
+    if (strlen(path) >= sizeof(server_addr.sun_path) || access(path, F_OK)) {
+        return -1;
+    }
+
+    /* chronyd replies to the address of the client, so it has to be bound */
+    bzero((char *) &client_addr, sizeof(client_addr));
+    client_addr.sun_family = AF_UNIX;
+    dir_end = strrchr(path, '/');
+    dir_len = dir_end ? (int)(dir_end - path) : 0;
+    if (snprintf(client_addr.sun_path, sizeof(client_addr.sun_path), "%.*s/" CHRONY_CLIENT_SOCKET,
+                 dir_len, path, (int)getpid(), atomic_fetch_add(&chrony_sock_serial, 1))
+            >= sizeof(client_addr.sun_path)) {
+        return -1;
+    }
+
+    sock_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    unlink(client_addr.sun_path);
+    if (bind(sock_fd, (struct sockaddr *) &client_addr, sizeof(client_addr)) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    strcpy(client->client_path, client_addr.sun_path);
+    register_client(client);
+
+    /* chronyd (running as an unprivileged user) has to be able to send replies */
+    if (chmod(client_addr.sun_path, 0666)) {
+        goto unix_error;
+    }
+
+    bzero((char *) &server_addr, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, path);
+    if (connect(sock_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+        goto unix_error;
+    }
+
+    return sock_fd;
+
+unix_error:
+    close(sock_fd);
+    unregister_client(client);
+    unlink(client->client_path);
+    client->client_path[0] = '\0';
+    return -1;
 }
 
 
-static int get_chrony_socket()
+/* "host", "host:port" or "[ipv6]:port" */
+static void split_host_port(const char* host_port, char* host, size_t host_size, char* port, size_t port_size)
 {
-    if (chrony_socket < 0) {
-        struct hostent *chrony_host;
-        struct sockaddr_in chrony_addr;
-        struct timeval timeout = {CHRONY_TIMEOUT, 0};
+    const char* sep;
 
-        chrony_socket = socket(AF_INET, SOCK_DGRAM, 0);
-        if (chrony_socket < 0) {
-            chrony_socket = 0;
-            goto ondemand_end;
+    snprintf(port, port_size, "%d", CHRONY_CMD_PORT);
+    if (host_port[0] == '[' && (sep = strchr(host_port, ']'))) {
+        snprintf(host, host_size, "%.*s", (int)(sep - host_port - 1), host_port + 1);
+        sep = (sep[1] == ':') ? sep + 1 : NULL;
+    }
+    else {
+        sep = strrchr(host_port, ':');
+        if (sep && strchr(host_port, ':') != sep) {
+            sep = NULL;    /* bare IPv6 address */
         }
+        snprintf(host, host_size, "%.*s", sep ? (int)(sep - host_port) : (int)strlen(host_port),
+                 host_port);
+    }
+    if (sep) {
+        snprintf(port, port_size, "%s", sep + 1);
+    }
+}
+
 
-        if (setsockopt(chrony_socket, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout,
-                        sizeof(struct timeval))) {
-            close_chrony_socket();
-            goto ondemand_end;
+static int open_udp_socket(const char* host_port)
+{
+    char host[CHRONY_ENDPOINT_LENGTH];
+    char port[8];
+    struct addrinfo hints, *res, *ai;
+    int sock_fd = -1;
+
+    split_host_port(host_port, host, sizeof(host), port, sizeof(port));
+
+    bzero((char *) &hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        return -1;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        sock_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock_fd < 0) {
+            continue;
         }
+        if (connect(sock_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock_fd);
+        sock_fd = -1;
+    }
+    freeaddrinfo(res);
+
+    return sock_fd;
+}
+
+
+int chrony_resolve_udp(const char* host_port, struct sockaddr_storage* addr, socklen_t* addr_len)
+{
+    char host[CHRONY_ENDPOINT_LENGTH];
+    char port[8];
+    struct addrinfo hints, *res;
+
+    if (!host_port || !host_port[0] || host_port[0] == '/' || strlen(host_port) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    split_host_port(host_port, host, sizeof(host), port, sizeof(port));
+
+    bzero((char *) &hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
 
-        chrony_host = gethostbyname(CHRONY_CMD_ADDR);
-        if (chrony_host == NULL) {
-            close_chrony_socket();
-            goto ondemand_end;
+
+static int get_chrony_socket(chrony_client* client)
+{
+    if (client->sock < 0) {
+        if (client->endpoint[0] == '/') {
+            client->sock = open_unix_socket(client, client->endpoint);
+            client->transport = CHRONY_TRANSPORT_UNIX;
+        }
+        else if (client->endpoint[0]) {
+            client->sock = open_udp_socket(client->endpoint);
+            client->transport = CHRONY_TRANSPORT_UDP;
+        }
+        else {
+            client->sock = open_unix_socket(client, CHRONY_CMD_SOCKET);
+            client->transport = CHRONY_TRANSPORT_UNIX;
+            if (client->sock < 0) {
+                client->sock = open_udp_socket(CHRONY_CMD_ADDR);
+                client->transport = CHRONY_TRANSPORT_UDP;
+            }
         }
 
-        bzero((char *) &chrony_addr, sizeof(chrony_addr));
-        chrony_addr.sin_family = AF_INET;
-        bcopy((char *)chrony_host->h_addr,
-            (char *)&chrony_addr.sin_addr.s_addr, chrony_host->h_length);
-        chrony_addr.sin_port = htons(CHRONY_CMD_PORT);
-        if (connect(chrony_socket, (struct sockaddr *) &chrony_addr,
-                        sizeof(chrony_addr)) < 0) {
-            close_chrony_socket();
-            goto ondemand_end;
+        if (client->sock < 0) {
+            client->transport = CHRONY_TRANSPORT_NONE;
         }
     }
 
-ondemand_end:
-    return chrony_socket;
+    return client->sock;
+}
+
+
+int chrony_client_init(chrony_client* client, const char* endpoint)
+{
+    struct timespec tp;
+
+    bzero((char *) client, sizeof(*client));
+    client->sock = -1;
+    client->transport = CHRONY_TRANSPORT_NONE;
+    client->timeout_ms = CHRONY_TIMEOUT_MS;
+
+    /* Do not accept late replies to a previous incarnation of the client */
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    atomic_init(&client->seq, (uint32_t)tp.tv_nsec ^ ((uint32_t)getpid() << 12));
+
+    return chrony_client_set_endpoint(client, endpoint);
+}
+
+
+int chrony_client_set_endpoint(chrony_client* client, const char* endpoint)
+{
+    if (endpoint && strlen(endpoint) >= sizeof(client->endpoint)) {
+        return -1;
+    }
+
+    chrony_client_close(client);
+    strcpy(client->endpoint, endpoint ? endpoint : "");
+    return 0;
+}
+
+
+int chrony_client_set_timeout(chrony_client* client, int timeout_ms)
+{
+    if (timeout_ms < 0) {
+        return -1;
+    }
+
+    client->timeout_ms = timeout_ms ? timeout_ms : CHRONY_TIMEOUT_MS;
+    return 0;
+}
+
+
+long chrony_attempt_timeout_us(int attempt)
+{
+    return riaps_ts_backoff_us(attempt, CHRONY_ATTEMPT_TIMEOUT_US, CHRONY_MAX_ATTEMPT_TIMEOUT_US);
+}
+
+
+/* End of the next attempt of a request, zero if the deadline has passed */
+static int64_t next_attempt_end(int attempt, int64_t deadline_us)
+{
+    return riaps_ts_attempt_end(chrony_attempt_timeout_us(attempt), deadline_us);
+}
+
+
+/* Send a request, a broken connection (e.g. chrony restarted) is reopened once */
+static int send_reconnect(chrony_client* client, chrony_req* req, int req_len, int rep_len)
+{
+    if (chrony_request_send(client, req, req_len, rep_len) == 0) {
+        return 0;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return -1;
+    }
+    return chrony_request_send(client, req, req_len, rep_len);
+}
+
+
+void chrony_client_close(chrony_client* client)
+{
+    if (client->sock >= 0) {
+        close(client->sock);
+    }
+    if (client->client_path[0]) {
+        unregister_client(client);
+        unlink(client->client_path);
+        client->client_path[0] = '\0';
+    }
+    client->sock = -1;
+    client->transport = CHRONY_TRANSPORT_NONE;
 }
 
-int chrony_request(chrony_req* req, int req_len, chrony_rep* rep, int rep_len, int rep_id)
+
+int chrony_client_transport(const chrony_client* client)
+{
+    return client->transport;
+}
+
+
+static int valid_reply(const chrony_req* req, const chrony_rep* rep, int recvlen, int rep_len, int rep_id)
+{
+    if (recvlen < rep_len) {
+        return 0;
+    }
+    if (rep->sequence != req->sequence) {
+        return 0;
+    }
+    if (rep->version != PROTO_VERSION_NUMBER) {
+        return 0;
+    }
+    if (rep->pkt_type != PKT_TYPE_CMD_REPLY) {
+        return 0;
+    }
+    if (rep->command != req->command) {
+        return 0;
+    }
+    if (ntohs(rep->status) != STT_SUCCESS) {
+        return 0;
+    }
+    if (ntohs(rep->reply) != rep_id) {
+        return 0;
+    }
+    return 1;
+}
+
+
+void chrony_request_init(chrony_client* client, chrony_req* req)
 {
     req->version = PROTO_VERSION_NUMBER;
     req->pkt_type = PKT_TYPE_CMD_REQUEST;
     req->res1 = 0;
     req->res2 = 0;
-    req->sequence = htonl(chrony_seq++);
-    req->attempt = -1;
+    req->sequence = htonl(atomic_fetch_add(&client->seq, 1));
+    req->attempt = 0;
     req->pad1 = 0;
     req->pad2 = 0;
+}
 
-    req_len = req_len > rep_len ? req_len : rep_len;
-
-    while (req->attempt++ > CHRONY_MAX_RETRIES) {
-        int sock_fd;
-        int recvlen;
 
-        sock_fd = get_chrony_socket();
-        if (sock_fd < 0) {
-            return -1;
-        }
-        if (send(sock_fd, (void *)req, req_len, 0) < 0) {
-            close_chrony_socket();
-        }
-
-        recvlen = recv(sock_fd, (void *)rep, sizeof(chrony_rep), 0);
-        if (recvlen < rep_len) {
-            continue;
-        }
-        if (rep->sequence != req->sequence) {
+int chrony_request(chrony_client* client, chrony_req* req, int req_len, chrony_rep* rep, int rep_len, int rep_id)
+{
+    int64_t deadline_us, attempt_end;
+    int attempt;
+    int error = ETIMEDOUT;
+
+    chrony_request_init(client, req);
+    deadline_us = riaps_ts_monotonic_us() + (int64_t)client->timeout_ms * 1000;
+
+    for (attempt = 0; (attempt_end = next_attempt_end(attempt, deadline_us)) != 0; attempt++) {
+        if (send_reconnect(client, req, req_len, rep_len)) {
+            /* chrony is not reachable (e.g. restarting), try again after the backoff */
+            error = errno;
+            riaps_ts_sleep_until_us(attempt_end);
             continue;
         }
-        if (rep->version != PROTO_VERSION_NUMBER) {
-            continue;
+
+        /* Stale, duplicated and invalid replies are skipped while waiting */
+        while (riaps_ts_wait_readable(client->sock, attempt_end) > 0) {
+            if (chrony_reply_receive(client, req, rep, rep_len, rep_id) == 0) {
+                return 0;
+            }
+            if (client->sock < 0) {
+                /* The connection is broken, it is reopened by the next attempt */
+                error = errno;
+                riaps_ts_sleep_until_us(attempt_end);
+                break;
+            }
         }
-        if (rep->pkt_type != PKT_TYPE_CMD_REPLY) {
-            continue;
+    }
+
+    errno = error;
+    return -1;
+}
+
+
+/*
+ * Send the pending requests of a batch from *unsent on. Stops at a full socket queue
+ * (the rest is sent as replies arrive), returns non-zero on a connection error.
+ */
+static int send_pending(chrony_client* client, chrony_xfer* xfers, int n_xfers, int* unsent, int* error)
+{
+    for (; *unsent < n_xfers; (*unsent)++) {
+        chrony_xfer* xfer = &xfers[*unsent];
+
+        if (xfer->status == CHRONY_XFER_PENDING &&
+            send_reconnect(client, &xfer->req, xfer->req_len, xfer->rep_len)) {
+            *error = errno;
+            return errno != EAGAIN && errno != EWOULDBLOCK;
         }
-        if (rep->command != req->command) {
+    }
+    return 0;
+}
+
+
+int chrony_request_many(chrony_client* client, chrony_xfer* xfers, int n_xfers)
+{
+    chrony_rep rep;
+    int64_t deadline_us, attempt_end;
+    uint32_t first_seq;
+    int n_pending = n_xfers;
+    int attempt;
+    int error = ETIMEDOUT;
+    int i;
+
+    if (n_xfers <= 0) {
+        return 0;
+    }
+
+    /* Consecutive sequence numbers, so replies can be matched by index */
+    first_seq = atomic_fetch_add(&client->seq, n_xfers);
+    for (i = 0; i < n_xfers; i++) {
+        chrony_request_init(client, &xfers[i].req);
+        xfers[i].req.sequence = htonl(first_seq + i);
+        xfers[i].status = CHRONY_XFER_PENDING;
+    }
+    deadline_us = riaps_ts_monotonic_us() + (int64_t)client->timeout_ms * 1000;
+
+    for (attempt = 0; n_pending > 0 && (attempt_end = next_attempt_end(attempt, deadline_us)) != 0;
+         attempt++) {
+        int unsent = 0;         /* The first request not sent yet in this attempt */
+
+        if (send_pending(client, xfers, n_xfers, &unsent, &error)) {
+            riaps_ts_sleep_until_us(attempt_end);
             continue;
         }
-        if (ntohs(rep->status) != STT_SUCCESS) {
-            continue;
+
+        while (n_pending > 0 && riaps_ts_wait_readable(client->sock, attempt_end) > 0) {
+            chrony_xfer* xfer;
+            uint32_t index;
+            int recvlen;
+
+            recvlen = recv(client->sock, (void *)&rep, sizeof(rep), MSG_DONTWAIT);
+            if (recvlen < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    continue;
+                }
+                error = errno;
+                chrony_client_close(client);
+                riaps_ts_sleep_until_us(attempt_end);
+                break;
+            }
+            if (recvlen < REP_HEADER_LENGTH ||
+                rep.version != PROTO_VERSION_NUMBER ||
+                rep.pkt_type != PKT_TYPE_CMD_REPLY) {
+                continue;
+            }
+
+            index = ntohl(rep.sequence) - first_seq;
+            if (index >= n_xfers) {
+                continue;
+            }
+            xfer = &xfers[index];
+            if (xfer->status != CHRONY_XFER_PENDING || rep.command != xfer->req.command) {
+                continue;
+            }
+            if (ntohs(rep.status) == STT_SUCCESS &&
+                (recvlen < xfer->rep_len ||
+                 (xfer->rep_id != CHRONY_REP_ANY && ntohs(rep.reply) != xfer->rep_id))) {
+                continue;
+            }
+
+            memcpy(&xfer->rep, &rep, recvlen);
+            xfer->rep_recv_len = recvlen;
+            xfer->status = ntohs(rep.status);
+            n_pending--;
+
+            /* A reply makes room in the queue of chrony for the rest of the batch */
+            if (unsent < n_xfers && send_pending(client, xfers, n_xfers, &unsent, &error)) {
+                break;
+            }
         }
-        if (ntohs(rep->reply) != rep_id) {
-            continue;
+    }
+
+    if (n_pending) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+
+int chrony_client_fd(chrony_client* client)
+{
+    return get_chrony_socket(client);
+}
+
+
+int chrony_request_send(chrony_client* client, chrony_req* req, int req_len, int rep_len)
+{
+    int sock_fd;
+
+    sock_fd = get_chrony_socket(client);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    req_len = req_len > rep_len ? req_len : rep_len;
+    if (send(sock_fd, (void *)req, req_len, MSG_DONTWAIT) < 0) {
+        /* A full queue of chrony (e.g. a long pipelined batch) is not a connection error */
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            chrony_client_close(client);
         }
+        return -1;
+    }
+    req->attempt = htons(ntohs(req->attempt) + 1);
+    return 0;
+}
 
-        // everything seems ok
-        return 0;
 
+void chrony_client_drain(chrony_client* client)
+{
+    chrony_rep rep;
+
+    if (client->sock >= 0) {
+        while (recv(client->sock, (void *)&rep, sizeof(rep), MSG_DONTWAIT) >= 0);
     }
+}
 
-    return -1;
+
+int chrony_reply_receive(chrony_client* client, const chrony_req* req, chrony_rep* rep, int rep_len, int rep_id)
+{
+    int recvlen;
+
+    if (client->sock < 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    /* Drain stale and invalid datagrams until the matching one arrives */
+    for (;;) {
+        recvlen = recv(client->sock, (void *)rep, sizeof(chrony_rep), MSG_DONTWAIT);
+        if (recvlen < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                chrony_client_close(client);
+            }
+            return -1;
+        }
+        if (valid_reply(req, rep, recvlen, rep_len, rep_id)) {
+            return 0;
+        }
+    }
 }
 
 
@@ -188,4 +641,60 @@ double double_from_chrony_float_t(const chrony_float_t* f)
         coef -= 1 << FLOAT_COEF_BITS;
 
     return coef * pow(2.0, exp);
-}
\ No newline at end of file
+}
+
+chrony_float_t chrony_float_t_from_double(double x)
+{
+    chrony_float_t f;
+    int32_t exp, coef, neg;
+
+    if (x < 0.0) {
+        x = -x;
+        neg = 1;
+    }
+    else {
+        neg = 0;
+    }
+
+    if (!(x >= 1.0e-100)) {
+        exp = coef = 0;     /* Also for NaN */
+    }
+    else if (x > 1.0e100) {
+        exp = FLOAT_EXP_MAX;
+        coef = FLOAT_COEF_MAX + neg;
+    }
+    else {
+        exp = log(x) / log(2) + 1;
+        coef = x * pow(2.0, -exp + FLOAT_COEF_BITS) + 0.5;
+
+        /* Might need to be shifted down by up to two bits */
+        while (coef > FLOAT_COEF_MAX + neg) {
+            coef >>= 1;
+            exp++;
+        }
+
+        if (exp > FLOAT_EXP_MAX) {
+            exp = FLOAT_EXP_MAX;
+            coef = FLOAT_COEF_MAX + neg;
+        }
+        else if (exp < FLOAT_EXP_MIN) {
+            /* Denormalized result */
+            while (exp < FLOAT_EXP_MIN && coef > 0) {
+                coef >>= 1;
+                exp++;
+            }
+        }
+    }
+
+    if (neg) {
+        coef = (uint32_t)-coef << FLOAT_EXP_BITS >> FLOAT_EXP_BITS;
+    }
+
+    f.f = htonl((uint32_t)exp << FLOAT_COEF_BITS | coef);
+    return f;
+}
+
+uint64_t uint64_from_chrony_int64_t(const chrony_int64_t* i)
+{
+    return (uint64_t)ntohl(i->high) << 32 | ntohl(i->low);
+}
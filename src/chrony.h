@@ -28,13 +28,15 @@
  * @brief RIAPS Timesync Service - Communication with the chrony daemon.
  *
  * This module contains a lightweight interface to communicate with the
- * running chrony daemon via its UDP command socket. The functions in this
+ * running chrony daemon via its Unix domain or UDP command socket. The functions in this
  * module are not supposed to be used by application level code, but provided
  * for higher-level interfaces in the riaps-timesync service.
  */
 
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,19 +46,23 @@
 #include <netinet/in.h>
 #include <netdb.h>
 
-#define CHRONY_CMD_ADDR "127.0.0.1" /**< Only local chrony daemons are supported */
-#define CHRONY_CMD_PORT 323         /**< Hardwired command (UDP) port of chrony */
+#define CHRONY_CMD_ADDR "127.0.0.1" /**< Default address of the command (UDP) socket */
+#define CHRONY_CMD_PORT 323         /**< Default command (UDP) port of chrony */
+#define CHRONY_CMD_SOCKET "/run/chrony/chronyd.sock" /**< Default command (Unix domain) socket */
+#define CHRONY_CLIENT_SOCKET "riaps_ts.%d.%d.sock" /**< Client socket name (pid, serial), next to the command socket */
 
 #define MAX_PADDING_LENGTH 396      /**< Hardwired chrony communication parameter */
 #define PROTO_VERSION_NUMBER 6      /**< Currently supported CMD protocol */
 
-#define CHRONY_TIMEOUT 1            /**< Connection timeout in seconds */
-#define CHRONY_MAX_RETRIES 3        /**< Number of connection retries before giving up */
+#define CHRONY_TIMEOUT_MS 1000      /**< Default time budget of a request (including retransmissions) */
+#define CHRONY_ATTEMPT_TIMEOUT_US 500 /**< Reply timeout of the first attempt, doubled for every retransmission */
+#define CHRONY_MAX_ATTEMPT_TIMEOUT_US 128000 /**< Upper limit of the per-attempt reply timeout */
 
 /*** Custom types ***/
 #define IPADDR_UNSPEC 0
 #define IPADDR_INET4 1
 #define IPADDR_INET6 2
+#define IPADDR_ID 3
 
 /**
  * @brief Chrony's 32-bit floating point type. @see double_from_chrony_float_t()
@@ -90,7 +96,25 @@ typedef struct
 #define PKT_TYPE_CMD_REPLY 2
 
 /*** Requests ***/
+#define REQ_N_SOURCES 14
+#define REQ_SOURCE_DATA 15
+#define REQ_DEL_SOURCE 29
 #define REQ_TRACKING 33
+#define REQ_SOURCESTATS 34
+#define REQ_SERVER_STATS 54
+#define REQ_ADD_SOURCE 64
+
+#define REQ_ADDSRC_SERVER 1
+#define REQ_ADDSRC_PEER 2
+#define REQ_ADDSRC_POOL 3
+
+#define REQ_ADDSRC_ONLINE 0x1
+#define REQ_ADDSRC_AUTOOFFLINE 0x2
+#define REQ_ADDSRC_IBURST 0x4
+#define REQ_ADDSRC_PREFER 0x8
+#define REQ_ADDSRC_NOSELECT 0x10
+#define REQ_ADDSRC_TRUST 0x20
+#define REQ_ADDSRC_REQUIRE 0x40
 
 /**
  * @brief Chrony end-of-request (null request)
@@ -100,6 +124,55 @@ typedef struct
     int32_t EOR;
 } req_null;
 
+/**
+ * @brief Chrony request for a source (by index)
+ */
+typedef struct
+{
+    int32_t index;
+    int32_t EOR;
+} req_source;
+
+/**
+ * @brief Chrony request for adding an NTP source at run time
+ */
+typedef struct
+{
+    uint32_t type;
+    int8_t name[256];
+    uint32_t port;
+    int32_t minpoll;
+    int32_t maxpoll;
+    int32_t presend_minpoll;
+    uint32_t min_stratum;
+    uint32_t poll_target;
+    uint32_t version;
+    uint32_t max_sources;
+    int32_t min_samples;
+    int32_t max_samples;
+    uint32_t authkey;
+    uint32_t nts_port;
+    chrony_float_t max_delay;
+    chrony_float_t max_delay_ratio;
+    chrony_float_t max_delay_dev_ratio;
+    chrony_float_t min_delay;
+    chrony_float_t asymmetry;
+    chrony_float_t offset;
+    uint32_t flags;
+    int32_t filter_length;
+    uint32_t reserved[3];
+    int32_t EOR;
+} req_ntp_source;
+
+/**
+ * @brief Chrony request for removing a source (by address)
+ */
+typedef struct
+{
+    ipaddr_t ip_addr;
+    int32_t EOR;
+} req_del_source;
+
 
 /**
  * @brief Chrony CMD protocol request datagram format
@@ -118,6 +191,12 @@ typedef struct
     union {
         req_null null;
         req_null tracking;
+        req_null n_sources;
+        req_source source_data;
+        req_source sourcestats;
+        req_null server_stats;
+        req_ntp_source ntp_source;
+        req_del_source del_source;
     } data;
     uint8_t padding[MAX_PADDING_LENGTH];
 } chrony_req;
@@ -125,8 +204,28 @@ typedef struct
 /*** Replies ***/
 
 #define STT_SUCCESS 0
+#define STT_FAILED 1
+#define STT_UNAUTH 2
+#define STT_INVALID 3
+#define STT_NOSUCHSOURCE 4
+#define STT_SOURCEALREADYKNOWN 11
+#define STT_TOOMANYSOURCES 12
+#define STT_INVALIDNAME 21
+
+#define RPY_NULL 1
 
+#define RPY_N_SOURCES 2
+#define RPY_SOURCE_DATA 3
 #define RPY_TRACKING 5
+#define RPY_SOURCESTATS 6
+#define RPY_SERVER_STATS 14
+#define RPY_SERVER_STATS2 22
+#define RPY_SERVER_STATS3 24
+#define RPY_SERVER_STATS4 25
+
+#define RPY_SD_MD_CLIENT 0
+#define RPY_SD_MD_PEER 1
+#define RPY_SD_MD_REF 2
 
 typedef struct
 {
@@ -155,6 +254,109 @@ typedef struct
     int32_t EOR;
 } rep_tracking;
 
+/**
+ * @brief Chrony CMD protocol number of sources datagram format
+ */
+typedef struct
+{
+    uint32_t n_sources;
+    int32_t EOR;
+} rep_n_sources;
+
+/**
+ * @brief Chrony CMD protocol source data datagram format
+ */
+typedef struct
+{
+    ipaddr_t ip_addr;
+    int16_t poll;
+    uint16_t stratum;
+    uint16_t state;
+    uint16_t mode;
+    uint16_t flags;
+    uint16_t reachability;
+    uint32_t since_sample;
+    chrony_float_t orig_latest_meas;
+    chrony_float_t latest_meas;
+    chrony_float_t latest_meas_err;
+    int32_t EOR;
+} rep_source_data;
+
+/**
+ * @brief Chrony CMD protocol source statistics datagram format
+ */
+typedef struct
+{
+    uint32_t ref_id;
+    ipaddr_t ip_addr;
+    uint32_t n_samples;
+    uint32_t n_runs;
+    uint32_t span_seconds;
+    chrony_float_t sd;
+    chrony_float_t resid_freq_ppm;
+    chrony_float_t skew_ppm;
+    chrony_float_t est_offset;
+    chrony_float_t est_offset_err;
+    int32_t EOR;
+} rep_sourcestats;
+
+/**
+ * @brief Chrony's 64-bit integer type
+ */
+typedef struct
+{
+    uint32_t high;
+    uint32_t low;
+} chrony_int64_t;
+
+/**
+ * @brief Chrony CMD protocol server statistics datagram format (RPY_SERVER_STATS .. RPY_SERVER_STATS3)
+ *
+ * RPY_SERVER_STATS2 is a prefix of RPY_SERVER_STATS3, while RPY_SERVER_STATS
+ * has only five fields with different meanings (see the comments).
+ */
+typedef struct
+{
+    uint32_t ntp_hits;
+    uint32_t nke_hits;      /* cmd_hits in RPY_SERVER_STATS */
+    uint32_t cmd_hits;      /* ntp_drops in RPY_SERVER_STATS */
+    uint32_t ntp_drops;     /* cmd_drops in RPY_SERVER_STATS */
+    uint32_t nke_drops;     /* log_drops in RPY_SERVER_STATS */
+    uint32_t cmd_drops;
+    uint32_t log_drops;
+    uint32_t ntp_auth_hits;
+    uint32_t ntp_interleaved_hits;
+    uint32_t ntp_timestamps;
+    uint32_t ntp_span_seconds;
+    int32_t EOR;
+} rep_server_stats;
+
+/**
+ * @brief Chrony CMD protocol server statistics datagram format (RPY_SERVER_STATS4)
+ */
+typedef struct
+{
+    chrony_int64_t ntp_hits;
+    chrony_int64_t nke_hits;
+    chrony_int64_t cmd_hits;
+    chrony_int64_t ntp_drops;
+    chrony_int64_t nke_drops;
+    chrony_int64_t cmd_drops;
+    chrony_int64_t log_drops;
+    chrony_int64_t ntp_auth_hits;
+    chrony_int64_t ntp_interleaved_hits;
+    chrony_int64_t ntp_timestamps;
+    chrony_int64_t ntp_span_seconds;
+    chrony_int64_t ntp_daemon_rx_timestamps;
+    chrony_int64_t ntp_daemon_tx_timestamps;
+    chrony_int64_t ntp_kernel_rx_timestamps;
+    chrony_int64_t ntp_kernel_tx_timestamps;
+    chrony_int64_t ntp_hw_rx_timestamps;
+    chrony_int64_t ntp_hw_tx_timestamps;
+    chrony_int64_t reserved[4];
+    int32_t EOR;
+} rep_server_stats4;
+
 /**
  * @brief Chrony CMD protocol reply datagram format
  */
@@ -177,29 +379,220 @@ typedef struct
     union {
         rep_null null;
         rep_tracking tracking;
+        rep_n_sources n_sources;
+        rep_source_data source_data;
+        rep_sourcestats sourcestats;
+        rep_server_stats server_stats;
+        rep_server_stats4 server_stats4;
     } data;
 
 } chrony_rep;
 
+/*** Transports ***/
+#define CHRONY_TRANSPORT_NONE 0     /**< No connection */
+#define CHRONY_TRANSPORT_UNIX 1     /**< Unix domain datagram socket */
+#define CHRONY_TRANSPORT_UDP 2      /**< UDP socket */
+
 #define REQ_LENGTH(reply_data_field) \
   offsetof(chrony_req, data.reply_data_field.EOR)
 
 #define REP_LENGTH(reply_data_field) \
   offsetof(chrony_rep, data.reply_data_field.EOR)
 
+#define REP_HEADER_LENGTH offsetof(chrony_rep, data)
+
+#define CHRONY_XFER_PENDING -1      /**< No reply received (yet) @see chrony_xfer */
+#define CHRONY_REP_ANY -1           /**< Accept any reply type @see chrony_xfer */
+
+/**
+ * @brief One request/reply exchange of a pipelined batch. @see chrony_request_many()
+ */
+typedef struct
+{
+    chrony_req req;     /**< Request (command and data fields are set by the caller) */
+    int req_len;        /**< Length of the request */
+    int rep_len;        /**< Minimum length of a successful reply */
+    int rep_id;         /**< Expected reply type or CHRONY_REP_ANY */
+    int rep_recv_len;   /**< Received length of the reply */
+    int status;         /**< Chrony status of the reply (STT_SUCCESS) or CHRONY_XFER_PENDING */
+    chrony_rep rep;     /**< Reply */
+} chrony_xfer;
+
+#define CHRONY_ENDPOINT_LENGTH 108  /**< Maximum length of an endpoint specification (sun_path) */
+
+/**
+ * @brief Connection state of a chrony command client.
+ *
+ * Every client owns its socket, so independent clients can be used from different
+ * threads in parallel. A single client must not be used by multiple threads at the
+ * same time.
+ */
+typedef struct chrony_client
+{
+    int sock;                               /**< Connected socket or -1 */
+    int transport;                          /**< Transport of the connected socket */
+    _Atomic uint32_t seq;                   /**< Sequence number of the next request */
+    int timeout_ms;                         /**< Time budget of a request @see chrony_client_set_timeout() */
+    char endpoint[CHRONY_ENDPOINT_LENGTH];  /**< Selected endpoint, empty for automatic selection */
+    char client_path[CHRONY_ENDPOINT_LENGTH]; /**< Bound path of a Unix domain client socket */
+    struct chrony_client* next;             /**< Registry of clients with bound paths */
+} chrony_client;
+
+/**
+ * @brief Initialize a chrony command client.
+ *
+ * The endpoint is either an absolute path of a Unix domain socket or a
+ * "host[:port]" UDP address. If @c endpoint is NULL or empty, the default Unix
+ * domain socket (@c CHRONY_CMD_SOCKET) is used when accessible, with a fall back
+ * to the default UDP address (@c CHRONY_CMD_ADDR, @c CHRONY_CMD_PORT).
+ * The connection is opened on demand.
+ *
+ * @param client Pointer to the client structure to be initialized
+ * @param endpoint The endpoint specification or NULL for automatic selection
+ * @return Zero, if the endpoint specification is valid.
+ */
+int chrony_client_init(chrony_client* client, const char* endpoint);
+
+/**
+ * @brief Select a new command endpoint for the client.
+ *
+ * The current connection (if any) is closed. @see chrony_client_init()
+ *
+ * @param client Pointer to an initialized client
+ * @param endpoint The endpoint specification or NULL for automatic selection
+ * @return Zero, if the endpoint specification is valid.
+ */
+int chrony_client_set_endpoint(chrony_client* client, const char* endpoint);
+
+/**
+ * @brief Set the time budget of the requests of the client.
+ *
+ * A request (including its retransmissions with exponential backoff and the
+ * reconnections) fails after this time, if no reply has been received.
+ *
+ * @param client Pointer to an initialized client
+ * @param timeout_ms The time budget in milliseconds (0 for @c CHRONY_TIMEOUT_MS)
+ * @return Zero, if the timeout is valid.
+ */
+int chrony_client_set_timeout(chrony_client* client, int timeout_ms);
+
+/**
+ * @brief Get the reply timeout of an attempt (exponential backoff).
+ *
+ * @param attempt The number of previous attempts of the request
+ * @return The timeout in microseconds
+ */
+long chrony_attempt_timeout_us(int attempt);
+
+/**
+ * @brief Resolve a "host[:port]" UDP endpoint (for clients managing their own sockets).
+ *
+ * @param host_port The endpoint specification @see chrony_client_init()
+ * @param addr Buffer to receive the (first) address of the endpoint
+ * @param addr_len Buffer to receive the length of the address
+ * @return Zero on success.
+ */
+int chrony_resolve_udp(const char* host_port, struct sockaddr_storage* addr, socklen_t* addr_len);
+
+/**
+ * @brief Close the connection of the client (it is reopened on demand).
+ *
+ * @param client Pointer to an initialized client
+ */
+void chrony_client_close(chrony_client* client);
+
+/**
+ * @brief Get the transport used by the current connection.
+ *
+ * @param client Pointer to an initialized client
+ * @return @c CHRONY_TRANSPORT_UNIX, @c CHRONY_TRANSPORT_UDP or @c CHRONY_TRANSPORT_NONE
+ */
+int chrony_client_transport(const chrony_client* client);
+
 /**
  * @brief Makes a standalone request and waits for the reply from chrony.
  *
  * Note, that both communication buffers (req/rep) have to be preallocated.
  *
+ * @param client Pointer to an initialized client
  * @param req Pointer to the allocated and initialized request buffer
  * @param req_len The size of the allocated request buffer
  * @param rep Pointer to the pre-allocated reply buffer
  * @param rep_len The size of the pre-allocated reply buffer
  * @param rep_id Filtering response messages to match this ID
- * @return Zero, if succeeded and a valid response has been received.
+ * @return Zero, if succeeded and a valid response has been received, -1 otherwise
+ *         (@c errno is ETIMEDOUT, if there was no reply within the time budget of the client).
+ */
+int chrony_request(chrony_client* client, chrony_req* req, int req_len, chrony_rep* rep, int rep_len, int rep_id);
+
+/**
+ * @brief Makes several requests at once and waits for all the replies.
+ *
+ * All the requests are sent before waiting for the replies, which are matched by
+ * their sequence numbers, so the batch takes a single round-trip time. Requests
+ * without replies are retransmitted (within the time budget of the client). Replies
+ * with an error status (e.g. for a non-existent source) complete the exchange with
+ * that status.
+ *
+ * @param client Pointer to an initialized client
+ * @param xfers The exchanges of the batch
+ * @param n_xfers Number of exchanges
+ * @return Zero, if every exchange has been completed (see the individual status fields).
+ */
+int chrony_request_many(chrony_client* client, chrony_xfer* xfers, int n_xfers);
+
+/**
+ * @brief Get the socket of the client for polling, connecting on demand.
+ *
+ * Note, that the socket might change after communication errors.
+ *
+ * @param client Pointer to an initialized client
+ * @return The socket descriptor or -1, if chrony is not reachable.
+ */
+int chrony_client_fd(chrony_client* client);
+
+/**
+ * @brief Initialize the header of a new request (with a new sequence number).
+ *
+ * Used for non-blocking communication. @see chrony_request_send(), chrony_reply_receive()
+ *
+ * @param client Pointer to an initialized client
+ * @param req Pointer to the request buffer (only the command and data fields are kept)
+ */
+void chrony_request_init(chrony_client* client, chrony_req* req);
+
+/**
+ * @brief Send (or retransmit) a request without blocking.
+ *
+ * @param client Pointer to an initialized client
+ * @param req Pointer to the request initialized by chrony_request_init()
+ * @param req_len The size of the request
+ * @param rep_len The size of the expected reply (requests are padded to this size)
+ * @return Zero, if the request has been sent.
+ */
+int chrony_request_send(chrony_client* client, chrony_req* req, int req_len, int rep_len);
+
+/**
+ * @brief Receive the reply to a request without blocking.
+ *
+ * Datagrams not matching the request (e.g. replies to earlier requests) are dropped.
+ *
+ * @param client Pointer to an initialized client
+ * @param req Pointer to the request sent by chrony_request_send()
+ * @param rep Pointer to the pre-allocated reply buffer
+ * @param rep_len The size of the expected reply
+ * @param rep_id Filtering response messages to match this ID
+ * @return Zero, if a valid response has been received, -1 otherwise
+ *         (@c errno is EAGAIN, if no valid response is available yet).
+ */
+int chrony_reply_receive(chrony_client* client, const chrony_req* req, chrony_rep* rep, int rep_len, int rep_id);
+
+/**
+ * @brief Drop all received, but unprocessed datagrams (e.g. late replies) without blocking.
+ *
+ * @param client Pointer to an initialized client
  */
-int chrony_request(chrony_req* req, int req_len, chrony_rep* rep, int rep_len, int rep_id);
+void chrony_client_drain(chrony_client* client);
 
 /**
  * @brief Get the integer (seconds) part of the @c timeval_t value
@@ -225,4 +618,20 @@ long nsec_of_timeval(const timeval_t* timeval);
  */
 double double_from_chrony_float_t(const chrony_float_t* f);
 
+/**
+ * @brief Convert from double to chrony 32-bit floating point type.
+ *
+ * @param x The value to be converted
+ * @return The value in chrony's (network byte order) representation
+ */
+chrony_float_t chrony_float_t_from_double(double x);
+
+/**
+ * @brief Convert from chrony 64-bit integer type.
+ *
+ * @param i Pointer to the 64-bit source value
+ * @return The value in host representation
+ */
+uint64_t uint64_from_chrony_int64_t(const chrony_int64_t* i);
+
 #endif // _CHRONY_H_
\ No newline at end of file
@@ -0,0 +1,735 @@
+/*
+    RIAPS Timesync Service - mock chrony daemon (test only)
+
+    Speaks the chrony command protocol (v6) over a Unix domain and/or UDP
+    socket, serves scripted tracking and source replies and injects faults:
+    dropped, delayed, duplicated, reordered and misnumbered replies, and
+    periodic restarts (the sockets are closed while the daemon is "down").
+
+    Script lines (key=value pairs, '#' starts a comment):
+        tracking refid=PPS stratum=1 offset=1e-7 rms=2e-7 freq=-3.5 skew=0.01 ...
+        source addr=10.0.0.1 mode=server state=0 stratum=2 reach=255 offset=1e-5 ...
+    Successive tracking requests cycle through the tracking lines. NTP sources
+    (IPv4 addresses) can be added and removed at run time through the Unix
+    domain socket, like with chronyc add server / delete.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "chrony.h"
+
+#define MAX_TRACKING 64
+#define MAX_SOURCES 64
+#define MAX_PENDING 256
+#define HOLD_MS 500         /* Reordered replies are sent anyway after this */
+
+struct tracking_entry {
+    char refid[5];
+    struct in_addr addr;
+    int use_addr;
+    int stratum;
+    int leap;
+    double values[9];       /* In the order of rep_tracking (correction ... interval) */
+};
+
+struct source_entry {
+    struct in_addr addr;
+    uint32_t refid;
+    int mode;
+    int state;
+    int stratum;
+    int poll;
+    int reach;
+    int samples;
+    double offset;
+    double error;
+    double sd;
+    double est_offset;
+};
+
+struct pending {
+    int sock;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int64_t send_at;
+    int held;
+    int len;
+    chrony_rep rep;
+};
+
+static const char* tracking_keys[] = {
+    "correction", "offset", "rms", "freq", "resid", "skew", "delay", "dispersion", "interval"
+};
+
+static struct tracking_entry trackings[MAX_TRACKING];
+static int n_trackings = 0;
+static int next_tracking = 0;
+static struct source_entry sources[MAX_SOURCES];
+static int n_sources = 0;
+
+static struct pending pending[MAX_PENDING];
+
+/* Fault profile */
+static double drop_prob = 0.0;
+static double dup_prob = 0.0;
+static double reorder_prob = 0.0;
+static double badseq_prob = 0.0;
+static int delay_ms = 0;
+static int jitter_ms = 0;
+static int restart_period_ms = 0;
+static int restart_down_ms = 0;
+
+static const char* socket_path = NULL;
+static int udp_port = 0;
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+static int64_t now_ms()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (int64_t)tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
+
+static int chance(double p)
+{
+    return p > 0.0 && drand48() < p;
+}
+
+static uint32_t refid_of_string(const char* s)
+{
+    uint32_t refid = 0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        refid = refid << 8 | (s[i] ? (uint8_t)s[i] : 0);
+        if (!s[i]) {
+            refid <<= 8 * (3 - i);
+            break;
+        }
+    }
+    return refid;
+}
+
+static void default_script()
+{
+    struct tracking_entry* t = &trackings[n_trackings++];
+    struct source_entry* s = &sources[n_sources++];
+
+    memset(t, 0, sizeof(*t));
+    strcpy(t->refid, "PPS");
+    t->stratum = 1;
+    t->values[1] = 1.0e-7;      /* offset */
+    t->values[2] = 2.0e-7;      /* rms */
+    t->values[3] = -3.5;        /* freq */
+    t->values[5] = 0.01;        /* skew */
+    t->values[7] = 1.0e-6;      /* dispersion */
+    t->values[8] = 1.0;         /* interval */
+
+    memset(s, 0, sizeof(*s));
+    s->refid = refid_of_string("PPS");
+    s->mode = RPY_SD_MD_REF;
+    s->reach = 255;
+    s->samples = 16;
+    s->offset = 1.0e-7;
+    s->error = 1.0e-8;
+}
+
+static int parse_mode(const char* value)
+{
+    if (strcmp(value, "server") == 0) {
+        return RPY_SD_MD_CLIENT;
+    }
+    if (strcmp(value, "peer") == 0) {
+        return RPY_SD_MD_PEER;
+    }
+    if (strcmp(value, "refclock") == 0) {
+        return RPY_SD_MD_REF;
+    }
+    return atoi(value);
+}
+
+static int load_script(const char* path)
+{
+    char line[512];
+    int lineno = 0;
+    FILE* f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char* token;
+        char* save;
+        int is_tracking;
+
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        token = strtok_r(line, " \t", &save);
+        if (!token) {
+            continue;
+        }
+
+        is_tracking = strcmp(token, "tracking") == 0;
+        if (is_tracking && n_trackings < MAX_TRACKING) {
+            memset(&trackings[n_trackings], 0, sizeof(struct tracking_entry));
+        }
+        else if (strcmp(token, "source") == 0 && n_sources < MAX_SOURCES) {
+            memset(&sources[n_sources], 0, sizeof(struct source_entry));
+        }
+        else {
+            fprintf(stderr, "ERROR: %s:%d: unknown entry or too many entries\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        while ((token = strtok_r(NULL, " \t", &save))) {
+            char* value = strchr(token, '=');
+            int i;
+
+            if (!value) {
+                fprintf(stderr, "ERROR: %s:%d: key=value expected: %s\n", path, lineno, token);
+                fclose(f);
+                return -1;
+            }
+            *value++ = '\0';
+
+            if (is_tracking) {
+                struct tracking_entry* t = &trackings[n_trackings];
+                if (strcmp(token, "refid") == 0) {
+                    snprintf(t->refid, sizeof(t->refid), "%s", value);
+                }
+                else if (strcmp(token, "addr") == 0) {
+                    t->use_addr = inet_pton(AF_INET, value, &t->addr) == 1;
+                }
+                else if (strcmp(token, "stratum") == 0) {
+                    t->stratum = atoi(value);
+                }
+                else if (strcmp(token, "leap") == 0) {
+                    t->leap = atoi(value);
+                }
+                else {
+                    for (i = 0; i < 9 && strcmp(token, tracking_keys[i]); i++);
+                    if (i < 9) {
+                        t->values[i] = atof(value);
+                    }
+                }
+            }
+            else {
+                struct source_entry* s = &sources[n_sources];
+                if (strcmp(token, "addr") == 0) {
+                    inet_pton(AF_INET, value, &s->addr);
+                }
+                else if (strcmp(token, "refid") == 0) {
+                    s->refid = refid_of_string(value);
+                }
+                else if (strcmp(token, "mode") == 0) {
+                    s->mode = parse_mode(value);
+                }
+                else if (strcmp(token, "state") == 0) {
+                    s->state = atoi(value);
+                }
+                else if (strcmp(token, "stratum") == 0) {
+                    s->stratum = atoi(value);
+                }
+                else if (strcmp(token, "poll") == 0) {
+                    s->poll = atoi(value);
+                }
+                else if (strcmp(token, "reach") == 0) {
+                    s->reach = atoi(value);
+                }
+                else if (strcmp(token, "samples") == 0) {
+                    s->samples = atoi(value);
+                }
+                else if (strcmp(token, "offset") == 0) {
+                    s->offset = atof(value);
+                }
+                else if (strcmp(token, "error") == 0) {
+                    s->error = atof(value);
+                }
+                else if (strcmp(token, "sd") == 0) {
+                    s->sd = atof(value);
+                }
+                else if (strcmp(token, "est_offset") == 0) {
+                    s->est_offset = atof(value);
+                }
+            }
+        }
+
+        if (is_tracking) {
+            n_trackings++;
+        }
+        else {
+            n_sources++;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void set_source_addr(ipaddr_t* ip_addr, const struct source_entry* s, int stats)
+{
+    memset(ip_addr, 0, sizeof(*ip_addr));
+    if (s->mode != RPY_SD_MD_REF) {
+        ip_addr->family = htons(IPADDR_INET4);
+        ip_addr->addr.in4 = s->addr.s_addr;
+    }
+    else if (!stats) {
+        /* Reference clocks are reported with their reference ID as address */
+        ip_addr->family = htons(IPADDR_INET4);
+        ip_addr->addr.in4 = htonl(s->refid);
+    }
+}
+
+/* Add or remove an NTP source, returns the chrony status */
+static int modify_sources(const chrony_req* req)
+{
+    struct in_addr addr;
+    int i;
+
+    if (ntohs(req->command) == REQ_ADD_SOURCE) {
+        const req_ntp_source* src = &req->data.ntp_source;
+        char name[sizeof(src->name) + 1];
+
+        snprintf(name, sizeof(name), "%.*s", (int)sizeof(src->name), (const char*)src->name);
+        if (ntohl(src->type) != REQ_ADDSRC_SERVER || inet_pton(AF_INET, name, &addr) != 1) {
+            return STT_INVALIDNAME;
+        }
+        for (i = 0; i < n_sources; i++) {
+            if (sources[i].mode != RPY_SD_MD_REF && sources[i].addr.s_addr == addr.s_addr) {
+                return STT_SOURCEALREADYKNOWN;
+            }
+        }
+        if (n_sources == MAX_SOURCES) {
+            return STT_TOOMANYSOURCES;
+        }
+        memset(&sources[n_sources], 0, sizeof(struct source_entry));
+        sources[n_sources].addr = addr;
+        sources[n_sources].mode = RPY_SD_MD_CLIENT;
+        sources[n_sources].poll = ntohl(src->minpoll);
+        n_sources++;
+        return STT_SUCCESS;
+    }
+
+    if (ntohs(req->data.del_source.ip_addr.family) != IPADDR_INET4) {
+        return STT_NOSUCHSOURCE;
+    }
+    for (i = 0; i < n_sources; i++) {
+        if (sources[i].mode != RPY_SD_MD_REF &&
+            sources[i].addr.s_addr == req->data.del_source.ip_addr.addr.in4) {
+            memmove(&sources[i], &sources[i + 1], (n_sources - i - 1) * sizeof(struct source_entry));
+            n_sources--;
+            return STT_SUCCESS;
+        }
+    }
+    return STT_NOSUCHSOURCE;
+}
+
+/* Build the reply, returns its length (0: no reply) */
+static int serve(const chrony_req* req, int req_len, int privileged, chrony_rep* rep)
+{
+    uint16_t command = ntohs(req->command);
+    int32_t index;
+    int len = REP_HEADER_LENGTH;
+
+    if (req_len < offsetof(chrony_req, data) ||
+        req->version != PROTO_VERSION_NUMBER || req->pkt_type != PKT_TYPE_CMD_REQUEST) {
+        return 0;
+    }
+
+    memset(rep, 0, sizeof(*rep));
+    rep->version = PROTO_VERSION_NUMBER;
+    rep->pkt_type = PKT_TYPE_CMD_REPLY;
+    rep->command = req->command;
+    rep->sequence = req->sequence;
+    rep->status = htons(STT_SUCCESS);
+
+    switch (command) {
+    case REQ_TRACKING: {
+        const struct tracking_entry* t = &trackings[next_tracking++ % n_trackings];
+        chrony_float_t* fields = &rep->data.tracking.current_correction;
+        struct timespec now;
+        int i;
+
+        rep->reply = htons(RPY_TRACKING);
+        if (t->use_addr) {
+            rep->data.tracking.ref_id = t->addr.s_addr;
+            rep->data.tracking.ip_addr.addr.in4 = t->addr.s_addr;
+            rep->data.tracking.ip_addr.family = htons(IPADDR_INET4);
+        }
+        else {
+            rep->data.tracking.ref_id = htonl(refid_of_string(t->refid));
+            rep->data.tracking.ip_addr.family = htons(IPADDR_UNSPEC);
+        }
+        rep->data.tracking.stratum = htons(t->stratum);
+        rep->data.tracking.leap_status = htons(t->leap);
+        clock_gettime(CLOCK_REALTIME, &now);
+        rep->data.tracking.ref_time.tv_sec_high = htonl((uint64_t)now.tv_sec >> 32);
+        rep->data.tracking.ref_time.tv_sec_low = htonl(now.tv_sec & 0xffffffff);
+        rep->data.tracking.ref_time.tv_nsec = htonl(now.tv_nsec);
+        for (i = 0; i < 9; i++) {
+            fields[i] = chrony_float_t_from_double(t->values[i]);
+        }
+        len = REP_LENGTH(tracking);
+        break;
+    }
+    case REQ_N_SOURCES:
+        rep->reply = htons(RPY_N_SOURCES);
+        rep->data.n_sources.n_sources = htonl(n_sources);
+        len = REP_LENGTH(n_sources);
+        break;
+    case REQ_SOURCE_DATA:
+    case REQ_SOURCESTATS:
+        index = ntohl(req->data.source_data.index);
+        if (index < 0 || index >= n_sources) {
+            rep->status = htons(STT_NOSUCHSOURCE);
+            rep->reply = htons(command == REQ_SOURCE_DATA ? RPY_SOURCE_DATA : RPY_SOURCESTATS);
+            break;
+        }
+        if (command == REQ_SOURCE_DATA) {
+            const struct source_entry* s = &sources[index];
+            rep->reply = htons(RPY_SOURCE_DATA);
+            set_source_addr(&rep->data.source_data.ip_addr, s, 0);
+            rep->data.source_data.poll = htons(s->poll);
+            rep->data.source_data.stratum = htons(s->stratum);
+            rep->data.source_data.state = htons(s->state);
+            rep->data.source_data.mode = htons(s->mode);
+            rep->data.source_data.reachability = htons(s->reach);
+            rep->data.source_data.since_sample = htonl(1);
+            rep->data.source_data.orig_latest_meas = chrony_float_t_from_double(s->offset);
+            rep->data.source_data.latest_meas = chrony_float_t_from_double(s->offset);
+            rep->data.source_data.latest_meas_err = chrony_float_t_from_double(s->error);
+            len = REP_LENGTH(source_data);
+        }
+        else {
+            const struct source_entry* s = &sources[index];
+            rep->reply = htons(RPY_SOURCESTATS);
+            rep->data.sourcestats.ref_id = htonl(s->mode == RPY_SD_MD_REF ? s->refid : ntohl(s->addr.s_addr));
+            set_source_addr(&rep->data.sourcestats.ip_addr, s, 1);
+            rep->data.sourcestats.n_samples = htonl(s->samples);
+            rep->data.sourcestats.n_runs = htonl(s->samples / 2);
+            rep->data.sourcestats.span_seconds = htonl(s->samples << (s->poll > 0 ? s->poll : 0));
+            rep->data.sourcestats.sd = chrony_float_t_from_double(s->sd);
+            rep->data.sourcestats.est_offset = chrony_float_t_from_double(s->est_offset);
+            len = REP_LENGTH(sourcestats);
+        }
+        break;
+    case REQ_ADD_SOURCE:
+    case REQ_DEL_SOURCE:
+        /* Only the Unix domain socket is allowed to modify the configuration */
+        rep->reply = htons(RPY_NULL);
+        if (req_len < (command == REQ_ADD_SOURCE ? REQ_LENGTH(ntp_source) : REQ_LENGTH(del_source))) {
+            rep->status = htons(STT_INVALID);
+        }
+        else {
+            rep->status = htons(privileged ? modify_sources(req) : STT_UNAUTH);
+        }
+        len = REP_LENGTH(null);
+        break;
+    case REQ_SERVER_STATS:
+        rep->reply = htons(RPY_SERVER_STATS);
+        rep->data.server_stats.ntp_hits = htonl(next_tracking);
+        len = REP_HEADER_LENGTH + 5 * sizeof(uint32_t);
+        break;
+    default:
+        rep->status = htons(STT_FAILED);
+        rep->reply = htons(RPY_NULL);
+        break;
+    }
+    return len;
+}
+
+static struct pending* queue_reply(int sock, const struct sockaddr_storage* addr, socklen_t addr_len,
+                                   const chrony_rep* rep, int len, int64_t send_at)
+{
+    int i;
+
+    for (i = 0; i < MAX_PENDING && pending[i].sock >= 0; i++);
+    if (i == MAX_PENDING) {
+        return NULL;
+    }
+    pending[i].sock = sock;
+    pending[i].addr = *addr;
+    pending[i].addr_len = addr_len;
+    pending[i].send_at = send_at;
+    pending[i].held = 0;
+    pending[i].len = len;
+    pending[i].rep = *rep;
+    return &pending[i];
+}
+
+static void handle_request(int sock)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    chrony_req req;
+    chrony_rep rep;
+    struct pending* p;
+    int64_t send_at;
+    int req_len, len, i;
+
+    req_len = recvfrom(sock, &req, sizeof(req), MSG_DONTWAIT, (struct sockaddr*)&addr, &addr_len);
+    if (req_len <= 0) {
+        return;
+    }
+    len = serve(&req, req_len, addr.ss_family == AF_UNIX, &rep);
+    if (len == 0 || chance(drop_prob)) {
+        return;
+    }
+
+    send_at = now_ms() + delay_ms + (jitter_ms > 0 ? lrand48() % (jitter_ms + 1) : 0);
+    if (chance(badseq_prob)) {
+        rep.sequence ^= htonl(0x5a5a5a5a);
+    }
+
+    p = queue_reply(sock, &addr, addr_len, &rep, len, send_at);
+    if (!p) {
+        return;
+    }
+
+    /* Previously held replies go after this one */
+    for (i = 0; i < MAX_PENDING; i++) {
+        if (pending[i].sock >= 0 && pending[i].held) {
+            pending[i].held = 0;
+            pending[i].send_at = send_at + 1;
+        }
+    }
+    if (chance(reorder_prob)) {
+        p->held = 1;
+        p->send_at = now_ms() + HOLD_MS;
+    }
+    if (chance(dup_prob)) {
+        queue_reply(sock, &addr, addr_len, &rep, len, send_at + 1);
+    }
+}
+
+static int open_unix()
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    unlink(socket_path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int open_udp()
+{
+    struct sockaddr_in addr;
+    int sock;
+    int on = 1;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(udp_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Open (up) or close (down) the sockets */
+static int set_up(struct pollfd* pfds, int up)
+{
+    int i;
+
+    if (!up) {
+        for (i = 0; i < 2; i++) {
+            if (pfds[i].fd >= 0) {
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+            }
+        }
+        if (socket_path) {
+            unlink(socket_path);
+        }
+        for (i = 0; i < MAX_PENDING; i++) {
+            pending[i].sock = -1;
+        }
+        return 0;
+    }
+
+    if (socket_path && pfds[0].fd < 0) {
+        pfds[0].fd = open_unix();
+        if (pfds[0].fd < 0) {
+            fprintf(stderr, "ERROR: %s: %s\n", socket_path, strerror(errno));
+            return -1;
+        }
+    }
+    if (udp_port && pfds[1].fd < 0) {
+        pfds[1].fd = open_udp();
+        if (pfds[1].fd < 0) {
+            fprintf(stderr, "ERROR: UDP port %d: %s\n", udp_port, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-s socket_path] [-u udp_port] [-S script] [-d drop_prob] "
+            "[-D delay_ms] [-J jitter_ms] [-2 dup_prob] [-O reorder_prob] [-w badseq_prob] "
+            "[-r period_ms:down_ms] [-R seed]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct pollfd pfds[2] = {{-1, POLLIN, 0}, {-1, POLLIN, 0}};
+    int64_t start;
+    int up = 1;
+    int opt;
+    int i;
+
+    srand48(1);
+    while ((opt = getopt(argc, argv, "s:u:S:d:D:J:2:O:w:r:R:h")) != -1) {
+        switch (opt) {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'u':
+            udp_port = atoi(optarg);
+            break;
+        case 'S':
+            if (load_script(optarg)) {
+                exit(-1);
+            }
+            break;
+        case 'd':
+            drop_prob = atof(optarg);
+            break;
+        case 'D':
+            delay_ms = atoi(optarg);
+            break;
+        case 'J':
+            jitter_ms = atoi(optarg);
+            break;
+        case '2':
+            dup_prob = atof(optarg);
+            break;
+        case 'O':
+            reorder_prob = atof(optarg);
+            break;
+        case 'w':
+            badseq_prob = atof(optarg);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%d:%d", &restart_period_ms, &restart_down_ms) != 2 ||
+                restart_down_ms >= restart_period_ms) {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'R':
+            srand48(atol(optarg));
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+    if (!socket_path && !udp_port) {
+        usage(argv[0]);
+        exit(-1);
+    }
+    if (n_trackings == 0) {
+        default_script();
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    for (i = 0; i < MAX_PENDING; i++) {
+        pending[i].sock = -1;
+    }
+    if (set_up(pfds, 1)) {
+        exit(-1);
+    }
+
+    start = now_ms();
+    while (running) {
+        int64_t now = now_ms();
+        int64_t next = now + 1000;
+        int timeout;
+
+        if (restart_period_ms) {
+            int64_t phase = (now - start) % restart_period_ms;
+            int should_be_up = phase < restart_period_ms - restart_down_ms;
+            if (should_be_up != up) {
+                up = should_be_up;
+                if (set_up(pfds, up)) {
+                    break;
+                }
+            }
+            next = now + (up ? restart_period_ms - restart_down_ms - phase : restart_period_ms - phase);
+        }
+
+        /* Send the due replies (in the order of their deadlines) */
+        for (;;) {
+            struct pending* due = NULL;
+            for (i = 0; i < MAX_PENDING; i++) {
+                if (pending[i].sock >= 0 && (!due || pending[i].send_at < due->send_at)) {
+                    due = &pending[i];
+                }
+            }
+            if (!due) {
+                break;
+            }
+            if (due->send_at > now) {
+                next = due->send_at < next ? due->send_at : next;
+                break;
+            }
+            sendto(due->sock, &due->rep, due->len, MSG_DONTWAIT, (struct sockaddr*)&due->addr, due->addr_len);
+            due->sock = -1;
+        }
+
+        timeout = next > now ? next - now : 0;
+        if (poll(pfds, 2, timeout) > 0) {
+            for (i = 0; i < 2; i++) {
+                if (pfds[i].fd >= 0 && (pfds[i].revents & POLLIN)) {
+                    handle_request(pfds[i].fd);
+                }
+            }
+        }
+    }
+
+    set_up(pfds, 0);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+    RIAPS Timesync Service - mock ptp4l daemon (test only)
+
+    Answers the PTP management GET requests of the status queries
+    (TIME_STATUS_NP, CURRENT_DATA_SET, PARENT_DATA_SET and PORT_DATA_SET, the
+    latter from every port) over a Unix domain socket, like the uds_address of
+    ptp4l. Other management IDs get a NOT_SUPPORTED error status. Responses can
+    be dropped to exercise the retransmissions of the client.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "pmc.h"
+
+#define MAX_PORTS 8
+#define PMC_ERROR_NOT_SUPPORTED 0x0006
+
+static const uint8_t own_identity[8] = {0x02, 0x42, 0xac, 0xff, 0xfe, 0x11, 0x00, 0x02};
+static const uint8_t gm_identity[8] = {0x00, 0x1b, 0x21, 0xff, 0xfe, 0x9a, 0x3c, 0x4d};
+
+static const char* socket_path = PMC_UDS_PATH;
+static int n_ports = 1;
+static int port_state = PTP_PS_SLAVE;
+static int64_t offset_ns = 12;
+static int64_t delay_ns = 750;
+static int steps_removed = 1;
+static double drop_prob = 0.0;
+static volatile sig_atomic_t running = 1;
+
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+
+static void send_response(int sock, const pmc_msg* req, const struct sockaddr_un* addr, socklen_t addr_len,
+                          int port, int tlv_type, int id, const void* data, int data_len)
+{
+    pmc_msg rep;
+    int len = PMC_MSG_HEADER_LENGTH + data_len;
+
+    if (drand48() < drop_prob) {
+        return;
+    }
+
+    memset(&rep, 0, sizeof(rep));
+    rep.hdr = req->hdr;
+    rep.hdr.message_length = htons(len);
+    memcpy(rep.hdr.source_port.clock_identity, own_identity, sizeof(own_identity));
+    rep.hdr.source_port.port_number = htons(port);
+    rep.target_port = req->hdr.source_port;
+    rep.starting_boundary_hops = req->starting_boundary_hops - req->boundary_hops;
+    rep.boundary_hops = 0;
+    rep.action = PMC_ACTION_RESPONSE;
+    rep.tlv_type = htons(tlv_type);
+    rep.tlv_length = htons(2 + data_len);
+    rep.management_id = htons(id);
+    memcpy(rep.data.raw, data, data_len);
+    sendto(sock, &rep, len, MSG_DONTWAIT, (const struct sockaddr*)addr, addr_len);
+}
+
+
+static void handle_request(int sock)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = sizeof(addr);
+    pmc_msg req;
+    int len;
+    int id;
+    int port;
+
+    len = recvfrom(sock, &req, sizeof(req), 0, (struct sockaddr*)&addr, &addr_len);
+    if (len < (int)PMC_MSG_HEADER_LENGTH || (req.hdr.message_type & 0x0f) != PTP_MSG_MANAGEMENT ||
+        (req.action & 0x0f) != PMC_ACTION_GET || ntohs(req.tlv_type) != PMC_TLV_MANAGEMENT) {
+        return;
+    }
+
+    id = ntohs(req.management_id);
+    switch (id) {
+    case PMC_ID_TIME_STATUS_NP: {
+        pmc_time_status_np tsn;
+
+        memset(&tsn, 0, sizeof(tsn));
+        tsn.master_offset = htobe64(offset_ns);
+        tsn.gm_present = htonl(port_state == PTP_PS_SLAVE);
+        memcpy(tsn.gm_identity, port_state == PTP_PS_SLAVE ? gm_identity : own_identity, 8);
+        send_response(sock, &req, &addr, addr_len, 0, PMC_TLV_MANAGEMENT, id, &tsn, sizeof(tsn));
+        break;
+    }
+    case PMC_ID_CURRENT_DATA_SET: {
+        pmc_current_data_set cds;
+
+        cds.steps_removed = htons(steps_removed);
+        cds.offset_from_master = htobe64(offset_ns * 65536);
+        cds.mean_path_delay = htobe64(delay_ns * 65536);
+        send_response(sock, &req, &addr, addr_len, 0, PMC_TLV_MANAGEMENT, id, &cds, sizeof(cds));
+        break;
+    }
+    case PMC_ID_PARENT_DATA_SET: {
+        pmc_parent_data_set pds;
+
+        memset(&pds, 0, sizeof(pds));
+        memcpy(pds.parent_port.clock_identity, port_state == PTP_PS_SLAVE ? gm_identity : own_identity, 8);
+        pds.parent_port.port_number = htons(port_state == PTP_PS_SLAVE ? 1 : 0);
+        pds.gm_priority1 = 128;
+        pds.gm_priority2 = 128;
+        pds.gm_clock_class = port_state == PTP_PS_SLAVE ? 6 : 248;
+        pds.gm_clock_accuracy = port_state == PTP_PS_SLAVE ? 0x21 : 0xfe;
+        memcpy(pds.gm_identity, port_state == PTP_PS_SLAVE ? gm_identity : own_identity, 8);
+        send_response(sock, &req, &addr, addr_len, 0, PMC_TLV_MANAGEMENT, id, &pds, sizeof(pds));
+        break;
+    }
+    case PMC_ID_PORT_DATA_SET:
+        /* Every port answers (the first one is in the configured state, the others are masters) */
+        for (port = 1; port <= n_ports; port++) {
+            pmc_port_data_set pds;
+
+            memset(&pds, 0, sizeof(pds));
+            memcpy(pds.port_identity.clock_identity, own_identity, 8);
+            pds.port_identity.port_number = htons(port);
+            pds.port_state = port == 1 ? port_state : PTP_PS_MASTER;
+            pds.version_number = PTP_VERSION;
+            send_response(sock, &req, &addr, addr_len, port, PMC_TLV_MANAGEMENT, id, &pds, sizeof(pds));
+        }
+        break;
+    default: {
+        uint8_t error[8];
+
+        /* Error status: managementId, reserved (4 bytes), empty display data */
+        memset(error, 0, sizeof(error));
+        memcpy(error, &req.management_id, 2);
+        send_response(sock, &req, &addr, addr_len, 0, PMC_TLV_MANAGEMENT_ERROR_STATUS, PMC_ERROR_NOT_SUPPORTED,
+                      error, sizeof(error));
+        break;
+    }
+    }
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-s socket_path] [-n ports] [-S port_state] [-o offset_ns] [-D delay_ns] "
+            "[-r steps_removed] [-d drop_prob]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct sockaddr_un addr;
+    struct pollfd pfd;
+    int opt;
+
+    srand48(1);
+    while ((opt = getopt(argc, argv, "s:n:S:o:D:r:d:h")) != -1) {
+        switch (opt) {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'n':
+            n_ports = atoi(optarg);
+            break;
+        case 'S':
+            port_state = atoi(optarg);
+            break;
+        case 'o':
+            offset_ns = atoll(optarg);
+            break;
+        case 'D':
+            delay_ns = atoll(optarg);
+            break;
+        case 'r':
+            steps_removed = atoi(optarg);
+            break;
+        case 'd':
+            drop_prob = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+    if (n_ports < 1 || n_ports > MAX_PORTS || port_state < PTP_PS_INITIALIZING || port_state > PTP_PS_SLAVE ||
+        strlen(socket_path) >= sizeof(addr.sun_path)) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    pfd.fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    pfd.events = POLLIN;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (pfd.fd < 0 || bind(pfd.fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror(socket_path);
+        exit(-1);
+    }
+
+    while (running) {
+        if (poll(&pfd, 1, 1000) > 0 && (pfd.revents & POLLIN)) {
+            handle_request(pfd.fd);
+        }
+    }
+
+    close(pfd.fd);
+    unlink(socket_path);
+    return 0;
+}
@@ -0,0 +1,308 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file pmc.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - PTP management client (implementation).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pmc.h"
+#include "riaps_ts_io.h"
+
+
+static int open_uds_socket(const char* path)
+{
+    struct sockaddr_un addr;
+    int sock_fd;
+
+    sock_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    /* ptp4l replies to the address of the client, autobind it to a unique abstract address */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (bind(sock_fd, (struct sockaddr *) &addr, sizeof(sa_family_t)) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+    if (connect(sock_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+
+int pmc_client_init(pmc_client* client, const char* endpoint)
+{
+    struct timespec tp;
+    uint32_t pid = (uint32_t)getpid();
+
+    memset(client, 0, sizeof(*client));
+    client->sock = -1;
+    client->timeout_ms = PMC_TIMEOUT_MS;
+
+    /* Do not accept late responses to a previous incarnation of the client */
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    client->seq = (uint16_t)(tp.tv_nsec ^ pid);
+
+    /* Management clients are identified by the process (like pmc) */
+    client->clock_identity[4] = pid >> 24;
+    client->clock_identity[5] = pid >> 16;
+    client->clock_identity[6] = pid >> 8;
+    client->clock_identity[7] = pid;
+
+    return pmc_client_set_endpoint(client, endpoint);
+}
+
+
+int pmc_client_set_endpoint(pmc_client* client, const char* endpoint)
+{
+    if (endpoint && (strlen(endpoint) >= sizeof(client->endpoint) || endpoint[0] != '/')) {
+        return -1;
+    }
+
+    pmc_client_close(client);
+    strcpy(client->endpoint, endpoint ? endpoint : PMC_UDS_PATH);
+    return 0;
+}
+
+
+int pmc_client_set_timeout(pmc_client* client, int timeout_ms)
+{
+    if (timeout_ms < 0) {
+        return -1;
+    }
+
+    client->timeout_ms = timeout_ms ? timeout_ms : PMC_TIMEOUT_MS;
+    return 0;
+}
+
+
+void pmc_client_close(pmc_client* client)
+{
+    if (client->sock >= 0) {
+        close(client->sock);
+    }
+    client->sock = -1;
+}
+
+
+int pmc_client_fd(pmc_client* client)
+{
+    if (client->sock < 0) {
+        client->sock = open_uds_socket(client->endpoint);
+    }
+    return client->sock;
+}
+
+
+static int send_request(pmc_client* client, const pmc_xfer* xfer)
+{
+    pmc_msg req;
+    int sock_fd;
+
+    sock_fd = pmc_client_fd(client);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    memset(&req, 0, PMC_MSG_HEADER_LENGTH);
+    req.hdr.message_type = PTP_MSG_MANAGEMENT;
+    req.hdr.version = PTP_VERSION;
+    req.hdr.message_length = htons(PMC_MSG_HEADER_LENGTH);
+    req.hdr.domain_number = client->domain;
+    memcpy(req.hdr.source_port.clock_identity, client->clock_identity, sizeof(client->clock_identity));
+    req.hdr.source_port.port_number = htons((uint16_t)getpid());
+    req.hdr.sequence_id = htons(xfer->sequence_id);
+    req.hdr.control = PTP_CTL_MANAGEMENT;
+    req.hdr.log_message_interval = PTP_LOG_INTERVAL_NONE;
+
+    /* Every port of the local clock, not forwarded to the network (no boundary hops) */
+    memset(&req.target_port, 0xff, sizeof(req.target_port));
+    req.action = PMC_ACTION_GET;
+    req.tlv_type = htons(PMC_TLV_MANAGEMENT);
+    req.tlv_length = htons(sizeof(req.management_id));  /* GET requests have no data */
+    req.management_id = htons(xfer->id);
+
+    if (send(sock_fd, (void *)&req, PMC_MSG_HEADER_LENGTH, MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            pmc_client_close(client);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Send the pending requests, a broken connection (e.g. ptp4l restarted) is reopened once */
+static int send_pending(pmc_client* client, pmc_xfer* xfers, int n_xfers, int* error)
+{
+    int i;
+
+    for (i = 0; i < n_xfers; i++) {
+        if (xfers[i].status != PMC_XFER_PENDING) {
+            continue;
+        }
+        if (send_request(client, &xfers[i]) &&
+            (errno == EAGAIN || errno == EWOULDBLOCK || send_request(client, &xfers[i]))) {
+            *error = errno;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/* Process a received datagram, returns the number of completed requests (0 or 1) */
+static int process_response(pmc_xfer* xfers, int n_xfers, const pmc_msg* rep, int recvlen,
+                            pmc_response_cb cb, void* arg)
+{
+    pmc_xfer* xfer = NULL;
+    uint16_t seq;
+    int data_len;
+    int i;
+
+    if (recvlen < (int)PMC_MSG_HEADER_LENGTH ||
+        (rep->hdr.message_type & 0x0f) != PTP_MSG_MANAGEMENT ||
+        (rep->hdr.version & 0x0f) != PTP_VERSION ||
+        (rep->action & 0x0f) != PMC_ACTION_RESPONSE) {
+        return 0;
+    }
+    data_len = (int)ntohs(rep->tlv_length) - (int)sizeof(rep->management_id);
+    if (data_len < 0 || PMC_MSG_HEADER_LENGTH + data_len > recvlen) {
+        return 0;
+    }
+
+    seq = ntohs(rep->hdr.sequence_id);
+    for (i = 0; i < n_xfers; i++) {
+        if (xfers[i].sequence_id == seq) {
+            xfer = &xfers[i];
+            break;
+        }
+    }
+    if (!xfer) {
+        return 0;
+    }
+
+    if (ntohs(rep->tlv_type) == PMC_TLV_MANAGEMENT_ERROR_STATUS) {
+        uint16_t id;
+
+        /* The management ID follows the error ID */
+        if (xfer->status != PMC_XFER_PENDING || data_len < (int)sizeof(id)) {
+            return 0;
+        }
+        memcpy(&id, rep->data.raw, sizeof(id));
+        if (ntohs(id) != xfer->id) {
+            return 0;
+        }
+        xfer->status = ntohs(rep->management_id);
+        return 1;
+    }
+    if (ntohs(rep->tlv_type) != PMC_TLV_MANAGEMENT || ntohs(rep->management_id) != xfer->id) {
+        return 0;
+    }
+
+    xfer->n_responses++;
+    cb(xfer, rep, data_len, arg);
+    if (xfer->status == PMC_XFER_PENDING) {
+        xfer->status = 0;
+        return 1;
+    }
+    return 0;
+}
+
+
+int pmc_request_many(pmc_client* client, pmc_xfer* xfers, int n_xfers, pmc_response_cb cb, void* arg)
+{
+    pmc_msg rep;
+    int64_t deadline_us, attempt_end;
+    int n_pending = n_xfers;
+    int attempt;
+    int error = ETIMEDOUT;
+    int recvlen;
+    int i;
+
+    if (n_xfers <= 0) {
+        return 0;
+    }
+
+    /* ptp4l removes its socket when it exits, so there is nothing to wait for */
+    if (client->sock < 0 && access(client->endpoint, F_OK)) {
+        return -1;
+    }
+
+    for (i = 0; i < n_xfers; i++) {
+        xfers[i].sequence_id = client->seq++;
+        xfers[i].status = PMC_XFER_PENDING;
+        xfers[i].n_responses = 0;
+    }
+    deadline_us = riaps_ts_monotonic_us() + (int64_t)client->timeout_ms * 1000;
+
+    for (attempt = 0; n_pending > 0 &&
+         (attempt_end = riaps_ts_attempt_end(riaps_ts_backoff_us(attempt, PMC_ATTEMPT_TIMEOUT_US,
+                                                                 PMC_MAX_ATTEMPT_TIMEOUT_US),
+                                             deadline_us)) != 0;
+         attempt++) {
+        if (send_pending(client, xfers, n_xfers, &error)) {
+            riaps_ts_sleep_until_us(attempt_end);
+            continue;
+        }
+
+        while (n_pending > 0 && riaps_ts_wait_readable(client->sock, attempt_end) > 0) {
+            recvlen = recv(client->sock, (void *)&rep, sizeof(rep), MSG_DONTWAIT);
+            if (recvlen < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    continue;
+                }
+                error = errno;
+                pmc_client_close(client);
+                riaps_ts_sleep_until_us(attempt_end);
+                break;
+            }
+            n_pending -= process_response(xfers, n_xfers, &rep, recvlen, cb, arg);
+        }
+    }
+
+    if (n_pending) {
+        errno = error;
+        return -1;
+    }
+
+    /* ptp4l answers a request from all its ports at once: the rest is already queued */
+    while ((recvlen = recv(client->sock, (void *)&rep, sizeof(rep), MSG_DONTWAIT)) >= 0) {
+        process_response(xfers, n_xfers, &rep, recvlen, cb, arg);
+    }
+    return 0;
+}
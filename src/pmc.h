@@ -0,0 +1,294 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _PMC_H_
+#define _PMC_H_
+
+
+/**
+ * @file pmc.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - PTP management client (ptp4l).
+ *
+ * This module contains a lightweight interface to query the running ptp4l daemon
+ * with PTP management messages (IEEE 1588-2008, 15.) via its Unix domain socket,
+ * the same way as the @c pmc utility of linuxptp. The requests of a batch are
+ * pipelined and retransmitted with exponential backoff, like the chrony requests.
+ * The functions in this module are not supposed to be used by application level
+ * code, but provided for higher-level interfaces in the riaps-timesync service.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PMC_UDS_PATH "/var/run/ptp4l"   /**< Default management socket of ptp4l (uds_address) */
+#define PMC_ENDPOINT_LENGTH 108         /**< Maximum length of a socket path (sun_path) */
+
+#define PMC_TIMEOUT_MS 1000             /**< Default time budget of a batch (including retransmissions) */
+#define PMC_ATTEMPT_TIMEOUT_US 1000     /**< Reply timeout of the first attempt, doubled for every retransmission */
+#define PMC_MAX_ATTEMPT_TIMEOUT_US 128000 /**< Upper limit of the per-attempt reply timeout */
+
+/*** Message header ***/
+#define PTP_VERSION 2
+#define PTP_MSG_MANAGEMENT 0xd
+#define PTP_CTL_MANAGEMENT 0x04
+#define PTP_LOG_INTERVAL_NONE 0x7f
+
+/*** Management actions ***/
+#define PMC_ACTION_GET 0
+#define PMC_ACTION_SET 1
+#define PMC_ACTION_RESPONSE 2
+#define PMC_ACTION_COMMAND 3
+#define PMC_ACTION_ACKNOWLEDGE 4
+
+/*** TLV types ***/
+#define PMC_TLV_MANAGEMENT 0x0001
+#define PMC_TLV_MANAGEMENT_ERROR_STATUS 0x0002
+
+/*** Management IDs ***/
+#define PMC_ID_CURRENT_DATA_SET 0x2001
+#define PMC_ID_PARENT_DATA_SET 0x2002
+#define PMC_ID_PORT_DATA_SET 0x2004
+#define PMC_ID_TIME_STATUS_NP 0xC000    /**< linuxptp extension */
+
+/*** Port states ***/
+#define PTP_PS_INITIALIZING 1
+#define PTP_PS_FAULTY 2
+#define PTP_PS_DISABLED 3
+#define PTP_PS_LISTENING 4
+#define PTP_PS_PRE_MASTER 5
+#define PTP_PS_MASTER 6
+#define PTP_PS_PASSIVE 7
+#define PTP_PS_UNCALIBRATED 8
+#define PTP_PS_SLAVE 9
+
+#define PMC_MAX_DATA_LENGTH 256
+
+/*** Wire format (network byte order, packed) ***/
+typedef struct __attribute__((packed))
+{
+    uint8_t clock_identity[8];
+    uint16_t port_number;
+} ptp_port_identity;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t message_type;       /* transportSpecific (high nibble) | messageType */
+    uint8_t version;
+    uint16_t message_length;
+    uint8_t domain_number;
+    uint8_t reserved1;
+    uint16_t flags;
+    int64_t correction;
+    uint32_t reserved2;
+    ptp_port_identity source_port;
+    uint16_t sequence_id;
+    uint8_t control;
+    int8_t log_message_interval;
+} ptp_header;
+
+/* Scaled nanoseconds (2^-16 ns) of the data sets */
+typedef int64_t ptp_time_interval;
+
+typedef struct __attribute__((packed))
+{
+    int64_t master_offset;      /* ns */
+    int64_t ingress_time;       /* ns */
+    int32_t cumulative_scaled_rate_offset;
+    int32_t scaled_last_gm_phase_change;
+    uint16_t gm_time_base_indicator;
+    uint16_t last_gm_phase_change_msb;
+    uint64_t last_gm_phase_change_lsb;
+    uint16_t last_gm_phase_change_frac;
+    int32_t gm_present;
+    uint8_t gm_identity[8];
+} pmc_time_status_np;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t steps_removed;
+    ptp_time_interval offset_from_master;
+    ptp_time_interval mean_path_delay;
+} pmc_current_data_set;
+
+typedef struct __attribute__((packed))
+{
+    ptp_port_identity parent_port;
+    uint8_t parent_stats;
+    uint8_t reserved;
+    uint16_t observed_parent_offset_scaled_log_variance;
+    int32_t observed_parent_clock_phase_change_rate;
+    uint8_t gm_priority1;
+    uint8_t gm_clock_class;
+    uint8_t gm_clock_accuracy;
+    uint16_t gm_offset_scaled_log_variance;
+    uint8_t gm_priority2;
+    uint8_t gm_identity[8];
+} pmc_parent_data_set;
+
+typedef struct __attribute__((packed))
+{
+    ptp_port_identity port_identity;
+    uint8_t port_state;
+    int8_t log_min_delay_req_interval;
+    ptp_time_interval peer_mean_path_delay;
+    int8_t log_announce_interval;
+    uint8_t announce_receipt_timeout;
+    int8_t log_sync_interval;
+    uint8_t delay_mechanism;
+    int8_t log_min_pdelay_req_interval;
+    uint8_t version_number;
+} pmc_port_data_set;
+
+/**
+ * @brief A management message with a single TLV.
+ *
+ * For @c PMC_TLV_MANAGEMENT_ERROR_STATUS TLVs the @c management_id field holds
+ * the error ID and the data starts with the management ID.
+ */
+typedef struct __attribute__((packed))
+{
+    ptp_header hdr;
+    ptp_port_identity target_port;
+    uint8_t starting_boundary_hops;
+    uint8_t boundary_hops;
+    uint8_t action;             /* low nibble */
+    uint8_t reserved;
+    uint16_t tlv_type;
+    uint16_t tlv_length;        /* management_id + data */
+    uint16_t management_id;
+    union {
+        pmc_time_status_np time_status_np;
+        pmc_current_data_set current_data_set;
+        pmc_parent_data_set parent_data_set;
+        pmc_port_data_set port_data_set;
+        uint8_t raw[PMC_MAX_DATA_LENGTH];
+    } data;
+} pmc_msg;
+
+#define PMC_MSG_HEADER_LENGTH offsetof(pmc_msg, data)   /**< Length of a message without TLV data */
+
+#define PMC_XFER_PENDING -1         /**< No response to the request yet @see pmc_xfer */
+
+/**
+ * @brief One GET request of a pipelined batch. @see pmc_request_many()
+ */
+typedef struct
+{
+    int id;                     /**< Management ID (set by the caller) */
+    uint16_t sequence_id;       /**< Sequence ID of the request */
+    int status;                 /**< Zero (response received), a management error ID or @c PMC_XFER_PENDING */
+    int n_responses;            /**< Number of responses (per-port data sets get one from every port) */
+} pmc_xfer;
+
+/**
+ * @brief Response handler of a batch.
+ *
+ * Called for every valid response (including the responses of further ports and the
+ * retransmissions), @c rep->data holds @c data_len bytes of the data set.
+ */
+typedef void (*pmc_response_cb)(const pmc_xfer* xfer, const pmc_msg* rep, int data_len, void* arg);
+
+/**
+ * @brief Connection state of a PTP management client.
+ */
+typedef struct pmc_client
+{
+    int sock;                               /**< Connected socket or -1 */
+    uint16_t seq;                           /**< Sequence ID of the next request */
+    int timeout_ms;                         /**< Time budget of a batch @see pmc_client_set_timeout() */
+    int domain;                             /**< PTP domain number of ptp4l */
+    uint8_t clock_identity[8];              /**< Clock identity of the client (source port) */
+    char endpoint[PMC_ENDPOINT_LENGTH];     /**< Management socket of ptp4l */
+} pmc_client;
+
+/**
+ * @brief Initialize a PTP management client.
+ *
+ * The client socket is bound to an autobound abstract address, so no file is
+ * left behind. The connection is opened on demand.
+ *
+ * @param client Pointer to the client structure to be initialized
+ * @param endpoint The management socket of ptp4l or NULL for @c PMC_UDS_PATH
+ * @return Zero, if the endpoint specification is valid.
+ */
+int pmc_client_init(pmc_client* client, const char* endpoint);
+
+/**
+ * @brief Select a new management socket for the client (the connection is closed).
+ *
+ * @param client Pointer to an initialized client
+ * @param endpoint The management socket of ptp4l or NULL for @c PMC_UDS_PATH
+ * @return Zero, if the endpoint specification is valid.
+ */
+int pmc_client_set_endpoint(pmc_client* client, const char* endpoint);
+
+/**
+ * @brief Set the time budget of the batches of the client.
+ *
+ * @param client Pointer to an initialized client
+ * @param timeout_ms The time budget in milliseconds (0 for @c PMC_TIMEOUT_MS)
+ * @return Zero, if the timeout is valid.
+ */
+int pmc_client_set_timeout(pmc_client* client, int timeout_ms);
+
+/**
+ * @brief Close the connection of the client (it is reopened on demand).
+ *
+ * @param client Pointer to an initialized client
+ */
+void pmc_client_close(pmc_client* client);
+
+/**
+ * @brief Get the socket of the client for polling, connecting on demand.
+ *
+ * @param client Pointer to an initialized client
+ * @return The socket descriptor or -1, if ptp4l is not reachable.
+ */
+int pmc_client_fd(pmc_client* client);
+
+/**
+ * @brief Send GET requests at once and wait for all the responses.
+ *
+ * All the requests are sent before waiting for the responses, which are matched
+ * by their sequence IDs. Requests without responses are retransmitted (within the
+ * time budget of the client). Once every request got a response, the responses
+ * already received from further ports are processed as well, so requests answered
+ * by every port should precede the requests answered by the clock.
+ *
+ * @param client Pointer to an initialized client
+ * @param xfers The requests of the batch
+ * @param n_xfers Number of requests
+ * @param cb Handler of the responses
+ * @param arg User argument of the handler
+ * @return Zero, if every request has been completed (see the individual status fields).
+ */
+int pmc_request_many(pmc_client* client, pmc_xfer* xfers, int n_xfers, pmc_response_cb cb, void* arg);
+
+/**
+ * @brief Convert a PTP time interval (scaled nanoseconds) to seconds.
+ */
+static inline double pmc_seconds_of_interval(ptp_time_interval interval)
+{
+    return (double)interval / 65536.0 * 1e-9;
+}
+
+#endif // _PMC_H_
@@ -25,9 +25,13 @@
  */
 
 #include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "riaps_ts.h"
 #include "chrony.h"
+#include "riaps_ts_ctx.h"
+#include "riaps_ts_shm.h"
 
 struct ref_id_entry {
     const char* prefix;
@@ -41,6 +45,105 @@ const struct ref_id_entry ref_id_map[] = {
     {"PHC", RIAPS_TS_SLAVE, RIAPS_TS_REF_PTP}
 };
 
+/* Endpoint of the default (per-thread) contexts */
+static pthread_mutex_t default_endpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static char default_endpoint[CHRONY_ENDPOINT_LENGTH];
+static _Atomic unsigned int default_endpoint_gen = 0;
+
+/* Request time budget of the default contexts (0: CHRONY_TIMEOUT_MS) */
+static _Atomic int default_timeout_ms = 0;
+
+static pthread_once_t default_ctx_once = PTHREAD_ONCE_INIT;
+static pthread_key_t default_ctx_key;
+
+static void destroy_default_ctx(void* ctx)
+{
+    riaps_ts_ctx_destroy(ctx);
+}
+
+static void init_default_ctx()
+{
+    pthread_key_create(&default_ctx_key, destroy_default_ctx);
+}
+
+riaps_ts_ctx* riaps_ts_default_ctx()
+{
+    riaps_ts_ctx* ctx;
+    unsigned int gen;
+    int timeout_ms;
+
+    pthread_once(&default_ctx_once, init_default_ctx);
+    ctx = pthread_getspecific(default_ctx_key);
+    if (!ctx) {
+        ctx = riaps_ts_ctx_create(NULL);
+        if (!ctx) {
+            return NULL;
+        }
+        ctx->endpoint_gen = -1;
+        pthread_setspecific(default_ctx_key, ctx);
+    }
+
+    gen = atomic_load(&default_endpoint_gen);
+    if (ctx->endpoint_gen != gen) {
+        pthread_mutex_lock(&default_endpoint_lock);
+        chrony_client_set_endpoint(&ctx->client, default_endpoint);
+        ctx->endpoint_gen = atomic_load(&default_endpoint_gen);
+        pthread_mutex_unlock(&default_endpoint_lock);
+    }
+    timeout_ms = atomic_load_explicit(&default_timeout_ms, memory_order_relaxed);
+    chrony_client_set_timeout(&ctx->client, timeout_ms);
+    pmc_client_set_timeout(&ctx->pmc, timeout_ms);
+    return ctx;
+}
+
+
+riaps_ts_ctx* riaps_ts_ctx_create(const char* endpoint)
+{
+    riaps_ts_ctx* ctx;
+
+    ctx = calloc(1, sizeof(riaps_ts_ctx));
+    if (!ctx) {
+        return NULL;
+    }
+    if (chrony_client_init(&ctx->client, endpoint)) {
+        free(ctx);
+        return NULL;
+    }
+    pmc_client_init(&ctx->pmc, NULL);
+    ctx->pmc_endpoint_gen = 0;
+    ctx->endpoint_gen = 0;
+    ctx->poll_fd = -1;
+    ctx->timer_fd = -1;
+    ctx->event_fd = -1;
+    ctx->async_state = RIAPS_TS_ASYNC_IDLE;
+    ctx->sources_hint = RIAPS_TS_SOURCES_HINT;
+    ctx->xfers = NULL;
+    ctx->xfers_capacity = 0;
+    ctx->got = NULL;
+    ctx->got_capacity = 0;
+    ctx->bound_refreshed = 0;
+    ctx->bound_next = 0;
+    ctx->bound_backoff = 0;
+    ctx->sleep_fd = -1;
+    return ctx;
+}
+
+
+void riaps_ts_ctx_destroy(riaps_ts_ctx* ctx)
+{
+    if (ctx) {
+        riaps_ts_async_close(ctx);
+        chrony_client_close(&ctx->client);
+        pmc_client_close(&ctx->pmc);
+        if (ctx->sleep_fd >= 0) {
+            close(ctx->sleep_fd);
+        }
+        free(ctx->xfers);
+        free(ctx->got);
+        free(ctx);
+    }
+}
+
 
 int riaps_ts_gettime(struct riaps_ts_timespec *res)
 {
@@ -76,31 +179,71 @@ int riaps_ts_sleep(int flags, const struct riaps_ts_timespec *request)
 }
 
 
-int riaps_ts_status(struct riap_ts_status* stat)
+int riaps_ts_set_endpoint(const char* endpoint)
 {
-    chrony_req req;
-    chrony_rep rep;
+    if (endpoint && strlen(endpoint) >= sizeof(default_endpoint)) {
+        return -1;
+    }
 
-    if (!stat) {
+    pthread_mutex_lock(&default_endpoint_lock);
+    strcpy(default_endpoint, endpoint ? endpoint : "");
+    atomic_fetch_add(&default_endpoint_gen, 1);
+    pthread_mutex_unlock(&default_endpoint_lock);
+    return 0;
+}
+
+
+int riaps_ts_set_timeout(int timeout_ms)
+{
+    if (timeout_ms < 0) {
         return -1;
     }
 
-    req.command = htons(REQ_TRACKING);
-    if (chrony_request(&req, REQ_LENGTH(tracking), &rep, REP_LENGTH(tracking), RPY_TRACKING)) {
+    atomic_store(&default_timeout_ms, timeout_ms);
+    return 0;
+}
+
+
+int riaps_ts_ctx_set_timeout(riaps_ts_ctx* ctx, int timeout_ms)
+{
+    if (!ctx) {
         return -1;
     }
-    if (ntohs(rep.data.tracking.ip_addr.family == IPADDR_UNSPEC)) {
-        int i;
-        uint32_t ref_id = ntohl(rep.data.tracking.ref_id);
-        char ref_name[sizeof(ref_id) + 1];
-
-	    memset(ref_name, '\0', sizeof(ref_name));
-        for (i = 0; i < sizeof(ref_id); i++) {
-            char c = (ref_id >> (24 - i * 8)) & 0xff;
-            if (isprint(c)) {
-                ref_name[i] = c;
-            }
+    if (chrony_client_set_timeout(&ctx->client, timeout_ms)) {
+        return -1;
+    }
+    return pmc_client_set_timeout(&ctx->pmc, timeout_ms);
+}
+
+
+void riaps_ts_ref_name(uint32_t ref_id, char* name)
+{
+    int i;
+
+    memset(name, '\0', RIAPS_TS_REF_NAME_LENGTH);
+    for (i = 0; i < sizeof(ref_id); i++) {
+        char c = (ref_id >> (24 - i * 8)) & 0xff;
+        if (isprint(c)) {
+            name[i] = c;
         }
+    }
+}
+
+
+void riaps_ts_decode_tracking(const chrony_rep* rep, struct riaps_ts_tracking* trk)
+{
+    struct riap_ts_status* stat = &trk->status;
+
+    /* chrony extrapolates the dispersion to the time of the query */
+    riaps_ts_gettime(&trk->query_time);
+
+    stat->role = RIAPS_TS_MASTER;
+    stat->reference = RIAPS_TS_REF_NONE;
+    if (ntohs(rep->data.tracking.ip_addr.family) == IPADDR_UNSPEC) {
+        int i;
+        char ref_name[RIAPS_TS_REF_NAME_LENGTH];
+
+        riaps_ts_ref_name(ntohl(rep->data.tracking.ref_id), ref_name);
 
         for (i = 0; i < sizeof(ref_id_map)/sizeof(struct ref_id_entry); i++) {
             size_t len_prefix = strlen(ref_id_map[i].prefix);
@@ -118,12 +261,115 @@ int riaps_ts_status(struct riap_ts_status* stat)
         stat->role = RIAPS_TS_SLAVE;
     }
 
-    stat->now.tv_sec = sec_of_timeval(&rep.data.tracking.ref_time);
-    stat->now.tv_nsec = nsec_of_timeval(&rep.data.tracking.ref_time);
+    stat->now.tv_sec = sec_of_timeval(&rep->data.tracking.ref_time);
+    stat->now.tv_nsec = nsec_of_timeval(&rep->data.tracking.ref_time);
 
-    stat->last_offset = double_from_chrony_float_t(&rep.data.tracking.last_offset);
-    stat->rms_offset = double_from_chrony_float_t(&rep.data.tracking.rms_offset);
-    stat->ppm = double_from_chrony_float_t(&rep.data.tracking.freq_ppm);
+    stat->last_offset = double_from_chrony_float_t(&rep->data.tracking.last_offset);
+    stat->rms_offset = double_from_chrony_float_t(&rep->data.tracking.rms_offset);
+    stat->ppm = double_from_chrony_float_t(&rep->data.tracking.freq_ppm);
+
+    trk->ref_id = ntohl(rep->data.tracking.ref_id);
+    trk->stratum = ntohs(rep->data.tracking.stratum);
+    trk->leap_status = ntohs(rep->data.tracking.leap_status);
+    trk->current_correction = double_from_chrony_float_t(&rep->data.tracking.current_correction);
+    trk->resid_freq_ppm = double_from_chrony_float_t(&rep->data.tracking.resid_freq_ppm);
+    trk->skew_ppm = double_from_chrony_float_t(&rep->data.tracking.skew_ppm);
+    trk->root_delay = double_from_chrony_float_t(&rep->data.tracking.root_delay);
+    trk->root_dispersion = double_from_chrony_float_t(&rep->data.tracking.root_dispersion);
+    trk->last_update_interval = double_from_chrony_float_t(&rep->data.tracking.last_update_interval);
+}
+
+
+int riaps_ts_tracking_direct_r(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk)
+{
+    chrony_req* req;
+    chrony_rep* rep;
+
+    if (!ctx || !trk) {
+        return -1;
+    }
+    req = &ctx->req;
+    rep = &ctx->rep;
+
+    req->command = htons(REQ_TRACKING);
+    if (chrony_request(&ctx->client, req, REQ_LENGTH(tracking), rep, REP_LENGTH(tracking), RPY_TRACKING)) {
+        return -1;
+    }
+
+    riaps_ts_decode_tracking(rep, trk);
+    return 0;
+}
+
+
+int riaps_ts_tracking_direct(struct riaps_ts_tracking* trk)
+{
+    return riaps_ts_tracking_direct_r(riaps_ts_default_ctx(), trk);
+}
+
+
+int riaps_ts_tracking_r(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk)
+{
+    int ret;
+
+    if (!trk) {
+        return -1;
+    }
+
+    ret = riaps_ts_shm_read(trk);
+    if (ret < 0) {
+        /* No (live) publisher on this node */
+        return riaps_ts_tracking_direct_r(ctx, trk);
+    }
+    return ret ? -1 : 0;
+}
+
+
+int riaps_ts_tracking(struct riaps_ts_tracking* trk)
+{
+    int ret;
+
+    if (!trk) {
+        return -1;
+    }
+
+    /* The default context is only needed without a publisher */
+    ret = riaps_ts_shm_read(trk);
+    if (ret < 0) {
+        return riaps_ts_tracking_direct_r(riaps_ts_default_ctx(), trk);
+    }
+    return ret ? -1 : 0;
+}
+
+
+int riaps_ts_status_r(riaps_ts_ctx* ctx, struct riap_ts_status* stat)
+{
+    struct riaps_ts_tracking trk;
+
+    if (!stat) {
+        return -1;
+    }
+
+    if (riaps_ts_tracking_r(ctx, &trk)) {
+        return -1;
+    }
+    *stat = trk.status;
+
+    return 0;
+}
+
+
+int riaps_ts_status(struct riap_ts_status* stat)
+{
+    struct riaps_ts_tracking trk;
+
+    if (!stat) {
+        return -1;
+    }
+
+    if (riaps_ts_tracking(&trk)) {
+        return -1;
+    }
+    *stat = trk.status;
 
     return 0;
 }
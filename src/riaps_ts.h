@@ -36,12 +36,52 @@
 
 #define RIAPS_TS_RELTIME 0 /**< Wait for relative time interfval (flag) @see riaps_ts_sleep() */
 #define RIAPS_TS_ABSTIME 1 /**< Wait for absolute time instant (flag) @see riaps_ts_sleep() */
+#define RIAPS_TS_CANCEL_ON_STEP 0x2 /**< Return ECANCELED when the clock is stepped (flag, with RIAPS_TS_ABSTIME) @see riaps_ts_sleep_precise() */
+#define RIAPS_TS_SPIN_AUTO (-1) /**< Spin as long as the calibrated slack requires @see riaps_ts_sleep_precise() */
 #define RIAPS_TS_MASTER 0  /**< Master role value @see riap_ts_status */
 #define RIAPS_TS_SLAVE 1   /**< Slave role value @see riap_ts_status */
 #define RIAPS_TS_REF_NONE 0  /**< No external reference clock is used/valid @see riap_ts_status */
 #define RIAPS_TS_REF_GPS 1   /**< GPS is used as timing reference @see riap_ts_status*/
 #define RIAPS_TS_REF_NTP 2   /**< An external NTP server is used as timing reference @see riap_ts_status */
 #define RIAPS_TS_REF_PTP 3   /**< A PTP server is the current timing reference @see riap_ts_status */
+#define RIAPS_TS_LEAP_NORMAL 0   /**< No leap second pending @see riaps_ts_tracking */
+#define RIAPS_TS_LEAP_INSERT 1   /**< A leap second will be inserted at the end of the day @see riaps_ts_tracking */
+#define RIAPS_TS_LEAP_DELETE 2   /**< A leap second will be deleted at the end of the day @see riaps_ts_tracking */
+#define RIAPS_TS_LEAP_UNSYNC 3   /**< The clock is not synchronized @see riaps_ts_tracking */
+#define RIAPS_TS_REBASE_NONE 0   /**< Keep the absolute deadlines when the clock is stepped @see riaps_ts_sleep_until() */
+#define RIAPS_TS_REBASE_SHIFT 1  /**< Shift the deadlines by the clock step (keep the elapsed time) @see riaps_ts_sleep_until() */
+#define RIAPS_TS_REBASE_RETURN 2 /**< Return to the caller when the clock is stepped @see riaps_ts_sleep_until() */
+#define RIAPS_TS_WAKE_STEPPED 0x1      /**< The clock was stepped during the wait @see riaps_ts_wakeup */
+#define RIAPS_TS_WAKE_LEAP_PENDING 0x2 /**< A leap second is scheduled before the deadline @see riaps_ts_wakeup */
+
+#define RIAPS_TS_SRC_SELECTED 0      /**< Source is the current synchronization reference @see riaps_ts_source */
+#define RIAPS_TS_SRC_NONSELECTABLE 1 /**< Source cannot be selected (e.g. unreachable) @see riaps_ts_source */
+#define RIAPS_TS_SRC_FALSETICKER 2   /**< Source disagrees with the majority @see riaps_ts_source */
+#define RIAPS_TS_SRC_JITTERY 3       /**< Source has too large jitter @see riaps_ts_source */
+#define RIAPS_TS_SRC_UNSELECTED 4    /**< Source is acceptable, but not selected @see riaps_ts_source */
+#define RIAPS_TS_SRC_SELECTABLE 5    /**< Source is combined with the selected one @see riaps_ts_source */
+#define RIAPS_TS_SRC_MODE_SERVER 0   /**< NTP server @see riaps_ts_source */
+#define RIAPS_TS_SRC_MODE_PEER 1     /**< NTP peer @see riaps_ts_source */
+#define RIAPS_TS_SRC_MODE_REFCLOCK 2 /**< Local reference clock (e.g. GPS/PPS, PHC) @see riaps_ts_source */
+#define RIAPS_TS_SOURCE_NAME_LENGTH 48 /**< Buffer size of source names @see riaps_ts_source */
+#define RIAPS_TS_ADD_IBURST 0x1      /**< Fast initial synchronization @see riaps_ts_add_server() */
+#define RIAPS_TS_ADD_PREFER 0x2      /**< Prefer the source in selection @see riaps_ts_add_server() */
+#define RIAPS_TS_ADD_NOSELECT 0x4    /**< Monitor the source only @see riaps_ts_add_server() */
+#define RIAPS_TS_ADD_TRUST 0x8       /**< Trust the source in falsetickers detection @see riaps_ts_add_server() */
+#define RIAPS_TS_ADD_REQUIRE 0x10    /**< Require the source to be selectable for any update @see riaps_ts_add_server() */
+
+#define RIAPS_TS_ENDPOINT_AUTO NULL                       /**< Unix domain socket if available, UDP otherwise @see riaps_ts_set_endpoint() */
+#define RIAPS_TS_ENDPOINT_UNIX "/run/chrony/chronyd.sock" /**< chrony's Unix domain command socket @see riaps_ts_set_endpoint() */
+#define RIAPS_TS_ENDPOINT_UDP "127.0.0.1:323"             /**< chrony's UDP command socket @see riaps_ts_set_endpoint() */
+
+/**
+ * @brief Client context for communicating with the timesync service.
+ *
+ * Every context owns its connection, so threads using separate contexts can query
+ * the service in parallel. A context must not be used by multiple threads at the
+ * same time. Functions without a context argument use a per-thread default context.
+ */
+typedef struct riaps_ts_ctx riaps_ts_ctx;
 
 struct riaps_ts_timespec {
     long    tv_sec;        /* seconds, always 32 bit */
@@ -60,6 +100,34 @@ struct riap_ts_status {
     double ppm;                /**< The local (compensated) time drift in parts per million */
 };
 
+/**
+ * @brief Detailed tracking information of the timesync service
+ *
+ * Superset of @c riap_ts_status with the remaining fields of chrony's tracking report.
+ */
+struct riaps_ts_tracking {
+    struct riap_ts_status status;   /**< Basic status information @see riap_ts_status */
+    unsigned int ref_id;            /**< Reference ID of the current source (chrony refid) */
+    int stratum;                    /**< NTP stratum of this node */
+    int leap_status;                /**< Leap second status @see RIAPS_TS_LEAP_NORMAL */
+    double current_correction;      /**< Offset of the system clock being slewed out (secs) */
+    double resid_freq_ppm;          /**< Residual frequency of the current reference (ppm) */
+    double skew_ppm;                /**< Estimated error bound of the frequency (ppm) */
+    double root_delay;              /**< Total network path delay to the stratum-1 reference (secs) */
+    double root_dispersion;         /**< Total accumulated dispersion to the stratum-1 reference (secs) */
+    double last_update_interval;    /**< Interval between the last two clock updates (secs) */
+    struct riaps_ts_timespec query_time; /**< System time when chrony was queried for this information */
+};
+
+/**
+ * @brief Time interval guaranteed to contain the true (reference) time
+ */
+struct riaps_ts_interval {
+    struct riaps_ts_timespec earliest;  /**< Lower bound of the true time */
+    struct riaps_ts_timespec now;       /**< The local (synchronized) clock reading */
+    struct riaps_ts_timespec latest;    /**< Upper bound of the true time */
+};
+
 /**
  * @brief Wrapper function to query the proper (synchronized) local time 
  *
@@ -78,12 +146,403 @@ int riaps_ts_gettime(struct riaps_ts_timespec *res);
  */
 int riaps_ts_sleep(int flags, const struct riaps_ts_timespec *request);
 
+/**
+ * @brief Clock events observed by a step-aware sleep @see riaps_ts_sleep_until()
+ */
+struct riaps_ts_wakeup {
+    int events;             /**< Bitwise OR of @c RIAPS_TS_WAKE_STEPPED, ... */
+    long long step_ns;      /**< Total step of the clock during the wait (nanosecs, negative: backwards) */
+    struct riaps_ts_timespec deadline; /**< The deadline after rebasing (the original one for RIAPS_TS_REBASE_NONE) */
+};
+
+/**
+ * @brief Wait for an absolute (synchronized) time instant, detecting clock steps.
+ *
+ * A plain absolute sleep follows a step of the system clock (e.g. chrony's makestep
+ * or a leap second), so a periodic loop either stalls for the size of a backward step
+ * or wakes in a catch-up burst after a forward one. This function is notified by the
+ * kernel of every step during the wait and handles it according to the policy:
+ * @c RIAPS_TS_REBASE_NONE keeps the absolute deadline, @c RIAPS_TS_REBASE_SHIFT moves
+ * it by the step (the elapsed waiting time is kept) and @c RIAPS_TS_REBASE_RETURN
+ * returns ECANCELED, so the caller can realign its schedule. A leap second pending
+ * (according to chrony) before the deadline is reported as well.
+ *
+ * @param deadline The time instant to wait for
+ * @param policy What to do when the clock is stepped @see RIAPS_TS_REBASE_NONE
+ * @param wakeup If not NULL, receives the clock events observed during the wait
+ * @return Zero, if the deadline was reached, ECANCELED if the clock was stepped
+ *         (@c RIAPS_TS_REBASE_RETURN only), EINTR if interrupted by a signal handler,
+ *         other errno values on failure.
+ */
+int riaps_ts_sleep_until(const struct riaps_ts_timespec* deadline, int policy, struct riaps_ts_wakeup* wakeup);
+
+/**
+ * @brief Description and statistics of a time source of the timesync service
+ */
+struct riaps_ts_source {
+    char name[RIAPS_TS_SOURCE_NAME_LENGTH]; /**< IP address of NTP sources, reference ID of reference clocks */
+    unsigned int ref_id;        /**< Reference ID of the source */
+    int mode;                   /**< Type of the source @see RIAPS_TS_SRC_MODE_SERVER */
+    int state;                  /**< Selection state of the source @see RIAPS_TS_SRC_SELECTED */
+    int stratum;                /**< NTP stratum of the source */
+    int poll;                   /**< Polling interval (log2 seconds) */
+    int reachability;           /**< Reachability register (last 8 polls) */
+    unsigned int flags;         /**< Selection option flags of the source (chrony) */
+    unsigned long since_sample; /**< Time since the last sample (secs) */
+    double orig_latest_meas;    /**< Offset of the last sample as measured (secs) */
+    double latest_meas;         /**< Offset of the last sample, adjusted for clock changes (secs) */
+    double latest_meas_err;     /**< Error bound of the last sample (secs) */
+    unsigned int n_samples;     /**< Number of retained samples */
+    unsigned int n_runs;        /**< Number of runs of residuals with the same sign */
+    unsigned int span_seconds;  /**< Time interval covered by the retained samples */
+    double std_dev;             /**< Estimated standard deviation of the samples (secs) */
+    double resid_freq_ppm;      /**< Residual frequency of the source (ppm) */
+    double skew_ppm;            /**< Estimated error bound of the frequency (ppm) */
+    double est_offset;          /**< Estimated offset of the source (secs) */
+    double est_offset_err;      /**< Error bound of the estimated offset (secs) */
+};
+
+/**
+ * @brief Request and traffic counters of the local chrony server
+ *
+ * Counters not provided by the running chrony version are zero.
+ */
+struct riaps_ts_server_stats {
+    unsigned long long ntp_hits;      /**< Number of NTP requests served */
+    unsigned long long nke_hits;      /**< Number of NTS-KE connections accepted */
+    unsigned long long cmd_hits;      /**< Number of command requests served */
+    unsigned long long ntp_drops;     /**< Number of dropped NTP requests */
+    unsigned long long nke_drops;     /**< Number of dropped NTS-KE connections */
+    unsigned long long cmd_drops;     /**< Number of dropped command requests */
+    unsigned long long log_drops;     /**< Number of clients not logged (full table) */
+    unsigned long long ntp_auth_hits; /**< Number of authenticated NTP requests served */
+};
+
+/**
+ * @brief Query the proper (synchronized) local time with a guaranteed error bound.
+ *
+ * The bounds are computed from chrony's error estimates (root delay, root dispersion,
+ * the offset still being slewed out) and extrapolated by the frequency error bounds
+ * for the time elapsed since the estimates were obtained. The estimates are cached
+ * (in the calling thread's default context) and refreshed about once per second, so
+ * this is almost as fast as riaps_ts_gettime(). While chrony cannot be reached, the
+ * refresh is retried with backoff and the last estimates are extrapolated meanwhile.
+ * @see riaps_ts_gettime_bounded_r()
+ *
+ * @param res Pointer to a pre-allocated @c riaps_ts_interval structure to be filled in.
+ * @return Zero on success, -1 on failure (e.g. the clock is not synchronized).
+ */
+int riaps_ts_gettime_bounded(struct riaps_ts_interval* res);
+
+/**
+ * @brief Wait until a time instant has surely passed everywhere (commit-wait).
+ *
+ * Returns when the lower bound of the true time is past the given instant, i.e. no
+ * properly synchronized node can read an earlier time anymore.
+ *
+ * @param instant The time instant (e.g. a timestamp assigned by this node)
+ * @return Zero on success, -1 on failure (e.g. the clock is not synchronized).
+ */
+int riaps_ts_commit_wait(const struct riaps_ts_timespec* instant);
+
+/**
+ * @brief Wait for the proper (synchronized) local time with sub-timer-tick accuracy.
+ *
+ * Sleeps until a calibrated slack before the deadline, then busy-polls the clock to
+ * return at the requested instant. The slack is continuously calibrated (per CPU) from
+ * the observed wake-up latencies of the kernel timer. The spinning time can be limited
+ * per call, trading timing accuracy for CPU time.
+ *
+ * With @c RIAPS_TS_CANCEL_ON_STEP an absolute wait is interrupted when the system clock
+ * is stepped, instead of stalling for the size of a backward step (the wait is done on
+ * a per-thread timerfd then). @see riaps_ts_sleep_until()
+ *
+ * @param flags Relative or absolute wait, optionally with @c RIAPS_TS_CANCEL_ON_STEP.
+ *        @see RIAPS_TS_RELTIME, RIAPS_TS_ABSTIME
+ * @param request The time interval or instant to wait for
+ * @param max_spin_ns Maximum busy-polling time (nanosecs), 0 for a plain sleep or
+ *        @c RIAPS_TS_SPIN_AUTO to spin as long as the calibrated slack requires
+ * @param lateness_ns If not NULL, receives the difference between the actual wake-up
+ *        time and the requested instant (nanosecs)
+ * @return Zero, if successfully sleeping for the requested interval, ECANCELED if the
+ *         clock was stepped (@c RIAPS_TS_CANCEL_ON_STEP only).
+ */
+int riaps_ts_sleep_precise(int flags, const struct riaps_ts_timespec *request, long max_spin_ns, long* lateness_ns);
+
+/**
+ * @brief Current calibrated slack of riaps_ts_sleep_precise().
+ *
+ * @param cpu The CPU (-1 for the current one)
+ * @return The time (nanosecs) the kernel timer is woken up before the deadline.
+ */
+long riaps_ts_sleep_slack(int cpu);
+
 /**
  * @brief Query the current status of the time synchronization service.
  *
+ * Uses the shared memory cache when available. @see riaps_ts_tracking()
+ *
  * @param stat Pre-allocated buffer to receive the status information. @see riap_ts_status
  * @return Zero, if succeeded and valid status is provided.
  */
 int riaps_ts_status(struct riap_ts_status* stat);
 
+/**
+ * @brief Query the detailed tracking information of the time synchronization service.
+ *
+ * The information is read from the node-wide shared memory cache maintained by the
+ * @c riaps_tsd publisher. This is a lock-free read without system calls. If the
+ * publisher is not running (or its data is stale) chrony is queried directly.
+ *
+ * @param trk Pre-allocated buffer to receive the tracking information. @see riaps_ts_tracking
+ * @return Zero, if succeeded and valid tracking information is provided.
+ */
+int riaps_ts_tracking(struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Select how to communicate with chrony (for direct queries).
+ *
+ * Applies to the default contexts (of all threads), not to the contexts created by
+ * riaps_ts_ctx_create(). By default the Unix domain command socket of chrony is used if it is accessible
+ * (it requires root or chrony group privileges), otherwise the UDP command port.
+ *
+ * @param endpoint Absolute path of a Unix domain socket, a "host[:port]" UDP address or
+ *        @c RIAPS_TS_ENDPOINT_AUTO. @see RIAPS_TS_ENDPOINT_UNIX, RIAPS_TS_ENDPOINT_UDP
+ * @return Zero, if the endpoint specification is valid.
+ */
+int riaps_ts_set_endpoint(const char* endpoint);
+
+/**
+ * @brief Set the time budget of the direct queries of chrony.
+ *
+ * Applies to the default contexts (of all threads). Lost requests are retransmitted with
+ * exponential backoff (starting at sub-millisecond intervals) and a broken connection
+ * is reopened, until the reply arrives or the time budget is exhausted (@c errno is
+ * ETIMEDOUT then). The default budget is one second.
+ *
+ * @param timeout_ms The time budget of a query in milliseconds (0 for the default)
+ * @return Zero, if the timeout is valid.
+ */
+int riaps_ts_set_timeout(int timeout_ms);
+
+/**
+ * @brief Query the detailed tracking information directly from chrony.
+ *
+ * Same as riaps_ts_tracking(), but bypasses the shared memory cache.
+ *
+ * @param trk Pre-allocated buffer to receive the tracking information. @see riaps_ts_tracking
+ * @return Zero, if succeeded and valid tracking information is provided.
+ */
+int riaps_ts_tracking_direct(struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Create a new client context.
+ *
+ * @param endpoint The chrony endpoint to be used by this context. @see riaps_ts_set_endpoint()
+ * @return The new context or NULL on failure.
+ */
+riaps_ts_ctx* riaps_ts_ctx_create(const char* endpoint);
+
+/**
+ * @brief Destroy a client context and release its resources.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ */
+void riaps_ts_ctx_destroy(riaps_ts_ctx* ctx);
+
+/**
+ * @brief Set the time budget of the direct queries of chrony (and ptp4l) using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param timeout_ms The time budget of a query in milliseconds (0 for the default)
+ * @return Zero, if the timeout is valid. @see riaps_ts_set_timeout()
+ */
+int riaps_ts_ctx_set_timeout(riaps_ts_ctx* ctx, int timeout_ms);
+
+/**
+ * @brief Reentrant version of riaps_ts_status() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param stat Pre-allocated buffer to receive the status information. @see riap_ts_status
+ * @return Zero, if succeeded and valid status is provided.
+ */
+int riaps_ts_status_r(riaps_ts_ctx* ctx, struct riap_ts_status* stat);
+
+/**
+ * @brief Reentrant version of riaps_ts_tracking() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param trk Pre-allocated buffer to receive the tracking information. @see riaps_ts_tracking
+ * @return Zero, if succeeded and valid tracking information is provided.
+ */
+int riaps_ts_tracking_r(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Reentrant version of riaps_ts_tracking_direct() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param trk Pre-allocated buffer to receive the tracking information. @see riaps_ts_tracking
+ * @return Zero, if succeeded and valid tracking information is provided.
+ */
+int riaps_ts_tracking_direct_r(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Query the description and statistics of every time source of the timesync service.
+ *
+ * The requests for all the sources are pipelined, so a query typically takes a single
+ * round-trip time to chrony.
+ *
+ * @param sources Pre-allocated array to receive the source information. @see riaps_ts_source
+ * @param max_sources Size of the array
+ * @return The number of sources (might be more than @c max_sources) or -1 on failure.
+ */
+int riaps_ts_sources(struct riaps_ts_source* sources, int max_sources);
+
+/**
+ * @brief Reentrant version of riaps_ts_sources() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param sources Pre-allocated array to receive the source information. @see riaps_ts_source
+ * @param max_sources Size of the array
+ * @return The number of sources (might be more than @c max_sources) or -1 on failure.
+ */
+int riaps_ts_sources_r(riaps_ts_ctx* ctx, struct riaps_ts_source* sources, int max_sources);
+
+/**
+ * @brief Query the tracking information and every time source in the same exchange.
+ *
+ * The tracking request is pipelined with the source requests, so a consistent
+ * snapshot of the service typically takes a single round-trip time to chrony.
+ * The shared memory cache is not used.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param trk Pre-allocated buffer to receive the tracking information. @see riaps_ts_tracking
+ * @param sources Pre-allocated array to receive the source information. @see riaps_ts_source
+ * @param max_sources Size of the array
+ * @return The number of sources (might be more than @c max_sources) or -1 on failure.
+ */
+int riaps_ts_snapshot_r(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk, struct riaps_ts_source* sources,
+                        int max_sources);
+
+/**
+ * @brief Query the request and traffic counters of the local chrony server.
+ *
+ * @param stats Pre-allocated buffer to receive the counters. @see riaps_ts_server_stats
+ * @return Zero, if succeeded and valid counters are provided.
+ */
+int riaps_ts_server_stats(struct riaps_ts_server_stats* stats);
+
+/**
+ * @brief Reentrant version of riaps_ts_server_stats() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param stats Pre-allocated buffer to receive the counters. @see riaps_ts_server_stats
+ * @return Zero, if succeeded and valid counters are provided.
+ */
+int riaps_ts_server_stats_r(riaps_ts_ctx* ctx, struct riaps_ts_server_stats* stats);
+
+/**
+ * @brief Add an NTP server to the running timesync service.
+ *
+ * The source is added without restarting chrony, so the clock discipline is kept.
+ * Requires the Unix domain command socket (root or chrony group privileges).
+ *
+ * @param name Host name or IP address of the server
+ * @param flags Bitwise OR of the @c RIAPS_TS_ADD_IBURST, ... options
+ * @return Zero, if the source was added, -1 otherwise (@c errno is EEXIST, if the source
+ *         is already known, EACCES, if the endpoint is not privileged).
+ */
+int riaps_ts_add_server(const char* name, int flags);
+
+/**
+ * @brief Reentrant version of riaps_ts_add_server() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param name Host name or IP address of the server
+ * @param flags Bitwise OR of the @c RIAPS_TS_ADD_IBURST, ... options
+ * @return Zero, if the source was added.
+ */
+int riaps_ts_add_server_r(riaps_ts_ctx* ctx, const char* name, int flags);
+
+/**
+ * @brief Remove an NTP source from the running timesync service.
+ *
+ * @param addr IP address of the source (@c name in riaps_ts_source)
+ * @return Zero, if the source was removed, -1 otherwise (@c errno is ENOENT, if there
+ *         is no such source).
+ */
+int riaps_ts_del_source(const char* addr);
+
+/**
+ * @brief Reentrant version of riaps_ts_del_source() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param addr IP address of the source
+ * @return Zero, if the source was removed.
+ */
+int riaps_ts_del_source_r(riaps_ts_ctx* ctx, const char* addr);
+
+/**
+ * @brief Reentrant version of riaps_ts_gettime_bounded() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create() (holds the cached error estimates)
+ * @param res Pointer to a pre-allocated @c riaps_ts_interval structure to be filled in.
+ * @return Zero on success, -1 on failure (e.g. the clock is not synchronized).
+ */
+int riaps_ts_gettime_bounded_r(riaps_ts_ctx* ctx, struct riaps_ts_interval* res);
+
+/**
+ * @brief Reentrant version of riaps_ts_sleep_until() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create() (holds the timer and the cached leap status)
+ * @param deadline The time instant to wait for
+ * @param policy What to do when the clock is stepped @see RIAPS_TS_REBASE_NONE
+ * @param wakeup If not NULL, receives the clock events observed during the wait
+ * @return Zero, if the deadline was reached, ECANCELED, EINTR or other errno values otherwise.
+ */
+int riaps_ts_sleep_until_r(riaps_ts_ctx* ctx, const struct riaps_ts_timespec* deadline, int policy,
+                           struct riaps_ts_wakeup* wakeup);
+
+/**
+ * @brief Start a non-blocking status query.
+ *
+ * Returns a descriptor to be added to the caller's poll/epoll/zmq poll set (for reading).
+ * Whenever it becomes readable, riaps_ts_status_complete() (or riaps_ts_tracking_complete())
+ * has to be called, which either provides the result or asks for more polling.
+ * Retransmissions are handled internally. The descriptor belongs to the context
+ * and remains the same for subsequent queries. A new query cancels the pending one.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @return A pollable descriptor or -1 on failure.
+ */
+int riaps_ts_status_begin(riaps_ts_ctx* ctx);
+
+/**
+ * @brief Collect the result of a non-blocking status query. @see riaps_ts_status_begin()
+ *
+ * @param ctx The context of the pending query
+ * @param stat Pre-allocated buffer to receive the status information. @see riap_ts_status
+ * @return Zero, if the query succeeded and valid status is provided, -1 otherwise
+ *         (@c errno is EAGAIN, if the query is still in progress and ETIMEDOUT if chrony did not reply).
+ */
+int riaps_ts_status_complete(riaps_ts_ctx* ctx, struct riap_ts_status* stat);
+
+/**
+ * @brief Collect the result of a non-blocking status query as tracking information.
+ *
+ * Same as riaps_ts_status_complete(), but provides all tracking details.
+ *
+ * @param ctx The context of the pending query
+ * @param trk Pre-allocated buffer to receive the tracking information. @see riaps_ts_tracking
+ * @return Zero, if the query succeeded, -1 otherwise (@c errno is EAGAIN, if still in progress).
+ */
+int riaps_ts_tracking_complete(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Cancel the pending non-blocking query (if any) of the context.
+ *
+ * @param ctx The context of the pending query
+ */
+void riaps_ts_status_cancel(riaps_ts_ctx* ctx);
+
 #endif // _RIAPS_TS_H_
@@ -0,0 +1,247 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_async.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Non-blocking status queries (implementation).
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "riaps_ts.h"
+#include "riaps_ts_ctx.h"
+#include "riaps_ts_io.h"
+#include "riaps_ts_shm.h"
+
+
+static int open_poll_set(riaps_ts_ctx* ctx)
+{
+    struct epoll_event ev;
+
+    if (ctx->poll_fd >= 0) {
+        return 0;
+    }
+
+    ctx->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->poll_fd < 0 || ctx->timer_fd < 0 || ctx->event_fd < 0) {
+        goto poll_error;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = ctx->timer_fd;
+    if (epoll_ctl(ctx->poll_fd, EPOLL_CTL_ADD, ctx->timer_fd, &ev)) {
+        goto poll_error;
+    }
+    ev.data.fd = ctx->event_fd;
+    if (epoll_ctl(ctx->poll_fd, EPOLL_CTL_ADD, ctx->event_fd, &ev)) {
+        goto poll_error;
+    }
+    return 0;
+
+poll_error:
+    riaps_ts_async_close(ctx);
+    return -1;
+}
+
+
+void riaps_ts_async_close(riaps_ts_ctx* ctx)
+{
+    if (ctx->poll_fd >= 0) {
+        close(ctx->poll_fd);
+    }
+    if (ctx->timer_fd >= 0) {
+        close(ctx->timer_fd);
+    }
+    if (ctx->event_fd >= 0) {
+        close(ctx->event_fd);
+    }
+    ctx->poll_fd = -1;
+    ctx->timer_fd = -1;
+    ctx->event_fd = -1;
+    ctx->async_state = RIAPS_TS_ASYNC_IDLE;
+}
+
+
+static void arm_timer(riaps_ts_ctx* ctx, long interval_us)
+{
+    struct itimerspec its = {{0, 0}, {interval_us / 1000000, (interval_us % 1000000) * 1000L}};
+
+    timerfd_settime(ctx->timer_fd, 0, &its, NULL);
+}
+
+
+static void reset_events(riaps_ts_ctx* ctx)
+{
+    uint64_t count;
+
+    arm_timer(ctx, 0);
+    while (read(ctx->timer_fd, &count, sizeof(count)) > 0);
+    while (read(ctx->event_fd, &count, sizeof(count)) > 0);
+    chrony_client_drain(&ctx->client);
+}
+
+
+static void signal_done(riaps_ts_ctx* ctx, int state, int error)
+{
+    uint64_t one = 1;
+
+    arm_timer(ctx, 0);
+    ctx->async_state = state;
+    ctx->async_error = error;
+    if (write(ctx->event_fd, &one, sizeof(one)) < 0) {
+        /* Cannot happen, the counter never overflows */
+    }
+}
+
+
+/*
+ * (Re)transmit the request with exponential backoff until the deadline of the query,
+ * the socket is (re)registered if it has changed
+ */
+static void send_request(riaps_ts_ctx* ctx)
+{
+    struct epoll_event ev;
+    int64_t left_us = ctx->async_deadline - riaps_ts_monotonic_us();
+    long timeout_us;
+
+    if (left_us <= 0) {
+        signal_done(ctx, RIAPS_TS_ASYNC_FAILED, ETIMEDOUT);
+        return;
+    }
+
+    /* A broken connection (e.g. chrony restarted) is reopened once */
+    if (chrony_request_send(&ctx->client, &ctx->req, REQ_LENGTH(tracking), REP_LENGTH(tracking)) == 0 ||
+        chrony_request_send(&ctx->client, &ctx->req, REQ_LENGTH(tracking), REP_LENGTH(tracking)) == 0) {
+        ev.events = EPOLLIN;
+        ev.data.fd = chrony_client_fd(&ctx->client);
+        epoll_ctl(ctx->poll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);   /* EEXIST is fine */
+    }
+    /* Otherwise chrony is not reachable (e.g. restarting), the timer triggers a retry */
+    timeout_us = chrony_attempt_timeout_us(ctx->async_attempts++);
+    arm_timer(ctx, timeout_us < left_us ? timeout_us : (long)left_us);
+}
+
+
+int riaps_ts_status_begin(riaps_ts_ctx* ctx)
+{
+    int ret;
+
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (open_poll_set(ctx)) {
+        return -1;
+    }
+    reset_events(ctx);
+
+    ret = riaps_ts_shm_read(&ctx->async_result);
+    if (ret == 0) {
+        signal_done(ctx, RIAPS_TS_ASYNC_READY, 0);
+    }
+    else if (ret > 0) {
+        /* The publisher is alive, but chrony is not available */
+        signal_done(ctx, RIAPS_TS_ASYNC_FAILED, EIO);
+    }
+    else {
+        ctx->req.command = htons(REQ_TRACKING);
+        chrony_request_init(&ctx->client, &ctx->req);
+        ctx->async_state = RIAPS_TS_ASYNC_PENDING;
+        ctx->async_attempts = 0;
+        ctx->async_deadline = riaps_ts_monotonic_us() + (int64_t)ctx->client.timeout_ms * 1000;
+        send_request(ctx);
+    }
+
+    return ctx->poll_fd;
+}
+
+
+int riaps_ts_tracking_complete(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk)
+{
+    uint64_t expirations;
+
+    if (!ctx || !trk) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->async_state == RIAPS_TS_ASYNC_PENDING) {
+        if (chrony_reply_receive(&ctx->client, &ctx->req, &ctx->rep, REP_LENGTH(tracking), RPY_TRACKING) == 0) {
+            riaps_ts_decode_tracking(&ctx->rep, &ctx->async_result);
+            signal_done(ctx, RIAPS_TS_ASYNC_READY, 0);
+        }
+        else if (read(ctx->timer_fd, &expirations, sizeof(expirations)) > 0) {
+            send_request(ctx);
+        }
+    }
+
+    switch (ctx->async_state) {
+    case RIAPS_TS_ASYNC_PENDING:
+        errno = EAGAIN;
+        return -1;
+    case RIAPS_TS_ASYNC_READY:
+        *trk = ctx->async_result;
+        reset_events(ctx);
+        ctx->async_state = RIAPS_TS_ASYNC_IDLE;
+        return 0;
+    case RIAPS_TS_ASYNC_FAILED:
+        reset_events(ctx);
+        ctx->async_state = RIAPS_TS_ASYNC_IDLE;
+        errno = ctx->async_error;
+        return -1;
+    default:
+        /* Not started, late replies might keep the descriptor readable */
+        chrony_client_drain(&ctx->client);
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+
+int riaps_ts_status_complete(riaps_ts_ctx* ctx, struct riap_ts_status* stat)
+{
+    struct riaps_ts_tracking trk;
+
+    if (!stat) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (riaps_ts_tracking_complete(ctx, &trk)) {
+        return -1;
+    }
+    *stat = trk.status;
+    return 0;
+}
+
+
+void riaps_ts_status_cancel(riaps_ts_ctx* ctx)
+{
+    if (ctx && ctx->poll_fd >= 0) {
+        reset_events(ctx);
+        ctx->async_state = RIAPS_TS_ASYNC_IDLE;
+    }
+}
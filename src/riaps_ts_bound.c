@@ -0,0 +1,143 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_bound.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Time queries with guaranteed error bounds (implementation).
+ */
+
+#include <errno.h>
+#include <math.h>
+
+#include "riaps_ts.h"
+#include "riaps_ts_ctx.h"
+#include "riaps_ts_util.h"
+
+
+const struct riaps_ts_tracking* riaps_ts_cached_tracking(riaps_ts_ctx* ctx)
+{
+    int64_t mono;
+
+    /* Hot path: only the local clock is read */
+    mono = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+    if (mono >= ctx->bound_next) {
+        struct riaps_ts_tracking fresh;
+        if (riaps_ts_tracking_r(ctx, &fresh) == 0) {
+            ctx->bound_trk = fresh;
+            ctx->bound_refreshed = mono;
+            ctx->bound_backoff = 0;
+            ctx->bound_next = mono + RIAPS_TS_BOUND_REFRESH_NS;
+        }
+        else {
+            /* Failed attempts are rate limited too, a query may take the whole timeout */
+            ctx->bound_backoff = ctx->bound_backoff ? 2 * ctx->bound_backoff : RIAPS_TS_BOUND_REFRESH_NS;
+            if (ctx->bound_backoff > RIAPS_TS_BOUND_BACKOFF_MAX_NS) {
+                ctx->bound_backoff = RIAPS_TS_BOUND_BACKOFF_MAX_NS;
+            }
+            ctx->bound_next = riaps_ts_clock_ns(CLOCK_MONOTONIC) + ctx->bound_backoff;
+            if (!ctx->bound_refreshed) {
+                return NULL;
+            }
+        }
+    }
+    else if (!ctx->bound_refreshed) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    /* Keep using (extrapolating) the last estimates, their error grows with the elapsed time */
+    return &ctx->bound_trk;
+}
+
+
+int riaps_ts_gettime_bounded_r(riaps_ts_ctx* ctx, struct riaps_ts_interval* res)
+{
+    const struct riaps_ts_tracking* trk;
+    int64_t now, elapsed;
+    double error, slow, fast;
+
+    if (!ctx || !res) {
+        return -1;
+    }
+
+    trk = riaps_ts_cached_tracking(ctx);
+    if (!trk) {
+        return -1;
+    }
+    if (trk->leap_status == RIAPS_TS_LEAP_UNSYNC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    now = riaps_ts_clock_ns(CLOCK_REALTIME);
+    elapsed = now - riaps_ts_ns_of_timespec(&trk->query_time);
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+
+    error = trk->root_delay / 2.0 + trk->root_dispersion +
+            (trk->skew_ppm + fabs(trk->resid_freq_ppm) + RIAPS_TS_MAX_CLOCK_ERROR_PPM) * 1e-6 * (elapsed / 1e9);
+
+    /*
+     * A positive correction means the clock is slow and it is being slewed out,
+     * so the true time is between now and now + correction.
+     */
+    slow = trk->current_correction > 0.0 ? trk->current_correction : 0.0;
+    fast = trk->current_correction < 0.0 ? -trk->current_correction : 0.0;
+
+    riaps_ts_timespec_of_ns(now, &res->now);
+    riaps_ts_timespec_of_ns(now - (int64_t)ceil((fast + error) * 1e9), &res->earliest);
+    riaps_ts_timespec_of_ns(now + (int64_t)ceil((slow + error) * 1e9), &res->latest);
+    return 0;
+}
+
+
+int riaps_ts_gettime_bounded(struct riaps_ts_interval* res)
+{
+    return riaps_ts_gettime_bounded_r(riaps_ts_default_ctx(), res);
+}
+
+
+int riaps_ts_commit_wait(const struct riaps_ts_timespec* instant)
+{
+    struct riaps_ts_interval interval;
+    struct riaps_ts_timespec remaining;
+    int64_t target;
+
+    if (!instant) {
+        return -1;
+    }
+    target = riaps_ts_ns_of_timespec(instant);
+
+    for (;;) {
+        int64_t earliest;
+
+        if (riaps_ts_gettime_bounded(&interval)) {
+            return -1;
+        }
+        earliest = riaps_ts_ns_of_timespec(&interval.earliest);
+        if (earliest > target) {
+            return 0;
+        }
+        /* The bounds may have grown in the meantime, so check again */
+        riaps_ts_timespec_of_ns(target - earliest + 1, &remaining);
+        riaps_ts_sleep(RIAPS_TS_RELTIME, &remaining);
+    }
+}
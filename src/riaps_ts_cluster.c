@@ -0,0 +1,434 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_cluster.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Cluster-wide synchronization quality (implementation).
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+#include "riaps_ts_cluster.h"
+#include "riaps_ts_ctx.h"
+#include "riaps_ts_io.h"
+
+#define CLUSTER_RCVBUF (1 << 20)    /* Room for the replies of a burst */
+#define CLUSTER_MAX_EVENTS 2
+
+/* A node in the current round */
+struct cluster_node {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int pending;
+    int attempt;
+    int64_t deadline_us;
+    int64_t next_us;                /* Time of the next (re)transmission */
+    int64_t sent_us;
+};
+
+struct riaps_ts_cluster {
+    int n_nodes;
+    struct cluster_node* nodes;
+    int socks[2];                   /* IPv4 and IPv6 sockets, shared by the nodes */
+    int epoll_fd;
+    int timeout_ms;
+    uint32_t seq;                   /* Sequence number of the first node in the round */
+    chrony_req req;
+};
+
+
+static int sock_index(const struct cluster_node* node)
+{
+    return node->addr.ss_family == AF_INET6;
+}
+
+static int open_socket(riaps_ts_cluster* cluster, int family)
+{
+    struct epoll_event ev;
+    int rcvbuf = CLUSTER_RCVBUF;
+    int sock;
+
+    sock = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    if (epoll_ctl(cluster->epoll_fd, EPOLL_CTL_ADD, sock, &ev)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+riaps_ts_cluster* riaps_ts_cluster_create(const char* const* endpoints, int n_nodes)
+{
+    riaps_ts_cluster* cluster;
+    struct timespec tp;
+    int i;
+
+    if (!endpoints || n_nodes <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    cluster = calloc(1, sizeof(riaps_ts_cluster));
+    if (!cluster) {
+        return NULL;
+    }
+    cluster->socks[0] = cluster->socks[1] = -1;
+    cluster->n_nodes = n_nodes;
+    cluster->timeout_ms = RIAPS_TS_CLUSTER_TIMEOUT_MS;
+    cluster->nodes = calloc(n_nodes, sizeof(struct cluster_node));
+    cluster->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!cluster->nodes || cluster->epoll_fd < 0) {
+        goto error;
+    }
+
+    for (i = 0; i < n_nodes; i++) {
+        struct cluster_node* node = &cluster->nodes[i];
+
+        if (chrony_resolve_udp(endpoints[i], &node->addr, &node->addr_len)) {
+            goto error;
+        }
+        if (cluster->socks[sock_index(node)] < 0) {
+            cluster->socks[sock_index(node)] = open_socket(cluster, node->addr.ss_family);
+            if (cluster->socks[sock_index(node)] < 0) {
+                goto error;
+            }
+        }
+    }
+
+    /* Late replies to a previous collector are not accepted */
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    cluster->seq = (uint32_t)tp.tv_nsec ^ ((uint32_t)getpid() << 12);
+    cluster->req.version = PROTO_VERSION_NUMBER;
+    cluster->req.pkt_type = PKT_TYPE_CMD_REQUEST;
+    cluster->req.command = htons(REQ_TRACKING);
+    return cluster;
+
+error:
+    riaps_ts_cluster_destroy(cluster);
+    return NULL;
+}
+
+
+void riaps_ts_cluster_destroy(riaps_ts_cluster* cluster)
+{
+    int saved_errno = errno;
+    int i;
+
+    if (cluster) {
+        for (i = 0; i < 2; i++) {
+            if (cluster->socks[i] >= 0) {
+                close(cluster->socks[i]);
+            }
+        }
+        if (cluster->epoll_fd >= 0) {
+            close(cluster->epoll_fd);
+        }
+        free(cluster->nodes);
+        free(cluster);
+    }
+    errno = saved_errno;
+}
+
+
+int riaps_ts_cluster_set_timeout(riaps_ts_cluster* cluster, int timeout_ms)
+{
+    if (!cluster || timeout_ms < 0) {
+        return -1;
+    }
+    cluster->timeout_ms = timeout_ms ? timeout_ms : RIAPS_TS_CLUSTER_TIMEOUT_MS;
+    return 0;
+}
+
+
+static void send_request(riaps_ts_cluster* cluster, int index, struct riaps_ts_node_status* status,
+                         int64_t now)
+{
+    struct cluster_node* node = &cluster->nodes[index];
+    chrony_req* req = &cluster->req;
+
+    /* The request is padded to the length of the reply */
+    req->sequence = htonl(cluster->seq + index);
+    req->attempt = htons(node->attempt);
+    if (sendto(cluster->socks[sock_index(node)], req, REP_LENGTH(tracking), MSG_DONTWAIT,
+               (struct sockaddr*)&node->addr, node->addr_len) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            /* The socket is congested by the burst, it is not an attempt */
+            node->next_us = now + 1000;
+            return;
+        }
+        status->error = errno;
+    }
+    node->sent_us = now;
+    node->next_us = now + riaps_ts_backoff_us(node->attempt++, RIAPS_TS_CLUSTER_ATTEMPT_TIMEOUT_US,
+                                              RIAPS_TS_CLUSTER_MAX_ATTEMPT_TIMEOUT_US);
+    if (node->next_us > node->deadline_us) {
+        node->next_us = node->deadline_us;
+    }
+}
+
+static int same_address(const struct sockaddr_storage* a, const struct sockaddr_storage* b)
+{
+    if (a->ss_family != b->ss_family) {
+        return 0;
+    }
+    if (a->ss_family == AF_INET) {
+        const struct sockaddr_in* a4 = (const struct sockaddr_in*)a;
+        const struct sockaddr_in* b4 = (const struct sockaddr_in*)b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+    else {
+        const struct sockaddr_in6* a6 = (const struct sockaddr_in6*)a;
+        const struct sockaddr_in6* b6 = (const struct sockaddr_in6*)b;
+        return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    }
+}
+
+static void decode_status(const chrony_rep* rep, struct riaps_ts_node_status* status)
+{
+    const struct riaps_ts_tracking* trk = &status->tracking;
+
+    riaps_ts_decode_tracking(rep, &status->tracking);
+    status->valid = 1;
+    status->error = 0;
+    status->synchronized = trk->leap_status != RIAPS_TS_LEAP_UNSYNC;
+    status->offset = -trk->current_correction;
+    status->error_bound = trk->root_delay / 2.0 + trk->root_dispersion;
+}
+
+/* Process the queued replies of a socket, returns the number of nodes completed */
+static int receive_replies(riaps_ts_cluster* cluster, int sock, struct riaps_ts_node_status* status)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    chrony_rep rep;
+    int completed = 0;
+
+    for (;;) {
+        struct cluster_node* node;
+        uint32_t index;
+        int len;
+
+        addr_len = sizeof(addr);
+        len = recvfrom(sock, &rep, sizeof(rep), MSG_DONTWAIT, (struct sockaddr*)&addr, &addr_len);
+        if (len < 0) {
+            return completed;
+        }
+        index = ntohl(rep.sequence) - cluster->seq;
+        if (len < REP_HEADER_LENGTH || rep.version != PROTO_VERSION_NUMBER || rep.pkt_type != PKT_TYPE_CMD_REPLY ||
+            rep.command != htons(REQ_TRACKING) || index >= cluster->n_nodes) {
+            continue;
+        }
+        node = &cluster->nodes[index];
+        if (!node->pending || !same_address(&node->addr, &addr)) {
+            continue;
+        }
+
+        if (ntohs(rep.status) != STT_SUCCESS) {
+            status[index].error = ntohs(rep.status) == STT_UNAUTH ? EACCES : EPROTO;
+        }
+        else if (len < REP_LENGTH(tracking) || ntohs(rep.reply) != RPY_TRACKING) {
+            status[index].error = EPROTO;
+        }
+        else {
+            decode_status(&rep, &status[index]);
+            status[index].rtt = (riaps_ts_monotonic_us() - node->sent_us) * 1e-6;
+        }
+        node->pending = 0;
+        completed++;
+    }
+}
+
+
+int riaps_ts_cluster_query(riaps_ts_cluster* cluster, struct riaps_ts_node_status* status)
+{
+    struct epoll_event events[CLUSTER_MAX_EVENTS];
+    int64_t start;
+    int pending, answered;
+    int i;
+
+    if (!cluster || !status) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* A new range of sequence numbers for every round */
+    cluster->seq += cluster->n_nodes;
+    start = riaps_ts_monotonic_us();
+    for (i = 0; i < cluster->n_nodes; i++) {
+        struct cluster_node* node = &cluster->nodes[i];
+
+        memset(&status[i], 0, sizeof(status[i]));
+        status[i].error = ETIMEDOUT;
+        node->pending = 1;
+        node->attempt = 0;
+        node->deadline_us = start + (int64_t)cluster->timeout_ms * 1000;
+        node->next_us = start;
+    }
+
+    pending = cluster->n_nodes;
+    while (pending > 0) {
+        int64_t now = riaps_ts_monotonic_us();
+        int64_t wake = INT64_MAX;
+        int timeout_ms;
+        int n;
+
+        /* Deadlines and (re)transmissions */
+        for (i = 0; i < cluster->n_nodes; i++) {
+            struct cluster_node* node = &cluster->nodes[i];
+
+            if (!node->pending) {
+                continue;
+            }
+            if (now >= node->deadline_us) {
+                node->pending = 0;
+                pending--;
+                continue;
+            }
+            if (now >= node->next_us) {
+                send_request(cluster, i, &status[i], now);
+            }
+            wake = node->next_us < wake ? node->next_us : wake;
+        }
+        if (pending == 0) {
+            break;
+        }
+
+        timeout_ms = (wake - riaps_ts_monotonic_us() + 999) / 1000;
+        n = epoll_wait(cluster->epoll_fd, events, CLUSTER_MAX_EVENTS, timeout_ms > 0 ? timeout_ms : 0);
+        if (n < 0 && errno != EINTR) {
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            pending -= receive_replies(cluster, events[i].data.fd, status);
+        }
+    }
+
+    for (i = 0, answered = 0; i < cluster->n_nodes; i++) {
+        answered += status[i].valid;
+    }
+    return answered;
+}
+
+
+/* Interval of the offset of a node's clock from the true time (like riaps_ts_gettime_bounded()) */
+static void offset_interval(const struct riaps_ts_node_status* s, double* lo, double* hi)
+{
+    /* The correction still being slewed out may have been applied any part */
+    *lo = (s->offset < 0.0 ? s->offset : 0.0) - s->error_bound;
+    *hi = (s->offset > 0.0 ? s->offset : 0.0) + s->error_bound;
+}
+
+
+double riaps_ts_node_pair_bound(const struct riaps_ts_node_status* a, const struct riaps_ts_node_status* b)
+{
+    double lo_a, hi_a, lo_b, hi_b;
+
+    if (!a || !b || !a->valid || !b->valid || !a->synchronized || !b->synchronized) {
+        return INFINITY;
+    }
+    offset_interval(a, &lo_a, &hi_a);
+    offset_interval(b, &lo_b, &hi_b);
+    return hi_a - lo_b > hi_b - lo_a ? hi_a - lo_b : hi_b - lo_a;
+}
+
+
+int riaps_ts_cluster_bound(const struct riaps_ts_node_status* status, int n_nodes,
+                           struct riaps_ts_cluster_bound* bound)
+{
+    /* The two largest upper and the two smallest lower ends (the pair must be of different nodes) */
+    double hi[2] = {-INFINITY, -INFINITY}, lo[2] = {INFINITY, INFINITY};
+    int hi_node[2] = {-1, -1}, lo_node[2] = {-1, -1};
+    double min_offset = INFINITY, max_offset = -INFINITY;
+    int i;
+
+    if (!status || !bound || n_nodes < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(bound, 0, sizeof(*bound));
+    bound->ahead = bound->behind = -1;
+    for (i = 0; i < n_nodes; i++) {
+        const struct riaps_ts_node_status* s = &status[i];
+        double l, h;
+
+        if (!s->valid || !s->synchronized) {
+            continue;
+        }
+        bound->n_nodes++;
+        offset_interval(s, &l, &h);
+        if (h > hi[0]) {
+            hi[1] = hi[0];
+            hi_node[1] = hi_node[0];
+            hi[0] = h;
+            hi_node[0] = i;
+        }
+        else if (h > hi[1]) {
+            hi[1] = h;
+            hi_node[1] = i;
+        }
+        if (l < lo[0]) {
+            lo[1] = lo[0];
+            lo_node[1] = lo_node[0];
+            lo[0] = l;
+            lo_node[0] = i;
+        }
+        else if (l < lo[1]) {
+            lo[1] = l;
+            lo_node[1] = i;
+        }
+        min_offset = s->offset < min_offset ? s->offset : min_offset;
+        max_offset = s->offset > max_offset ? s->offset : max_offset;
+    }
+    if (bound->n_nodes < 2) {
+        return 0;
+    }
+
+    bound->max_offset = max_offset - min_offset;
+    if (hi_node[0] != lo_node[0]) {
+        bound->ahead = hi_node[0];
+        bound->behind = lo_node[0];
+    }
+    else if (hi[0] - lo[1] >= hi[1] - lo[0]) {
+        bound->ahead = hi_node[0];
+        bound->behind = lo_node[1];
+    }
+    else {
+        bound->ahead = hi_node[1];
+        bound->behind = lo_node[0];
+    }
+    offset_interval(&status[bound->ahead], &lo[0], &hi[0]);
+    offset_interval(&status[bound->behind], &lo[1], &hi[1]);
+    bound->max_bound = hi[0] - lo[1];
+    return 0;
+}
@@ -0,0 +1,133 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_CLUSTER_H_
+#define _RIAPS_TS_CLUSTER_H_
+
+
+/**
+ * @file riaps_ts_cluster.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Cluster-wide synchronization quality.
+ *
+ * A collector queries the tracking information of many nodes at once over chrony's
+ * command protocol (UDP, the nodes need @c cmdallow / @c bindcmdaddress for the
+ * collector). Every node gets one non-blocking request (retransmitted with backoff)
+ * from a single epoll loop, and a node is given up at its own deadline, so a round
+ * takes at most the timeout regardless of the number of nodes.
+ *
+ * The offset of a node's clock from the true time is bounded by chrony's error
+ * estimates (like riaps_ts_gettime_bounded()), so the disagreement of the clocks of
+ * any two nodes is bounded by the sum of their offsets and error budgets.
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_CLUSTER_TIMEOUT_MS 200         /**< Default deadline of a node in a round */
+#define RIAPS_TS_CLUSTER_ATTEMPT_TIMEOUT_US 2000 /**< Reply timeout of the first attempt, doubled for every retransmission */
+#define RIAPS_TS_CLUSTER_MAX_ATTEMPT_TIMEOUT_US 64000 /**< Upper limit of the per-attempt reply timeout */
+
+/**
+ * @brief Collector of the synchronization status of a set of nodes
+ */
+typedef struct riaps_ts_cluster riaps_ts_cluster;
+
+/**
+ * @brief Status of a node in a round
+ */
+struct riaps_ts_node_status {
+    int valid;                      /**< The tracking information has been received */
+    int error;                      /**< errno of a failed query (ETIMEDOUT: no reply, EACCES: refused by chrony) */
+    int synchronized;               /**< The node is synchronized (the bounds are valid) */
+    struct riaps_ts_tracking tracking;  /**< The tracking information of the node (query_time is local) */
+    double offset;                  /**< Estimated offset of the node's clock from the true time (secs, positive: ahead) */
+    double error_bound;             /**< Error budget of the estimated offset (secs) */
+    double rtt;                     /**< Round-trip time of the query (secs) */
+};
+
+/**
+ * @brief Cluster-wide bounds of the clock disagreement
+ */
+struct riaps_ts_cluster_bound {
+    int n_nodes;                    /**< Number of synchronized nodes in the bound */
+    double max_offset;              /**< Largest difference of the estimated offsets of two nodes (secs) */
+    double max_bound;               /**< Upper bound of the clock difference of any two nodes (secs) */
+    int ahead;                      /**< Node index of the bound: clock[ahead] - clock[behind] <= max_bound */
+    int behind;                     /**< Node index of the bound (-1 if there are less than two nodes) */
+};
+
+/**
+ * @brief Create a collector.
+ *
+ * The addresses are resolved once, at creation.
+ *
+ * @param endpoints The "host[:port]" UDP endpoints of the nodes' chrony (port 323 by default)
+ * @param n_nodes Number of nodes
+ * @return The collector or NULL on failure (@c errno is EHOSTUNREACH, if an endpoint can not be resolved).
+ */
+riaps_ts_cluster* riaps_ts_cluster_create(const char* const* endpoints, int n_nodes);
+
+/**
+ * @brief Destroy a collector.
+ *
+ * @param cluster The collector
+ */
+void riaps_ts_cluster_destroy(riaps_ts_cluster* cluster);
+
+/**
+ * @brief Set the deadline of the nodes in a round.
+ *
+ * @param cluster The collector
+ * @param timeout_ms The deadline in milliseconds (0 for @c RIAPS_TS_CLUSTER_TIMEOUT_MS)
+ * @return Zero, if the timeout is valid.
+ */
+int riaps_ts_cluster_set_timeout(riaps_ts_cluster* cluster, int timeout_ms);
+
+/**
+ * @brief Query all the nodes (a round).
+ *
+ * @param cluster The collector
+ * @param status Pre-allocated array to receive the status of every node (in the order of the endpoints)
+ * @return The number of nodes answered or -1 on failure.
+ */
+int riaps_ts_cluster_query(riaps_ts_cluster* cluster, struct riaps_ts_node_status* status);
+
+/**
+ * @brief Upper bound of the clock difference of two nodes (secs).
+ *
+ * @param a Status of a synchronized node
+ * @param b Status of another synchronized node
+ * @return The bound of |clock(a) - clock(b)| or INFINITY, if either node is not synchronized.
+ */
+double riaps_ts_node_pair_bound(const struct riaps_ts_node_status* a, const struct riaps_ts_node_status* b);
+
+/**
+ * @brief Compute the cluster-wide bounds from the status of the nodes (in linear time).
+ *
+ * @param status The status of the nodes @see riaps_ts_cluster_query()
+ * @param n_nodes Number of nodes
+ * @param bound Pre-allocated buffer to receive the bounds
+ * @return Zero on success.
+ */
+int riaps_ts_cluster_bound(const struct riaps_ts_node_status* status, int n_nodes,
+                           struct riaps_ts_cluster_bound* bound);
+
+#endif /* _RIAPS_TS_CLUSTER_H_ */
@@ -0,0 +1,201 @@
+/*
+    RIAPS Timesync Service - cluster sync-quality collector
+
+    Queries the tracking information of the chrony of many nodes at once
+    (see riaps_ts_cluster.h) and reports the status of every node and the
+    cluster-wide bounds of the clock disagreement, once or periodically.
+
+    The nodes are given on the command line and/or in a file (one
+    "host[:port]" per line, '#' starts a comment).
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "riaps_ts_cluster.h"
+
+static volatile sig_atomic_t running = 1;
+
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+
+/* Append the endpoints of a file to the list, returns the new number of nodes or -1 */
+static int read_nodes(const char* path, char*** nodes, int n_nodes)
+{
+    char line[256];
+    FILE* f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char* node = line + strspn(line, " \t");
+        char** grown;
+
+        node[strcspn(node, "# \t\r\n")] = '\0';
+        if (!*node) {
+            continue;
+        }
+        grown = realloc(*nodes, (n_nodes + 1) * sizeof(char*));
+        if (!grown || !(grown[n_nodes] = strdup(node))) {
+            perror("ERROR: read_nodes()");
+            free(grown);
+            fclose(f);
+            return -1;
+        }
+        *nodes = grown;
+        n_nodes++;
+    }
+    fclose(f);
+    return n_nodes;
+}
+
+
+static void print_round(char** nodes, const struct riaps_ts_node_status* status, int n_nodes,
+                        int answered, double elapsed, int summary_only)
+{
+    struct riaps_ts_cluster_bound bound;
+    int i;
+
+    if (!summary_only) {
+        printf("%-32s %-7s %12s %12s %12s %10s %s\n", "node", "stratum", "offset[us]", "error[us]",
+               "freq[ppm]", "rtt[us]", "state");
+        for (i = 0; i < n_nodes; i++) {
+            const struct riaps_ts_node_status* s = &status[i];
+
+            if (!s->valid) {
+                printf("%-32s %-7s %12s %12s %12s %10s %s\n", nodes[i], "-", "-", "-", "-", "-",
+                       strerror(s->error));
+                continue;
+            }
+            printf("%-32s %-7d %12.3f %12.3f %12.3f %10.1f %s\n", nodes[i], s->tracking.stratum,
+                   s->offset * 1e6, s->error_bound * 1e6, s->tracking.status.ppm, s->rtt * 1e6,
+                   s->synchronized ? "synchronized" : "unsynchronized");
+        }
+    }
+
+    riaps_ts_cluster_bound(status, n_nodes, &bound);
+    printf("%d/%d nodes answered in %.1f ms, %d synchronized", answered, n_nodes, elapsed * 1e3,
+           bound.n_nodes);
+    if (bound.n_nodes >= 2) {
+        printf(", max offset %.3f us, max bound %.3f us (%s - %s)", bound.max_offset * 1e6,
+               bound.max_bound * 1e6, nodes[bound.ahead], nodes[bound.behind]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-t timeout_ms] [-i interval_ms] [-s] [-f nodes_file] [host[:port] ...]\n",
+            prog);
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct riaps_ts_node_status* status;
+    riaps_ts_cluster* cluster;
+    char** nodes = NULL;
+    int n_nodes = 0;
+    int timeout_ms = RIAPS_TS_CLUSTER_TIMEOUT_MS;
+    int interval_ms = 0;
+    int summary_only = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:i:sf:h")) != -1) {
+        switch (opt) {
+        case 't':
+            timeout_ms = atoi(optarg);
+            if (timeout_ms <= 0) {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 's':
+            summary_only = 1;
+            break;
+        case 'f':
+            n_nodes = read_nodes(optarg, &nodes, n_nodes);
+            if (n_nodes < 0) {
+                exit(-1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+    for (; optind < argc; optind++) {
+        char** grown = realloc(nodes, (n_nodes + 1) * sizeof(char*));
+        if (!grown) {
+            perror("ERROR: realloc()");
+            exit(-1);
+        }
+        nodes = grown;
+        nodes[n_nodes++] = argv[optind];
+    }
+    if (n_nodes == 0) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    cluster = riaps_ts_cluster_create((const char* const*)nodes, n_nodes);
+    status = calloc(n_nodes, sizeof(struct riaps_ts_node_status));
+    if (!cluster || !status) {
+        perror("ERROR: riaps_ts_cluster_create()");
+        exit(-1);
+    }
+    riaps_ts_cluster_set_timeout(cluster, timeout_ms);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    while (running) {
+        struct timespec start, end;
+        int answered;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        answered = riaps_ts_cluster_query(cluster, status);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (answered < 0) {
+            perror("ERROR: riaps_ts_cluster_query()");
+            break;
+        }
+        print_round(nodes, status, n_nodes, answered,
+                    (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec), summary_only);
+        if (interval_ms <= 0) {
+            break;
+        }
+
+        /* Rounds start on the interval grid */
+        start.tv_sec += interval_ms / 1000;
+        start.tv_nsec += (interval_ms % 1000) * 1000000L;
+        if (start.tv_nsec >= 1000000000L) {
+            start.tv_sec++;
+            start.tv_nsec -= 1000000000L;
+        }
+        while (running && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start, NULL) == EINTR) {
+        }
+    }
+
+    riaps_ts_cluster_destroy(cluster);
+    free(status);
+    return 0;
+}
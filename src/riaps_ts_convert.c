@@ -0,0 +1,362 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_convert.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Conversion of foreign timestamps into the synchronized time (implementation).
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riaps_ts_convert.h"
+#include "riaps_ts_util.h"
+
+#define CONVERT_LANES 4
+#define CONVERT_RANGE_NS (1LL << 50)        /* The SIMD kernel is exact within this distance from a pair */
+#define CONVERT_MAGIC 6755399441055744.0    /* 1.5 * 2^52: integers below 2^51 are exact in its mantissa */
+#define CONVERT_MAGIC_BITS 0x4338000000000000LL
+
+typedef int64_t v4i64 __attribute__((vector_size(CONVERT_LANES * sizeof(int64_t))));
+typedef double v4f64 __attribute__((vector_size(CONVERT_LANES * sizeof(double))));
+
+/* A pair of readings and the segment of the mapping starting at it */
+struct pair {
+    int64_t foreign_ns;
+    int64_t sync_ns;
+    int64_t uncertainty_ns;
+    double rate;                    /* d(sync) / d(foreign) - 1 up to the next pair */
+};
+
+/* A segment of the mapping, valid for the foreign times in [lo, hi) */
+struct segment {
+    int64_t foreign_ns;
+    int64_t sync_ns;
+    double rate;
+    int64_t lo;
+    int64_t hi;
+};
+
+struct riaps_ts_clockmap {
+    clockid_t clock_id;
+    riaps_ts_phc* phc;              /* Cross-timestamped, if not NULL */
+    pthread_rwlock_t lock;
+    struct pair* pairs;             /* Ring of the pairs */
+    int capacity;
+    int head;                       /* Index of the oldest pair */
+    int n_pairs;
+    unsigned long steps;
+};
+
+
+static riaps_ts_clockmap* create_map(clockid_t clock_id, riaps_ts_phc* phc, int capacity)
+{
+    riaps_ts_clockmap* map;
+
+    if (capacity < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    map = calloc(1, sizeof(riaps_ts_clockmap));
+    if (!map) {
+        return NULL;
+    }
+    map->capacity = capacity ? capacity : RIAPS_TS_CLOCKMAP_CAPACITY;
+    map->pairs = calloc(map->capacity, sizeof(struct pair));
+    if (!map->pairs) {
+        free(map);
+        return NULL;
+    }
+    map->clock_id = clock_id;
+    map->phc = phc;
+    pthread_rwlock_init(&map->lock, NULL);
+    return map;
+}
+
+
+riaps_ts_clockmap* riaps_ts_clockmap_create(clockid_t clock_id, int capacity)
+{
+    struct timespec tp;
+
+    if (clock_gettime(clock_id, &tp)) {
+        return NULL;
+    }
+    return create_map(clock_id, NULL, capacity);
+}
+
+
+riaps_ts_clockmap* riaps_ts_clockmap_create_phc(riaps_ts_phc* phc, int capacity)
+{
+    if (!phc) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return create_map(riaps_ts_phc_clockid(phc), phc, capacity);
+}
+
+
+void riaps_ts_clockmap_destroy(riaps_ts_clockmap* map)
+{
+    if (map) {
+        pthread_rwlock_destroy(&map->lock);
+        free(map->pairs);
+        free(map);
+    }
+}
+
+
+static inline const struct pair* pair_at(const riaps_ts_clockmap* map, int i)
+{
+    return &map->pairs[(map->head + i) % map->capacity];
+}
+
+
+int riaps_ts_clockmap_add(riaps_ts_clockmap* map, int64_t foreign_ns, int64_t sync_ns, int64_t uncertainty_ns)
+{
+    struct pair* pair;
+
+    if (!map) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&map->lock);
+    if (map->n_pairs > 0) {
+        struct pair* last = (struct pair*)pair_at(map, map->n_pairs - 1);
+        double rate;
+
+        if (foreign_ns <= last->foreign_ns) {
+            pthread_rwlock_unlock(&map->lock);
+            errno = EINVAL;
+            return -1;
+        }
+        /* A step keeps the previous rate up to the new pair, where the mapping jumps */
+        rate = (double)(sync_ns - last->sync_ns) / (double)(foreign_ns - last->foreign_ns) - 1.0;
+        if (fabs(rate) > RIAPS_TS_CLOCKMAP_MAX_RATE) {
+            map->steps++;
+        }
+        else {
+            last->rate = rate;
+        }
+    }
+    if (map->n_pairs == map->capacity) {
+        map->head = (map->head + 1) % map->capacity;
+        map->n_pairs--;
+    }
+
+    pair = (struct pair*)pair_at(map, map->n_pairs);
+    pair->rate = map->n_pairs > 0 ? pair_at(map, map->n_pairs - 1)->rate : 0.0;
+    pair->foreign_ns = foreign_ns;
+    pair->sync_ns = sync_ns;
+    pair->uncertainty_ns = uncertainty_ns;
+    map->n_pairs++;
+    pthread_rwlock_unlock(&map->lock);
+    return 0;
+}
+
+
+int riaps_ts_clockmap_sample(riaps_ts_clockmap* map)
+{
+    int64_t foreign_ns, sync_ns, window;
+    int i;
+
+    if (!map) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (map->phc) {
+        struct riaps_ts_phc_sample sample;
+
+        if (riaps_ts_phc_sample(map->phc, &sample)) {
+            return -1;
+        }
+        foreign_ns = riaps_ts_ns_of_timespec(&sample.phc);
+        sync_ns = riaps_ts_ns_of_timespec(&sample.sys);
+        window = 2 * sample.uncertainty;
+    }
+    else {
+        /* The foreign clock read in the tightest bracket of the synchronized clock */
+        window = -1;
+        for (i = 0; i < RIAPS_TS_CLOCKMAP_PAIR_READS; i++) {
+            int64_t before = riaps_ts_clock_ns(CLOCK_REALTIME);
+            int64_t foreign = riaps_ts_clock_ns(map->clock_id);
+            int64_t after = riaps_ts_clock_ns(CLOCK_REALTIME);
+
+            if (window < 0 || after - before < window) {
+                window = after - before;
+                foreign_ns = foreign;
+                sync_ns = before + window / 2;
+            }
+        }
+    }
+    return riaps_ts_clockmap_add(map, foreign_ns, sync_ns, window / 2);
+}
+
+
+/* The segment of a foreign time (the map is not empty) */
+static void find_segment(const riaps_ts_clockmap* map, int64_t t, struct segment* seg)
+{
+    const struct pair* pair;
+    int lo = 0, hi = map->n_pairs - 1;
+
+    /* The latest pair not later than t (or the oldest one) */
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (pair_at(map, mid)->foreign_ns <= t) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    pair = pair_at(map, lo);
+    seg->foreign_ns = pair->foreign_ns;
+    seg->sync_ns = pair->sync_ns;
+    seg->rate = pair->rate;
+    seg->lo = lo == 0 ? INT64_MIN : pair->foreign_ns;
+    seg->hi = lo == map->n_pairs - 1 ? INT64_MAX : pair_at(map, lo + 1)->foreign_ns;
+
+    /* The SIMD kernel is used within its exact range only */
+    if (seg->lo < pair->foreign_ns - CONVERT_RANGE_NS) {
+        seg->lo = pair->foreign_ns - CONVERT_RANGE_NS;
+    }
+    if (seg->hi > pair->foreign_ns + CONVERT_RANGE_NS) {
+        seg->hi = pair->foreign_ns + CONVERT_RANGE_NS;
+    }
+}
+
+static inline int64_t convert_one(const struct segment* seg, int64_t t)
+{
+    int64_t d = t - seg->foreign_ns;
+    return seg->sync_ns + d + llrint((double)d * seg->rate);
+}
+
+/* Same as convert_one() for four timestamps of the segment (within CONVERT_RANGE_NS) */
+static inline void convert_lanes(const struct segment* seg, const int64_t* foreign_ns, int64_t* sync_ns)
+{
+    v4i64 t, d;
+    v4f64 dd, correction;
+
+    memcpy(&t, foreign_ns, sizeof(t));
+    d = t - seg->foreign_ns;
+    dd = (v4f64)(d + CONVERT_MAGIC_BITS) - CONVERT_MAGIC;
+    /* The product must be rounded before the addition (built with -ffp-contract=off, no FMA) */
+    correction = dd * seg->rate + CONVERT_MAGIC;
+    t = seg->sync_ns + d + ((v4i64)correction - CONVERT_MAGIC_BITS);
+    memcpy(sync_ns, &t, sizeof(t));
+}
+
+
+int riaps_ts_clockmap_convert(riaps_ts_clockmap* map, const int64_t* foreign_ns, int64_t* sync_ns, size_t n)
+{
+    struct segment seg = {0, 0, 0.0, 0, 0};
+    size_t k = 0;
+
+    if (!map || (n && (!foreign_ns || !sync_ns))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&map->lock);
+    if (map->n_pairs == 0) {
+        pthread_rwlock_unlock(&map->lock);
+        errno = ENODATA;
+        return -1;
+    }
+
+    while (k < n) {
+        v4i64 t, in_segment;
+        int i;
+
+        if (k + CONVERT_LANES <= n) {
+            memcpy(&t, foreign_ns + k, sizeof(t));
+            in_segment = (t >= seg.lo) & (t < seg.hi);
+            if (in_segment[0] & in_segment[1] & in_segment[2] & in_segment[3]) {
+                convert_lanes(&seg, foreign_ns + k, sync_ns + k);
+                k += CONVERT_LANES;
+                continue;
+            }
+        }
+
+        /* Crossing a segment boundary (or the tail) */
+        for (i = 0; i < CONVERT_LANES && k < n; i++, k++) {
+            int64_t ts = foreign_ns[k];
+            if (ts < seg.lo || ts >= seg.hi) {
+                find_segment(map, ts, &seg);
+            }
+            sync_ns[k] = convert_one(&seg, ts);
+        }
+    }
+    pthread_rwlock_unlock(&map->lock);
+    return 0;
+}
+
+
+int riaps_ts_clockmap_convert_timespec(riaps_ts_clockmap* map, const struct riaps_ts_timespec* foreign,
+                                       struct riaps_ts_timespec* sync)
+{
+    int64_t foreign_ns, sync_ns;
+
+    if (!foreign || !sync) {
+        errno = EINVAL;
+        return -1;
+    }
+    foreign_ns = riaps_ts_ns_of_timespec(foreign);
+    if (riaps_ts_clockmap_convert(map, &foreign_ns, &sync_ns, 1)) {
+        return -1;
+    }
+    riaps_ts_timespec_of_ns(sync_ns, sync);
+    return 0;
+}
+
+
+int riaps_ts_clockmap_info(riaps_ts_clockmap* map, struct riaps_ts_clockmap_info* info)
+{
+    int i;
+
+    if (!map || !info) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    pthread_rwlock_rdlock(&map->lock);
+    info->n_pairs = map->n_pairs;
+    info->steps = map->steps;
+    if (map->n_pairs > 0) {
+        const struct pair* last = pair_at(map, map->n_pairs - 1);
+
+        riaps_ts_timespec_of_ns(pair_at(map, 0)->foreign_ns, &info->first);
+        riaps_ts_timespec_of_ns(last->foreign_ns, &info->last);
+        info->rate_ppm = last->rate * 1e6;
+        info->uncertainty = last->uncertainty_ns * 1e-9;
+        for (i = 0; i < map->n_pairs; i++) {
+            double uncertainty = pair_at(map, i)->uncertainty_ns * 1e-9;
+            info->max_uncertainty = uncertainty > info->max_uncertainty ? uncertainty : info->max_uncertainty;
+        }
+    }
+    pthread_rwlock_unlock(&map->lock);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_CONVERT_H_
+#define _RIAPS_TS_CONVERT_H_
+
+
+/**
+ * @file riaps_ts_convert.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Conversion of foreign timestamps into the synchronized time.
+ *
+ * Sensor drivers and @c SO_TIMESTAMPING sockets timestamp with CLOCK_MONOTONIC,
+ * CLOCK_BOOTTIME or the PTP hardware clock of the NIC. A clock map keeps a history
+ * of paired readings of such a (foreign) clock and the synchronized clock, taken as
+ * tightly bracketed reads (or hardware cross-timestamps for a PHC), and converts
+ * foreign timestamps through the piecewise-linear mapping between the pairs. So a
+ * timestamp is converted with the mapping valid when it was taken, even if the
+ * synchronized clock has been slewed or stepped since.
+ *
+ * Whole arrays are converted in one call, the timestamps falling into the same
+ * segment of the mapping are processed by a SIMD kernel (four at a time).
+ * The map is sampled by the application (e.g. from a periodic timer, once per
+ * second), conversions may run concurrently with the sampling.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "riaps_ts.h"
+#include "riaps_ts_phc.h"
+
+#define RIAPS_TS_CLOCKMAP_CAPACITY 4096     /**< Default number of pairs kept (> 1 hour at 1 s) */
+#define RIAPS_TS_CLOCKMAP_PAIR_READS 5      /**< Bracketed reads per pair (the tightest one is kept) */
+#define RIAPS_TS_CLOCKMAP_MAX_RATE 0.1      /**< Segments with a larger rate difference are clock steps */
+
+/**
+ * @brief History of the mapping of a foreign clock to the synchronized time
+ */
+typedef struct riaps_ts_clockmap riaps_ts_clockmap;
+
+/**
+ * @brief State of a clock map
+ */
+struct riaps_ts_clockmap_info {
+    int n_pairs;                        /**< Number of pairs in the history */
+    struct riaps_ts_timespec first;     /**< Foreign time of the oldest pair */
+    struct riaps_ts_timespec last;      /**< Foreign time of the latest pair */
+    double rate_ppm;                    /**< Rate of the synchronized clock relative to the foreign one (latest segment) */
+    double uncertainty;                 /**< Half width of the bracket of the latest pair (secs) */
+    double max_uncertainty;             /**< Largest bracket half width in the history (secs) */
+    unsigned long steps;                /**< Number of clock steps in the history */
+};
+
+/**
+ * @brief Create a clock map for a POSIX clock.
+ *
+ * @param clock_id The foreign clock (e.g. CLOCK_MONOTONIC, CLOCK_BOOTTIME or the
+ *        clock id of a PHC)
+ * @param capacity Number of pairs kept (0 for @c RIAPS_TS_CLOCKMAP_CAPACITY)
+ * @return The map or NULL on failure.
+ */
+riaps_ts_clockmap* riaps_ts_clockmap_create(clockid_t clock_id, int capacity);
+
+/**
+ * @brief Create a clock map for a PTP hardware clock (NIC hardware timestamps).
+ *
+ * The pairs are taken with riaps_ts_phc_sample(), i.e. cross-timestamped by the
+ * hardware, if the driver supports it.
+ *
+ * @param phc The clock opened by riaps_ts_phc_open() (must outlive the map)
+ * @param capacity Number of pairs kept (0 for @c RIAPS_TS_CLOCKMAP_CAPACITY)
+ * @return The map or NULL on failure.
+ */
+riaps_ts_clockmap* riaps_ts_clockmap_create_phc(riaps_ts_phc* phc, int capacity);
+
+/**
+ * @brief Destroy a clock map.
+ *
+ * @param map The clock map
+ */
+void riaps_ts_clockmap_destroy(riaps_ts_clockmap* map);
+
+/**
+ * @brief Take a paired reading of the clocks and add it to the history.
+ *
+ * @param map The clock map
+ * @return Zero on success, -1 on failure.
+ */
+int riaps_ts_clockmap_sample(riaps_ts_clockmap* map);
+
+/**
+ * @brief Add a pair measured by other means (e.g. by a driver).
+ *
+ * The pairs must be added in the order of the foreign clock.
+ *
+ * @param map The clock map
+ * @param foreign_ns Foreign time (nanosecs)
+ * @param sync_ns Synchronized time at the same instant (nanosecs since the epoch)
+ * @param uncertainty_ns Uncertainty of the pairing (nanosecs)
+ * @return Zero on success, -1 on failure (@c errno is EINVAL, if the pair is not
+ *         later than the latest one).
+ */
+int riaps_ts_clockmap_add(riaps_ts_clockmap* map, int64_t foreign_ns, int64_t sync_ns, int64_t uncertainty_ns);
+
+/**
+ * @brief Convert an array of foreign timestamps into the synchronized time.
+ *
+ * Timestamps before the oldest or after the latest pair are extrapolated with the
+ * rate of the oldest or the latest segment. The arrays may be the same (in-place
+ * conversion). Sorted arrays are converted the fastest, but any order is accepted.
+ *
+ * @param map The clock map
+ * @param foreign_ns Foreign timestamps (nanosecs)
+ * @param sync_ns Pre-allocated array to receive the synchronized times (nanosecs since the epoch)
+ * @param n Number of timestamps
+ * @return Zero on success, -1 on failure (@c errno is ENODATA, if the map has no pairs yet).
+ */
+int riaps_ts_clockmap_convert(riaps_ts_clockmap* map, const int64_t* foreign_ns, int64_t* sync_ns, size_t n);
+
+/**
+ * @brief Convert a single foreign timestamp into the synchronized time.
+ *
+ * @param map The clock map
+ * @param foreign The foreign timestamp
+ * @param sync Pre-allocated buffer to receive the synchronized time
+ * @return Zero on success, -1 on failure. @see riaps_ts_clockmap_convert()
+ */
+int riaps_ts_clockmap_convert_timespec(riaps_ts_clockmap* map, const struct riaps_ts_timespec* foreign,
+                                       struct riaps_ts_timespec* sync);
+
+/**
+ * @brief Query the state of a clock map.
+ *
+ * @param map The clock map
+ * @param info Pre-allocated buffer to receive the state
+ * @return Zero on success.
+ */
+int riaps_ts_clockmap_info(riaps_ts_clockmap* map, struct riaps_ts_clockmap_info* info);
+
+#endif /* _RIAPS_TS_CONVERT_H_ */
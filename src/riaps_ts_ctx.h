@@ -0,0 +1,134 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_CTX_H_
+#define _RIAPS_TS_CTX_H_
+
+
+/**
+ * @file riaps_ts_ctx.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Client context internals.
+ *
+ * The functions in this module are not supposed to be used by application
+ * level code, but shared by the implementation modules of the riaps-timesync
+ * service.
+ */
+
+#include "riaps_ts.h"
+#include "chrony.h"
+#include "pmc.h"
+
+#define RIAPS_TS_REF_NAME_LENGTH 5  /**< Buffer size of a printable reference ID */
+#define RIAPS_TS_SOURCES_HINT 8     /**< Initial guess of the number of sources (for pipelining) */
+#define RIAPS_TS_BOUND_REFRESH_NS 1000000000LL /**< Refresh period of the cached error estimates */
+#define RIAPS_TS_BOUND_BACKOFF_MAX_NS 16000000000LL /**< Longest wait between failed refreshes of the estimates */
+#define RIAPS_TS_MAX_CLOCK_ERROR_PPM 1.0 /**< Frequency instability of the local clock (chrony's maxclockerror) */
+
+#define RIAPS_TS_ASYNC_IDLE 0       /**< No non-blocking query in progress */
+#define RIAPS_TS_ASYNC_PENDING 1    /**< Waiting for chrony's reply */
+#define RIAPS_TS_ASYNC_READY 2      /**< Result is available (e.g. from the shared memory cache) */
+#define RIAPS_TS_ASYNC_FAILED 3     /**< The query failed, the error is available */
+
+/**
+ * @brief Client context state @see riaps_ts_ctx
+ */
+struct riaps_ts_ctx {
+    chrony_client client;       /**< Connection to chrony */
+    unsigned int endpoint_gen;  /**< Generation of the default endpoint in use */
+    chrony_req req;             /**< Request buffer */
+    chrony_rep rep;             /**< Reply buffer */
+
+    /* Non-blocking queries */
+    int poll_fd;                /**< epoll set of the socket, the retransmission timer and the ready event */
+    int timer_fd;               /**< Retransmission timer */
+    int event_fd;               /**< Signals immediately available results */
+    int async_state;            /**< @see RIAPS_TS_ASYNC_IDLE */
+    int async_error;            /**< errno value of a failed query */
+    int async_attempts;         /**< Number of transmissions so far */
+    int64_t async_deadline;     /**< When the query times out (CLOCK_MONOTONIC us) */
+    struct riaps_ts_tracking async_result; /**< Result of the query (in READY state) */
+
+    int sources_hint;           /**< Number of sources at the last query @see riaps_ts_sources_r() */
+    chrony_xfer* xfers;         /**< Exchanges of the source queries (reused) */
+    int xfers_capacity;         /**< Size of the exchanges buffer */
+    unsigned char* got;         /**< Completion flags of the queried sources (reused) */
+    int got_capacity;           /**< Size of the completion flags buffer */
+
+    /* PTP status queries */
+    pmc_client pmc;             /**< Connection to ptp4l @see riaps_ts_ptp_status_r() */
+    unsigned int pmc_endpoint_gen; /**< Generation of the default ptp4l endpoint in use */
+
+    /* Bounded time queries */
+    struct riaps_ts_tracking bound_trk; /**< Cached error estimates @see riaps_ts_gettime_bounded_r() */
+    int64_t bound_refreshed;    /**< When the estimates were refreshed (CLOCK_MONOTONIC ns, 0: never) */
+    int64_t bound_next;         /**< When the next refresh is due (CLOCK_MONOTONIC ns, 0: now) */
+    int64_t bound_backoff;      /**< Wait after the last failed refresh (0: the last one succeeded) */
+
+    /* Step-aware sleeps */
+    int sleep_fd;               /**< Blocking timerfd of riaps_ts_sleep_until_r() (-1: not yet created) */
+};
+
+/**
+ * @brief Get the default context of the calling thread.
+ *
+ * @return The context (created on demand) or NULL on failure.
+ */
+riaps_ts_ctx* riaps_ts_default_ctx();
+
+/**
+ * @brief Convert a chrony reference ID to a printable name (e.g. "PPS").
+ *
+ * @param ref_id The reference ID in host byte order
+ * @param name Buffer of @c RIAPS_TS_REF_NAME_LENGTH bytes to receive the name
+ */
+void riaps_ts_ref_name(uint32_t ref_id, char* name);
+
+/**
+ * @brief Decode a tracking reply of chrony.
+ *
+ * @param rep The validated @c RPY_TRACKING reply
+ * @param trk Pre-allocated buffer to receive the tracking information.
+ */
+void riaps_ts_decode_tracking(const chrony_rep* rep, struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Get the cached tracking information of the context.
+ *
+ * The information is refreshed from chrony about once per second
+ * (@c RIAPS_TS_BOUND_REFRESH_NS), the last successful query is kept on failures.
+ * Failed refreshes are retried with exponential backoff (up to
+ * @c RIAPS_TS_BOUND_BACKOFF_MAX_NS), so the callers do not wait for chrony in
+ * between.
+ *
+ * @param ctx The context
+ * @return The cached tracking information or NULL, if chrony was never reached
+ *         (@c errno is EAGAIN until the next attempt is due).
+ */
+const struct riaps_ts_tracking* riaps_ts_cached_tracking(riaps_ts_ctx* ctx);
+
+/**
+ * @brief Release the resources of non-blocking queries. @see riaps_ts_status_begin()
+ *
+ * @param ctx The context
+ */
+void riaps_ts_async_close(riaps_ts_ctx* ctx);
+
+#endif // _RIAPS_TS_CTX_H_
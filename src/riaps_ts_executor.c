@@ -0,0 +1,704 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_executor.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Time-triggered executor for TDMA-style schedules (implementation).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "riaps_ts_executor.h"
+#include "riaps_ts_util.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+#define DEADLINE_MIN_RUNTIME_NS 1024    /* The kernel does not accept less */
+#define DEADLINE_SLACK_FACTOR 4         /* Room for the growth of the calibrated spinning */
+
+/* Scheduling attributes of a thread (struct sched_attr of sched_setattr(2)) */
+struct dl_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+struct worker {
+    riaps_ts_executor* executor;
+    int index;
+    int* slots;                     /* Indices of the slots of the worker, by offset */
+    int n_slots;
+    void* stack;                    /* Guard page and the stack */
+    size_t stack_len;
+    pthread_t thread;
+    int created;
+    int error;                      /* errno of the scheduling setup */
+};
+
+struct riaps_ts_executor {
+    int64_t hyperperiod_ns;
+    int64_t phase_ns;
+    struct riaps_ts_slot* slots;
+    int n_slots;
+    struct riaps_ts_executor_attr attr;
+    char* stats_name;
+    struct riaps_ts_executor_stats* stats;
+    struct worker workers[RIAPS_TS_EXECUTOR_MAX_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int ready;                      /* Workers done with their setup */
+    int go;                         /* 1: run, -1: abort the start */
+    _Atomic int stopping;
+};
+
+
+void riaps_ts_executor_attr_init(struct riaps_ts_executor_attr* attr)
+{
+    int i;
+
+    memset(attr, 0, sizeof(*attr));
+    attr->n_workers = 1;
+    attr->policy = SCHED_FIFO;
+    attr->priority = RIAPS_TS_EXECUTOR_PRIORITY;
+    for (i = 0; i < RIAPS_TS_EXECUTOR_MAX_WORKERS; i++) {
+        attr->cpus[i] = -1;
+    }
+    attr->stack_size = RIAPS_TS_EXECUTOR_STACK_SIZE;
+    attr->lock_memory = 1;
+    attr->max_spin_ns = RIAPS_TS_SPIN_AUTO;
+    attr->stats_name = NULL;
+}
+
+
+static int valid_attr(const struct riaps_ts_executor_attr* attr)
+{
+    int i;
+
+    if (attr->n_workers < 1 || attr->n_workers > RIAPS_TS_EXECUTOR_MAX_WORKERS) {
+        return 0;
+    }
+    if (attr->policy != SCHED_FIFO && attr->policy != SCHED_DEADLINE && attr->policy != SCHED_OTHER) {
+        return 0;
+    }
+    if (attr->policy == SCHED_FIFO && (attr->priority < sched_get_priority_min(SCHED_FIFO) ||
+                                       attr->priority > sched_get_priority_max(SCHED_FIFO))) {
+        return 0;
+    }
+    for (i = 0; i < attr->n_workers; i++) {
+        /* Deadline tasks must be allowed to run on their whole root domain */
+        if (attr->cpus[i] >= CPU_SETSIZE || (attr->cpus[i] >= 0 && attr->policy == SCHED_DEADLINE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static int compare_offsets(const void* a, const void* b, void* arg)
+{
+    const struct riaps_ts_slot* slots = arg;
+    int64_t oa = riaps_ts_ns_of_timespec(&slots[*(const int*)a].offset);
+    int64_t ob = riaps_ts_ns_of_timespec(&slots[*(const int*)b].offset);
+
+    return oa < ob ? -1 : oa > ob;
+}
+
+
+/* Map and initialize the statistics block */
+static struct riaps_ts_executor_stats* create_stats(riaps_ts_executor* executor)
+{
+    struct riaps_ts_executor_stats* stats;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = sizeof(struct riaps_ts_executor_stats) + executor->n_slots * sizeof(struct riaps_ts_slot_stats);
+    int fd;
+
+    size = (size + page - 1) / page * page;
+    if (executor->stats_name) {
+        fd = shm_open(executor->stats_name, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) {
+            return NULL;
+        }
+        if (ftruncate(fd, size)) {
+            close(fd);
+            return NULL;
+        }
+        fchmod(fd, 0644);   /* shm_open() is subject to the umask */
+        stats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    else {
+        stats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (stats == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Pre-faulted, the workers never take a page fault on it */
+    memset(stats, 0, size);
+    stats->version = RIAPS_TS_EXECUTOR_STATS_VERSION;
+    stats->size = size;
+    stats->n_slots = executor->n_slots;
+    stats->hyperperiod_ns = executor->hyperperiod_ns;
+    stats->phase_ns = executor->phase_ns;
+    atomic_thread_fence(memory_order_release);
+    stats->magic = RIAPS_TS_EXECUTOR_STATS_MAGIC;
+    return stats;
+}
+
+
+/* The schedule of the workers and the effective deadlines of the slots */
+static int setup_workers(riaps_ts_executor* executor)
+{
+    int i, j;
+
+    for (i = 0; i < executor->attr.n_workers; i++) {
+        struct worker* w = &executor->workers[i];
+
+        w->executor = executor;
+        w->index = i;
+        w->slots = calloc(executor->n_slots, sizeof(int));
+        if (!w->slots) {
+            return -1;
+        }
+        for (j = 0; j < executor->n_slots; j++) {
+            if (executor->slots[j].worker == i) {
+                w->slots[w->n_slots++] = j;
+            }
+        }
+        qsort_r(w->slots, w->n_slots, sizeof(int), compare_offsets, executor->slots);
+
+        for (j = 0; j < w->n_slots; j++) {
+            const struct riaps_ts_slot* slot = &executor->slots[w->slots[j]];
+            struct riaps_ts_slot_stats* s = &executor->stats->slots[w->slots[j]];
+            int64_t offset = riaps_ts_ns_of_timespec(&slot->offset);
+            int64_t next = riaps_ts_ns_of_timespec(&executor->slots[w->slots[(j + 1) % w->n_slots]].offset);
+
+            s->worker = i;
+            s->offset_ns = offset;
+            s->deadline_ns = riaps_ts_ns_of_timespec(&slot->deadline);
+            if (s->deadline_ns == 0) {
+                s->deadline_ns = next > offset ? next - offset : next + executor->hyperperiod_ns - offset;
+            }
+        }
+    }
+    return 0;
+}
+
+
+riaps_ts_executor* riaps_ts_executor_create(const struct riaps_ts_timespec* hyperperiod,
+                                            const struct riaps_ts_timespec* phase,
+                                            const struct riaps_ts_slot* slots, int n_slots,
+                                            const struct riaps_ts_executor_attr* attr)
+{
+    riaps_ts_executor* executor;
+    int64_t hyperperiod_ns;
+    int i;
+
+    if (!hyperperiod || !slots || n_slots <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    hyperperiod_ns = riaps_ts_ns_of_timespec(hyperperiod);
+    if (hyperperiod_ns <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    executor = calloc(1, sizeof(riaps_ts_executor));
+    if (!executor) {
+        return NULL;
+    }
+    pthread_mutex_init(&executor->lock, NULL);
+    pthread_cond_init(&executor->cond, NULL);
+    if (attr) {
+        executor->attr = *attr;
+    }
+    else {
+        riaps_ts_executor_attr_init(&executor->attr);
+    }
+    executor->attr.stats_name = NULL;
+    if (!valid_attr(&executor->attr)) {
+        errno = EINVAL;
+        goto error;
+    }
+    for (i = 0; i < n_slots; i++) {
+        int64_t offset = riaps_ts_ns_of_timespec(&slots[i].offset);
+        if (offset < 0 || offset >= hyperperiod_ns || riaps_ts_ns_of_timespec(&slots[i].deadline) < 0 ||
+            riaps_ts_ns_of_timespec(&slots[i].budget) < 0 || !slots[i].action ||
+            slots[i].worker < 0 || slots[i].worker >= executor->attr.n_workers) {
+            errno = EINVAL;
+            goto error;
+        }
+    }
+
+    executor->hyperperiod_ns = hyperperiod_ns;
+    executor->phase_ns = phase ? riaps_ts_ns_of_timespec(phase) % hyperperiod_ns : 0;
+    if (executor->phase_ns < 0) {
+        executor->phase_ns += hyperperiod_ns;
+    }
+    executor->n_slots = n_slots;
+    executor->slots = malloc(n_slots * sizeof(struct riaps_ts_slot));
+    if (!executor->slots) {
+        goto error;
+    }
+    memcpy(executor->slots, slots, n_slots * sizeof(struct riaps_ts_slot));
+    if (attr && attr->stats_name) {
+        executor->stats_name = strdup(attr->stats_name);
+        if (!executor->stats_name) {
+            goto error;
+        }
+    }
+    executor->stats = create_stats(executor);
+    if (!executor->stats || setup_workers(executor)) {
+        goto error;
+    }
+    return executor;
+
+error:
+    riaps_ts_executor_destroy(executor);
+    return NULL;
+}
+
+
+/* Pre-faulted stack with a guard page */
+static int allocate_stack(struct worker* w, size_t stack_size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (stack_size < PTHREAD_STACK_MIN) {
+        stack_size = PTHREAD_STACK_MIN;
+    }
+    stack_size = (stack_size + page - 1) / page * page;
+    w->stack_len = stack_size + page;
+    w->stack = mmap(NULL, w->stack_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (w->stack == MAP_FAILED) {
+        w->stack = NULL;
+        return -1;
+    }
+    mprotect(w->stack, page, PROT_NONE);
+    memset((char*)w->stack + page, 0, stack_size);
+    return 0;
+}
+
+
+/* Scheduling attributes of the calling worker, returns zero or an errno */
+static int apply_scheduling(struct worker* w)
+{
+    const riaps_ts_executor* executor = w->executor;
+    const struct riaps_ts_executor_attr* attr = &executor->attr;
+
+    if (attr->cpus[w->index] >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(attr->cpus[w->index], &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            return EINVAL;
+        }
+    }
+
+    if (attr->policy == SCHED_FIFO) {
+        struct sched_param param = {.sched_priority = attr->priority};
+        return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+    else if (attr->policy == SCHED_DEADLINE) {
+        /* Period: the shortest time between two releases, deadline: the shortest deadline */
+        struct dl_attr dl;
+        int64_t period = executor->hyperperiod_ns;
+        int64_t deadline = executor->hyperperiod_ns;
+        int64_t runtime = 0;
+        int i;
+
+        for (i = 0; i < w->n_slots; i++) {
+            const struct riaps_ts_slot_stats* s = &executor->stats->slots[w->slots[i]];
+            int64_t next = executor->stats->slots[w->slots[(i + 1) % w->n_slots]].offset_ns;
+            int64_t gap = next > s->offset_ns ? next - s->offset_ns : next + executor->hyperperiod_ns - s->offset_ns;
+            int64_t budget = riaps_ts_ns_of_timespec(&executor->slots[w->slots[i]].budget);
+
+            period = gap < period ? gap : period;
+            deadline = s->deadline_ns < deadline ? s->deadline_ns : deadline;
+            runtime = (budget ? budget : s->deadline_ns) > runtime ? (budget ? budget : s->deadline_ns) : runtime;
+        }
+        if (w->n_slots == 0) {
+            return 0;
+        }
+        /* The waiting ends with spinning, the runtime has to cover it too */
+        runtime += attr->max_spin_ns >= 0 ? attr->max_spin_ns : riaps_ts_sleep_slack(-1) * DEADLINE_SLACK_FACTOR;
+        deadline = deadline < period ? deadline : period;
+        runtime = runtime < deadline ? runtime : deadline;
+        runtime = runtime > DEADLINE_MIN_RUNTIME_NS ? runtime : DEADLINE_MIN_RUNTIME_NS;
+
+        memset(&dl, 0, sizeof(dl));
+        dl.size = sizeof(dl);
+        dl.sched_policy = SCHED_DEADLINE;
+        dl.sched_runtime = runtime;
+        dl.sched_deadline = deadline;
+        dl.sched_period = period;
+        if (syscall(SYS_sched_setattr, 0, &dl, 0)) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+
+/* Record an execution or a skipped release of a slot (single writer: the worker of the slot) */
+static void record(struct riaps_ts_slot_stats* s, int64_t jitter, int64_t exec, int missed, uint64_t skipped)
+{
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (skipped) {
+        s->skips += skipped;
+    }
+    else {
+        s->releases++;
+        s->misses += missed;
+        s->jitter_last_ns = jitter;
+        s->jitter_sum_ns += jitter;
+        s->jitter_max_ns = jitter > s->jitter_max_ns ? jitter : s->jitter_max_ns;
+        s->exec_last_ns = exec;
+        s->exec_sum_ns += exec;
+        s->exec_max_ns = exec > s->exec_max_ns ? exec : s->exec_max_ns;
+    }
+
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+}
+
+
+static void run_schedule(struct worker* w)
+{
+    riaps_ts_executor* executor = w->executor;
+    int64_t hyperperiod = executor->hyperperiod_ns;
+    int64_t base = atomic_load_explicit(&executor->stats->start_ns, memory_order_relaxed);
+    int64_t offset = riaps_ts_wall_offset_ns();
+    int64_t resume = 0;     /* Releases before a clock step are dropped */
+    int i;
+
+    while (!atomic_load_explicit(&executor->stopping, memory_order_relaxed)) {
+        int64_t now = riaps_ts_clock_ns(CLOCK_REALTIME);
+        int stepped = 0;
+
+        /* Whole hyperperiods missed (e.g. the clock stepped forward) */
+        if (now - base >= 2 * hyperperiod) {
+            int64_t missed = (now - base) / hyperperiod - 1;
+            for (i = 0; i < w->n_slots; i++) {
+                record(&executor->stats->slots[w->slots[i]], 0, 0, 0, missed);
+            }
+            base += missed * hyperperiod;
+        }
+
+        for (i = 0; i < w->n_slots && !atomic_load_explicit(&executor->stopping, memory_order_relaxed); i++) {
+            const struct riaps_ts_slot* slot = &executor->slots[w->slots[i]];
+            struct riaps_ts_slot_stats* s = &executor->stats->slots[w->slots[i]];
+            struct riaps_ts_timespec release_ts;
+            int64_t release = base + s->offset_ns;
+            int64_t begin, end;
+
+            if (release < resume) {
+                continue;
+            }
+            /* Also stepped while executing an action */
+            if (riaps_ts_wall_step_ns(offset)) {
+                stepped = 1;
+                break;
+            }
+            riaps_ts_timespec_of_ns(release, &release_ts);
+            now = riaps_ts_clock_ns(CLOCK_REALTIME);
+            if (now >= release + s->deadline_ns) {
+                record(s, 0, 0, 0, 1);
+                continue;
+            }
+            if (now < release) {
+                int ret;
+
+                /* Only cancelled while waiting, never in the middle of an action */
+                pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+                ret = riaps_ts_sleep_precise(RIAPS_TS_ABSTIME | RIAPS_TS_CANCEL_ON_STEP, &release_ts,
+                                             executor->attr.max_spin_ns, NULL);
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+                if (ret == ECANCELED) {
+                    stepped = 1;
+                    break;
+                }
+            }
+
+            begin = riaps_ts_clock_ns(CLOCK_REALTIME);
+            slot->action(&release_ts, slot->arg);
+            end = riaps_ts_clock_ns(CLOCK_REALTIME);
+            record(s, begin - release, end - begin, end > release + s->deadline_ns, 0);
+        }
+
+        if (stepped) {
+            /*
+             * The clock was stepped: continue with the first release after the step on
+             * the grid of the new time, instead of stalling (backward step) or counting
+             * the skipped hyperperiods as overruns (forward step)
+             */
+            offset = riaps_ts_wall_offset_ns();
+            resume = riaps_ts_clock_ns(CLOCK_REALTIME);
+            base = resume - ((resume - executor->phase_ns) % hyperperiod + hyperperiod) % hyperperiod;
+            continue;
+        }
+        base += hyperperiod;
+    }
+}
+
+
+static void* worker_main(void* arg)
+{
+    struct worker* w = arg;
+    riaps_ts_executor* executor = w->executor;
+    int go;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    w->error = apply_scheduling(w);
+
+    pthread_mutex_lock(&executor->lock);
+    executor->ready++;
+    pthread_cond_broadcast(&executor->cond);
+    while (!executor->go) {
+        pthread_cond_wait(&executor->cond, &executor->lock);
+    }
+    go = executor->go;
+    pthread_mutex_unlock(&executor->lock);
+
+    if (go > 0) {
+        run_schedule(w);
+    }
+    return NULL;
+}
+
+
+int riaps_ts_executor_start(riaps_ts_executor* executor)
+{
+    const struct riaps_ts_executor_attr* attr;
+    pthread_attr_t thread_attr;
+    int64_t now, start;
+    int created = 0;
+    int error = 0;
+    int i;
+
+    if (!executor || atomic_load_explicit(&executor->stats->running, memory_order_relaxed)) {
+        errno = EINVAL;
+        return -1;
+    }
+    attr = &executor->attr;
+    if (attr->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        return -1;
+    }
+
+    executor->ready = 0;
+    executor->go = 0;
+    atomic_store(&executor->stopping, 0);
+    for (i = 0; i < attr->n_workers && !error; i++) {
+        struct worker* w = &executor->workers[i];
+
+        if (!w->stack && allocate_stack(w, attr->stack_size)) {
+            error = errno;
+            break;
+        }
+        pthread_attr_init(&thread_attr);
+        pthread_attr_setstack(&thread_attr, (char*)w->stack + sysconf(_SC_PAGESIZE),
+                              w->stack_len - sysconf(_SC_PAGESIZE));
+        w->error = 0;
+        error = pthread_create(&w->thread, &thread_attr, worker_main, w);
+        pthread_attr_destroy(&thread_attr);
+        w->created = !error;
+        created += w->created;
+    }
+
+    /* All the workers have to be set up before the first release is chosen */
+    pthread_mutex_lock(&executor->lock);
+    while (executor->ready < created) {
+        pthread_cond_wait(&executor->cond, &executor->lock);
+    }
+    for (i = 0; i < attr->n_workers && !error; i++) {
+        error = executor->workers[i].error;
+    }
+    if (!error) {
+        now = riaps_ts_clock_ns(CLOCK_REALTIME) + RIAPS_TS_EXECUTOR_START_MARGIN_NS - executor->phase_ns;
+        start = (now / executor->hyperperiod_ns + 1) * executor->hyperperiod_ns + executor->phase_ns;
+        atomic_store(&executor->stats->start_ns, start);
+        atomic_store(&executor->stats->running, 1);
+    }
+    executor->go = error ? -1 : 1;
+    pthread_cond_broadcast(&executor->cond);
+    pthread_mutex_unlock(&executor->lock);
+
+    if (error) {
+        for (i = 0; i < attr->n_workers; i++) {
+            if (executor->workers[i].created) {
+                pthread_join(executor->workers[i].thread, NULL);
+                executor->workers[i].created = 0;
+            }
+        }
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+
+void riaps_ts_executor_stop(riaps_ts_executor* executor)
+{
+    int i;
+
+    if (!executor) {
+        return;
+    }
+    atomic_store(&executor->stopping, 1);
+    for (i = 0; i < executor->attr.n_workers; i++) {
+        struct worker* w = &executor->workers[i];
+
+        if (w->created) {
+            pthread_cancel(w->thread);
+            pthread_join(w->thread, NULL);
+            w->created = 0;
+        }
+    }
+    if (executor->stats) {
+        atomic_store(&executor->stats->running, 0);
+    }
+}
+
+
+void riaps_ts_executor_destroy(riaps_ts_executor* executor)
+{
+    int saved_errno = errno;
+    int i;
+
+    if (!executor) {
+        return;
+    }
+    riaps_ts_executor_stop(executor);
+    for (i = 0; i < RIAPS_TS_EXECUTOR_MAX_WORKERS; i++) {
+        if (executor->workers[i].stack) {
+            munmap(executor->workers[i].stack, executor->workers[i].stack_len);
+        }
+        free(executor->workers[i].slots);
+    }
+    if (executor->stats) {
+        munmap(executor->stats, executor->stats->size);
+    }
+    if (executor->stats_name) {
+        shm_unlink(executor->stats_name);
+        free(executor->stats_name);
+    }
+    pthread_cond_destroy(&executor->cond);
+    pthread_mutex_destroy(&executor->lock);
+    free(executor->slots);
+    free(executor);
+    errno = saved_errno;
+}
+
+
+const struct riaps_ts_executor_stats* riaps_ts_executor_stats(const riaps_ts_executor* executor)
+{
+    return executor ? executor->stats : NULL;
+}
+
+
+const struct riaps_ts_executor_stats* riaps_ts_executor_stats_attach(const char* name)
+{
+    struct riaps_ts_executor_stats* stats;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st)) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < sizeof(struct riaps_ts_executor_stats)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    stats = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED) {
+        return NULL;
+    }
+    if (stats->magic != RIAPS_TS_EXECUTOR_STATS_MAGIC || stats->version != RIAPS_TS_EXECUTOR_STATS_VERSION ||
+        stats->size != st.st_size ||
+        sizeof(struct riaps_ts_executor_stats) + stats->n_slots * sizeof(struct riaps_ts_slot_stats) > st.st_size) {
+        munmap(stats, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+    return stats;
+}
+
+
+void riaps_ts_executor_stats_detach(const struct riaps_ts_executor_stats* stats)
+{
+    if (stats) {
+        munmap((void*)stats, stats->size);
+    }
+}
+
+
+int riaps_ts_executor_read_slot(const struct riaps_ts_executor_stats* stats, int slot,
+                                struct riaps_ts_slot_stats* slot_stats)
+{
+    const struct riaps_ts_slot_stats* s;
+    uint32_t seq_begin, seq_end;
+    int i;
+
+    if (!stats || !slot_stats || slot < 0 || slot >= stats->n_slots) {
+        return -1;
+    }
+    s = &stats->slots[slot];
+    for (i = 0; i < RIAPS_TS_EXECUTOR_READ_RETRIES; i++) {
+        seq_begin = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq_begin & 1) {
+            continue;
+        }
+        memcpy(slot_stats, s, sizeof(*slot_stats));
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&s->seq, memory_order_relaxed);
+        if (seq_begin == seq_end) {
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,221 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_EXECUTOR_H_
+#define _RIAPS_TS_EXECUTOR_H_
+
+
+/**
+ * @file riaps_ts_executor.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Time-triggered executor for TDMA-style schedules.
+ *
+ * An executor runs a static schedule table: every slot of the table is released at
+ * a fixed offset within a hyperperiod, and the hyperperiods are aligned to the
+ * synchronized time (t = k * hyperperiod + phase, like the periodic timers), so the
+ * same slot is released at the same instant on every synchronized node. Each slot
+ * belongs to one of the worker threads of the executor, which wait for the releases
+ * with riaps_ts_sleep_precise() under a real-time policy (SCHED_FIFO or
+ * SCHED_DEADLINE), optionally pinned to a CPU, with locked memory and pre-faulted
+ * stacks.
+ *
+ * The release jitter, the execution time and the deadline misses of every slot are
+ * recorded in a statistics block, updated without locks (a sequence lock per slot,
+ * written only by the slot's worker). The block can be published as a POSIX shared
+ * memory object, so it can be read by other processes while the executor is running.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_EXECUTOR_MAX_WORKERS 16            /**< Maximum number of worker threads */
+#define RIAPS_TS_EXECUTOR_STACK_SIZE (256 * 1024)   /**< Default stack size of the workers (bytes) */
+#define RIAPS_TS_EXECUTOR_PRIORITY 80               /**< Default SCHED_FIFO priority of the workers */
+#define RIAPS_TS_EXECUTOR_START_MARGIN_NS 10000000  /**< Minimum time from the start to the first release */
+#define RIAPS_TS_EXECUTOR_STATS_MAGIC 0x52545845    /**< Statistics block identifier ("RTXE") */
+#define RIAPS_TS_EXECUTOR_STATS_VERSION 1           /**< Layout version of the statistics block */
+#define RIAPS_TS_EXECUTOR_READ_RETRIES 64           /**< Number of sequence lock read attempts before giving up */
+
+/**
+ * @brief Time-triggered executor
+ */
+typedef struct riaps_ts_executor riaps_ts_executor;
+
+/**
+ * @brief Action of a slot
+ *
+ * @param release The (synchronized) release time of the slot
+ * @param arg User argument of the slot
+ */
+typedef void (*riaps_ts_action)(const struct riaps_ts_timespec* release, void* arg);
+
+/**
+ * @brief A slot of the schedule table
+ */
+struct riaps_ts_slot {
+    struct riaps_ts_timespec offset;    /**< Release time within the hyperperiod (0 <= offset < hyperperiod) */
+    struct riaps_ts_timespec deadline;  /**< Relative deadline (zero: the next release of the same worker) */
+    struct riaps_ts_timespec budget;    /**< Worst-case execution time (SCHED_DEADLINE runtime only) */
+    int worker;                         /**< Index of the worker thread executing the slot */
+    riaps_ts_action action;             /**< The action to be executed */
+    void* arg;                          /**< User argument of the action */
+};
+
+/**
+ * @brief Scheduling attributes of the worker threads
+ */
+struct riaps_ts_executor_attr {
+    int n_workers;                  /**< Number of worker threads (1 .. RIAPS_TS_EXECUTOR_MAX_WORKERS) */
+    int policy;                     /**< SCHED_FIFO, SCHED_DEADLINE or SCHED_OTHER (no real-time priority) */
+    int priority;                   /**< SCHED_FIFO priority */
+    int cpus[RIAPS_TS_EXECUTOR_MAX_WORKERS]; /**< CPU of each worker (-1: not pinned, must be -1 for SCHED_DEADLINE) */
+    size_t stack_size;              /**< Stack size of the workers (pre-faulted) */
+    int lock_memory;                /**< Lock the memory of the process (mlockall) at start */
+    long max_spin_ns;               /**< Spinning before the releases @see riaps_ts_sleep_precise() */
+    const char* stats_name;         /**< Name of the shared memory object of the statistics (NULL: private) */
+};
+
+/**
+ * @brief Statistics of a slot (nanosecs)
+ */
+struct riaps_ts_slot_stats {
+    _Atomic uint32_t seq;           /**< Sequence lock counter (odd while an update is in progress) */
+    int32_t worker;                 /**< Worker of the slot */
+    int64_t offset_ns;              /**< Release time within the hyperperiod */
+    int64_t deadline_ns;            /**< Relative deadline */
+    uint64_t releases;              /**< Number of executions */
+    uint64_t misses;                /**< Number of executions completed after the deadline */
+    uint64_t skips;                 /**< Number of releases not executed (not started before the deadline) */
+    int64_t jitter_last_ns;         /**< Start of the last execution after the release */
+    int64_t jitter_max_ns;          /**< Largest release jitter */
+    int64_t jitter_sum_ns;          /**< Sum of the release jitters */
+    int64_t exec_last_ns;           /**< Last execution time */
+    int64_t exec_max_ns;            /**< Largest execution time */
+    int64_t exec_sum_ns;            /**< Sum of the execution times */
+} __attribute__((aligned(64)));
+
+/**
+ * @brief Layout of the statistics block
+ */
+struct riaps_ts_executor_stats {
+    uint32_t magic;                 /**< Always RIAPS_TS_EXECUTOR_STATS_MAGIC */
+    uint32_t version;               /**< Always RIAPS_TS_EXECUTOR_STATS_VERSION */
+    uint32_t size;                  /**< Size of the block (including the slots) */
+    uint32_t n_slots;               /**< Number of slots */
+    int64_t hyperperiod_ns;         /**< Length of the hyperperiod */
+    int64_t phase_ns;               /**< Phase of the hyperperiods */
+    _Atomic int64_t start_ns;       /**< Synchronized time of the first hyperperiod (0: not started) */
+    _Atomic int32_t running;        /**< Non-zero while the workers are running */
+    struct riaps_ts_slot_stats slots[]; /**< Statistics of the slots (in the order of the table) */
+};
+
+/**
+ * @brief Initialize the attributes with the defaults.
+ *
+ * One SCHED_FIFO worker at @c RIAPS_TS_EXECUTOR_PRIORITY, not pinned, locked memory,
+ * calibrated spinning and private statistics.
+ *
+ * @param attr The attributes
+ */
+void riaps_ts_executor_attr_init(struct riaps_ts_executor_attr* attr);
+
+/**
+ * @brief Create an executor (the workers are not started).
+ *
+ * @param hyperperiod Length of the hyperperiod (positive)
+ * @param phase Offset of the hyperperiods from the integer multiples of their length
+ * @param slots The schedule table (copied)
+ * @param n_slots Number of slots
+ * @param attr Scheduling attributes (NULL for the defaults)
+ * @return The executor or NULL on failure (@c errno is EINVAL for an invalid table).
+ */
+riaps_ts_executor* riaps_ts_executor_create(const struct riaps_ts_timespec* hyperperiod,
+                                            const struct riaps_ts_timespec* phase,
+                                            const struct riaps_ts_slot* slots, int n_slots,
+                                            const struct riaps_ts_executor_attr* attr);
+
+/**
+ * @brief Start the workers.
+ *
+ * The first hyperperiod starts at least @c RIAPS_TS_EXECUTOR_START_MARGIN_NS later.
+ * Fails if any of the workers could not apply its scheduling attributes (e.g. EPERM
+ * without the privilege for real-time scheduling, EBUSY if SCHED_DEADLINE admission
+ * control rejects the worker).
+ *
+ * @param executor The executor
+ * @return Zero, if all the workers are running.
+ */
+int riaps_ts_executor_start(riaps_ts_executor* executor);
+
+/**
+ * @brief Stop the workers.
+ *
+ * Running actions are completed, the workers are cancelled while waiting for a release.
+ *
+ * @param executor The executor
+ */
+void riaps_ts_executor_stop(riaps_ts_executor* executor);
+
+/**
+ * @brief Stop the workers and destroy the executor.
+ *
+ * The shared memory object of the statistics is removed.
+ *
+ * @param executor The executor
+ */
+void riaps_ts_executor_destroy(riaps_ts_executor* executor);
+
+/**
+ * @brief The statistics block of an executor.
+ *
+ * @param executor The executor
+ * @return The block (valid for the lifetime of the executor).
+ */
+const struct riaps_ts_executor_stats* riaps_ts_executor_stats(const riaps_ts_executor* executor);
+
+/**
+ * @brief Map the published statistics block of an executor (of any process).
+ *
+ * @param name Name of the shared memory object @see riaps_ts_executor_attr
+ * @return The block or NULL on failure (@c errno is EPROTO for an incompatible block).
+ */
+const struct riaps_ts_executor_stats* riaps_ts_executor_stats_attach(const char* name);
+
+/**
+ * @brief Unmap a statistics block mapped by riaps_ts_executor_stats_attach().
+ *
+ * @param stats The block
+ */
+void riaps_ts_executor_stats_detach(const struct riaps_ts_executor_stats* stats);
+
+/**
+ * @brief Read a consistent snapshot of the statistics of a slot.
+ *
+ * @param stats The statistics block
+ * @param slot Index of the slot
+ * @param slot_stats Pre-allocated buffer to receive the statistics
+ * @return Zero on success, -1 if the slot is invalid or is being updated too often.
+ */
+int riaps_ts_executor_read_slot(const struct riaps_ts_executor_stats* stats, int slot,
+                                struct riaps_ts_slot_stats* slot_stats);
+
+#endif // _RIAPS_TS_EXECUTOR_H_
@@ -0,0 +1,691 @@
+/*
+    RIAPS Timesync Service - OpenMetrics exporter
+
+    Serves the tracking information and the per-source statistics of chrony
+    (and optionally the PHC to system clock offset and the port state of ptp4l)
+    as OpenMetrics text over
+    HTTP on a local TCP port and/or a Unix domain socket.
+
+    The page is rendered into pre-allocated buffers and cached for the refresh
+    interval, so chrony is queried (in a single pipelined exchange) at most once
+    per interval regardless of the number of scrapers, and scrapes do not
+    allocate memory.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "riaps_ts.h"
+#include "riaps_ts_ctx.h"
+#include "riaps_ts_phc.h"
+#include "riaps_ts_ptp.h"
+
+#define DEFAULT_LISTEN "127.0.0.1:9327"
+#define DEFAULT_INTERVAL_MS 1000
+#define QUERY_TIMEOUT_MS 500
+#define MAX_SOURCES 64
+#define MAX_CLIENTS 16
+#define REQUEST_LENGTH 2048
+#define HEADER_RESERVE 192          /* The HTTP header is rendered right before the body */
+#define BODY_CAPACITY 65536
+#define TAIL_RESERVE 4096           /* Room for the metrics after the per-source families */
+#define CLIENT_TIMEOUT_MS 5000
+
+/* A rendered response (header and body in one contiguous block) */
+struct page {
+    char buf[HEADER_RESERVE + BODY_CAPACITY];
+    const char* data;
+    size_t len;
+    int users;                      /* Clients sending this page */
+    int64_t rendered;               /* CLOCK_MONOTONIC ms, 0: never */
+};
+
+struct client {
+    int fd;                         /* -1: free slot */
+    char req[REQUEST_LENGTH];
+    size_t req_len;
+    const char* resp;               /* NULL while reading the request */
+    size_t resp_len;
+    size_t sent;
+    struct page* page;              /* NULL for the static responses */
+    int64_t deadline;
+};
+
+struct out {
+    char* pos;
+    char* end;
+    int overflow;
+};
+
+static const char* role_str[] = {"MASTER", "SLAVE"};
+static const char* reference_str[] = {"NONE", "GPS", "NTP", "PTP"};
+static const char* mode_str[] = {"server", "peer", "refclock"};
+static const char* port_state_str[] = {"unknown", "initializing", "faulty", "disabled", "listening",
+                                       "pre_master", "master", "passive", "uncalibrated", "slave"};
+
+static const char not_found[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\n"
+    "Not Found\n";
+static const char bad_request[] =
+    "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nContent-Length: 12\r\nConnection: close\r\n\r\n"
+    "Bad Request\n";
+
+static volatile sig_atomic_t running = 1;
+
+static riaps_ts_ctx* ctx;
+static riaps_ts_phc* phc = NULL;
+static int ptp_enabled = 0;
+static struct riaps_ts_ptp_status ptp;
+static struct riaps_ts_tracking trk;
+static struct riaps_ts_source sources[MAX_SOURCES];
+static struct page pages[2];
+static int current_page = 0;
+static struct client clients[MAX_CLIENTS];
+static unsigned int interval_ms = DEFAULT_INTERVAL_MS;
+static unsigned long long query_failures = 0;
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+static int64_t now_ms()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (int64_t)tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
+
+static void out_printf(struct out* o, const char* fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (o->overflow) {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(o->pos, o->end - o->pos, fmt, ap);
+    va_end(ap);
+    if (n < 0 || n >= o->end - o->pos) {
+        o->overflow = 1;
+        return;
+    }
+    o->pos += n;
+}
+
+static void out_family(struct out* o, const char* name, const char* type, const char* help)
+{
+    out_printf(o, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/* Label value with the OpenMetrics escapes */
+static void out_label(struct out* o, const char* name, const char* value)
+{
+    out_printf(o, "%s=\"", name);
+    for (; *value && !o->overflow; value++) {
+        if (*value == '\\' || *value == '"') {
+            out_printf(o, "\\%c", *value);
+        }
+        else if (*value == '\n') {
+            out_printf(o, "\\n");
+        }
+        else {
+            out_printf(o, "%c", *value);
+        }
+    }
+    out_printf(o, "\"");
+}
+
+static void out_gauge(struct out* o, const char* name, const char* help, double value)
+{
+    out_family(o, name, "gauge", help);
+    out_printf(o, "%s %.10g\n", name, value);
+}
+
+/* Per-source metrics, one family at a time */
+enum {
+    SRC_OFFSET, SRC_ERROR, SRC_EST_OFFSET, SRC_STD_DEV, SRC_STRATUM, SRC_POLL, SRC_REACH,
+    SRC_AGE, SRC_SAMPLES, SRC_STATE, SRC_SELECTED, N_SRC_METRICS
+};
+
+static const struct {
+    const char* name;
+    const char* help;
+} source_metrics[N_SRC_METRICS] = {
+    {"riaps_ts_chrony_source_offset_seconds", "Offset of the last sample of the source"},
+    {"riaps_ts_chrony_source_error_seconds", "Error bound of the last sample of the source"},
+    {"riaps_ts_chrony_source_estimated_offset_seconds", "Estimated offset of the source"},
+    {"riaps_ts_chrony_source_std_dev_seconds", "Estimated standard deviation of the samples of the source"},
+    {"riaps_ts_chrony_source_stratum", "NTP stratum of the source"},
+    {"riaps_ts_chrony_source_poll_interval_seconds", "Polling interval of the source"},
+    {"riaps_ts_chrony_source_reachability", "Reachability register of the source (last 8 polls)"},
+    {"riaps_ts_chrony_source_last_sample_age_seconds", "Time since the last sample of the source"},
+    {"riaps_ts_chrony_source_samples", "Number of retained samples of the source"},
+    {"riaps_ts_chrony_source_state", "Selection state of the source (0: selected, 1: nonselectable, "
+                                     "2: falseticker, 3: jittery, 4: unselected, 5: selectable)"},
+    {"riaps_ts_chrony_source_selected", "The source is the current synchronization reference"},
+};
+
+static double source_value(const struct riaps_ts_source* s, int metric)
+{
+    switch (metric) {
+    case SRC_OFFSET:
+        return s->latest_meas;
+    case SRC_ERROR:
+        return s->latest_meas_err;
+    case SRC_EST_OFFSET:
+        return s->est_offset;
+    case SRC_STD_DEV:
+        return s->std_dev;
+    case SRC_STRATUM:
+        return s->stratum;
+    case SRC_POLL:
+        return ldexp(1.0, s->poll);
+    case SRC_REACH:
+        return s->reachability;
+    case SRC_AGE:
+        return s->since_sample;
+    case SRC_SAMPLES:
+        return s->n_samples;
+    case SRC_STATE:
+        return s->state;
+    default:
+        return s->state == RIAPS_TS_SRC_SELECTED;
+    }
+}
+
+static void render_body(struct out* o, int valid, int n_sources, int phc_valid,
+                        const struct riaps_ts_phc_sample* sample, int ptp_valid, double query_seconds)
+{
+    char ref_name[RIAPS_TS_REF_NAME_LENGTH];
+    char* end;
+    int truncated = 0;
+    int metric;
+    int i;
+
+    out_gauge(o, "riaps_ts_chrony_up", "chrony could be queried", valid);
+    if (valid) {
+        const struct riap_ts_status* stat = &trk.status;
+
+        riaps_ts_ref_name(trk.ref_id, ref_name);
+        out_family(o, "riaps_ts_reference", "info", "Synchronization role and timing reference of the node");
+        out_printf(o, "riaps_ts_reference_info{");
+        out_label(o, "role", role_str[stat->role]);
+        out_printf(o, ",");
+        out_label(o, "reference", reference_str[stat->reference]);
+        out_printf(o, ",");
+        out_label(o, "refid", ref_name);
+        out_printf(o, "} 1\n");
+
+        out_gauge(o, "riaps_ts_chrony_stratum", "NTP stratum of the node", trk.stratum);
+        out_gauge(o, "riaps_ts_chrony_leap_status",
+                  "Leap second status (0: normal, 1: insert, 2: delete, 3: unsynchronized)", trk.leap_status);
+        out_gauge(o, "riaps_ts_chrony_last_offset_seconds", "Last offset from the reference", stat->last_offset);
+        out_gauge(o, "riaps_ts_chrony_rms_offset_seconds", "Long-term RMS offset from the reference",
+                  stat->rms_offset);
+        out_gauge(o, "riaps_ts_chrony_frequency_ppm", "Frequency correction of the system clock", stat->ppm);
+        out_gauge(o, "riaps_ts_chrony_residual_frequency_ppm", "Residual frequency of the reference",
+                  trk.resid_freq_ppm);
+        out_gauge(o, "riaps_ts_chrony_skew_ppm", "Estimated error bound of the frequency", trk.skew_ppm);
+        out_gauge(o, "riaps_ts_chrony_root_delay_seconds", "Network path delay to the stratum-1 reference",
+                  trk.root_delay);
+        out_gauge(o, "riaps_ts_chrony_root_dispersion_seconds", "Dispersion to the stratum-1 reference",
+                  trk.root_dispersion);
+        out_gauge(o, "riaps_ts_chrony_correction_seconds", "Offset of the system clock being slewed out",
+                  trk.current_correction);
+        out_gauge(o, "riaps_ts_chrony_update_interval_seconds", "Interval between the last two clock updates",
+                  trk.last_update_interval);
+
+        if (n_sources > MAX_SOURCES) {
+            n_sources = MAX_SOURCES;
+        }
+        out_gauge(o, "riaps_ts_chrony_sources", "Number of time sources", n_sources);
+        /* Whole per-source families are dropped if they do not fit, the rest of the page is kept */
+        end = o->end;
+        o->end = end - TAIL_RESERVE > o->pos ? end - TAIL_RESERVE : o->pos;
+        for (metric = 0; metric < N_SRC_METRICS && n_sources > 0; metric++) {
+            char* family = o->pos;
+
+            out_family(o, source_metrics[metric].name, "gauge", source_metrics[metric].help);
+            for (i = 0; i < n_sources; i++) {
+                const struct riaps_ts_source* s = &sources[i];
+
+                out_printf(o, "%s{", source_metrics[metric].name);
+                out_label(o, "source", s->name);
+                out_printf(o, ",");
+                out_label(o, "mode", s->mode >= 0 && s->mode <= RIAPS_TS_SRC_MODE_REFCLOCK ? mode_str[s->mode] : "unknown");
+                out_printf(o, "} %.10g\n", source_value(s, metric));
+            }
+            if (o->overflow) {
+                o->pos = family;
+                o->overflow = 0;
+                truncated = 1;
+                break;
+            }
+        }
+        o->end = end;
+    }
+
+    if (phc) {
+        out_gauge(o, "riaps_ts_phc_up", "The PTP hardware clock could be sampled", phc_valid);
+        if (phc_valid) {
+            out_gauge(o, "riaps_ts_phc_offset_seconds", "PHC minus system time (TAI-UTC included)",
+                      sample->offset * 1e-9);
+            out_gauge(o, "riaps_ts_phc_uncertainty_seconds", "Half width of the PHC reading window",
+                      sample->uncertainty * 1e-9);
+        }
+    }
+
+    if (ptp_enabled) {
+        out_gauge(o, "riaps_ts_ptp_up", "ptp4l could be queried", ptp_valid);
+        if (ptp_valid) {
+            out_family(o, "riaps_ts_ptp_grandmaster", "info", "Grandmaster and parent port of ptp4l");
+            out_printf(o, "riaps_ts_ptp_grandmaster_info{");
+            out_label(o, "grandmaster", ptp.grandmaster);
+            out_printf(o, ",");
+            out_label(o, "parent", ptp.parent_port);
+            out_printf(o, ",");
+            out_label(o, "port_state", port_state_str[ptp.port_state <= RIAPS_TS_PTP_SLAVE ? ptp.port_state : 0]);
+            out_printf(o, "} 1\n");
+
+            out_gauge(o, "riaps_ts_ptp_port_state", "State of the most synchronized port of ptp4l "
+                      "(6: master, 8: uncalibrated, 9: slave)", ptp.port_state);
+            out_gauge(o, "riaps_ts_ptp_ports", "Number of ports of ptp4l", ptp.n_ports);
+            out_gauge(o, "riaps_ts_ptp_master_offset_seconds", "Offset of the PHC from the master",
+                      ptp.master_offset);
+            out_gauge(o, "riaps_ts_ptp_mean_path_delay_seconds", "Mean path delay to the master",
+                      ptp.mean_path_delay);
+            out_gauge(o, "riaps_ts_ptp_steps_removed", "Number of hops to the grandmaster", ptp.steps_removed);
+            out_gauge(o, "riaps_ts_ptp_gm_present", "A grandmaster is present", ptp.gm_present);
+            out_gauge(o, "riaps_ts_ptp_gm_clock_class", "Clock class of the grandmaster", ptp.gm_clock_class);
+        }
+    }
+
+    out_family(o, "riaps_ts_exporter_query_failures", "counter", "Failed chrony queries");
+    out_printf(o, "riaps_ts_exporter_query_failures_total %llu\n", query_failures);
+    out_gauge(o, "riaps_ts_exporter_query_duration_seconds", "Duration of the last chrony query", query_seconds);
+    out_gauge(o, "riaps_ts_exporter_truncated", "Per-source metrics were dropped to fit the page", truncated);
+    out_printf(o, "# EOF\n");
+}
+
+/* Query the service and render a new page */
+static void refresh(struct page* p)
+{
+    struct riaps_ts_phc_sample sample;
+    struct out o;
+    char header[HEADER_RESERVE];
+    int64_t start = now_ms();
+    int n_sources, phc_valid = 0, ptp_valid = 0;
+    int header_len;
+
+    n_sources = riaps_ts_snapshot_r(ctx, &trk, sources, MAX_SOURCES);
+    if (n_sources < 0) {
+        query_failures++;
+    }
+    if (phc) {
+        phc_valid = riaps_ts_phc_sample(phc, &sample) == 0;
+    }
+    if (ptp_enabled) {
+        ptp_valid = riaps_ts_ptp_status_r(ctx, &ptp) == 0;
+    }
+
+    o.pos = p->buf + HEADER_RESERVE;
+    o.end = p->buf + sizeof(p->buf);
+    o.overflow = 0;
+    render_body(&o, n_sources >= 0, n_sources, phc_valid, &sample, ptp_valid, (now_ms() - start) * 1e-3);
+    if (o.overflow) {
+        fprintf(stderr, "WARNING: metrics truncated\n");
+        o.pos = p->buf + HEADER_RESERVE;
+        o.overflow = 0;
+        out_printf(&o, "# EOF\n");
+    }
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n",
+                          (size_t)(o.pos - (p->buf + HEADER_RESERVE)));
+    p->data = p->buf + HEADER_RESERVE - header_len;
+    memcpy((char*)p->data, header, header_len);
+    p->len = o.pos - p->data;
+    p->rendered = now_ms();
+}
+
+/* The current page, refreshed if it is older than the interval and a buffer is free */
+static struct page* metrics_page()
+{
+    struct page* p = &pages[current_page];
+    int next;
+
+    if (p->rendered && now_ms() - p->rendered < interval_ms) {
+        return p;
+    }
+    next = pages[!current_page].users == 0 ? !current_page : current_page;
+    if (pages[next].users == 0) {
+        refresh(&pages[next]);
+        current_page = next;
+    }
+    return &pages[current_page];
+}
+
+static void close_client(struct client* c)
+{
+    if (c->page) {
+        c->page->users--;
+    }
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void respond(struct client* c)
+{
+    char* end = memmem(c->req, c->req_len, "\r\n\r\n", 4);
+    size_t path_len;
+
+    c->resp = NULL;
+    if (end && c->req_len > 4 && memcmp(c->req, "GET ", 4) == 0) {
+        path_len = strcspn(c->req + 4, " ?\r\n");
+        if (path_len == 8 && memcmp(c->req + 4, "/metrics", 8) == 0) {
+            c->page = metrics_page();
+            c->page->users++;
+            c->resp = c->page->data;
+            c->resp_len = c->page->len;
+        }
+        else {
+            c->resp = not_found;
+            c->resp_len = sizeof(not_found) - 1;
+        }
+    }
+    else if (end || c->req_len == sizeof(c->req)) {
+        c->resp = bad_request;
+        c->resp_len = sizeof(bad_request) - 1;
+    }
+    c->sent = 0;
+}
+
+static void handle_client(struct client* c, short revents)
+{
+    ssize_t n;
+
+    if (!c->resp) {
+        n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - c->req_len, 0);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                close_client(c);
+            }
+            return;
+        }
+        c->req_len += n;
+        respond(c);
+        if (!c->resp) {
+            return;
+        }
+    }
+
+    n = send(c->fd, c->resp + c->sent, c->resp_len - c->sent, MSG_NOSIGNAL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            close_client(c);
+        }
+        return;
+    }
+    c->sent += n;
+    if (c->sent == c->resp_len) {
+        shutdown(c->fd, SHUT_WR);
+        close_client(c);
+    }
+}
+
+static void accept_client(int listener)
+{
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    int i;
+
+    if (fd < 0) {
+        return;
+    }
+    for (i = 0; i < MAX_CLIENTS && clients[i].fd >= 0; i++);
+    if (i == MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    clients[i].fd = fd;
+    clients[i].req_len = 0;
+    clients[i].resp = NULL;
+    clients[i].page = NULL;
+    clients[i].deadline = now_ms() + CLIENT_TIMEOUT_MS;
+}
+
+static int listen_tcp(const char* spec)
+{
+    struct addrinfo hints = {0};
+    struct addrinfo* res;
+    char host[256];
+    const char* port = strrchr(spec, ':');
+    int one = 1;
+    int fd;
+
+    if (port) {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - spec), spec);
+        port++;
+    }
+    else {
+        strcpy(host, "127.0.0.1");
+        port = spec;
+    }
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res)) {
+        fprintf(stderr, "ERROR: invalid address: %s\n", spec);
+        return -1;
+    }
+    fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+        bind(fd, res->ai_addr, res->ai_addrlen) || listen(fd, MAX_CLIENTS)) {
+        perror("ERROR: listening on TCP");
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int listen_unix(const char* path)
+{
+    struct sockaddr_un addr = {0};
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path is too long: %s\n", path);
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, MAX_CLIENTS)) {
+        perror("ERROR: listening on the Unix domain socket");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-l [addr:]port | -l none] [-u socket_path] [-i interval_ms] "
+                    "[-P phc_device] [-T ptp4l_socket] [-e chrony_endpoint]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct pollfd pfds[2 + MAX_CLIENTS];
+    struct client* polled[2 + MAX_CLIENTS];
+    const char* tcp_spec = DEFAULT_LISTEN;
+    const char* unix_path = NULL;
+    const char* endpoint = RIAPS_TS_ENDPOINT_AUTO;
+    const char* phc_device = NULL;
+    const char* ptp_endpoint = NULL;
+    int listeners[2];
+    int n_listeners = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "l:u:i:P:T:e:h")) != -1) {
+        switch (opt) {
+        case 'l':
+            tcp_spec = strcmp(optarg, "none") ? optarg : NULL;
+            break;
+        case 'u':
+            unix_path = optarg;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            if (interval_ms == 0) {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'P':
+            phc_device = optarg;
+            break;
+        case 'T':
+            ptp_endpoint = optarg;
+            break;
+        case 'e':
+            endpoint = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+    if (!tcp_spec && !unix_path) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    ctx = riaps_ts_ctx_create(endpoint);
+    if (!ctx) {
+        perror("ERROR: riaps_ts_ctx_create()");
+        exit(-1);
+    }
+    riaps_ts_ctx_set_timeout(ctx, QUERY_TIMEOUT_MS);
+    if (ptp_endpoint) {
+        if (riaps_ts_ctx_set_ptp_endpoint(ctx, ptp_endpoint)) {
+            fprintf(stderr, "ERROR: invalid ptp4l socket: %s\n", ptp_endpoint);
+            exit(-1);
+        }
+        ptp_enabled = 1;
+    }
+    if (phc_device) {
+        phc = riaps_ts_phc_open(phc_device);
+        if (!phc) {
+            perror("ERROR: riaps_ts_phc_open()");
+            exit(-1);
+        }
+    }
+
+    if (tcp_spec) {
+        listeners[n_listeners] = listen_tcp(tcp_spec);
+        if (listeners[n_listeners++] < 0) {
+            exit(-1);
+        }
+    }
+    if (unix_path) {
+        listeners[n_listeners] = listen_unix(unix_path);
+        if (listeners[n_listeners++] < 0) {
+            exit(-1);
+        }
+    }
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+    fprintf(stderr, "serving metrics on %s%s%s (refreshed at most every %u ms)\n",
+            tcp_spec ? tcp_spec : "", tcp_spec && unix_path ? " and " : "", unix_path ? unix_path : "",
+            interval_ms);
+
+    while (running) {
+        int64_t now = now_ms();
+        int timeout = -1;
+        int n = 0;
+
+        for (i = 0; i < n_listeners; i++) {
+            pfds[n].fd = listeners[i];
+            pfds[n].events = POLLIN;
+            polled[n++] = NULL;
+        }
+        for (i = 0; i < MAX_CLIENTS; i++) {
+            struct client* c = &clients[i];
+            int left;
+
+            if (c->fd < 0) {
+                continue;
+            }
+            left = (int)(c->deadline - now);
+            if (left <= 0) {
+                close_client(c);
+                continue;
+            }
+            timeout = timeout < 0 || left < timeout ? left : timeout;
+            pfds[n].fd = c->fd;
+            pfds[n].events = c->resp ? POLLOUT : POLLIN;
+            polled[n++] = c;
+        }
+
+        if (poll(pfds, n, timeout) < 0) {
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if (!pfds[i].revents) {
+                continue;
+            }
+            if (polled[i]) {
+                handle_client(polled[i], pfds[i].revents);
+            }
+            else {
+                accept_client(pfds[i].fd);
+            }
+        }
+    }
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            close_client(&clients[i]);
+        }
+    }
+    for (i = 0; i < n_listeners; i++) {
+        close(listeners[i]);
+    }
+    if (unix_path) {
+        unlink(unix_path);
+    }
+    riaps_ts_phc_close(phc);
+    riaps_ts_ctx_destroy(ctx);
+    return 0;
+}
@@ -0,0 +1,380 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_fast.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Fast timestamps from the CPU cycle counter (implementation).
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riaps_ts_fast.h"
+#include "riaps_ts_util.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define FAST_COUNTER_SUPPORTED 1
+#define FAST_CLOCKSOURCE "tsc"
+#elif defined(__aarch64__)
+#define FAST_COUNTER_SUPPORTED 1
+#define FAST_CLOCKSOURCE "arch_sys_counter"
+#else
+#define FAST_COUNTER_SUPPORTED 0
+#endif
+
+#define FAST_CLOCKSOURCE_PATH "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+#define FAST_INIT_INTERVAL_NS 20000000LL    /* Initial frequency measurement */
+#define FAST_RECAL_INTERVAL_NS 1000000000LL /* Recalibration period */
+#define FAST_PAIR_READS 5                   /* Reads to select the tightest counter/clock pair from */
+#define FAST_STEP_NS 1000000LL              /* Larger residuals are not slewed in (clock step) */
+#define FAST_MAX_STEPS 3                    /* Consecutive steps before giving up the counter */
+#define FAST_MAX_SKEW_NS 1000LL             /* Largest tolerated counter offset between CPUs */
+#define FAST_MAX_CPUS 64                    /* Number of CPUs checked for skew */
+#define FAST_SHIFT 32                       /* Fixed point fraction bits of the scale */
+
+/* Linear mapping from the counter to the synchronized time (seqlock protected) */
+struct fast_mapping {
+    _Atomic uint32_t seq;
+    uint64_t base_cnt;
+    int64_t base_ns;
+    uint64_t mult;          /* ns per tick, FAST_SHIFT fraction bits */
+    uint64_t recal_cnt;     /* Counter value after which a recalibration is due */
+};
+
+static struct fast_mapping mapping;
+static atomic_int fast_mode = RIAPS_TS_FAST_FALLBACK;
+static atomic_flag recal_lock = ATOMIC_FLAG_INIT;
+static pthread_once_t fast_once = PTHREAD_ONCE_INIT;
+
+/* Calibration state (only touched by the holder of recal_lock) */
+static uint64_t last_cnt;
+static int64_t last_ns;
+static int steps;
+static struct riaps_ts_fast_info stats;
+
+#if FAST_COUNTER_SUPPORTED
+
+static inline uint64_t read_counter()
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    uint64_t cnt;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(cnt) :: "memory");
+    return cnt;
+#endif
+}
+
+static inline int64_t map_counter(uint64_t cnt, uint64_t base_cnt, int64_t base_ns, uint64_t mult)
+{
+    return base_ns + (int64_t)(((__int128)(int64_t)(cnt - base_cnt) * mult) >> FAST_SHIFT);
+}
+
+/* Read the counter and the system clock at the same instant (the tightest of a few reads) */
+static void read_pair(uint64_t* cnt, int64_t* ns)
+{
+    uint64_t best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < FAST_PAIR_READS; i++) {
+        uint64_t before = read_counter();
+        int64_t now = riaps_ts_clock_ns(CLOCK_REALTIME);
+        uint64_t after = read_counter();
+        if (after - before < best) {
+            best = after - before;
+            *cnt = before + (after - before) / 2;
+            *ns = now;
+        }
+    }
+}
+
+static void publish(uint64_t base_cnt, int64_t base_ns, uint64_t mult)
+{
+    atomic_fetch_add_explicit(&mapping.seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    mapping.base_cnt = base_cnt;
+    mapping.base_ns = base_ns;
+    mapping.mult = mult;
+    mapping.recal_cnt = base_cnt + (uint64_t)(FAST_RECAL_INTERVAL_NS * stats.counter_hz / 1e9);
+
+    atomic_fetch_add_explicit(&mapping.seq, 1, memory_order_release);
+}
+
+static const char* check_counter()
+{
+    char clocksource[32] = "";
+    FILE* f;
+
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+        return "TSC is not invariant";
+    }
+#endif
+    f = fopen(FAST_CLOCKSOURCE_PATH, "r");
+    if (f) {
+        if (!fgets(clocksource, sizeof(clocksource), f)) {
+            clocksource[0] = '\0';
+        }
+        fclose(f);
+    }
+    clocksource[strcspn(clocksource, "\n")] = '\0';
+    if (strcmp(clocksource, FAST_CLOCKSOURCE)) {
+        return "counter is not the kernel's clocksource";
+    }
+    return NULL;
+}
+
+/* Skew measurement, done by a helper thread (the affinity of the caller is not touched) */
+struct skew_check {
+    uint64_t base_cnt;
+    int64_t base_ns;
+    uint64_t mult;
+    int64_t skew;
+};
+
+static void* skew_main(void* arg)
+{
+    struct skew_check* check = arg;
+    cpu_set_t orig, one;
+    int64_t min_offset = INT64_MAX, max_offset = INT64_MIN;
+    int cpu, checked = 0;
+
+    /* The thread inherits the CPUs the caller may run on */
+    if (sched_getaffinity(0, sizeof(orig), &orig)) {
+        return NULL;
+    }
+    for (cpu = 0; cpu < CPU_SETSIZE && checked < FAST_MAX_CPUS; cpu++) {
+        uint64_t cnt;
+        int64_t ns, offset;
+
+        if (!CPU_ISSET(cpu, &orig)) {
+            continue;
+        }
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one)) {
+            continue;
+        }
+        read_pair(&cnt, &ns);
+        offset = map_counter(cnt, check->base_cnt, check->base_ns, check->mult) - ns;
+        if (offset < min_offset) {
+            min_offset = offset;
+        }
+        if (offset > max_offset) {
+            max_offset = offset;
+        }
+        checked++;
+    }
+    check->skew = checked ? max_offset - min_offset : 0;
+    return NULL;
+}
+
+/* Largest offset of the counter between the CPUs the caller may run on */
+static int64_t measure_skew(uint64_t base_cnt, int64_t base_ns, uint64_t mult)
+{
+    struct skew_check check = {base_cnt, base_ns, mult, 0};
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, skew_main, &check)) {
+        return 0;
+    }
+    pthread_join(thread, NULL);
+    return check.skew;
+}
+
+static void init_counter()
+{
+    struct timespec interval;
+    uint64_t cnt0, cnt1;
+    int64_t ns0, ns1;
+    uint64_t mult;
+    int64_t skew;
+
+    stats.fallback_reason = check_counter();
+    if (stats.fallback_reason) {
+        return;
+    }
+
+    read_pair(&cnt0, &ns0);
+    riaps_ts_posix_timespec_of_ns(FAST_INIT_INTERVAL_NS, &interval);
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, NULL);
+    read_pair(&cnt1, &ns1);
+    if (cnt1 <= cnt0 || ns1 <= ns0) {
+        stats.fallback_reason = "counter is not running";
+        return;
+    }
+    stats.counter_hz = (cnt1 - cnt0) * 1e9 / (ns1 - ns0);
+    mult = (uint64_t)((double)(ns1 - ns0) / (cnt1 - cnt0) * (1ULL << FAST_SHIFT));
+
+    skew = measure_skew(cnt1, ns1, mult);
+    stats.cpu_skew = skew / 1e9;
+    if (skew > FAST_MAX_SKEW_NS) {
+        stats.fallback_reason = "counter is not synchronized between CPUs";
+        return;
+    }
+
+    last_cnt = cnt1;
+    last_ns = ns1;
+    publish(cnt1, ns1, mult);
+    atomic_store(&fast_mode, RIAPS_TS_FAST_COUNTER);
+}
+
+/* Returns non-zero, if another thread is recalibrating (the current mapping is still usable) */
+static int recalibrate()
+{
+    uint64_t cnt, base_cnt, mult;
+    int64_t ns, base_ns, predicted, residual;
+    double ns_per_tick;
+
+    if (atomic_flag_test_and_set_explicit(&recal_lock, memory_order_acquire)) {
+        return 1;
+    }
+    if (atomic_load(&fast_mode) != RIAPS_TS_FAST_COUNTER) {
+        atomic_flag_clear_explicit(&recal_lock, memory_order_release);
+        return 0;
+    }
+
+    read_pair(&cnt, &ns);
+    base_cnt = mapping.base_cnt;
+    base_ns = mapping.base_ns;
+    mult = mapping.mult;
+
+    predicted = map_counter(cnt, base_cnt, base_ns, mult);
+    residual = predicted - ns;
+    stats.residual = residual / 1e9;
+    if (llabs(residual) > stats.max_residual * 1e9) {
+        stats.max_residual = llabs(residual) / 1e9;
+    }
+    stats.calibrations++;
+
+    if (cnt <= last_cnt || ns <= last_ns || llabs(residual) > FAST_STEP_NS) {
+        /* Clock step (or counter glitch): restart from the current pair */
+        if (++steps >= FAST_MAX_STEPS) {
+            stats.fallback_reason = "mapping keeps failing";
+            atomic_store(&fast_mode, RIAPS_TS_FAST_FALLBACK);
+        }
+        else {
+            publish(cnt, ns, mult);
+        }
+    }
+    else {
+        /* Slew the residual out by the next recalibration */
+        steps = 0;
+        ns_per_tick = (double)(ns - last_ns) / (cnt - last_cnt);
+        stats.counter_hz = 1e9 / ns_per_tick;
+        ns_per_tick *= 1.0 - (double)residual / FAST_RECAL_INTERVAL_NS;
+        publish(cnt, predicted, (uint64_t)(ns_per_tick * (1ULL << FAST_SHIFT)));
+    }
+    last_cnt = cnt;
+    last_ns = ns;
+
+    atomic_flag_clear_explicit(&recal_lock, memory_order_release);
+    return 0;
+}
+
+#else
+
+static void init_counter()
+{
+    stats.fallback_reason = "no usable cycle counter on this architecture";
+}
+
+#endif /* FAST_COUNTER_SUPPORTED */
+
+static void init_once()
+{
+    init_counter();
+    stats.mode = atomic_load(&fast_mode);
+}
+
+
+int riaps_ts_fast_init()
+{
+    pthread_once(&fast_once, init_once);
+    return atomic_load(&fast_mode);
+}
+
+
+long long riaps_ts_fast_ns()
+{
+#if FAST_COUNTER_SUPPORTED
+    uint32_t seq_begin, seq_end;
+    uint64_t cnt, base_cnt, mult, recal_cnt;
+    int64_t base_ns;
+
+    pthread_once(&fast_once, init_once);
+    while (atomic_load_explicit(&fast_mode, memory_order_relaxed) == RIAPS_TS_FAST_COUNTER) {
+        seq_begin = atomic_load_explicit(&mapping.seq, memory_order_acquire);
+        if (seq_begin & 1) {
+            continue;
+        }
+        base_cnt = mapping.base_cnt;
+        base_ns = mapping.base_ns;
+        mult = mapping.mult;
+        recal_cnt = mapping.recal_cnt;
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&mapping.seq, memory_order_relaxed);
+        if (seq_begin != seq_end) {
+            continue;
+        }
+
+        cnt = read_counter();
+        if ((int64_t)(cnt - recal_cnt) < 0 || recalibrate()) {
+            return map_counter(cnt, base_cnt, base_ns, mult);
+        }
+    }
+#endif
+    return riaps_ts_clock_ns(CLOCK_REALTIME);
+}
+
+
+int riaps_ts_fast_gettime(struct riaps_ts_timespec* res)
+{
+    int64_t ns = riaps_ts_fast_ns();
+    res->tv_sec = ns / RIAPS_TS_NSEC_PER_SEC;
+    res->tv_nsec = ns % RIAPS_TS_NSEC_PER_SEC;
+    return 0;
+}
+
+
+int riaps_ts_fast_info(struct riaps_ts_fast_info* info)
+{
+    if (!info) {
+        return -1;
+    }
+    pthread_once(&fast_once, init_once);
+    while (atomic_flag_test_and_set_explicit(&recal_lock, memory_order_acquire)) {
+        sched_yield();
+    }
+    *info = stats;
+    info->mode = atomic_load(&fast_mode);
+    atomic_flag_clear_explicit(&recal_lock, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_FAST_H_
+#define _RIAPS_TS_FAST_H_
+
+
+/**
+ * @file riaps_ts_fast.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Fast timestamps from the CPU cycle counter.
+ *
+ * For high-rate data tagging, the synchronized time is computed from the CPU cycle
+ * counter (TSC on amd64, CNTVCT_EL0 on arm64) through a linear mapping, which is
+ * periodically recalibrated against CLOCK_REALTIME (by the first caller after the
+ * period elapsed). Recalibrations are slewed in, so the timestamps stay monotonic
+ * unless the system clock is stepped.
+ *
+ * The counter is only used if it is invariant, trusted by the kernel (as its
+ * clocksource) and consistent across the CPUs. Otherwise (or if the mapping keeps
+ * failing at runtime) the functions fall back to clock_gettime() transparently.
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_FAST_COUNTER 0     /**< Timestamps are computed from the cycle counter */
+#define RIAPS_TS_FAST_FALLBACK 1    /**< Timestamps are read with clock_gettime() */
+
+/**
+ * @brief State and quality of the fast timestamp source
+ */
+struct riaps_ts_fast_info {
+    int mode;                       /**< @see RIAPS_TS_FAST_COUNTER, RIAPS_TS_FAST_FALLBACK */
+    const char* fallback_reason;    /**< Why the counter is not used (NULL in counter mode) */
+    double counter_hz;              /**< Estimated frequency of the counter */
+    double residual;                /**< Error of the mapping at the last recalibration (secs) */
+    double max_residual;            /**< Largest absolute error at recalibrations (secs) */
+    double cpu_skew;                /**< Largest counter offset between CPUs (secs) */
+    unsigned long calibrations;     /**< Number of recalibrations so far */
+};
+
+/**
+ * @brief Initialize the fast timestamp source.
+ *
+ * Checks the counter and measures its frequency (takes ~20 ms). It is called
+ * implicitly by the first timestamp query, but applications may call it at startup
+ * to avoid the delay on their critical path.
+ *
+ * @return The mode of operation. @see RIAPS_TS_FAST_COUNTER
+ */
+int riaps_ts_fast_init();
+
+/**
+ * @brief Query the synchronized time from the cycle counter.
+ *
+ * @param res Pointer to a pre-allocated @c riaps_ts_timespec structure to be filled in.
+ * @return Zero on success.
+ */
+int riaps_ts_fast_gettime(struct riaps_ts_timespec* res);
+
+/**
+ * @brief Query the synchronized time from the cycle counter (cheapest form).
+ *
+ * @return Nanoseconds since the epoch.
+ */
+long long riaps_ts_fast_ns();
+
+/**
+ * @brief Query the state and quality of the fast timestamp source.
+ *
+ * @param info Pre-allocated buffer to receive the information.
+ * @return Zero on success.
+ */
+int riaps_ts_fast_info(struct riaps_ts_fast_info* info);
+
+#endif /* _RIAPS_TS_FAST_H_ */
@@ -0,0 +1,530 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_history.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Synchronization quality history (implementation).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "riaps_ts_history.h"
+#include "riaps_ts_util.h"
+
+#define HISTORY_SHM_NAME "/riaps_ts_history"
+#define HISTORY_MAGIC 0x52545348            /* "RTSH" */
+#define HISTORY_VERSION 1
+#define HISTORY_READ_RETRIES 64
+
+#define HIST_BINS_PER_OCTAVE 8
+#define HIST_BINS (40 * HIST_BINS_PER_OCTAVE + 1)  /* Absolute offsets from 1 ns to ~1000 s */
+
+/*
+ * Layout of a history (position independent, so it can be shared). The header is
+ * followed by the sample ring, the ring of the max-offset deque and the rings of the
+ * Allan variance terms (one for each averaging time, indexed by the first sample).
+ */
+struct history_data {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint32_t capacity;
+    uint32_t period_ms;
+    _Atomic uint32_t seq;           /* Sequence lock counter (odd while an update is in progress) */
+    int32_t closed;                 /* The (shared) history has been replaced */
+    uint64_t count;                 /* Number of samples added so far */
+    uint64_t deque_head;            /* Monotonic deque of sample indices with decreasing |offset| */
+    uint64_t deque_tail;
+    double sum_freq;                /* Sum of the frequencies in the ring */
+    double sum_ifreq;               /* Sum of (position in the ring) * frequency */
+    double adev_sum[RIAPS_TS_HISTORY_ADEV_TAUS];
+    uint32_t hist[HIST_BINS];       /* Histogram of the absolute offsets */
+};
+
+struct riaps_ts_history {
+    struct history_data* data;
+    size_t size;
+    int shared;
+    int writable;
+};
+
+static size_t layout_size(uint32_t capacity)
+{
+    return sizeof(struct history_data) +
+           capacity * (sizeof(struct riaps_ts_history_sample) + sizeof(uint64_t) +
+                       RIAPS_TS_HISTORY_ADEV_TAUS * sizeof(double));
+}
+
+static struct riaps_ts_history_sample* samples_of(struct history_data* d)
+{
+    return (struct riaps_ts_history_sample*)(d + 1);
+}
+
+static uint64_t* deque_of(struct history_data* d)
+{
+    return (uint64_t*)(samples_of(d) + d->capacity);
+}
+
+static double* adev_terms_of(struct history_data* d, int tau)
+{
+    return (double*)(deque_of(d) + d->capacity) + (size_t)tau * d->capacity;
+}
+
+static int hist_bin(double offset)
+{
+    double ns = fabs(offset) * 1e9;
+    int bin;
+
+    if (ns < 1.0) {
+        return 0;
+    }
+    bin = 1 + (int)(log2(ns) * HIST_BINS_PER_OCTAVE);
+    return bin < HIST_BINS ? bin : HIST_BINS - 1;
+}
+
+/* Upper edge of a histogram bin (secs) */
+static double hist_edge(int bin)
+{
+    return exp2((double)bin / HIST_BINS_PER_OCTAVE) * 1e-9;
+}
+
+/* Averaging time of an Allan deviation term (in periods), 0 if the ring is too short */
+static uint64_t adev_m(const struct history_data* d, int tau)
+{
+    uint64_t m = 1ULL << tau;
+    return 2 * m < d->capacity ? m : 0;
+}
+
+static void init_data(struct history_data* d, size_t size, uint32_t capacity, uint32_t period_ms)
+{
+    memset(d, 0, size);
+    d->size = size;
+    d->capacity = capacity;
+    d->period_ms = period_ms;
+    d->version = HISTORY_VERSION;
+    d->magic = HISTORY_MAGIC;
+}
+
+static riaps_ts_history* new_handle(struct history_data* d, size_t size, int shared, int writable)
+{
+    riaps_ts_history* history = malloc(sizeof(riaps_ts_history));
+    if (history) {
+        history->data = d;
+        history->size = size;
+        history->shared = shared;
+        history->writable = writable;
+    }
+    return history;
+}
+
+
+riaps_ts_history* riaps_ts_history_create(int capacity, unsigned int period_ms)
+{
+    riaps_ts_history* history;
+    struct history_data* d;
+    size_t size;
+
+    if (capacity < 0) {
+        return NULL;
+    }
+    capacity = capacity ? capacity : RIAPS_TS_HISTORY_CAPACITY;
+    period_ms = period_ms ? period_ms : RIAPS_TS_HISTORY_PERIOD_MS;
+    size = layout_size(capacity);
+
+    d = malloc(size);
+    if (!d) {
+        return NULL;
+    }
+    init_data(d, size, capacity, period_ms);
+
+    history = new_handle(d, size, 0, 1);
+    if (!history) {
+        free(d);
+    }
+    return history;
+}
+
+
+riaps_ts_history* riaps_ts_history_create_shared(int capacity, unsigned int period_ms)
+{
+    riaps_ts_history* history;
+    struct history_data* d;
+    struct stat st;
+    size_t size;
+    int fd;
+
+    if (capacity < 0) {
+        return NULL;
+    }
+    capacity = capacity ? capacity : RIAPS_TS_HISTORY_CAPACITY;
+    period_ms = period_ms ? period_ms : RIAPS_TS_HISTORY_PERIOD_MS;
+    size = layout_size(capacity);
+
+    /* The size may change, so a new segment is created and the readers of the old one notified */
+    fd = shm_open(HISTORY_SHM_NAME, O_RDWR, 0);
+    if (fd >= 0) {
+        if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct history_data)) {
+            d = mmap(NULL, sizeof(struct history_data), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (d != MAP_FAILED) {
+                atomic_fetch_add_explicit(&d->seq, 1, memory_order_relaxed);
+                atomic_thread_fence(memory_order_release);
+                d->closed = 1;
+                atomic_fetch_add_explicit(&d->seq, 1, memory_order_release);
+                munmap(d, sizeof(struct history_data));
+            }
+        }
+        close(fd);
+        shm_unlink(HISTORY_SHM_NAME);
+    }
+
+    fd = shm_open(HISTORY_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    fchmod(fd, 0644);   /* shm_open() is subject to the umask */
+    if (ftruncate(fd, size)) {
+        close(fd);
+        shm_unlink(HISTORY_SHM_NAME);
+        return NULL;
+    }
+    d = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (d == MAP_FAILED) {
+        shm_unlink(HISTORY_SHM_NAME);
+        return NULL;
+    }
+    init_data(d, size, capacity, period_ms);
+
+    history = new_handle(d, size, 1, 1);
+    if (!history) {
+        munmap(d, size);
+    }
+    return history;
+}
+
+
+riaps_ts_history* riaps_ts_history_attach()
+{
+    riaps_ts_history* history;
+    struct history_data* d;
+    struct stat st;
+    size_t size;
+    int fd;
+
+    fd = shm_open(HISTORY_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < sizeof(struct history_data)) {
+        close(fd);
+        return NULL;
+    }
+    size = st.st_size;
+    d = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (d == MAP_FAILED) {
+        return NULL;
+    }
+    if (d->magic != HISTORY_MAGIC || d->version != HISTORY_VERSION ||
+        d->size != size || layout_size(d->capacity) != size) {
+        munmap(d, size);
+        return NULL;
+    }
+
+    history = new_handle(d, size, 1, 0);
+    if (!history) {
+        munmap(d, size);
+    }
+    return history;
+}
+
+
+void riaps_ts_history_destroy(riaps_ts_history* history)
+{
+    if (history) {
+        if (history->shared) {
+            munmap(history->data, history->size);
+        }
+        else {
+            free(history->data);
+        }
+        free(history);
+    }
+}
+
+/* Recompute the running sums from scratch (to get rid of the accumulated rounding errors) */
+static void rebuild_sums(struct history_data* d)
+{
+    struct riaps_ts_history_sample* samples = samples_of(d);
+    uint64_t n = d->count < d->capacity ? d->count : d->capacity;
+    uint64_t oldest = d->count - n;
+    uint64_t j;
+    int t;
+
+    d->sum_freq = 0.0;
+    d->sum_ifreq = 0.0;
+    for (j = oldest; j < d->count; j++) {
+        d->sum_freq += samples[j % d->capacity].freq_ppm;
+        d->sum_ifreq += (j - oldest) * samples[j % d->capacity].freq_ppm;
+    }
+    for (t = 0; t < RIAPS_TS_HISTORY_ADEV_TAUS; t++) {
+        uint64_t m = adev_m(d, t);
+        double* terms = adev_terms_of(d, t);
+
+        d->adev_sum[t] = 0.0;
+        for (j = oldest; m && j + 2 * m < d->count; j++) {
+            d->adev_sum[t] += terms[j % d->capacity];
+        }
+    }
+}
+
+
+int riaps_ts_history_add(riaps_ts_history* history, const struct riaps_ts_tracking* trk)
+{
+    struct history_data* d;
+    struct riaps_ts_history_sample* samples;
+    struct riaps_ts_history_sample* s;
+    uint64_t* deque;
+    uint64_t k, cap, n;
+    int t;
+
+    if (!history || !history->writable || !trk) {
+        return -1;
+    }
+    d = history->data;
+    samples = samples_of(d);
+    deque = deque_of(d);
+    cap = d->capacity;
+    k = d->count;   /* Index of the new sample */
+
+    atomic_fetch_add_explicit(&d->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (k >= cap) {
+        /* Evict the oldest sample */
+        uint64_t e = k - cap;
+        s = &samples[e % cap];
+
+        d->hist[hist_bin(s->offset)]--;
+        if (d->deque_head != d->deque_tail && deque[d->deque_head % cap] == e) {
+            d->deque_head++;
+        }
+        /* The positions of the remaining samples decrease by one */
+        d->sum_freq -= s->freq_ppm;
+        d->sum_ifreq -= d->sum_freq;
+        for (t = 0; t < RIAPS_TS_HISTORY_ADEV_TAUS; t++) {
+            uint64_t m = adev_m(d, t);
+            if (m) {
+                d->adev_sum[t] -= adev_terms_of(d, t)[e % cap];
+            }
+        }
+        n = cap - 1;
+    }
+    else {
+        n = k;
+    }
+
+    s = &samples[k % cap];
+    s->time = trk->query_time;
+    s->offset = trk->status.last_offset;
+    s->rms_offset = trk->status.rms_offset;
+    s->freq_ppm = trk->status.ppm;
+    s->skew_ppm = trk->skew_ppm;
+    s->reference = trk->status.reference;
+
+    d->hist[hist_bin(s->offset)]++;
+    while (d->deque_tail != d->deque_head &&
+           fabs(samples[deque[(d->deque_tail - 1) % cap] % cap].offset) <= fabs(s->offset)) {
+        d->deque_tail--;
+    }
+    deque[d->deque_tail++ % cap] = k;
+
+    d->sum_ifreq += n * s->freq_ppm;
+    d->sum_freq += s->freq_ppm;
+
+    /* Allan variance term (second difference of the offsets) ending with this sample */
+    for (t = 0; t < RIAPS_TS_HISTORY_ADEV_TAUS; t++) {
+        uint64_t m = adev_m(d, t);
+        if (m && k >= 2 * m) {
+            double diff = s->offset - 2.0 * samples[(k - m) % cap].offset + samples[(k - 2 * m) % cap].offset;
+            adev_terms_of(d, t)[(k - 2 * m) % cap] = diff * diff;
+            d->adev_sum[t] += diff * diff;
+        }
+    }
+
+    d->count = k + 1;
+    if (d->count % cap == 0) {
+        rebuild_sums(d);
+    }
+
+    atomic_fetch_add_explicit(&d->seq, 1, memory_order_release);
+    return 0;
+}
+
+
+int riaps_ts_history_stats(riaps_ts_history* history, struct riaps_ts_history_stats* stats)
+{
+    struct history_data* d;
+    struct riaps_ts_history_sample* samples;
+    uint32_t hist[HIST_BINS];
+    double adev_sum[RIAPS_TS_HISTORY_ADEV_TAUS];
+    double sum_freq, sum_ifreq, offset_max = 0.0;
+    uint32_t seq_begin, seq_end;
+    uint64_t count, n = 0, cap;
+    int closed = 0;
+    int i, t;
+
+    if (!history || !stats) {
+        return -1;
+    }
+    d = history->data;
+    samples = samples_of(d);
+    cap = d->capacity;
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < HISTORY_READ_RETRIES; i++) {
+        seq_begin = atomic_load_explicit(&d->seq, memory_order_acquire);
+        if (seq_begin & 1) {
+            continue;
+        }
+        closed = d->closed;
+        count = d->count;
+        n = count < cap ? count : cap;
+        if (n) {
+            stats->first = samples[(count - n) % cap].time;
+            stats->last = samples[(count - 1) % cap].time;
+            offset_max = fabs(samples[deque_of(d)[d->deque_head % cap] % cap].offset);
+        }
+        sum_freq = d->sum_freq;
+        sum_ifreq = d->sum_ifreq;
+        memcpy(adev_sum, d->adev_sum, sizeof(adev_sum));
+        memcpy(hist, d->hist, sizeof(hist));
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&d->seq, memory_order_relaxed);
+        if (seq_begin == seq_end) {
+            break;
+        }
+    }
+    if (i == HISTORY_READ_RETRIES) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (closed) {
+        errno = ESTALE;
+        return -1;
+    }
+
+    stats->n_samples = n;
+    stats->period = d->period_ms / 1000.0;
+    if (n == 0) {
+        return 0;
+    }
+
+    /* Percentiles from the histogram (not beyond the exact maximum) */
+    {
+        uint64_t rank50 = (n + 1) / 2, rank99 = (n * 99 + 99) / 100, seen = 0;
+        int p50 = -1, p99 = -1;
+
+        for (i = 0; i < HIST_BINS && p99 < 0; i++) {
+            seen += hist[i];
+            if (p50 < 0 && seen >= rank50) {
+                p50 = i;
+            }
+            if (seen >= rank99) {
+                p99 = i;
+            }
+        }
+        stats->offset_p50 = fmin(hist_edge(p50), offset_max);
+        stats->offset_p99 = fmin(hist_edge(p99 < 0 ? HIST_BINS - 1 : p99), offset_max);
+        stats->offset_max = offset_max;
+    }
+
+    /* Least squares fit of the frequency against the position in the ring */
+    stats->freq_mean = sum_freq / n;
+    if (n > 1) {
+        double sum_i = n * (n - 1) / 2.0;
+        double sum_ii = (n - 1) * n * (2.0 * n - 1) / 6.0;
+        double slope = (n * sum_ifreq - sum_i * sum_freq) / (n * sum_ii - sum_i * sum_i);
+        stats->freq_trend = slope * 3600.0 / stats->period;
+    }
+
+    for (t = 0; t < RIAPS_TS_HISTORY_ADEV_TAUS; t++) {
+        uint64_t m = adev_m(d, t);
+        double tau = (1 << t) * stats->period;
+
+        stats->adev_tau[t] = tau;
+        if (m && n > 2 * m) {
+            stats->adev[t] = sqrt(fmax(adev_sum[t], 0.0) / (2.0 * tau * tau * (n - 2 * m)));
+        }
+    }
+    return 0;
+}
+
+
+int riaps_ts_history_samples(riaps_ts_history* history, struct riaps_ts_history_sample* samples, int max_samples)
+{
+    struct history_data* d;
+    uint32_t seq_begin, seq_end;
+    uint64_t count, n = 0, j;
+    int closed = 0;
+    int i;
+
+    if (!history || !samples || max_samples < 0) {
+        return -1;
+    }
+    d = history->data;
+
+    for (i = 0; i < HISTORY_READ_RETRIES; i++) {
+        seq_begin = atomic_load_explicit(&d->seq, memory_order_acquire);
+        if (seq_begin & 1) {
+            continue;
+        }
+        closed = d->closed;
+        count = d->count;
+        n = count < d->capacity ? count : d->capacity;
+        n = n < (uint64_t)max_samples ? n : (uint64_t)max_samples;
+        for (j = 0; j < n; j++) {
+            samples[j] = samples_of(d)[(count - n + j) % d->capacity];
+        }
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&d->seq, memory_order_relaxed);
+        if (seq_begin == seq_end) {
+            break;
+        }
+    }
+    if (i == HISTORY_READ_RETRIES) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (closed) {
+        errno = ESTALE;
+        return -1;
+    }
+    return n;
+}
@@ -0,0 +1,147 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_HISTORY_H_
+#define _RIAPS_TS_HISTORY_H_
+
+
+/**
+ * @file riaps_ts_history.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Synchronization quality history.
+ *
+ * A history is a fixed-size ring of tracking samples taken at a fixed period, with
+ * the statistics of the ring (offset percentiles and maximum, frequency trend, Allan
+ * deviation) maintained incrementally as the samples are added. Queries cost O(1),
+ * regardless of the length of the history.
+ *
+ * The @c riaps_tsd service keeps a node-wide history (one hour at 1 s by default) in
+ * shared memory, which can be queried through riaps_ts_history_attach(). Applications
+ * may also keep their own histories. A history has a single writer, readers access it
+ * without locking (through a sequence lock).
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_HISTORY_CAPACITY 3600      /**< Default number of samples in a history */
+#define RIAPS_TS_HISTORY_PERIOD_MS 1000     /**< Default sampling period of a history */
+#define RIAPS_TS_HISTORY_ADEV_TAUS 8        /**< Number of Allan deviation averaging times (1, 2, 4, ... periods) */
+
+/**
+ * @brief Synchronization quality history
+ */
+typedef struct riaps_ts_history riaps_ts_history;
+
+/**
+ * @brief A sample of the history
+ */
+struct riaps_ts_history_sample {
+    struct riaps_ts_timespec time;  /**< When the sample was taken */
+    double offset;                  /**< Estimated local offset (secs) */
+    double rms_offset;              /**< RMS offset (secs) */
+    double freq_ppm;                /**< Frequency error of the local clock (ppm) */
+    double skew_ppm;                /**< Estimated error bound of the frequency (ppm) */
+    int reference;                  /**< The reference in use @see RIAPS_TS_REF_NONE */
+};
+
+/**
+ * @brief Statistics of the samples in the history
+ */
+struct riaps_ts_history_stats {
+    int n_samples;                  /**< Number of samples in the history */
+    double period;                  /**< Sampling period (secs) */
+    struct riaps_ts_timespec first; /**< Time of the oldest sample */
+    struct riaps_ts_timespec last;  /**< Time of the latest sample */
+    double offset_p50;              /**< Median absolute offset (secs, ~9% resolution) */
+    double offset_p99;              /**< 99th percentile of the absolute offset (secs, ~9% resolution) */
+    double offset_max;              /**< Maximum absolute offset (secs) */
+    double freq_mean;               /**< Average frequency error (ppm) */
+    double freq_trend;              /**< Linear trend of the frequency error (ppm/hour) */
+    double adev_tau[RIAPS_TS_HISTORY_ADEV_TAUS]; /**< Averaging times of the Allan deviations (secs) */
+    double adev[RIAPS_TS_HISTORY_ADEV_TAUS];     /**< Allan deviation of the offset (0 if there are not enough samples) */
+};
+
+/**
+ * @brief Create a (process-local) history.
+ *
+ * @param capacity Number of samples kept (0 for @c RIAPS_TS_HISTORY_CAPACITY)
+ * @param period_ms The intended sampling period (0 for @c RIAPS_TS_HISTORY_PERIOD_MS)
+ * @return The history or NULL on failure.
+ */
+riaps_ts_history* riaps_ts_history_create(int capacity, unsigned int period_ms);
+
+/**
+ * @brief Create the node-wide history in shared memory (used by @c riaps_tsd).
+ *
+ * Readers attached to a previous node-wide history are notified to re-attach.
+ *
+ * @param capacity Number of samples kept (0 for @c RIAPS_TS_HISTORY_CAPACITY)
+ * @param period_ms The intended sampling period (0 for @c RIAPS_TS_HISTORY_PERIOD_MS)
+ * @return The history or NULL on failure.
+ */
+riaps_ts_history* riaps_ts_history_create_shared(int capacity, unsigned int period_ms);
+
+/**
+ * @brief Attach to the node-wide history (read-only).
+ *
+ * @return The history or NULL, if it is not available (@c riaps_tsd is not running).
+ */
+riaps_ts_history* riaps_ts_history_attach();
+
+/**
+ * @brief Destroy or detach from a history.
+ *
+ * @param history The history
+ */
+void riaps_ts_history_destroy(riaps_ts_history* history);
+
+/**
+ * @brief Add a sample to the history (evicting the oldest one, if it is full).
+ *
+ * Samples should be added at the sampling period of the history.
+ *
+ * @param history A history created by this process
+ * @param trk The tracking information of the sample
+ * @return Zero on success, -1 on failure (e.g. attached history).
+ */
+int riaps_ts_history_add(riaps_ts_history* history, const struct riaps_ts_tracking* trk);
+
+/**
+ * @brief Query the statistics of the history.
+ *
+ * @param history The history
+ * @param stats Pre-allocated buffer to receive the statistics.
+ * @return Zero on success, -1 on failure (@c errno is ESTALE, if the node-wide
+ *         history has been replaced and it has to be attached again).
+ */
+int riaps_ts_history_stats(riaps_ts_history* history, struct riaps_ts_history_stats* stats);
+
+/**
+ * @brief Query the latest samples of the history.
+ *
+ * @param history The history
+ * @param samples Pre-allocated array to receive the samples (oldest first)
+ * @param max_samples Size of the array
+ * @return The number of samples provided or -1 on failure. @see riaps_ts_history_stats()
+ */
+int riaps_ts_history_samples(riaps_ts_history* history, struct riaps_ts_history_sample* samples, int max_samples);
+
+#endif /* _RIAPS_TS_HISTORY_H_ */
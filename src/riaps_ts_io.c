@@ -0,0 +1,93 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_io.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Deadline based datagram I/O helpers (implementation).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "riaps_ts_io.h"
+
+
+int64_t riaps_ts_monotonic_us()
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (int64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+
+int riaps_ts_wait_readable(int sock_fd, int64_t until_us)
+{
+    struct pollfd pfd = {sock_fd, POLLIN, 0};
+    struct timespec timeout;
+    int64_t left;
+    int ret;
+
+    do {
+        left = until_us - riaps_ts_monotonic_us();
+        if (left <= 0) {
+            return 0;
+        }
+        timeout.tv_sec = left / 1000000;
+        timeout.tv_nsec = (left % 1000000) * 1000;
+        ret = ppoll(&pfd, 1, &timeout, NULL);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+
+void riaps_ts_sleep_until_us(int64_t until_us)
+{
+    struct timespec tp = {until_us / 1000000, (until_us % 1000000) * 1000};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+}
+
+
+long riaps_ts_backoff_us(int attempt, long first_us, long max_us)
+{
+    long timeout_us = first_us;
+
+    while (attempt-- > 0 && timeout_us < max_us) {
+        timeout_us *= 2;
+    }
+    return timeout_us < max_us ? timeout_us : max_us;
+}
+
+
+int64_t riaps_ts_attempt_end(long timeout_us, int64_t deadline_us)
+{
+    int64_t now = riaps_ts_monotonic_us();
+    int64_t end = now + timeout_us;
+
+    if (now >= deadline_us) {
+        return 0;
+    }
+    return end < deadline_us ? end : deadline_us;
+}
@@ -0,0 +1,79 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_IO_H_
+#define _RIAPS_TS_IO_H_
+
+
+/**
+ * @file riaps_ts_io.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Deadline based datagram I/O helpers.
+ *
+ * Shared by the clients of the local daemons (chrony, ptp4l): requests are
+ * retransmitted with exponential backoff until the time budget of the request
+ * runs out. The functions in this module are not supposed to be used by
+ * application level code.
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief CLOCK_MONOTONIC time in microseconds (request deadlines).
+ */
+int64_t riaps_ts_monotonic_us();
+
+/**
+ * @brief Wait for a datagram until the given time.
+ *
+ * @param sock_fd The socket
+ * @param until_us The end of the wait (CLOCK_MONOTONIC us)
+ * @return Positive, if the socket is readable, zero on timeout, -1 on error.
+ */
+int riaps_ts_wait_readable(int sock_fd, int64_t until_us);
+
+/**
+ * @brief Sleep until the given time.
+ *
+ * @param until_us The end of the sleep (CLOCK_MONOTONIC us)
+ */
+void riaps_ts_sleep_until_us(int64_t until_us);
+
+/**
+ * @brief Get the reply timeout of an attempt (exponential backoff).
+ *
+ * @param attempt The number of previous attempts of the request
+ * @param first_us The timeout of the first attempt
+ * @param max_us The upper limit of the timeout
+ * @return The timeout in microseconds
+ */
+long riaps_ts_backoff_us(int attempt, long first_us, long max_us);
+
+/**
+ * @brief Get the end of the next attempt of a request.
+ *
+ * @param timeout_us The reply timeout of the attempt @see riaps_ts_backoff_us()
+ * @param deadline_us The deadline of the request (CLOCK_MONOTONIC us)
+ * @return The end of the attempt (limited by the deadline), zero if the deadline has passed.
+ */
+int64_t riaps_ts_attempt_end(long timeout_us, int64_t deadline_us);
+
+#endif // _RIAPS_TS_IO_H_
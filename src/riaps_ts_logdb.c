@@ -0,0 +1,1199 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_logdb.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Indexed store of the chrony logs (implementation).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "riaps_ts_logdb.h"
+#include "riaps_ts_util.h"
+
+#define LOGDB_MAGIC 0x42444c52              /* "RLDB" */
+#define LOGDB_VERSION 1
+#define LOGDB_HEADER_SIZE 16384
+#define LOGDB_MAX_COLUMNS 12
+#define LOGDB_MAX_SOURCES 320
+#define LOGDB_ROWS_PER_BLOCK 4096
+#define LOGDB_BLOCK_HEADER_SIZE 512
+#define LOGDB_WINDOW (64 << 20)             /* Memory-mapped window of a log */
+#define LOGDB_READ_CHUNK 65536              /* Read buffer of a compressed log */
+#define LOGDB_MAX_LINE 1024
+#define LOGDB_MAX_TOKENS 24
+#define LOGDB_OTHER_SOURCE "(other)"        /* Name of the sources beyond LOGDB_MAX_SOURCES */
+#define NSEC_PER_DAY (86400 * RIAPS_TS_NSEC_PER_SEC)
+
+/*
+ * Layout of a store: the header is followed by the blocks. A block starts with its
+ * summary, followed by the timestamps, the source IDs and the columns of its rows.
+ * Rows are published by incrementing n_rows, after they have been written.
+ */
+struct logdb_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t n_columns;
+    uint32_t rows_per_block;
+    _Atomic uint32_t n_sources;
+    _Atomic uint64_t n_rows;
+    int64_t first_ns;
+    int64_t last_ns;
+    uint64_t log_dev;               /* The log file being followed */
+    uint64_t log_ino;
+    uint64_t log_offset;            /* Position after the last processed line */
+    char sources[LOGDB_MAX_SOURCES][RIAPS_TS_LOGDB_SOURCE_LENGTH];
+};
+
+struct block_summary {
+    int64_t first_ns;
+    int64_t last_ns;
+    uint32_t n_rows;
+    uint32_t count[LOGDB_MAX_COLUMNS];      /* Number of values (not NaN) */
+    float min[LOGDB_MAX_COLUMNS];
+    float max[LOGDB_MAX_COLUMNS];
+    double sum[LOGDB_MAX_COLUMNS];
+};
+
+_Static_assert(sizeof(struct logdb_header) <= LOGDB_HEADER_SIZE, "store header too large");
+_Static_assert(sizeof(struct block_summary) <= LOGDB_BLOCK_HEADER_SIZE, "block summary too large");
+
+/*** Log formats ***/
+#define COL_NUMBER 0
+#define COL_LEAP 1
+
+struct column_def {
+    const char* name;
+    int token;                      /* Index of the field in the line */
+    int type;
+};
+
+struct kind_def {
+    const char* name;
+    int min_tokens;                 /* Fields of a valid line (later ones are optional) */
+    int n_columns;
+    struct column_def columns[LOGDB_MAX_COLUMNS];
+};
+
+/* Fields: date, time, source (IP address or reference ID), ... */
+static const struct kind_def kinds[RIAPS_TS_LOG_KINDS] = {
+    {"tracking", 13, 11, {
+        {"stratum", 3, COL_NUMBER},
+        {"freq_ppm", 4, COL_NUMBER},
+        {"skew_ppm", 5, COL_NUMBER},
+        {"offset", 6, COL_NUMBER},
+        {"leap", 7, COL_LEAP},
+        {"combined", 8, COL_NUMBER},
+        {"offset_sd", 9, COL_NUMBER},
+        {"remaining_correction", 10, COL_NUMBER},
+        {"root_delay", 11, COL_NUMBER},
+        {"root_dispersion", 12, COL_NUMBER},
+        {"max_error", 13, COL_NUMBER},
+    }},
+    {"measurements", 16, 8, {
+        {"leap", 3, COL_LEAP},
+        {"stratum", 4, COL_NUMBER},
+        {"score", 10, COL_NUMBER},
+        {"offset", 11, COL_NUMBER},
+        {"peer_delay", 12, COL_NUMBER},
+        {"peer_dispersion", 13, COL_NUMBER},
+        {"root_delay", 14, COL_NUMBER},
+        {"root_dispersion", 15, COL_NUMBER},
+    }},
+    {"statistics", 12, 10, {
+        {"std_dev", 3, COL_NUMBER},
+        {"est_offset", 4, COL_NUMBER},
+        {"offset_sd", 5, COL_NUMBER},
+        {"diff_freq", 6, COL_NUMBER},
+        {"est_skew", 7, COL_NUMBER},
+        {"stress", 8, COL_NUMBER},
+        {"samples", 9, COL_NUMBER},
+        {"skipped", 10, COL_NUMBER},
+        {"runs", 11, COL_NUMBER},
+        {"asymmetry", 12, COL_NUMBER},
+    }},
+    {"refclocks", 9, 4, {
+        {"leap", 4, COL_LEAP},
+        {"raw_offset", 6, COL_NUMBER},
+        {"cooked_offset", 7, COL_NUMBER},
+        {"dispersion", 8, COL_NUMBER},
+    }},
+};
+
+struct riaps_ts_logdb {
+    int fd;
+    int kind;
+    int writable;
+    struct logdb_header* hdr;
+    size_t map_size;
+    size_t block_size;
+    int last_source;                /* Cache of the source lookups */
+    float* scratch;                 /* Values of the quantiles (reused) */
+    size_t scratch_capacity;
+};
+
+/* State of an update */
+struct ingest {
+    riaps_ts_logdb* db;
+    int follow;                     /* The position of the file is recorded in the store */
+    int continuation;               /* Rows at the time of the last row are accepted */
+    uint64_t offset;
+    long long added;
+};
+
+
+const char* riaps_ts_logdb_kind_name(int kind)
+{
+    return kind >= 0 && kind < RIAPS_TS_LOG_KINDS ? kinds[kind].name : NULL;
+}
+
+
+int riaps_ts_logdb_kind(const char* name)
+{
+    int kind;
+
+    for (kind = 0; kind < RIAPS_TS_LOG_KINDS; kind++) {
+        if (strcmp(kinds[kind].name, name) == 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+
+int riaps_ts_logdb_n_columns(int kind)
+{
+    return kind >= 0 && kind < RIAPS_TS_LOG_KINDS ? kinds[kind].n_columns : -1;
+}
+
+
+const char* riaps_ts_logdb_column_name(int kind, int column)
+{
+    if (column < 0 || column >= riaps_ts_logdb_n_columns(kind)) {
+        return NULL;
+    }
+    return kinds[kind].columns[column].name;
+}
+
+
+int riaps_ts_logdb_column(int kind, const char* name)
+{
+    int column;
+
+    for (column = 0; column < riaps_ts_logdb_n_columns(kind); column++) {
+        if (strcmp(kinds[kind].columns[column].name, name) == 0) {
+            return column;
+        }
+    }
+    return -1;
+}
+
+
+/*** Layout ***/
+
+static struct block_summary* block_of(const riaps_ts_logdb* db, uint64_t block)
+{
+    return (struct block_summary*)((char*)db->hdr + LOGDB_HEADER_SIZE + block * db->block_size);
+}
+
+static int64_t* times_of(const riaps_ts_logdb* db, uint64_t block)
+{
+    return (int64_t*)((char*)block_of(db, block) + LOGDB_BLOCK_HEADER_SIZE);
+}
+
+static uint16_t* sources_of(const riaps_ts_logdb* db, uint64_t block)
+{
+    return (uint16_t*)(times_of(db, block) + LOGDB_ROWS_PER_BLOCK);
+}
+
+static float* column_of(const riaps_ts_logdb* db, uint64_t block, int column)
+{
+    return (float*)(sources_of(db, block) + LOGDB_ROWS_PER_BLOCK) + (size_t)column * LOGDB_ROWS_PER_BLOCK;
+}
+
+static size_t store_size(const riaps_ts_logdb* db, uint64_t n_rows)
+{
+    uint64_t n_blocks = (n_rows + LOGDB_ROWS_PER_BLOCK - 1) / LOGDB_ROWS_PER_BLOCK;
+    return LOGDB_HEADER_SIZE + n_blocks * db->block_size;
+}
+
+/* Map the store up to the given size (at least) */
+static int map_store(riaps_ts_logdb* db, size_t size)
+{
+    struct stat st;
+    void* map;
+
+    if (db->map_size >= size) {
+        return 0;
+    }
+    if (fstat(db->fd, &st)) {
+        return -1;
+    }
+    if (st.st_size < size) {
+        if (!db->writable) {
+            errno = EIO;
+            return -1;
+        }
+        if (ftruncate(db->fd, size)) {
+            return -1;
+        }
+        st.st_size = size;
+    }
+
+    if (db->hdr) {
+        map = mremap(db->hdr, db->map_size, st.st_size, MREMAP_MAYMOVE);
+    }
+    else {
+        map = mmap(NULL, st.st_size, db->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, db->fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    db->hdr = map;
+    db->map_size = st.st_size;
+    return 0;
+}
+
+/* Published rows (the store is mapped to cover them) */
+static uint64_t published_rows(riaps_ts_logdb* db)
+{
+    uint64_t n_rows = atomic_load_explicit(&db->hdr->n_rows, memory_order_acquire);
+
+    if (map_store(db, store_size(db, n_rows))) {
+        return 0;
+    }
+    return n_rows;
+}
+
+
+riaps_ts_logdb* riaps_ts_logdb_open(const char* dir, int kind, int writable)
+{
+    riaps_ts_logdb* db;
+    struct stat st;
+    char path[PATH_MAX];
+
+    if (kind < 0 || kind >= RIAPS_TS_LOG_KINDS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (snprintf(path, sizeof(path), "%s/%s.logdb", dir ? dir : RIAPS_TS_LOGDB_DIR,
+                 kinds[kind].name) >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    db = calloc(1, sizeof(riaps_ts_logdb));
+    if (!db) {
+        return NULL;
+    }
+    db->kind = kind;
+    db->writable = writable;
+    db->last_source = -1;
+    db->block_size = LOGDB_BLOCK_HEADER_SIZE +
+                     LOGDB_ROWS_PER_BLOCK * (sizeof(int64_t) + sizeof(uint16_t) +
+                                             kinds[kind].n_columns * sizeof(float));
+
+    db->fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if (db->fd < 0) {
+        free(db);
+        return NULL;
+    }
+    if ((writable && flock(db->fd, LOCK_EX | LOCK_NB)) || fstat(db->fd, &st)) {
+        goto error;
+    }
+
+    if (st.st_size == 0 && writable) {
+        if (map_store(db, LOGDB_HEADER_SIZE)) {
+            goto error;
+        }
+        db->hdr->kind = kind;
+        db->hdr->n_columns = kinds[kind].n_columns;
+        db->hdr->rows_per_block = LOGDB_ROWS_PER_BLOCK;
+        db->hdr->version = LOGDB_VERSION;
+        db->hdr->magic = LOGDB_MAGIC;
+    }
+    else if (st.st_size < LOGDB_HEADER_SIZE) {
+        errno = EINVAL;
+        goto error;
+    }
+    else if (map_store(db, st.st_size)) {
+        goto error;
+    }
+
+    if (db->hdr->magic != LOGDB_MAGIC || db->hdr->version != LOGDB_VERSION || db->hdr->kind != kind ||
+        db->hdr->n_columns != kinds[kind].n_columns || db->hdr->rows_per_block != LOGDB_ROWS_PER_BLOCK) {
+        errno = EINVAL;
+        goto error;
+    }
+    return db;
+
+error:
+    riaps_ts_logdb_close(db);
+    return NULL;
+}
+
+
+void riaps_ts_logdb_close(riaps_ts_logdb* db)
+{
+    int saved_errno = errno;
+
+    if (db) {
+        if (db->hdr) {
+            if (db->writable) {
+                msync(db->hdr, db->map_size, MS_ASYNC);
+            }
+            munmap(db->hdr, db->map_size);
+        }
+        close(db->fd);
+        free(db->scratch);
+        free(db);
+    }
+    errno = saved_errno;
+}
+
+
+/*** Parsing and appending rows ***/
+
+/* Days since the epoch of a civil date (proleptic Gregorian) */
+static int64_t days_of_date(int64_t y, int m, int d)
+{
+    int64_t era;
+    int64_t yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/* Fixed width decimal field */
+static int digits(const char* s, int n)
+{
+    int value = 0;
+
+    for (; n > 0; n--, s++) {
+        if (*s < '0' || *s > '9') {
+            return -1;
+        }
+        value = value * 10 + *s - '0';
+    }
+    return value;
+}
+
+/* "YYYY-MM-DD" "HH:MM:SS[.ffffff]" */
+static int parse_time(const char* date, const char* time, int64_t* ns)
+{
+    int y, mo, d, h, mi, s;
+    int64_t frac = 0, scale = RIAPS_TS_NSEC_PER_SEC;
+
+    if (strlen(date) != 10 || strlen(time) < 8) {
+        return -1;
+    }
+    y = digits(date, 4);
+    mo = digits(date + 5, 2);
+    d = digits(date + 8, 2);
+    if (y < 0 || mo < 1 || mo > 12 || d < 1 || d > 31) {
+        return -1;
+    }
+    h = digits(time, 2);
+    mi = digits(time + 3, 2);
+    s = digits(time + 6, 2);
+    if (h < 0 || mi < 0 || s < 0) {
+        return -1;
+    }
+    if (time[8] == '.') {
+        for (time += 9; *time >= '0' && *time <= '9' && scale > 1; time++) {
+            scale /= 10;
+            frac += (*time - '0') * scale;
+        }
+    }
+    *ns = ((days_of_date(y, mo, d) * 86400 + h * 3600 + mi * 60 + s) * RIAPS_TS_NSEC_PER_SEC) + frac;
+    return 0;
+}
+
+static float parse_value(const char* token, int type)
+{
+    char* end;
+    double value;
+
+    if (type == COL_LEAP) {
+        switch (token[0]) {
+        case 'N':
+            return 0;
+        case '+':
+            return 1;
+        case '-':
+            return 2;
+        case '?':
+            return 3;
+        default:
+            return NAN;
+        }
+    }
+    value = strtod(token, &end);
+    return *end || end == token ? NAN : value;
+}
+
+static int source_id(riaps_ts_logdb* db, const char* name)
+{
+    struct logdb_header* hdr = db->hdr;
+    uint32_t n_sources = atomic_load(&hdr->n_sources);
+    uint32_t id;
+
+    if (db->last_source >= 0 && strcmp(hdr->sources[db->last_source], name) == 0) {
+        return db->last_source;
+    }
+    for (id = 0; id < n_sources; id++) {
+        if (strcmp(hdr->sources[id], name) == 0) {
+            return db->last_source = id;
+        }
+    }
+
+    /* New source (the last slot collects the rest) */
+    if (n_sources == LOGDB_MAX_SOURCES) {
+        return db->last_source = LOGDB_MAX_SOURCES - 1;
+    }
+    snprintf(hdr->sources[n_sources], RIAPS_TS_LOGDB_SOURCE_LENGTH, "%s",
+             n_sources == LOGDB_MAX_SOURCES - 1 ? LOGDB_OTHER_SOURCE : name);
+    atomic_store(&hdr->n_sources, n_sources + 1);
+    return db->last_source = n_sources;
+}
+
+static int append_row(struct ingest* in, int64_t t, const char* source, const float* values)
+{
+    riaps_ts_logdb* db = in->db;
+    struct logdb_header* hdr = db->hdr;
+    uint64_t n_rows = atomic_load_explicit(&hdr->n_rows, memory_order_relaxed);
+    struct block_summary* summary;
+    uint64_t block = n_rows / LOGDB_ROWS_PER_BLOCK;
+    int row = n_rows % LOGDB_ROWS_PER_BLOCK;
+    int column;
+
+    if (n_rows > 0 && (t < hdr->last_ns || (t == hdr->last_ns && !in->continuation))) {
+        return 0;
+    }
+    if (map_store(db, store_size(db, n_rows + 1))) {
+        return -1;
+    }
+    hdr = db->hdr;
+    summary = block_of(db, block);
+
+    if (row == 0) {
+        memset(summary, 0, sizeof(*summary));
+        summary->first_ns = t;
+    }
+    times_of(db, block)[row] = t;
+    sources_of(db, block)[row] = source_id(db, source);
+    for (column = 0; column < hdr->n_columns; column++) {
+        float value = values[column];
+
+        column_of(db, block, column)[row] = value;
+        if (isnan(value)) {
+            continue;
+        }
+        if (summary->count[column] == 0 || value < summary->min[column]) {
+            summary->min[column] = value;
+        }
+        if (summary->count[column] == 0 || value > summary->max[column]) {
+            summary->max[column] = value;
+        }
+        summary->count[column]++;
+        summary->sum[column] += value;
+    }
+    summary->last_ns = t;
+    summary->n_rows = row + 1;
+
+    if (n_rows == 0) {
+        hdr->first_ns = t;
+    }
+    hdr->last_ns = t;
+    atomic_store_explicit(&hdr->n_rows, n_rows + 1, memory_order_release);
+    in->continuation = 1;
+    in->added++;
+    return 0;
+}
+
+static int process_line(struct ingest* in, char* line)
+{
+    const struct kind_def* def = &kinds[in->db->kind];
+    char* tokens[LOGDB_MAX_TOKENS];
+    float values[LOGDB_MAX_COLUMNS];
+    char* save;
+    int n_tokens;
+    int64_t t;
+    int column;
+
+    /* Headers and separators */
+    if (line[0] < '0' || line[0] > '9') {
+        return 0;
+    }
+    for (n_tokens = 0, line = strtok_r(line, " \t", &save); line && n_tokens < LOGDB_MAX_TOKENS;
+         line = strtok_r(NULL, " \t", &save)) {
+        tokens[n_tokens++] = line;
+    }
+    if (n_tokens < def->min_tokens || parse_time(tokens[0], tokens[1], &t)) {
+        return 0;
+    }
+
+    for (column = 0; column < def->n_columns; column++) {
+        const struct column_def* col = &def->columns[column];
+        values[column] = col->token < n_tokens ? parse_value(tokens[col->token], col->type) : NAN;
+    }
+    return append_row(in, t, tokens[2], values);
+}
+
+/* Process the complete lines of a buffer, returns the number of bytes consumed or -1 */
+static ssize_t feed(struct ingest* in, const char* buf, size_t len, int eof)
+{
+    char line[LOGDB_MAX_LINE];
+    size_t pos = 0;
+
+    while (pos < len) {
+        const char* nl = memchr(buf + pos, '\n', len - pos);
+        size_t line_len = nl ? nl - (buf + pos) : len - pos;
+
+        if (!nl && !eof) {
+            break;
+        }
+        if (line_len < sizeof(line)) {
+            memcpy(line, buf + pos, line_len);
+            line[line_len] = '\0';
+            if (process_line(in, line)) {
+                return -1;
+            }
+        }
+        pos += line_len + (nl != NULL);
+        in->offset += line_len + (nl != NULL);
+        if (in->follow) {
+            in->db->hdr->log_offset = in->offset;
+        }
+    }
+    return pos;
+}
+
+/* Memory-mapped windows of a plain log from the given position */
+static int ingest_file(struct ingest* in, const char* path)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    while (in->offset < st.st_size) {
+        off_t base = in->offset & ~(page_size - 1);
+        size_t len = st.st_size - base < LOGDB_WINDOW ? st.st_size - base : LOGDB_WINDOW;
+        size_t skip = in->offset - base;
+        ssize_t consumed;
+        char* map;
+
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, base);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+        consumed = feed(in, map + skip, len - skip, 0);
+        munmap(map, len);
+        if (consumed < 0) {
+            close(fd);
+            return -1;
+        }
+        if (consumed == 0) {
+            if (base + len == st.st_size) {
+                break;  /* The last line is still being written */
+            }
+            /* No line break in a whole window, not a log */
+            in->offset = base + len;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+/* Compressed rotations through gzip */
+static int ingest_gzip(struct ingest* in, const char* path)
+{
+    char* buf;
+    size_t len = 0;
+    int pipe_fds[2];
+    int status;
+    pid_t pid;
+    int ret = 0;
+
+    buf = malloc(LOGDB_READ_CHUNK);
+    if (!buf || pipe2(pipe_fds, O_CLOEXEC)) {
+        free(buf);
+        return -1;
+    }
+    pid = fork();
+    if (pid == 0) {
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        execlp("gzip", "gzip", "-dc", "--", path, (char*)NULL);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        free(buf);
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t n = read(pipe_fds[0], buf + len, LOGDB_READ_CHUNK - len);
+        ssize_t consumed;
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            ret = -1;
+            break;
+        }
+        len += n;
+        consumed = feed(in, buf, len, n == 0);
+        if (consumed < 0) {
+            ret = -1;
+            break;
+        }
+        if (consumed == 0 && len == LOGDB_READ_CHUNK) {
+            consumed = len;     /* Overlong line */
+        }
+        memmove(buf, buf + consumed, len - consumed);
+        len -= consumed;
+        if (n == 0) {
+            break;
+        }
+    }
+    close(pipe_fds[0]);
+    free(buf);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    if (ret == 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        errno = EIO;
+        ret = -1;
+    }
+    return ret;
+}
+
+
+long long riaps_ts_logdb_update(riaps_ts_logdb* db, const char* path)
+{
+    struct logdb_header* hdr;
+    struct ingest in;
+    struct stat st, rotated_st;
+    char rotated[PATH_MAX];
+    size_t len;
+
+    if (!db || !path || !db->writable) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (stat(path, &st)) {
+        return -1;
+    }
+
+    memset(&in, 0, sizeof(in));
+    in.db = db;
+    len = strlen(path);
+    if (len > 3 && strcmp(path + len - 3, ".gz") == 0) {
+        return ingest_gzip(&in, path) ? -1 : in.added;
+    }
+
+    hdr = db->hdr;
+    if (st.st_dev != hdr->log_dev || st.st_ino != hdr->log_ino) {
+        /* Rotated: the rest of the followed file first */
+        if (hdr->log_ino && snprintf(rotated, sizeof(rotated), "%s.1", path) < sizeof(rotated) &&
+            stat(rotated, &rotated_st) == 0 && rotated_st.st_dev == hdr->log_dev &&
+            rotated_st.st_ino == hdr->log_ino) {
+            in.follow = 1;
+            in.continuation = 1;
+            in.offset = hdr->log_offset;
+            if (ingest_file(&in, rotated)) {
+                return -1;
+            }
+            hdr = db->hdr;
+        }
+        hdr->log_dev = st.st_dev;
+        hdr->log_ino = st.st_ino;
+        hdr->log_offset = 0;
+        in.continuation = 0;
+    }
+    else if (st.st_size < hdr->log_offset) {
+        /* Truncated */
+        hdr->log_offset = 0;
+    }
+    else {
+        in.continuation = 1;
+    }
+
+    in.follow = 1;
+    in.offset = hdr->log_offset;
+    return ingest_file(&in, path) ? -1 : in.added;
+}
+
+
+/*** Queries ***/
+
+int riaps_ts_logdb_info(riaps_ts_logdb* db, struct riaps_ts_logdb_info* info)
+{
+    uint64_t n_rows;
+
+    if (!db || !info) {
+        errno = EINVAL;
+        return -1;
+    }
+    n_rows = published_rows(db);
+    memset(info, 0, sizeof(*info));
+    info->kind = db->kind;
+    info->n_rows = n_rows;
+    info->n_sources = atomic_load(&db->hdr->n_sources);
+    if (n_rows > 0) {
+        riaps_ts_timespec_of_ns(db->hdr->first_ns, &info->first);
+        riaps_ts_timespec_of_ns(db->hdr->last_ns, &info->last);
+    }
+    return 0;
+}
+
+
+int riaps_ts_logdb_source(riaps_ts_logdb* db, const char* name)
+{
+    uint32_t n_sources;
+    uint32_t id;
+
+    if (!db || !name) {
+        return -1;
+    }
+    n_sources = atomic_load(&db->hdr->n_sources);
+    for (id = 0; id < n_sources; id++) {
+        if (strcmp(db->hdr->sources[id], name) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+
+int riaps_ts_logdb_source_name(riaps_ts_logdb* db, int source, char* name)
+{
+    if (!db || source < 0 || source >= atomic_load(&db->hdr->n_sources)) {
+        return -1;
+    }
+    memcpy(name, db->hdr->sources[source], RIAPS_TS_LOGDB_SOURCE_LENGTH);
+    name[RIAPS_TS_LOGDB_SOURCE_LENGTH - 1] = '\0';
+    return 0;
+}
+
+static uint64_t rows_in_block(uint64_t n_rows, uint64_t block)
+{
+    uint64_t rest = n_rows - block * LOGDB_ROWS_PER_BLOCK;
+    return rest < LOGDB_ROWS_PER_BLOCK ? rest : LOGDB_ROWS_PER_BLOCK;
+}
+
+/* Index of the first row at or after t (n_rows if none) */
+static uint64_t lower_bound(const riaps_ts_logdb* db, uint64_t n_rows, int64_t t)
+{
+    uint64_t lo = 0, hi = (n_rows + LOGDB_ROWS_PER_BLOCK - 1) / LOGDB_ROWS_PER_BLOCK;
+    uint64_t block;
+    const int64_t* times;
+
+    /* The first block ending at or after t */
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const int64_t* mid_times = times_of(db, mid);
+        if (mid_times[rows_in_block(n_rows, mid) - 1] < t) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    block = lo;
+    if (block * LOGDB_ROWS_PER_BLOCK >= n_rows) {
+        return n_rows;
+    }
+
+    times = times_of(db, block);
+    lo = 0;
+    hi = rows_in_block(n_rows, block);
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (times[mid] < t) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return block * LOGDB_ROWS_PER_BLOCK + lo;
+}
+
+typedef int (*span_fn)(riaps_ts_logdb* db, uint64_t n_rows, int64_t from, int64_t to, void* arg);
+
+/* Call fn for the time spans of the query (in time order) */
+static int for_each_span(riaps_ts_logdb* db, const struct riaps_ts_logdb_query* query, uint64_t n_rows,
+                         span_fn fn, void* arg)
+{
+    int64_t from = riaps_ts_ns_of_timespec(&query->from);
+    int64_t to = riaps_ts_ns_of_timespec(&query->to);
+    int64_t day;
+
+    if (n_rows == 0) {
+        return 0;
+    }
+    if (from == 0 || from < db->hdr->first_ns) {
+        from = db->hdr->first_ns;
+    }
+    if (to == 0 || to > db->hdr->last_ns) {
+        to = db->hdr->last_ns + 1;
+    }
+    if (query->tod_from < 0) {
+        return from < to ? fn(db, n_rows, from, to, arg) : 0;
+    }
+
+    /* A window spanning midnight starts on the previous day */
+    for (day = from / NSEC_PER_DAY - 1; day * NSEC_PER_DAY < to; day++) {
+        int64_t start = day * NSEC_PER_DAY + query->tod_from * RIAPS_TS_NSEC_PER_SEC;
+        int64_t end = day * NSEC_PER_DAY + query->tod_to * RIAPS_TS_NSEC_PER_SEC;
+
+        if (query->tod_to <= query->tod_from) {
+            end += NSEC_PER_DAY;
+        }
+        start = start > from ? start : from;
+        end = end < to ? end : to;
+        if (start < end && fn(db, n_rows, start, end, arg)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Statistics of a query */
+struct accum {
+    const struct riaps_ts_logdb_query* query;
+    int collect;                    /* The values are collected for the quantiles */
+    long long n;
+    double sum;
+    float min, max;
+    int64_t min_ns, max_ns;
+    int64_t min_block, max_block;   /* Block of the extremum from a summary (-1: time known) */
+};
+
+static int collect_value(riaps_ts_logdb* db, struct accum* acc, float value)
+{
+    if (acc->n >= db->scratch_capacity) {
+        size_t capacity = db->scratch_capacity ? 2 * db->scratch_capacity : LOGDB_ROWS_PER_BLOCK;
+        float* scratch = realloc(db->scratch, capacity * sizeof(float));
+        if (!scratch) {
+            return -1;
+        }
+        db->scratch = scratch;
+        db->scratch_capacity = capacity;
+    }
+    db->scratch[acc->n] = value;
+    return 0;
+}
+
+static int accumulate_span(riaps_ts_logdb* db, uint64_t n_rows, int64_t from, int64_t to, void* arg)
+{
+    struct accum* acc = arg;
+    const struct riaps_ts_logdb_query* query = acc->query;
+    uint64_t full_blocks = n_rows / LOGDB_ROWS_PER_BLOCK;
+    uint64_t r = lower_bound(db, n_rows, from);
+
+    while (r < n_rows) {
+        uint64_t block = r / LOGDB_ROWS_PER_BLOCK;
+        uint64_t i = r % LOGDB_ROWS_PER_BLOCK;
+        uint64_t n = rows_in_block(n_rows, block);
+        const struct block_summary* summary = block_of(db, block);
+        const int64_t* times = times_of(db, block);
+        const uint16_t* sources = sources_of(db, block);
+        const float* values = column_of(db, block, query->column);
+
+        if (times[i] >= to) {
+            break;
+        }
+
+        /* Whole blocks from the summaries */
+        if (i == 0 && block < full_blocks && summary->last_ns < to && !acc->collect && !query->absolute &&
+            query->source < 0) {
+            if (summary->count[query->column] > 0) {
+                if (acc->n == 0 || summary->min[query->column] < acc->min) {
+                    acc->min = summary->min[query->column];
+                    acc->min_block = block;
+                }
+                if (acc->n == 0 || summary->max[query->column] > acc->max) {
+                    acc->max = summary->max[query->column];
+                    acc->max_block = block;
+                }
+                acc->n += summary->count[query->column];
+                acc->sum += summary->sum[query->column];
+            }
+            r += LOGDB_ROWS_PER_BLOCK;
+            continue;
+        }
+
+        for (; i < n && times[i] < to; i++) {
+            float value = values[i];
+
+            if (isnan(value) || (query->source >= 0 && sources[i] != query->source)) {
+                continue;
+            }
+            if (query->absolute) {
+                value = fabsf(value);
+            }
+            if (acc->collect && collect_value(db, acc, value)) {
+                return -1;
+            }
+            if (acc->n == 0 || value < acc->min) {
+                acc->min = value;
+                acc->min_ns = times[i];
+                acc->min_block = -1;
+            }
+            if (acc->n == 0 || value > acc->max) {
+                acc->max = value;
+                acc->max_ns = times[i];
+                acc->max_block = -1;
+            }
+            acc->n++;
+            acc->sum += value;
+        }
+        if (i < n) {
+            break;
+        }
+        r = (block + 1) * LOGDB_ROWS_PER_BLOCK;
+    }
+    return 0;
+}
+
+/* Time of the first occurrence of a value in a block */
+static int64_t find_value(const riaps_ts_logdb* db, uint64_t block, int column, float value)
+{
+    const float* values = column_of(db, block, column);
+    int i;
+
+    for (i = 0; i < LOGDB_ROWS_PER_BLOCK - 1 && values[i] != value; i++);
+    return times_of(db, block)[i];
+}
+
+/* Partially sort the values so that values[k] is the k-th smallest one (Wirth) */
+static void select_nth(float* values, long n, long k)
+{
+    long lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        float pivot = values[k];
+        long i = lo, j = hi;
+
+        do {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (pivot < values[j]) {
+                j--;
+            }
+            if (i <= j) {
+                float tmp = values[i];
+                values[i++] = values[j];
+                values[j--] = tmp;
+            }
+        } while (i <= j);
+        if (j < k) {
+            lo = i;
+        }
+        if (k < i) {
+            hi = j;
+        }
+    }
+}
+
+static int compare_quantiles(const void* a, const void* b, void* arg)
+{
+    const double* quantiles = arg;
+    double qa = quantiles[*(const int*)a], qb = quantiles[*(const int*)b];
+    return qa < qb ? -1 : qa > qb;
+}
+
+/* Quantiles (linear interpolation) of the collected values, from the lowest one */
+static void compute_quantiles(riaps_ts_logdb* db, size_t n, const double* quantiles, double* values,
+                              int n_quantiles)
+{
+    int order[n_quantiles];
+    size_t lo = 0;
+    int i;
+
+    for (i = 0; i < n_quantiles; i++) {
+        order[i] = i;
+    }
+    qsort_r(order, n_quantiles, sizeof(int), compare_quantiles, (void*)quantiles);
+
+    for (i = 0; i < n_quantiles; i++) {
+        double q = quantiles[order[i]];
+        double pos = (q < 0 ? 0 : q > 1 ? 1 : q) * (n - 1);
+        size_t k = (size_t)pos;
+        float next;
+        size_t j;
+
+        /* The values below the previous quantile stay below */
+        select_nth(db->scratch + lo, n - lo, k - lo);
+        lo = k;
+        next = db->scratch[k];
+        if (k + 1 < n) {
+            next = db->scratch[k + 1];
+            for (j = k + 2; j < n; j++) {
+                next = db->scratch[j] < next ? db->scratch[j] : next;
+            }
+        }
+        values[order[i]] = db->scratch[k] + (pos - k) * ((double)next - db->scratch[k]);
+    }
+}
+
+
+int riaps_ts_logdb_stats(riaps_ts_logdb* db, const struct riaps_ts_logdb_query* query,
+                         struct riaps_ts_logdb_stats* stats, const double* quantiles, double* values,
+                         int n_quantiles)
+{
+    struct accum acc;
+    uint64_t n_rows;
+    int i;
+
+    if (!db || !query || !stats || n_quantiles < 0 || (n_quantiles > 0 && (!quantiles || !values)) ||
+        query->column < 0 || query->column >= kinds[db->kind].n_columns) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&acc, 0, sizeof(acc));
+    acc.query = query;
+    acc.collect = n_quantiles > 0;
+    acc.min_block = acc.max_block = -1;
+    n_rows = published_rows(db);
+    if (for_each_span(db, query, n_rows, accumulate_span, &acc)) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->n = acc.n;
+    for (i = 0; i < n_quantiles; i++) {
+        values[i] = NAN;
+    }
+    if (acc.n == 0) {
+        stats->mean = stats->min = stats->max = NAN;
+        return 0;
+    }
+
+    if (acc.min_block >= 0) {
+        acc.min_ns = find_value(db, acc.min_block, query->column, acc.min);
+    }
+    if (acc.max_block >= 0) {
+        acc.max_ns = find_value(db, acc.max_block, query->column, acc.max);
+    }
+    stats->mean = acc.sum / acc.n;
+    stats->min = acc.min;
+    stats->max = acc.max;
+    riaps_ts_timespec_of_ns(acc.min_ns, &stats->min_time);
+    riaps_ts_timespec_of_ns(acc.max_ns, &stats->max_time);
+    if (n_quantiles > 0) {
+        compute_quantiles(db, acc.n, quantiles, values, n_quantiles);
+    }
+    return 0;
+}
+
+/* Reference changes of a query */
+struct switches {
+    struct riaps_ts_logdb_switch* switches;
+    int max_switches;
+    long long n;
+};
+
+static int switches_span(riaps_ts_logdb* db, uint64_t n_rows, int64_t from, int64_t to, void* arg)
+{
+    struct switches* sw = arg;
+    uint64_t r = lower_bound(db, n_rows, from);
+    int prev = -1;
+
+    /* Compared to the row before the span */
+    if (r > 0) {
+        prev = sources_of(db, (r - 1) / LOGDB_ROWS_PER_BLOCK)[(r - 1) % LOGDB_ROWS_PER_BLOCK];
+    }
+    for (; r < n_rows; r++) {
+        uint64_t block = r / LOGDB_ROWS_PER_BLOCK;
+        uint64_t i = r % LOGDB_ROWS_PER_BLOCK;
+        int64_t t = times_of(db, block)[i];
+        int source = sources_of(db, block)[i];
+
+        if (t >= to) {
+            break;
+        }
+        if (prev >= 0 && source != prev) {
+            if (sw->n < sw->max_switches) {
+                struct riaps_ts_logdb_switch* s = &sw->switches[sw->n];
+                riaps_ts_timespec_of_ns(t, &s->time);
+                s->from = prev;
+                s->to = source;
+            }
+            sw->n++;
+        }
+        prev = source;
+    }
+    return 0;
+}
+
+
+long long riaps_ts_logdb_switches(riaps_ts_logdb* db, const struct riaps_ts_logdb_query* query,
+                                  struct riaps_ts_logdb_switch* switches, int max_switches)
+{
+    struct switches sw;
+
+    if (!db || !query || (max_switches > 0 && !switches) || db->kind != RIAPS_TS_LOG_TRACKING) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sw.switches = switches;
+    sw.max_switches = max_switches;
+    sw.n = 0;
+    if (for_each_span(db, query, published_rows(db), switches_span, &sw)) {
+        return -1;
+    }
+    return sw.n;
+}
@@ -0,0 +1,241 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_LOGDB_H_
+#define _RIAPS_TS_LOGDB_H_
+
+
+/**
+ * @file riaps_ts_logdb.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Indexed store of the chrony logs.
+ *
+ * The statistics logs of chrony (@c tracking, @c measurements, @c statistics and
+ * @c refclocks in @c /var/log/chrony) are converted into compact columnar stores, one
+ * file for each kind of log. A store is a sequence of fixed-size blocks of rows in time
+ * order: every block holds the timestamps, the source IDs and the numeric columns in
+ * separate arrays, and a summary (time span, minimum, maximum and sum of every column).
+ * Range queries find the first block by binary search on the block headers and only
+ * touch the rows in range, excursions and means of whole blocks come from the summaries.
+ *
+ * The logs are read in bounded memory-mapped windows (compressed rotations through
+ * @c gzip), and the store remembers the position in the live log, so later updates
+ * only parse the new lines (following the rotation of the log). A store has a single
+ * writer (enforced by a file lock), readers may query it while it is being updated.
+ * The times of the logs (and the queries) are UTC.
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_LOGDB_DIR "/var/lib/riaps-timesync/logdb"  /**< Default directory of the stores */
+#define RIAPS_TS_LOG_DIR "/var/log/chrony"                  /**< Default log directory of chrony */
+#define RIAPS_TS_LOGDB_SOURCE_LENGTH 48                     /**< Buffer size of a source name */
+
+/*** Kinds of logs (stores) ***/
+#define RIAPS_TS_LOG_TRACKING 0
+#define RIAPS_TS_LOG_MEASUREMENTS 1
+#define RIAPS_TS_LOG_STATISTICS 2
+#define RIAPS_TS_LOG_REFCLOCKS 3
+#define RIAPS_TS_LOG_KINDS 4
+
+/**
+ * @brief Columnar store of a chrony log
+ */
+typedef struct riaps_ts_logdb riaps_ts_logdb;
+
+/**
+ * @brief Contents of a store
+ */
+struct riaps_ts_logdb_info {
+    int kind;                       /**< Kind of the log @see RIAPS_TS_LOG_TRACKING */
+    long long n_rows;               /**< Number of rows */
+    int n_sources;                  /**< Number of distinct sources */
+    struct riaps_ts_timespec first; /**< Time of the first row */
+    struct riaps_ts_timespec last;  /**< Time of the last row */
+};
+
+/**
+ * @brief Selection of the rows of a query
+ *
+ * A zero @c from / @c to means the beginning / end of the store. With a daily window
+ * only the rows within [@c tod_from, @c tod_to) seconds of the UTC days are selected
+ * (the window may span midnight, i.e. @c tod_to < @c tod_from).
+ */
+struct riaps_ts_logdb_query {
+    struct riaps_ts_timespec from;  /**< Start of the time range (inclusive) */
+    struct riaps_ts_timespec to;    /**< End of the time range (exclusive) */
+    int tod_from;                   /**< Start of the daily window (secs of the day), -1 for whole days */
+    int tod_to;                     /**< End of the daily window (secs of the day) */
+    int source;                     /**< Source ID or -1 for all the sources @see riaps_ts_logdb_source() */
+    int column;                     /**< The column of the statistics @see riaps_ts_logdb_column() */
+    int absolute;                   /**< Non-zero for statistics of the absolute values */
+};
+
+/**
+ * @brief Statistics of a column over the selected rows
+ */
+struct riaps_ts_logdb_stats {
+    long long n;                    /**< Number of values (missing values are not counted) */
+    double mean;                    /**< Mean of the values */
+    double min;                     /**< Minimum */
+    double max;                     /**< Maximum */
+    struct riaps_ts_timespec min_time;  /**< Time of the (first) minimum */
+    struct riaps_ts_timespec max_time;  /**< Time of the (first) maximum */
+};
+
+/**
+ * @brief Change of the synchronization reference (tracking logs)
+ */
+struct riaps_ts_logdb_switch {
+    struct riaps_ts_timespec time;  /**< Time of the first row with the new reference */
+    int from;                       /**< Source ID of the previous reference */
+    int to;                         /**< Source ID of the new reference */
+};
+
+/**
+ * @brief Name of a kind of log (as in the file names of chrony, e.g. "tracking").
+ *
+ * @param kind The kind of the log
+ * @return The name or NULL for invalid kinds.
+ */
+const char* riaps_ts_logdb_kind_name(int kind);
+
+/**
+ * @brief Look up a kind of log by name.
+ *
+ * @param name The name of the log @see riaps_ts_logdb_kind_name()
+ * @return The kind or -1, if unknown.
+ */
+int riaps_ts_logdb_kind(const char* name);
+
+/**
+ * @brief Number of the numeric columns of a kind of log.
+ */
+int riaps_ts_logdb_n_columns(int kind);
+
+/**
+ * @brief Name of a numeric column (e.g. "offset", "freq_ppm").
+ *
+ * @param kind The kind of the log
+ * @param column The index of the column
+ * @return The name or NULL for invalid columns.
+ */
+const char* riaps_ts_logdb_column_name(int kind, int column);
+
+/**
+ * @brief Look up a numeric column by name.
+ *
+ * @param kind The kind of the log
+ * @param name The name of the column
+ * @return The index of the column or -1, if unknown.
+ */
+int riaps_ts_logdb_column(int kind, const char* name);
+
+/**
+ * @brief Open (or create) the store of a log.
+ *
+ * @param dir The directory of the stores (NULL for @c RIAPS_TS_LOGDB_DIR)
+ * @param kind The kind of the log
+ * @param writable Non-zero to update the store (created if missing, fails with
+ *                 EWOULDBLOCK if another process is updating it)
+ * @return The store or NULL on failure.
+ */
+riaps_ts_logdb* riaps_ts_logdb_open(const char* dir, int kind, int writable);
+
+/**
+ * @brief Close a store.
+ *
+ * @param db The store
+ */
+void riaps_ts_logdb_close(riaps_ts_logdb* db);
+
+/**
+ * @brief Add the new lines of a log file to a writable store.
+ *
+ * The live log is continued from the position of the last update. After its rotation
+ * the rest of the rotated file (@c path.1) is added first. Other files (e.g. older
+ * rotations, also gzip compressed ones) only contribute rows newer than the store,
+ * so they are to be added in time order (oldest first).
+ *
+ * @param db The store opened for writing
+ * @param path The log file
+ * @return The number of rows added or -1 on failure.
+ */
+long long riaps_ts_logdb_update(riaps_ts_logdb* db, const char* path);
+
+/**
+ * @brief Query the contents of a store.
+ *
+ * @param db The store
+ * @param info Pre-allocated buffer to receive the information
+ * @return Zero on success.
+ */
+int riaps_ts_logdb_info(riaps_ts_logdb* db, struct riaps_ts_logdb_info* info);
+
+/**
+ * @brief Look up a source (IP address or reference ID) of a store.
+ *
+ * @param db The store
+ * @param name The name of the source as it appears in the log
+ * @return The source ID or -1, if the source does not appear in the store.
+ */
+int riaps_ts_logdb_source(riaps_ts_logdb* db, const char* name);
+
+/**
+ * @brief Name of a source of a store.
+ *
+ * @param db The store
+ * @param source The source ID
+ * @param name Buffer of @c RIAPS_TS_LOGDB_SOURCE_LENGTH bytes to receive the name
+ * @return Zero on success, -1 for invalid source IDs.
+ */
+int riaps_ts_logdb_source_name(riaps_ts_logdb* db, int source, char* name);
+
+/**
+ * @brief Compute the statistics and quantiles of a column over the selected rows.
+ *
+ * @param db The store
+ * @param query The selection and the column
+ * @param stats Pre-allocated buffer to receive the statistics
+ * @param quantiles The requested quantiles in [0, 1] (may be NULL)
+ * @param values Pre-allocated array to receive the value of each quantile
+ * @param n_quantiles Number of the requested quantiles
+ * @return Zero on success (@c stats->n is zero if no value has been selected).
+ */
+int riaps_ts_logdb_stats(riaps_ts_logdb* db, const struct riaps_ts_logdb_query* query,
+                         struct riaps_ts_logdb_stats* stats, const double* quantiles, double* values,
+                         int n_quantiles);
+
+/**
+ * @brief List the changes of the synchronization reference (tracking logs only).
+ *
+ * The column, source and absolute fields of the query are ignored.
+ *
+ * @param db The store of the tracking log
+ * @param query The selection of the rows
+ * @param switches Pre-allocated array to receive the changes (in time order)
+ * @param max_switches Size of the array
+ * @return The number of changes (may exceed @c max_switches) or -1 on failure.
+ */
+long long riaps_ts_logdb_switches(riaps_ts_logdb* db, const struct riaps_ts_logdb_query* query,
+                                  struct riaps_ts_logdb_switch* switches, int max_switches);
+
+#endif /* _RIAPS_TS_LOGDB_H_ */
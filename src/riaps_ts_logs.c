@@ -0,0 +1,556 @@
+/*
+    RIAPS Timesync Service - chrony log analyzer
+
+    Converts the statistics logs of chrony (/var/log/chrony) into indexed
+    columnar stores (see riaps_ts_logdb.h), keeps them up to date and answers
+    range queries: statistics and quantiles of a column (optionally within a
+    daily window, e.g. 02:00-03:00 of every day of the last week), excursions
+    and the changes of the synchronization reference.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "riaps_ts_logdb.h"
+
+#define DEFAULT_INTERVAL_MS 1000
+#define MAX_ROTATIONS 64
+#define MAX_QUANTILES 16
+#define MAX_SWITCHES 1024
+#define DEFAULT_QUANTILES "0.5,0.9,0.99,0.999"
+
+static const char* db_dir = RIAPS_TS_LOGDB_DIR;
+static volatile sig_atomic_t running = 1;
+
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+
+static double elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+
+static const char* format_time(const struct riaps_ts_timespec* ts, char* buf, size_t size)
+{
+    time_t t = ts->tv_sec;
+    struct tm tm;
+
+    strftime(buf, size, "%Y-%m-%d %H:%M:%S", gmtime_r(&t, &tm));
+    return buf;
+}
+
+
+/* "YYYY-MM-DD[ HH:MM[:SS]]" (UTC), "@epoch", "now" or relative to now: "-7d", "-12h", "-30m", "-10s" */
+static int parse_time(const char* s, struct riaps_ts_timespec* ts)
+{
+    struct tm tm;
+    char* end;
+    long value;
+
+    memset(ts, 0, sizeof(*ts));
+    if (strcmp(s, "now") == 0) {
+        ts->tv_sec = time(NULL);
+        return 0;
+    }
+    if (s[0] == '@') {
+        ts->tv_sec = strtol(s + 1, &end, 10);
+        return *end ? -1 : 0;
+    }
+    if (s[0] == '-') {
+        value = strtol(s + 1, &end, 10);
+        switch (*end) {
+        case 'd':
+            value *= 86400;
+            break;
+        case 'h':
+            value *= 3600;
+            break;
+        case 'm':
+            value *= 60;
+            break;
+        case 's':
+            break;
+        default:
+            return -1;
+        }
+        ts->tv_sec = time(NULL) - value;
+        return end[1] ? -1 : 0;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%Y-%m-%d", &tm);
+    if (end && (*end == ' ' || *end == 'T')) {
+        char* rest = strptime(end + 1, "%H:%M:%S", &tm);
+        end = rest ? rest : strptime(end + 1, "%H:%M", &tm);
+    }
+    if (!end || *end) {
+        return -1;
+    }
+    ts->tv_sec = timegm(&tm);
+    return 0;
+}
+
+
+/* "HH:MM-HH:MM" */
+static int parse_window(const char* s, int* from, int* to)
+{
+    int h1, m1, h2, m2;
+    char tail;
+
+    if (sscanf(s, "%d:%d-%d:%d%c", &h1, &m1, &h2, &m2, &tail) != 4 || h1 < 0 || h1 > 24 || m1 < 0 ||
+        m1 > 59 || h2 < 0 || h2 > 24 || m2 < 0 || m2 > 59) {
+        return -1;
+    }
+    *from = (h1 * 60 + m1) * 60 % 86400;
+    *to = (h2 * 60 + m2) * 60 % 86400;
+    return 0;
+}
+
+
+static int mkdirs(const char* path)
+{
+    char buf[PATH_MAX];
+    char* p;
+
+    if (snprintf(buf, sizeof(buf), "%s", path) >= sizeof(buf)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    for (p = buf + 1; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(buf, 0755) && errno != EEXIST) {
+                return -1;
+            }
+            if (!c) {
+                return 0;
+            }
+            *p = c;
+        }
+    }
+}
+
+
+/*** update ***/
+
+struct rotation {
+    int n;
+    char path[PATH_MAX];
+};
+
+static int compare_rotations(const void* a, const void* b)
+{
+    return ((const struct rotation*)b)->n - ((const struct rotation*)a)->n;
+}
+
+/* Add the rotated logs (newer than the store, oldest first) and the live log */
+static long long update_kind(riaps_ts_logdb* db, int kind, const char* log_dir, int rotations)
+{
+    const char* name = riaps_ts_logdb_kind_name(kind);
+    struct rotation rot[MAX_ROTATIONS];
+    struct riaps_ts_logdb_info info;
+    char live[PATH_MAX];
+    size_t name_len = strlen(name);
+    int n_rot = 0;
+    long long added = 0, n;
+    int i;
+
+    if (rotations) {
+        struct dirent* entry;
+        DIR* dir = opendir(log_dir);
+
+        riaps_ts_logdb_info(db, &info);
+        while (dir && (entry = readdir(dir)) && n_rot < MAX_ROTATIONS) {
+            char* end;
+            struct stat st;
+
+            /* <name>.log.N[.gz] */
+            if (strncmp(entry->d_name, name, name_len) || strncmp(entry->d_name + name_len, ".log.", 5)) {
+                continue;
+            }
+            rot[n_rot].n = strtol(entry->d_name + name_len + 5, &end, 10);
+            if (end == entry->d_name + name_len + 5 || (*end && strcmp(end, ".gz"))) {
+                continue;
+            }
+            snprintf(rot[n_rot].path, sizeof(rot[n_rot].path), "%s/%s", log_dir, entry->d_name);
+            if (stat(rot[n_rot].path, &st) == 0 && (info.n_rows == 0 || st.st_mtime >= info.last.tv_sec)) {
+                n_rot++;
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        qsort(rot, n_rot, sizeof(rot[0]), compare_rotations);
+    }
+
+    for (i = 0; i < n_rot; i++) {
+        n = riaps_ts_logdb_update(db, rot[i].path);
+        if (n < 0) {
+            fprintf(stderr, "WARNING: %s: %s\n", rot[i].path, strerror(errno));
+            continue;
+        }
+        added += n;
+    }
+
+    snprintf(live, sizeof(live), "%s/%s.log", log_dir, name);
+    n = riaps_ts_logdb_update(db, live);
+    if (n < 0 && errno != ENOENT) {
+        fprintf(stderr, "WARNING: %s: %s\n", live, strerror(errno));
+    }
+    return added + (n > 0 ? n : 0);
+}
+
+static int cmd_update(int argc, char* argv[])
+{
+    riaps_ts_logdb* dbs[RIAPS_TS_LOG_KINDS] = {NULL};
+    const char* log_dir = RIAPS_TS_LOG_DIR;
+    unsigned int interval_ms = DEFAULT_INTERVAL_MS;
+    int follow = 0;
+    int n_logs;
+    int kind;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "l:fi:")) != -1) {
+        switch (opt) {
+        case 'l':
+            log_dir = optarg;
+            break;
+        case 'f':
+            follow = 1;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (interval_ms == 0) {
+        return -1;
+    }
+
+    if (mkdirs(db_dir)) {
+        perror(db_dir);
+        return 1;
+    }
+    /* All the logs by default */
+    n_logs = optind == argc ? RIAPS_TS_LOG_KINDS : argc - optind;
+    for (i = 0; i < n_logs; i++) {
+        struct timespec start;
+        long long added;
+
+        kind = optind == argc ? i : riaps_ts_logdb_kind(argv[optind + i]);
+        if (kind < 0) {
+            fprintf(stderr, "ERROR: unknown log: %s\n", argv[optind + i]);
+            return 1;
+        }
+        if (dbs[kind]) {
+            continue;
+        }
+        dbs[kind] = riaps_ts_logdb_open(db_dir, kind, 1);
+        if (!dbs[kind]) {
+            fprintf(stderr, "ERROR: %s/%s.logdb: %s\n", db_dir, riaps_ts_logdb_kind_name(kind), strerror(errno));
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        added = update_kind(dbs[kind], kind, log_dir, 1);
+        printf("%s: %lld rows added in %.1f ms\n", riaps_ts_logdb_kind_name(kind), added, elapsed_ms(&start));
+    }
+    fflush(stdout);
+
+    /* The stores are kept open (and locked) while following the logs */
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    while (follow && running) {
+        struct timespec delay = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+
+        nanosleep(&delay, NULL);
+        for (kind = 0; kind < RIAPS_TS_LOG_KINDS && running; kind++) {
+            if (dbs[kind]) {
+                update_kind(dbs[kind], kind, log_dir, 0);
+            }
+        }
+    }
+
+    for (kind = 0; kind < RIAPS_TS_LOG_KINDS; kind++) {
+        riaps_ts_logdb_close(dbs[kind]);
+    }
+    return 0;
+}
+
+
+/*** info ***/
+
+static int cmd_info(int argc, char* argv[])
+{
+    int kind;
+
+    for (kind = 0; kind < RIAPS_TS_LOG_KINDS; kind++) {
+        riaps_ts_logdb* db = riaps_ts_logdb_open(db_dir, kind, 0);
+        struct riaps_ts_logdb_info info;
+        char first[32], last[32], name[RIAPS_TS_LOGDB_SOURCE_LENGTH];
+        int i;
+
+        if (!db) {
+            printf("%s: %s\n", riaps_ts_logdb_kind_name(kind), strerror(errno));
+            continue;
+        }
+        riaps_ts_logdb_info(db, &info);
+        printf("%s: %lld rows", riaps_ts_logdb_kind_name(kind), info.n_rows);
+        if (info.n_rows > 0) {
+            printf(" [%s, %s] UTC", format_time(&info.first, first, sizeof(first)),
+                   format_time(&info.last, last, sizeof(last)));
+        }
+        printf("\n\tsources:");
+        for (i = 0; i < info.n_sources; i++) {
+            riaps_ts_logdb_source_name(db, i, name);
+            printf(" %s", name);
+        }
+        printf("\n\tcolumns:");
+        for (i = 0; i < riaps_ts_logdb_n_columns(kind); i++) {
+            printf(" %s", riaps_ts_logdb_column_name(kind, i));
+        }
+        printf("\n");
+        riaps_ts_logdb_close(db);
+    }
+    return 0;
+}
+
+
+/*** stats and switches ***/
+
+/* Options of the selection of rows, returns the index of the first other option */
+static int parse_query(int argc, char* argv[], const char* extra, struct riaps_ts_logdb_query* query,
+                       const char** source, const char** quantiles)
+{
+    char optstring[32];
+    int opt;
+
+    memset(query, 0, sizeof(*query));
+    query->tod_from = query->tod_to = -1;
+    query->source = -1;
+    snprintf(optstring, sizeof(optstring), "s:e:w:%s", extra);
+    while ((opt = getopt(argc, argv, optstring)) != -1) {
+        switch (opt) {
+        case 's':
+            if (parse_time(optarg, &query->from)) {
+                fprintf(stderr, "ERROR: invalid time: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'e':
+            if (parse_time(optarg, &query->to)) {
+                fprintf(stderr, "ERROR: invalid time: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'w':
+            if (parse_window(optarg, &query->tod_from, &query->tod_to)) {
+                fprintf(stderr, "ERROR: invalid daily window: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'S':
+            *source = optarg;
+            break;
+        case 'a':
+            query->absolute = 1;
+            break;
+        case 'q':
+            *quantiles = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return optind;
+}
+
+static int cmd_stats(int argc, char* argv[])
+{
+    struct riaps_ts_logdb_query query;
+    struct riaps_ts_logdb_stats stats;
+    struct timespec start;
+    const char* source = NULL;
+    const char* quantile_spec = DEFAULT_QUANTILES;
+    double quantiles[MAX_QUANTILES], values[MAX_QUANTILES];
+    char min_time[32], max_time[32];
+    riaps_ts_logdb* db;
+    int n_quantiles = 0;
+    int kind;
+    int i;
+
+    i = parse_query(argc, argv, "S:aq:", &query, &source, &quantile_spec);
+    if (i < 0 || argc - i != 2) {
+        return -1;
+    }
+    kind = riaps_ts_logdb_kind(argv[i]);
+    query.column = riaps_ts_logdb_column(kind, argv[i + 1]);
+    if (kind < 0 || query.column < 0) {
+        fprintf(stderr, "ERROR: unknown log or column: %s %s\n", argv[i], argv[i + 1]);
+        return 1;
+    }
+    while (*quantile_spec && n_quantiles < MAX_QUANTILES) {
+        char* end;
+
+        quantiles[n_quantiles] = strtod(quantile_spec, &end);
+        if (end == quantile_spec || (*end && *end != ',') || quantiles[n_quantiles] < 0 ||
+            quantiles[n_quantiles] > 1) {
+            fprintf(stderr, "ERROR: invalid quantiles: %s\n", quantile_spec);
+            return 1;
+        }
+        n_quantiles++;
+        quantile_spec = *end ? end + 1 : end;
+    }
+
+    db = riaps_ts_logdb_open(db_dir, kind, 0);
+    if (!db) {
+        fprintf(stderr, "ERROR: %s/%s.logdb: %s\n", db_dir, argv[i], strerror(errno));
+        return 1;
+    }
+    if (source) {
+        query.source = riaps_ts_logdb_source(db, source);
+        if (query.source < 0) {
+            fprintf(stderr, "ERROR: unknown source: %s\n", source);
+            riaps_ts_logdb_close(db);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (riaps_ts_logdb_stats(db, &query, &stats, quantiles, values, n_quantiles)) {
+        perror("ERROR: riaps_ts_logdb_stats()");
+        riaps_ts_logdb_close(db);
+        return 1;
+    }
+    printf("%s %s%s: %lld values (%.1f ms)\n", argv[i], query.absolute ? "|" : "", argv[i + 1],
+           stats.n, elapsed_ms(&start));
+    if (stats.n > 0) {
+        printf("\tmean: %.6g\n"
+               "\tmin: %.6g at %s\n"
+               "\tmax: %.6g at %s\n",
+               stats.mean,
+               stats.min, format_time(&stats.min_time, min_time, sizeof(min_time)),
+               stats.max, format_time(&stats.max_time, max_time, sizeof(max_time)));
+        printf("\tmax excursion: %.6g at %s\n", fabs(stats.max) >= fabs(stats.min) ? stats.max : stats.min,
+               fabs(stats.max) >= fabs(stats.min) ? max_time : min_time);
+        for (i = 0; i < n_quantiles; i++) {
+            printf("\tp%g: %.6g\n", quantiles[i] * 100, values[i]);
+        }
+    }
+    riaps_ts_logdb_close(db);
+    return 0;
+}
+
+static int cmd_switches(int argc, char* argv[])
+{
+    struct riaps_ts_logdb_query query;
+    struct riaps_ts_logdb_switch switches[MAX_SWITCHES];
+    char time[32], from[RIAPS_TS_LOGDB_SOURCE_LENGTH], to[RIAPS_TS_LOGDB_SOURCE_LENGTH];
+    riaps_ts_logdb* db;
+    long long n;
+    int i;
+
+    if (parse_query(argc, argv, "", &query, NULL, NULL) != argc) {
+        return -1;
+    }
+    db = riaps_ts_logdb_open(db_dir, RIAPS_TS_LOG_TRACKING, 0);
+    if (!db) {
+        fprintf(stderr, "ERROR: %s/tracking.logdb: %s\n", db_dir, strerror(errno));
+        return 1;
+    }
+    n = riaps_ts_logdb_switches(db, &query, switches, MAX_SWITCHES);
+    if (n < 0) {
+        perror("ERROR: riaps_ts_logdb_switches()");
+        riaps_ts_logdb_close(db);
+        return 1;
+    }
+    for (i = 0; i < n && i < MAX_SWITCHES; i++) {
+        riaps_ts_logdb_source_name(db, switches[i].from, from);
+        riaps_ts_logdb_source_name(db, switches[i].to, to);
+        printf("%s %s -> %s\n", format_time(&switches[i].time, time, sizeof(time)), from, to);
+    }
+    printf("%lld reference changes\n", n);
+    riaps_ts_logdb_close(db);
+    return 0;
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-d db_dir] update [-l log_dir] [-f] [-i interval_ms] [log ...]\n"
+                    "       %s [-d db_dir] info\n"
+                    "       %s [-d db_dir] stats [-s from] [-e to] [-w HH:MM-HH:MM] [-S source] [-a] "
+                    "[-q quantiles] log column\n"
+                    "       %s [-d db_dir] switches [-s from] [-e to] [-w HH:MM-HH:MM]\n"
+                    "logs: tracking, measurements, statistics, refclocks (see info for the columns)\n"
+                    "times (UTC): YYYY-MM-DD[ HH:MM[:SS]], @epoch, now, -<n>{d,h,m,s}\n",
+            prog, prog, prog, prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* prog = argv[0];
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "+d:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            db_dir = optarg;
+            break;
+        default:
+            usage(prog);
+            exit(-1);
+        }
+    }
+    if (optind == argc) {
+        usage(prog);
+        exit(-1);
+    }
+
+    /* The options of the command */
+    argc -= optind;
+    argv += optind;
+    optind = 1;
+    if (strcmp(argv[0], "update") == 0) {
+        ret = cmd_update(argc, argv);
+    }
+    else if (strcmp(argv[0], "info") == 0) {
+        ret = cmd_info(argc, argv);
+    }
+    else if (strcmp(argv[0], "stats") == 0) {
+        ret = cmd_stats(argc, argv);
+    }
+    else if (strcmp(argv[0], "switches") == 0) {
+        ret = cmd_switches(argc, argv);
+    }
+    else {
+        ret = -1;
+    }
+    if (ret < 0) {
+        usage(prog);
+        exit(-1);
+    }
+    return ret;
+}
@@ -0,0 +1,322 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_phc.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Direct access to the PTP hardware clock (implementation).
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/ethtool.h>
+#include <linux/ptp_clock.h>
+#include <linux/sockios.h>
+
+#include "riaps_ts_phc.h"
+#include "riaps_ts_util.h"
+
+#define PHC_SAMPLES 5   /* Number of reads to select the tightest one from */
+
+#define FD_TO_CLOCKID(fd) ((~(clockid_t)(fd) << 3) | 3)
+
+struct riaps_ts_phc {
+    int fd;                 /* -1 for the software stand-in clock */
+    clockid_t clock_id;
+    _Atomic int method;     /* Best working cross-timestamp method */
+    int64_t sw_base_raw;    /* Software clock: CLOCK_MONOTONIC_RAW at opening */
+    int64_t sw_base;        /* Software clock: its time at opening */
+    double sw_rate;         /* Software clock: 1 + frequency error */
+};
+
+/* Look up the PHC device of a network interface */
+static int phc_of_interface(const char* ifname, char* device, size_t len)
+{
+    struct ethtool_ts_info info;
+    struct ifreq ifr;
+    int sock, ret;
+
+    if (strlen(ifname) >= sizeof(ifr.ifr_name)) {
+        return -1;
+    }
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    memset(&info, 0, sizeof(info));
+    info.cmd = ETHTOOL_GET_TS_INFO;
+    strcpy(ifr.ifr_name, ifname);
+    ifr.ifr_data = (char*)&info;
+    ret = ioctl(sock, SIOCETHTOOL, &ifr);
+    close(sock);
+    if (ret < 0) {
+        return -1;
+    }
+    if (info.phc_index < 0) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    snprintf(device, len, "/dev/ptp%d", info.phc_index);
+    return 0;
+}
+
+static int open_software(riaps_ts_phc* phc, const char* spec)
+{
+    long long offset = 0;
+    double ppm = 0.0;
+
+    if (spec[strlen(RIAPS_TS_PHC_SOFTWARE)] == ':' &&
+        sscanf(spec + strlen(RIAPS_TS_PHC_SOFTWARE) + 1, "%lld:%lf", &offset, &ppm) < 1) {
+        return -1;
+    }
+
+    phc->fd = -1;
+    phc->clock_id = CLOCK_MONOTONIC_RAW;
+    phc->method = RIAPS_TS_PHC_METHOD_SOFTWARE;
+    phc->sw_base_raw = riaps_ts_clock_ns(CLOCK_MONOTONIC_RAW);
+    phc->sw_base = riaps_ts_clock_ns(CLOCK_REALTIME) + offset;
+    phc->sw_rate = 1.0 + ppm * 1e-6;
+    return 0;
+}
+
+static int64_t software_time(const riaps_ts_phc* phc, int64_t raw)
+{
+    return phc->sw_base + (int64_t)((raw - phc->sw_base_raw) * phc->sw_rate);
+}
+
+
+riaps_ts_phc* riaps_ts_phc_open(const char* device)
+{
+    riaps_ts_phc* phc;
+    char path[32];
+
+    if (!device) {
+        device = RIAPS_TS_PHC_DEFAULT;
+    }
+
+    phc = calloc(1, sizeof(riaps_ts_phc));
+    if (!phc) {
+        return NULL;
+    }
+
+    if (strncmp(device, RIAPS_TS_PHC_SOFTWARE, strlen(RIAPS_TS_PHC_SOFTWARE)) == 0 &&
+        (device[strlen(RIAPS_TS_PHC_SOFTWARE)] == '\0' || device[strlen(RIAPS_TS_PHC_SOFTWARE)] == ':')) {
+        if (open_software(phc, device)) {
+            free(phc);
+            return NULL;
+        }
+        return phc;
+    }
+
+    if (device[0] != '/') {
+        if (phc_of_interface(device, path, sizeof(path))) {
+            free(phc);
+            return NULL;
+        }
+        device = path;
+    }
+
+    phc->fd = open(device, O_RDONLY | O_CLOEXEC);
+    if (phc->fd < 0) {
+        free(phc);
+        return NULL;
+    }
+    phc->clock_id = FD_TO_CLOCKID(phc->fd);
+    phc->method = RIAPS_TS_PHC_METHOD_PRECISE;
+    return phc;
+}
+
+
+void riaps_ts_phc_close(riaps_ts_phc* phc)
+{
+    if (phc) {
+        if (phc->fd >= 0) {
+            close(phc->fd);
+        }
+        free(phc);
+    }
+}
+
+
+clockid_t riaps_ts_phc_clockid(riaps_ts_phc* phc)
+{
+    return phc->clock_id;
+}
+
+
+int riaps_ts_phc_gettime(riaps_ts_phc* phc, struct riaps_ts_timespec* res)
+{
+    struct timespec tp;
+
+    if (!phc || !res) {
+        return -1;
+    }
+    if (phc->method == RIAPS_TS_PHC_METHOD_SOFTWARE) {
+        riaps_ts_timespec_of_ns(software_time(phc, riaps_ts_clock_ns(CLOCK_MONOTONIC_RAW)), res);
+        return 0;
+    }
+    if (clock_gettime(phc->clock_id, &tp)) {
+        return -1;
+    }
+    res->tv_sec = tp.tv_sec;
+    res->tv_nsec = tp.tv_nsec;
+    return 0;
+}
+
+/* Tightest (system time before, PHC time, system time after) triplet */
+static void best_triplet(int64_t* phc_ns, int64_t* sys_ns, int64_t* window,
+                         int64_t before, int64_t phc_time, int64_t after)
+{
+    if (*window < 0 || after - before < *window) {
+        *window = after - before;
+        *phc_ns = phc_time;
+        *sys_ns = before + (after - before) / 2;
+    }
+}
+
+static int64_t ns_of_ptp_clock_time(const struct ptp_clock_time* t)
+{
+    return t->sec * RIAPS_TS_NSEC_PER_SEC + t->nsec;
+}
+
+static int sample_precise(riaps_ts_phc* phc, int64_t* phc_ns, int64_t* sys_ns, int64_t* window)
+{
+    struct ptp_sys_offset_precise req;
+
+    memset(&req, 0, sizeof(req));
+    if (ioctl(phc->fd, PTP_SYS_OFFSET_PRECISE, &req)) {
+        return -1;
+    }
+    *phc_ns = ns_of_ptp_clock_time(&req.device);
+    *sys_ns = ns_of_ptp_clock_time(&req.sys_realtime);
+    *window = 0;
+    return 0;
+}
+
+static int sample_extended(riaps_ts_phc* phc, int64_t* phc_ns, int64_t* sys_ns, int64_t* window)
+{
+    struct ptp_sys_offset_extended req;
+    unsigned int i;
+
+    memset(&req, 0, sizeof(req));
+    req.n_samples = PHC_SAMPLES;
+    if (ioctl(phc->fd, PTP_SYS_OFFSET_EXTENDED, &req)) {
+        return -1;
+    }
+    *window = -1;
+    for (i = 0; i < req.n_samples; i++) {
+        best_triplet(phc_ns, sys_ns, window,
+                     ns_of_ptp_clock_time(&req.ts[i][0]),
+                     ns_of_ptp_clock_time(&req.ts[i][1]),
+                     ns_of_ptp_clock_time(&req.ts[i][2]));
+    }
+    return 0;
+}
+
+static int sample_basic(riaps_ts_phc* phc, int64_t* phc_ns, int64_t* sys_ns, int64_t* window)
+{
+    struct ptp_sys_offset req;
+    unsigned int i;
+
+    memset(&req, 0, sizeof(req));
+    req.n_samples = PHC_SAMPLES;
+    if (ioctl(phc->fd, PTP_SYS_OFFSET, &req)) {
+        return -1;
+    }
+    /* System and PHC times are interleaved: sys, phc, sys, ..., phc, sys */
+    *window = -1;
+    for (i = 0; i < req.n_samples; i++) {
+        best_triplet(phc_ns, sys_ns, window,
+                     ns_of_ptp_clock_time(&req.ts[2 * i]),
+                     ns_of_ptp_clock_time(&req.ts[2 * i + 1]),
+                     ns_of_ptp_clock_time(&req.ts[2 * i + 2]));
+    }
+    return 0;
+}
+
+static int sample_software(riaps_ts_phc* phc, int64_t* phc_ns, int64_t* sys_ns, int64_t* window)
+{
+    int i;
+
+    *window = -1;
+    for (i = 0; i < PHC_SAMPLES; i++) {
+        int64_t before = riaps_ts_clock_ns(CLOCK_REALTIME);
+        int64_t raw = riaps_ts_clock_ns(CLOCK_MONOTONIC_RAW);
+        int64_t after = riaps_ts_clock_ns(CLOCK_REALTIME);
+        best_triplet(phc_ns, sys_ns, window, before, software_time(phc, raw), after);
+    }
+    return 0;
+}
+
+
+int riaps_ts_phc_sample(riaps_ts_phc* phc, struct riaps_ts_phc_sample* sample)
+{
+    int64_t phc_ns, sys_ns, window;
+    int ret = -1;
+
+    if (!phc || !sample) {
+        return -1;
+    }
+
+    /* Fall back to the less accurate methods, unsupported ones are not tried again */
+    switch (phc->method) {
+    case RIAPS_TS_PHC_METHOD_PRECISE:
+        ret = sample_precise(phc, &phc_ns, &sys_ns, &window);
+        if (ret == 0 || errno == EINTR || errno == EBUSY) {
+            break;
+        }
+        phc->method = RIAPS_TS_PHC_METHOD_EXTENDED;
+        /* fall through */
+    case RIAPS_TS_PHC_METHOD_EXTENDED:
+        ret = sample_extended(phc, &phc_ns, &sys_ns, &window);
+        if (ret == 0 || errno == EINTR || errno == EBUSY) {
+            break;
+        }
+        phc->method = RIAPS_TS_PHC_METHOD_BASIC;
+        /* fall through */
+    case RIAPS_TS_PHC_METHOD_BASIC:
+        ret = sample_basic(phc, &phc_ns, &sys_ns, &window);
+        break;
+    case RIAPS_TS_PHC_METHOD_SOFTWARE:
+        ret = sample_software(phc, &phc_ns, &sys_ns, &window);
+        break;
+    }
+    if (ret) {
+        return -1;
+    }
+
+    riaps_ts_timespec_of_ns(phc_ns, &sample->phc);
+    riaps_ts_timespec_of_ns(sys_ns, &sample->sys);
+    sample->offset = phc_ns - sys_ns;
+    sample->uncertainty = window / 2;
+    sample->method = phc->method;
+    return 0;
+}
@@ -0,0 +1,116 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_PHC_H_
+#define _RIAPS_TS_PHC_H_
+
+
+/**
+ * @file riaps_ts_phc.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Direct access to the PTP hardware clock (PHC).
+ *
+ * On PTP slaves the NIC's hardware clock is disciplined by ptp4l directly, while the
+ * system clock (CLOCK_REALTIME) follows it through the phc2sys servo. Measurement
+ * oriented applications can timestamp against the hardware clock through this module
+ * and get the (cross-timestamped) PHC to system clock offset as well.
+ *
+ * Note, that ptp4l keeps the PHC on the PTP timescale (TAI), so PHC timestamps
+ * are ahead of the system clock (UTC) by the current TAI-UTC offset.
+ *
+ * A software stand-in clock (@c RIAPS_TS_PHC_SOFTWARE) is provided for testing on
+ * machines without a PHC.
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_PHC_DEFAULT "/dev/ptp0" /**< Default PHC device @see riaps_ts_phc_open() */
+#define RIAPS_TS_PHC_SOFTWARE "sw"       /**< Software stand-in clock @see riaps_ts_phc_open() */
+
+#define RIAPS_TS_PHC_METHOD_PRECISE 0   /**< Hardware cross-timestamp (PTP_SYS_OFFSET_PRECISE) */
+#define RIAPS_TS_PHC_METHOD_EXTENDED 1  /**< System time bracketing the PHC read (PTP_SYS_OFFSET_EXTENDED) */
+#define RIAPS_TS_PHC_METHOD_BASIC 2     /**< Interleaved system and PHC reads (PTP_SYS_OFFSET) */
+#define RIAPS_TS_PHC_METHOD_SOFTWARE 3  /**< Software stand-in clock */
+
+/**
+ * @brief An opened PTP hardware clock
+ */
+typedef struct riaps_ts_phc riaps_ts_phc;
+
+/**
+ * @brief Simultaneous readings of the PHC and the system clock
+ */
+struct riaps_ts_phc_sample {
+    struct riaps_ts_timespec phc;   /**< PHC time */
+    struct riaps_ts_timespec sys;   /**< System (synchronized) time at the same instant */
+    long long offset;               /**< PHC - system time (nanosecs) */
+    long long uncertainty;          /**< Half width of the window the PHC was read in (nanosecs) */
+    int method;                     /**< The measurement method @see RIAPS_TS_PHC_METHOD_PRECISE */
+};
+
+/**
+ * @brief Open a PTP hardware clock.
+ *
+ * @param device The PHC device (e.g. "/dev/ptp0"), a network interface with a PHC
+ *        (e.g. "eth0"), NULL for @c RIAPS_TS_PHC_DEFAULT or the software stand-in clock:
+ *        "sw[:offset_ns[:ppm]]" (offset and frequency error relative to the system
+ *        clock at the time of opening)
+ * @return The clock or NULL on failure.
+ */
+riaps_ts_phc* riaps_ts_phc_open(const char* device);
+
+/**
+ * @brief Close a PTP hardware clock.
+ *
+ * @param phc The clock opened by riaps_ts_phc_open()
+ */
+void riaps_ts_phc_close(riaps_ts_phc* phc);
+
+/**
+ * @brief Get the POSIX clock id of the PHC (for clock_gettime() and friends).
+ *
+ * @param phc The clock opened by riaps_ts_phc_open()
+ * @return The clock id (CLOCK_MONOTONIC_RAW for the software stand-in clock).
+ */
+clockid_t riaps_ts_phc_clockid(riaps_ts_phc* phc);
+
+/**
+ * @brief Read the PHC directly.
+ *
+ * @param phc The clock opened by riaps_ts_phc_open()
+ * @param res The current time of the PHC
+ * @return Zero on success, -1 on failure.
+ */
+int riaps_ts_phc_gettime(riaps_ts_phc* phc, struct riaps_ts_timespec* res);
+
+/**
+ * @brief Cross-timestamp the PHC and the system clock.
+ *
+ * Uses the most accurate method supported by the device driver (precise hardware
+ * cross-timestamp, then the best of a few bracketed or interleaved reads).
+ *
+ * @param phc The clock opened by riaps_ts_phc_open()
+ * @param sample The simultaneous readings of the clocks
+ * @return Zero on success, -1 on failure.
+ */
+int riaps_ts_phc_sample(riaps_ts_phc* phc, struct riaps_ts_phc_sample* sample);
+
+#endif /* _RIAPS_TS_PHC_H_ */
@@ -0,0 +1,243 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_ptp.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - PTP (ptp4l) status (implementation).
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+
+#include "riaps_ts_ptp.h"
+#include "riaps_ts_ctx.h"
+
+#define PTP_MAX_PORTS 16
+
+/* Management socket of the default contexts */
+static pthread_mutex_t default_ptp_endpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static char default_ptp_endpoint[PMC_ENDPOINT_LENGTH] = RIAPS_TS_PTP_ENDPOINT;
+static _Atomic unsigned int default_ptp_endpoint_gen = 0;
+
+/* Responses of a status query */
+struct ptp_query {
+    struct riaps_ts_ptp_status* ptp;
+    uint16_t ports[PTP_MAX_PORTS];
+};
+
+
+static void clock_identity_name(const uint8_t* id, char* name)
+{
+    snprintf(name, RIAPS_TS_PTP_IDENTITY_LENGTH, "%02x%02x%02x.%02x%02x.%02x%02x%02x",
+             id[0], id[1], id[2], id[3], id[4], id[5], id[6], id[7]);
+}
+
+
+/* Preference of port states, when a clock has several ports */
+static int port_state_rank(int state)
+{
+    switch (state) {
+    case RIAPS_TS_PTP_SLAVE:
+        return 4;
+    case RIAPS_TS_PTP_UNCALIBRATED:
+        return 3;
+    case RIAPS_TS_PTP_MASTER:
+        return 2;
+    case RIAPS_TS_PTP_PASSIVE:
+    case RIAPS_TS_PTP_PRE_MASTER:
+    case RIAPS_TS_PTP_LISTENING:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+
+static void on_response(const pmc_xfer* xfer, const pmc_msg* rep, int data_len, void* arg)
+{
+    struct ptp_query* query = arg;
+    struct riaps_ts_ptp_status* ptp = query->ptp;
+
+    switch (xfer->id) {
+    case PMC_ID_TIME_STATUS_NP:
+        if (data_len >= sizeof(pmc_time_status_np)) {
+            const pmc_time_status_np* tsn = &rep->data.time_status_np;
+            ptp->master_offset = (int64_t)be64toh(tsn->master_offset) * 1e-9;
+            ptp->gm_present = ntohl(tsn->gm_present) != 0;
+            clock_identity_name(tsn->gm_identity, ptp->grandmaster);
+        }
+        break;
+
+    case PMC_ID_CURRENT_DATA_SET:
+        if (data_len >= sizeof(pmc_current_data_set)) {
+            const pmc_current_data_set* cds = &rep->data.current_data_set;
+            ptp->steps_removed = ntohs(cds->steps_removed);
+            ptp->mean_path_delay = pmc_seconds_of_interval((int64_t)be64toh(cds->mean_path_delay));
+        }
+        break;
+
+    case PMC_ID_PARENT_DATA_SET:
+        if (data_len >= sizeof(pmc_parent_data_set)) {
+            const pmc_parent_data_set* pds = &rep->data.parent_data_set;
+            char name[RIAPS_TS_PTP_IDENTITY_LENGTH];
+
+            clock_identity_name(pds->parent_port.clock_identity, name);
+            snprintf(ptp->parent_port, sizeof(ptp->parent_port), "%.18s-%u", name,
+                     ntohs(pds->parent_port.port_number));
+            ptp->gm_priority1 = pds->gm_priority1;
+            ptp->gm_priority2 = pds->gm_priority2;
+            ptp->gm_clock_class = pds->gm_clock_class;
+            ptp->gm_clock_accuracy = pds->gm_clock_accuracy;
+        }
+        break;
+
+    case PMC_ID_PORT_DATA_SET:
+        if (data_len >= sizeof(pmc_port_data_set)) {
+            const pmc_port_data_set* pds = &rep->data.port_data_set;
+            uint16_t port = ntohs(pds->port_identity.port_number);
+            int i;
+
+            /* Every port answers, retransmitted requests are answered again */
+            for (i = 0; i < ptp->n_ports && query->ports[i] != port; i++);
+            if (i < ptp->n_ports || i == PTP_MAX_PORTS) {
+                break;
+            }
+            query->ports[ptp->n_ports++] = port;
+            if (ptp->n_ports == 1 || port_state_rank(pds->port_state) > port_state_rank(ptp->port_state)) {
+                ptp->port_state = pds->port_state;
+                ptp->port_number = port;
+            }
+        }
+        break;
+    }
+}
+
+
+int riaps_ts_ptp_status_r(riaps_ts_ctx* ctx, struct riaps_ts_ptp_status* ptp)
+{
+    struct ptp_query query;
+    /* The per-port request goes first: the responses of all the ports precede the others */
+    pmc_xfer xfers[] = {
+        {.id = PMC_ID_PORT_DATA_SET},
+        {.id = PMC_ID_TIME_STATUS_NP},
+        {.id = PMC_ID_CURRENT_DATA_SET},
+        {.id = PMC_ID_PARENT_DATA_SET},
+    };
+    int i;
+
+    if (!ctx || !ptp) {
+        return -1;
+    }
+
+    memset(ptp, 0, sizeof(*ptp));
+    query.ptp = ptp;
+    riaps_ts_gettime(&ptp->query_time);
+    if (pmc_request_many(&ctx->pmc, xfers, sizeof(xfers) / sizeof(xfers[0]), on_response, &query)) {
+        return -1;
+    }
+    for (i = 0; i < sizeof(xfers) / sizeof(xfers[0]); i++) {
+        if (xfers[i].status != 0) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static riaps_ts_ctx* default_ptp_ctx()
+{
+    riaps_ts_ctx* ctx = riaps_ts_default_ctx();
+    unsigned int gen;
+
+    if (!ctx) {
+        return NULL;
+    }
+    gen = atomic_load(&default_ptp_endpoint_gen);
+    if (ctx->pmc_endpoint_gen != gen) {
+        pthread_mutex_lock(&default_ptp_endpoint_lock);
+        pmc_client_set_endpoint(&ctx->pmc, default_ptp_endpoint);
+        ctx->pmc_endpoint_gen = atomic_load(&default_ptp_endpoint_gen);
+        pthread_mutex_unlock(&default_ptp_endpoint_lock);
+    }
+    return ctx;
+}
+
+
+int riaps_ts_ptp_status(struct riaps_ts_ptp_status* ptp)
+{
+    return riaps_ts_ptp_status_r(default_ptp_ctx(), ptp);
+}
+
+
+int riaps_ts_status_ex_r(riaps_ts_ctx* ctx, struct riaps_ts_status_ex* stat)
+{
+    struct riap_ts_status* status;
+
+    if (!ctx || !stat) {
+        return -1;
+    }
+
+    stat->tracking_valid = riaps_ts_tracking_r(ctx, &stat->tracking) == 0;
+    stat->ptp_valid = riaps_ts_ptp_status_r(ctx, &stat->ptp) == 0;
+
+    /* The PHC reference of chrony is only valid while ptp4l is synchronized to a master */
+    status = &stat->tracking.status;
+    if (stat->tracking_valid && status->reference == RIAPS_TS_REF_PTP &&
+        (!stat->ptp_valid || stat->ptp.port_state != RIAPS_TS_PTP_SLAVE)) {
+        status->reference = RIAPS_TS_REF_NONE;
+    }
+    return stat->tracking_valid || stat->ptp_valid ? 0 : -1;
+}
+
+
+int riaps_ts_status_ex(struct riaps_ts_status_ex* stat)
+{
+    return riaps_ts_status_ex_r(default_ptp_ctx(), stat);
+}
+
+
+int riaps_ts_set_ptp_endpoint(const char* endpoint)
+{
+    if (endpoint && (strlen(endpoint) >= sizeof(default_ptp_endpoint) || endpoint[0] != '/')) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&default_ptp_endpoint_lock);
+    strcpy(default_ptp_endpoint, endpoint ? endpoint : RIAPS_TS_PTP_ENDPOINT);
+    atomic_fetch_add(&default_ptp_endpoint_gen, 1);
+    pthread_mutex_unlock(&default_ptp_endpoint_lock);
+    return 0;
+}
+
+
+int riaps_ts_ctx_set_ptp_endpoint(riaps_ts_ctx* ctx, const char* endpoint)
+{
+    if (!ctx) {
+        return -1;
+    }
+    return pmc_client_set_endpoint(&ctx->pmc, endpoint);
+}
@@ -0,0 +1,142 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+#ifndef _RIAPS_TS_PTP_H_
+#define _RIAPS_TS_PTP_H_
+
+
+/**
+ * @file riaps_ts_ptp.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - PTP (ptp4l) status.
+ *
+ * On PTP nodes chrony only sees the PHC reference clock, which is disciplined by
+ * ptp4l. This module queries ptp4l directly with PTP management messages (like the
+ * @c pmc utility, but without forking it) over its Unix domain socket: the port
+ * state, the offset from the master, the mean path delay and the grandmaster. The
+ * requests are pipelined, so a query typically takes a single round-trip time.
+ * Accessing the socket of ptp4l requires root privileges.
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_PTP_ENDPOINT "/var/run/ptp4l" /**< Default management socket of ptp4l @see riaps_ts_set_ptp_endpoint() */
+#define RIAPS_TS_PTP_IDENTITY_LENGTH 32 /**< Buffer size of printable clock and port identities */
+
+#define RIAPS_TS_PTP_INITIALIZING 1 /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_FAULTY 2       /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_DISABLED 3     /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_LISTENING 4    /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_PRE_MASTER 5   /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_MASTER 6       /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_PASSIVE 7      /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_UNCALIBRATED 8 /**< PTP port state @see riaps_ts_ptp_status */
+#define RIAPS_TS_PTP_SLAVE 9        /**< PTP port state @see riaps_ts_ptp_status */
+
+/**
+ * @brief Status of the local PTP clock (ptp4l)
+ */
+struct riaps_ts_ptp_status {
+    int port_state;             /**< State of the (most synchronized) port @see RIAPS_TS_PTP_SLAVE */
+    int port_number;            /**< Number of that port */
+    int n_ports;                /**< Number of ports of the clock */
+    double master_offset;       /**< Last offset of the clock from the master (secs) */
+    double mean_path_delay;     /**< Mean propagation delay to the master (secs) */
+    int steps_removed;          /**< Number of communication paths to the grandmaster */
+    int gm_present;             /**< Non-zero, if a grandmaster is present */
+    char grandmaster[RIAPS_TS_PTP_IDENTITY_LENGTH]; /**< Clock identity of the grandmaster (e.g. "001122.fffe.334455") */
+    char parent_port[RIAPS_TS_PTP_IDENTITY_LENGTH]; /**< Port identity of the master (e.g. "001122.fffe.334455-1") */
+    int gm_priority1;           /**< Priority1 of the grandmaster */
+    int gm_priority2;           /**< Priority2 of the grandmaster */
+    int gm_clock_class;         /**< Clock class of the grandmaster (e.g. 6: synchronized to GPS) */
+    int gm_clock_accuracy;      /**< Clock accuracy of the grandmaster (IEEE 1588 enumeration) */
+    struct riaps_ts_timespec query_time; /**< System time when ptp4l was queried for this information */
+};
+
+/**
+ * @brief Combined status of chrony and ptp4l
+ */
+struct riaps_ts_status_ex {
+    int tracking_valid;         /**< Non-zero, if the tracking information is valid */
+    struct riaps_ts_tracking tracking; /**< Tracking information of chrony @see riaps_ts_tracking() */
+    int ptp_valid;              /**< Non-zero, if the PTP status is valid (ptp4l is running) */
+    struct riaps_ts_ptp_status ptp; /**< Status of ptp4l @see riaps_ts_ptp_status() */
+};
+
+/**
+ * @brief Query the status of ptp4l.
+ *
+ * Fails immediately (ENOENT), if ptp4l is not running.
+ *
+ * @param ptp Pre-allocated buffer to receive the status.
+ * @return Zero, if succeeded and a valid status is provided.
+ */
+int riaps_ts_ptp_status(struct riaps_ts_ptp_status* ptp);
+
+/**
+ * @brief Reentrant version of riaps_ts_ptp_status() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param ptp Pre-allocated buffer to receive the status.
+ * @return Zero, if succeeded and a valid status is provided.
+ */
+int riaps_ts_ptp_status_r(riaps_ts_ctx* ctx, struct riaps_ts_ptp_status* ptp);
+
+/**
+ * @brief Get the tracking information of chrony and the status of ptp4l.
+ *
+ * The tracking information is read as by riaps_ts_tracking() (from the shared
+ * memory cache if available). On a PTP slave, whose chrony reference is the PHC,
+ * the reference is reported as @c RIAPS_TS_REF_NONE while the port of ptp4l is not
+ * in the @c RIAPS_TS_PTP_SLAVE state.
+ *
+ * @param stat Pre-allocated buffer to receive the status.
+ * @return Zero, if any of the parts is valid.
+ */
+int riaps_ts_status_ex(struct riaps_ts_status_ex* stat);
+
+/**
+ * @brief Reentrant version of riaps_ts_status_ex() using the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param stat Pre-allocated buffer to receive the status.
+ * @return Zero, if any of the parts is valid.
+ */
+int riaps_ts_status_ex_r(riaps_ts_ctx* ctx, struct riaps_ts_status_ex* stat);
+
+/**
+ * @brief Select the management socket of ptp4l (for the default contexts).
+ *
+ * @param endpoint Absolute path of the socket or NULL for @c RIAPS_TS_PTP_ENDPOINT
+ * @return Zero, if the endpoint specification is valid.
+ */
+int riaps_ts_set_ptp_endpoint(const char* endpoint);
+
+/**
+ * @brief Select the management socket of ptp4l for the given context.
+ *
+ * @param ctx The context created by riaps_ts_ctx_create()
+ * @param endpoint Absolute path of the socket or NULL for @c RIAPS_TS_PTP_ENDPOINT
+ * @return Zero, if the endpoint specification is valid.
+ */
+int riaps_ts_ctx_set_ptp_endpoint(riaps_ts_ctx* ctx, const char* endpoint);
+
+#endif // _RIAPS_TS_PTP_H_
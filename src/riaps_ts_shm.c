@@ -0,0 +1,185 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_shm.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Node-wide shared memory status cache (implementation).
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "riaps_ts_shm.h"
+#include "riaps_ts_util.h"
+
+static _Atomic(struct riaps_ts_shm*) shm_view = NULL;
+static _Atomic int64_t shm_next_attach_ns = 0;
+
+struct riaps_ts_shm* riaps_ts_shm_create(unsigned int period_ms)
+{
+    struct riaps_ts_shm* shm;
+    int fd;
+
+    fd = shm_open(RIAPS_TS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    /* Readers may still have the segment mapped, so it is reused, not recreated */
+    if (ftruncate(fd, sizeof(struct riaps_ts_shm))) {
+        close(fd);
+        return NULL;
+    }
+    fchmod(fd, 0644);   /* shm_open() is subject to the umask */
+
+    shm = mmap(NULL, sizeof(struct riaps_ts_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Invalidate the previous contents before (re)initializing the header */
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    shm->valid = 0;
+    shm->size = sizeof(struct riaps_ts_shm);
+    shm->version = RIAPS_TS_SHM_VERSION;
+    shm->period_ms = period_ms ? period_ms : RIAPS_TS_SHM_PERIOD_MS;
+    shm->updated_ns = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+    shm->magic = RIAPS_TS_SHM_MAGIC;
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_release);
+
+    return shm;
+}
+
+
+void riaps_ts_shm_publish(struct riaps_ts_shm* shm, const struct riaps_ts_tracking* trk, int valid)
+{
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    shm->valid = valid && trk;
+    if (shm->valid) {
+        memcpy(&shm->tracking, trk, sizeof(shm->tracking));
+    }
+    shm->updated_ns = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+
+    atomic_fetch_add_explicit(&shm->seq, 1, memory_order_release);
+}
+
+
+void riaps_ts_shm_destroy(struct riaps_ts_shm* shm)
+{
+    if (shm) {
+        munmap(shm, sizeof(struct riaps_ts_shm));
+    }
+}
+
+
+static struct riaps_ts_shm* attach_shm()
+{
+    struct riaps_ts_shm* shm;
+    struct riaps_ts_shm* expected = NULL;
+    struct stat st;
+    int64_t now;
+    int fd;
+
+    shm = atomic_load_explicit(&shm_view, memory_order_acquire);
+    if (shm) {
+        return shm;
+    }
+
+    /* Do not hammer /dev/shm when the publisher is not running */
+    now = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+    if (now < atomic_load_explicit(&shm_next_attach_ns, memory_order_relaxed)) {
+        return NULL;
+    }
+    atomic_store_explicit(&shm_next_attach_ns, now + RIAPS_TS_SHM_ATTACH_RETRY_MS * 1000000LL,
+                          memory_order_relaxed);
+
+    fd = shm_open(RIAPS_TS_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < sizeof(struct riaps_ts_shm)) {
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(struct riaps_ts_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Another thread might have been faster */
+    if (!atomic_compare_exchange_strong(&shm_view, &expected, shm)) {
+        munmap(shm, sizeof(struct riaps_ts_shm));
+        shm = expected;
+    }
+    return shm;
+}
+
+
+int riaps_ts_shm_read(struct riaps_ts_tracking* trk)
+{
+    const struct riaps_ts_shm* shm;
+    uint32_t seq_begin, seq_end;
+    uint32_t period_ms;
+    int64_t updated_ns;
+    int valid;
+    int i;
+
+    shm = attach_shm();
+    if (!shm) {
+        return -1;
+    }
+
+    for (i = 0; i < RIAPS_TS_SHM_READ_RETRIES; i++) {
+        seq_begin = atomic_load_explicit(&shm->seq, memory_order_acquire);
+        if (seq_begin & 1) {
+            continue;
+        }
+        if (shm->magic != RIAPS_TS_SHM_MAGIC || shm->version != RIAPS_TS_SHM_VERSION) {
+            return -1;
+        }
+        valid = shm->valid;
+        period_ms = shm->period_ms;
+        updated_ns = shm->updated_ns;
+        memcpy(trk, &shm->tracking, sizeof(*trk));
+        atomic_thread_fence(memory_order_acquire);
+        seq_end = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+        if (seq_begin == seq_end) {
+            break;
+        }
+    }
+    if (i == RIAPS_TS_SHM_READ_RETRIES) {
+        return -1;
+    }
+
+    if (riaps_ts_clock_ns(CLOCK_MONOTONIC) - updated_ns > (int64_t)period_ms * RIAPS_TS_SHM_STALE_PERIODS * 1000000LL) {
+        return -1;
+    }
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_SHM_H_
+#define _RIAPS_TS_SHM_H_
+
+
+/**
+ * @file riaps_ts_shm.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Node-wide shared memory status cache.
+ *
+ * A single publisher (@c riaps_tsd) polls chrony periodically and stores the
+ * decoded tracking information in a POSIX shared memory segment. Readers map
+ * the segment once and access it through a sequence lock, so a status query
+ * costs no system calls and no communication with chrony. The functions in this
+ * module are not supposed to be used by application level code, but provided
+ * for higher-level interfaces in the riaps-timesync service.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_SHM_NAME "/riaps_ts_status" /**< Name of the shared memory object (in /dev/shm) */
+#define RIAPS_TS_SHM_MAGIC 0x52545353        /**< Segment identifier ("RTSS") */
+#define RIAPS_TS_SHM_VERSION 2               /**< Layout version of the segment */
+
+#define RIAPS_TS_SHM_PERIOD_MS 250           /**< Default publishing period in milliseconds */
+#define RIAPS_TS_SHM_STALE_PERIODS 4         /**< Data is stale after this many missed publishing periods */
+#define RIAPS_TS_SHM_ATTACH_RETRY_MS 1000    /**< Minimum time between attempts to attach to the segment */
+#define RIAPS_TS_SHM_READ_RETRIES 64         /**< Number of sequence lock read attempts before giving up */
+
+/**
+ * @brief Layout of the shared memory segment
+ */
+struct riaps_ts_shm {
+    uint32_t magic;                 /**< Always RIAPS_TS_SHM_MAGIC */
+    uint32_t version;               /**< Always RIAPS_TS_SHM_VERSION */
+    uint32_t size;                  /**< Size of this structure */
+    uint32_t period_ms;             /**< Publishing period of the publisher */
+    _Atomic uint32_t seq;           /**< Sequence lock counter (odd while an update is in progress) */
+    int32_t valid;                  /**< Non-zero, if chrony provided valid tracking data */
+    int64_t updated_ns;             /**< CLOCK_MONOTONIC time of the last update (nanosecs) */
+    struct riaps_ts_tracking tracking; /**< The last tracking information */
+};
+
+/**
+ * @brief Create (or reuse) and map the shared memory segment for publishing.
+ *
+ * @param period_ms The intended publishing period, used by the readers for staleness detection.
+ * @return Pointer to the mapped segment or NULL on failure.
+ */
+struct riaps_ts_shm* riaps_ts_shm_create(unsigned int period_ms);
+
+/**
+ * @brief Publish new tracking information into the segment.
+ *
+ * There must be only a single publisher for a segment.
+ *
+ * @param shm Pointer to the segment mapped by riaps_ts_shm_create()
+ * @param trk The tracking information to be published (ignored, if @c valid is zero)
+ * @param valid Zero, if chrony could not be queried successfully.
+ */
+void riaps_ts_shm_publish(struct riaps_ts_shm* shm, const struct riaps_ts_tracking* trk, int valid);
+
+/**
+ * @brief Unmap the published segment.
+ *
+ * The segment is not removed, so readers will detect the missing publisher by staleness.
+ *
+ * @param shm Pointer to the segment mapped by riaps_ts_shm_create()
+ */
+void riaps_ts_shm_destroy(struct riaps_ts_shm* shm);
+
+/**
+ * @brief Read the published tracking information.
+ *
+ * The segment is attached on demand. Once attached, reading involves no system calls.
+ *
+ * @param trk Pre-allocated buffer to receive the tracking information.
+ * @return Zero, if valid data was read, positive if the publisher is running but
+ *         could not query chrony, negative if the publisher is missing or stale.
+ */
+int riaps_ts_shm_read(struct riaps_ts_tracking* trk);
+
+#endif // _RIAPS_TS_SHM_H_
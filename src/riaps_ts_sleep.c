@@ -0,0 +1,250 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_sleep.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Precise (hybrid sleep-and-spin) waiting (implementation).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "riaps_ts.h"
+#include "riaps_ts_util.h"
+
+#define SLACK_MAX_CPUS 256              /* CPUs with separate calibration (others share the last slot) */
+#define SLACK_INITIAL_NS 200000         /* Initial guess of the wake-up latency */
+#define SLACK_MIN_NS 2000               /* Never trust the kernel timer more than this */
+#define SLACK_MAX_NS 5000000            /* Longer latencies are outliers, not worth spinning for */
+#define SLACK_GAIN_SHIFT 4              /* Averaging over ~16 wake-ups */
+#define SLACK_DEV_FACTOR 4              /* Slack = mean + factor * mean deviation */
+
+/* Wake-up latency statistics of a CPU (own cache line, updated without locking) */
+struct slack_stats {
+    _Atomic int64_t mean_ns;
+    _Atomic int64_t dev_ns;
+    _Atomic int64_t slack_ns;
+} __attribute__((aligned(64)));
+
+static struct slack_stats slack_table[SLACK_MAX_CPUS];
+static pthread_once_t slack_once = PTHREAD_ONCE_INIT;
+
+/* Per-thread timerfd of the step-aware waits (descriptor + 1, closed at thread exit) */
+static pthread_once_t step_timer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t step_timer_key;
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+static void init_slack()
+{
+    int i;
+
+    for (i = 0; i < SLACK_MAX_CPUS; i++) {
+        atomic_store_explicit(&slack_table[i].mean_ns, SLACK_INITIAL_NS / 2, memory_order_relaxed);
+        atomic_store_explicit(&slack_table[i].dev_ns, SLACK_INITIAL_NS / (2 * SLACK_DEV_FACTOR), memory_order_relaxed);
+        atomic_store_explicit(&slack_table[i].slack_ns, SLACK_INITIAL_NS, memory_order_relaxed);
+    }
+}
+
+static struct slack_stats* cpu_slack(int cpu)
+{
+    /* Once only, a concurrent calibration must not be reset */
+    pthread_once(&slack_once, init_slack);
+    if (cpu < 0 || cpu >= SLACK_MAX_CPUS) {
+        cpu = SLACK_MAX_CPUS - 1;
+    }
+    return &slack_table[cpu];
+}
+
+static void close_step_timer(void* value)
+{
+    close((int)(intptr_t)value - 1);
+}
+
+static void init_step_timer()
+{
+    pthread_key_create(&step_timer_key, close_step_timer);
+}
+
+static int step_timer()
+{
+    int fd;
+
+    pthread_once(&step_timer_once, init_step_timer);
+    fd = (int)(intptr_t)pthread_getspecific(step_timer_key) - 1;
+    if (fd < 0) {
+        fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+        if (fd >= 0) {
+            pthread_setspecific(step_timer_key, (void*)(intptr_t)(fd + 1));
+        }
+    }
+    return fd;
+}
+
+/*
+ * Sleep until an absolute instant, returns ECANCELED if the clock was stepped since the
+ * offset 'base' was read (a step past the deadline may expire the timer before cancelling it)
+ */
+static int sleep_step_aware(int64_t until, int64_t base)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    uint64_t expirations;
+    int fd = step_timer();
+    int expired;
+
+    if (fd < 0) {
+        return errno;
+    }
+    riaps_ts_posix_timespec_of_ns(until, &its.it_value);
+    for (;;) {
+        expired = 0;
+        if (timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) == 0) {
+            expired = read(fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+        }
+        if (!expired && errno != ECANCELED) {
+            return errno;
+        }
+        if (riaps_ts_wall_step_ns(base)) {
+            return ECANCELED;
+        }
+        if (expired) {
+            return 0;
+        }
+        /* Late cancellation of an earlier step, wait again */
+    }
+}
+
+/* Feed a measured wake-up latency of the kernel timer into the calibration */
+static void update_slack(struct slack_stats* stats, int64_t latency_ns)
+{
+    int64_t mean = atomic_load_explicit(&stats->mean_ns, memory_order_relaxed);
+    int64_t dev = atomic_load_explicit(&stats->dev_ns, memory_order_relaxed);
+    int64_t diff = latency_ns - mean;
+    int64_t slack;
+
+    if (latency_ns > SLACK_MAX_NS) {
+        return;
+    }
+    mean += diff >> SLACK_GAIN_SHIFT;
+    dev += ((diff < 0 ? -diff : diff) - dev) >> SLACK_GAIN_SHIFT;
+    slack = mean + SLACK_DEV_FACTOR * dev;
+    if (slack < SLACK_MIN_NS) {
+        slack = SLACK_MIN_NS;
+    }
+    if (slack > SLACK_MAX_NS) {
+        slack = SLACK_MAX_NS;
+    }
+
+    atomic_store_explicit(&stats->mean_ns, mean, memory_order_relaxed);
+    atomic_store_explicit(&stats->dev_ns, dev, memory_order_relaxed);
+    atomic_store_explicit(&stats->slack_ns, slack, memory_order_relaxed);
+}
+
+
+int riaps_ts_sleep_precise(int flags, const struct riaps_ts_timespec *request, long max_spin_ns, long* lateness_ns)
+{
+    struct timespec cn_req;
+    struct slack_stats* stats;
+    int64_t deadline, sleep_until, now;
+    int64_t slack, base = 0;
+    int cancel_on_step = flags & RIAPS_TS_CANCEL_ON_STEP;
+    int ret = 0;
+
+    if (!request) {
+        return -1;
+    }
+    flags &= ~RIAPS_TS_CANCEL_ON_STEP;
+    if (cancel_on_step && flags != RIAPS_TS_ABSTIME) {
+        return -1;
+    }
+    if (flags == RIAPS_TS_ABSTIME) {
+        deadline = riaps_ts_ns_of_timespec(request);
+    }
+    else if (flags == RIAPS_TS_RELTIME) {
+        deadline = riaps_ts_clock_ns(CLOCK_REALTIME) + riaps_ts_ns_of_timespec(request);
+    }
+    else {
+        return -1;
+    }
+
+    stats = cpu_slack(sched_getcpu());
+    slack = atomic_load_explicit(&stats->slack_ns, memory_order_relaxed);
+    if (max_spin_ns >= 0 && slack > max_spin_ns) {
+        slack = max_spin_ns;
+    }
+
+    sleep_until = deadline - slack;
+    if (cancel_on_step) {
+        base = riaps_ts_wall_offset_ns();
+    }
+    now = riaps_ts_clock_ns(CLOCK_REALTIME);
+    if (sleep_until > now) {
+        if (cancel_on_step) {
+            ret = sleep_step_aware(sleep_until, base);
+        }
+        else {
+            riaps_ts_posix_timespec_of_ns(sleep_until, &cn_req);
+            ret = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &cn_req, NULL);
+        }
+        if (ret) {
+            return ret;
+        }
+        now = riaps_ts_clock_ns(CLOCK_REALTIME);
+        /* Calibrate on the CPU that served the wake-up */
+        update_slack(cpu_slack(sched_getcpu()), now - sleep_until);
+    }
+
+    while (now < deadline) {
+        cpu_relax();
+        now = riaps_ts_clock_ns(CLOCK_REALTIME);
+        if (cancel_on_step && riaps_ts_wall_step_ns(base)) {
+            return ECANCELED;
+        }
+    }
+
+    if (lateness_ns) {
+        *lateness_ns = now - deadline;
+    }
+    return 0;
+}
+
+
+long riaps_ts_sleep_slack(int cpu)
+{
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    return atomic_load_explicit(&cpu_slack(cpu)->slack_ns, memory_order_relaxed);
+}
@@ -0,0 +1,468 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_sources.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Time source statistics (implementation).
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+
+#include "riaps_ts.h"
+#include "riaps_ts_ctx.h"
+
+#define SRC_GOT_DATA 1
+#define SRC_GOT_STATS 2
+
+
+static void source_name(const ipaddr_t* ip_addr, uint32_t ref_id, char* name)
+{
+    switch (ntohs(ip_addr->family)) {
+    case IPADDR_INET4:
+        inet_ntop(AF_INET, &ip_addr->addr.in4, name, RIAPS_TS_SOURCE_NAME_LENGTH);
+        break;
+    case IPADDR_INET6:
+        inet_ntop(AF_INET6, ip_addr->addr.in6, name, RIAPS_TS_SOURCE_NAME_LENGTH);
+        break;
+    default:
+        /* Reference clocks are identified by their reference ID */
+        riaps_ts_ref_name(ref_id, name);
+        break;
+    }
+}
+
+
+static void decode_source_data(const rep_source_data* data, struct riaps_ts_source* src)
+{
+    src->mode = ntohs(data->mode);
+    src->state = ntohs(data->state);
+    src->stratum = ntohs(data->stratum);
+    src->poll = (int16_t)ntohs(data->poll);
+    src->reachability = ntohs(data->reachability);
+    src->flags = ntohs(data->flags);
+    src->since_sample = ntohl(data->since_sample);
+    src->orig_latest_meas = double_from_chrony_float_t(&data->orig_latest_meas);
+    src->latest_meas = double_from_chrony_float_t(&data->latest_meas);
+    src->latest_meas_err = double_from_chrony_float_t(&data->latest_meas_err);
+}
+
+
+static void decode_sourcestats(const rep_sourcestats* stats, struct riaps_ts_source* src)
+{
+    src->ref_id = ntohl(stats->ref_id);
+    source_name(&stats->ip_addr, src->ref_id, src->name);
+    src->n_samples = ntohl(stats->n_samples);
+    src->n_runs = ntohl(stats->n_runs);
+    src->span_seconds = ntohl(stats->span_seconds);
+    src->std_dev = double_from_chrony_float_t(&stats->sd);
+    src->resid_freq_ppm = double_from_chrony_float_t(&stats->resid_freq_ppm);
+    src->skew_ppm = double_from_chrony_float_t(&stats->skew_ppm);
+    src->est_offset = double_from_chrony_float_t(&stats->est_offset);
+    src->est_offset_err = double_from_chrony_float_t(&stats->est_offset_err);
+}
+
+
+static void prepare_source_xfers(chrony_xfer* xfers, int index)
+{
+    xfers[0].req.command = htons(REQ_SOURCE_DATA);
+    xfers[0].req.data.source_data.index = htonl(index);
+    xfers[0].req_len = REQ_LENGTH(source_data);
+    xfers[0].rep_len = REP_LENGTH(source_data);
+    xfers[0].rep_id = RPY_SOURCE_DATA;
+
+    xfers[1].req.command = htons(REQ_SOURCESTATS);
+    xfers[1].req.data.sourcestats.index = htonl(index);
+    xfers[1].req_len = REQ_LENGTH(sourcestats);
+    xfers[1].rep_len = REP_LENGTH(sourcestats);
+    xfers[1].rep_id = RPY_SOURCESTATS;
+}
+
+
+/* Collect the successful source replies, returns the number of incomplete sources */
+static int collect_sources(const chrony_xfer* xfers, int n_xfers, struct riaps_ts_source* sources,
+                           unsigned char* got, int n_sources)
+{
+    int i;
+    int missing = 0;
+
+    for (i = 0; i < n_xfers; i++) {
+        const chrony_xfer* xfer = &xfers[i];
+        int index = ntohl(xfer->req.data.source_data.index);
+
+        if (index >= n_sources || xfer->status != STT_SUCCESS) {
+            continue;
+        }
+        if (xfer->req.command == htons(REQ_SOURCE_DATA)) {
+            decode_source_data(&xfer->rep.data.source_data, &sources[index]);
+            got[index] |= SRC_GOT_DATA;
+        }
+        else if (xfer->req.command == htons(REQ_SOURCESTATS)) {
+            decode_sourcestats(&xfer->rep.data.sourcestats, &sources[index]);
+            got[index] |= SRC_GOT_STATS;
+        }
+    }
+
+    for (i = 0; i < n_sources; i++) {
+        if (got[i] != (SRC_GOT_DATA | SRC_GOT_STATS)) {
+            missing++;
+        }
+    }
+    return missing;
+}
+
+
+/* Grow the reused exchange buffers of the context */
+static int reserve_xfers(riaps_ts_ctx* ctx, int n_xfers, int n_got)
+{
+    if (n_xfers > ctx->xfers_capacity) {
+        chrony_xfer* xfers = realloc(ctx->xfers, n_xfers * sizeof(chrony_xfer));
+        if (!xfers) {
+            return -1;
+        }
+        ctx->xfers = xfers;
+        ctx->xfers_capacity = n_xfers;
+    }
+    if (n_got > ctx->got_capacity) {
+        unsigned char* got = realloc(ctx->got, n_got);
+        if (!got) {
+            return -1;
+        }
+        ctx->got = got;
+        ctx->got_capacity = n_got;
+    }
+    return 0;
+}
+
+
+/* Query the sources and optionally the tracking information (in the first batch) */
+static int query_sources(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk, struct riaps_ts_source* sources,
+                         int max_sources)
+{
+    chrony_xfer* xfers;
+    int n_guess, n_sources, n_xfers, n_wanted;
+    int first = trk ? 2 : 1;
+    int i;
+
+    if (!ctx || max_sources < 0 || (max_sources > 0 && !sources)) {
+        return -1;
+    }
+
+    /*
+     * The number of sources and the details of the (probably) existing sources are
+     * requested in the same batch. The sources not covered by the guess are requested
+     * in a second batch. The buffers are kept in the context for the next query.
+     */
+    n_guess = ctx->sources_hint < max_sources ? ctx->sources_hint : max_sources;
+    if (reserve_xfers(ctx, first + 2 * n_guess, 0)) {
+        return -1;
+    }
+    xfers = ctx->xfers;
+    memset(xfers, 0, (first + 2 * n_guess) * sizeof(chrony_xfer));
+
+    if (trk) {
+        xfers[0].req.command = htons(REQ_TRACKING);
+        xfers[0].req_len = REQ_LENGTH(tracking);
+        xfers[0].rep_len = REP_LENGTH(tracking);
+        xfers[0].rep_id = RPY_TRACKING;
+    }
+    xfers[first - 1].req.command = htons(REQ_N_SOURCES);
+    xfers[first - 1].req_len = REQ_LENGTH(n_sources);
+    xfers[first - 1].rep_len = REP_LENGTH(n_sources);
+    xfers[first - 1].rep_id = RPY_N_SOURCES;
+    for (i = 0; i < n_guess; i++) {
+        prepare_source_xfers(&xfers[first + 2 * i], i);
+    }
+    if (chrony_request_many(&ctx->client, xfers, first + 2 * n_guess) ||
+        xfers[first - 1].status != STT_SUCCESS || (trk && xfers[0].status != STT_SUCCESS)) {
+        return -1;
+    }
+    if (trk) {
+        riaps_ts_decode_tracking(&xfers[0].rep, trk);
+    }
+
+    n_sources = ntohl(xfers[first - 1].rep.data.n_sources.n_sources);
+    ctx->sources_hint = n_sources > 0 ? n_sources : 1;
+    n_wanted = n_sources < max_sources ? n_sources : max_sources;
+
+    if (reserve_xfers(ctx, 0, n_wanted + 1)) {
+        return -1;
+    }
+    memset(ctx->got, 0, n_wanted + 1);
+    if (n_wanted > 0) {
+        memset(sources, 0, n_wanted * sizeof(struct riaps_ts_source));
+    }
+    if (collect_sources(&xfers[first], 2 * n_guess, sources, ctx->got, n_wanted)) {
+        /* Sources beyond the guess or changed while the first batch was served */
+        if (reserve_xfers(ctx, 2 * n_wanted, 0)) {
+            return -1;
+        }
+        xfers = ctx->xfers;
+        memset(xfers, 0, 2 * n_wanted * sizeof(chrony_xfer));
+        n_xfers = 0;
+        for (i = 0; i < n_wanted; i++) {
+            if (ctx->got[i] != (SRC_GOT_DATA | SRC_GOT_STATS)) {
+                prepare_source_xfers(&xfers[n_xfers], i);
+                n_xfers += 2;
+            }
+        }
+        if (chrony_request_many(&ctx->client, xfers, n_xfers) ||
+            collect_sources(xfers, n_xfers, sources, ctx->got, n_wanted)) {
+            return -1;
+        }
+    }
+    return n_sources;
+}
+
+
+int riaps_ts_sources_r(riaps_ts_ctx* ctx, struct riaps_ts_source* sources, int max_sources)
+{
+    return query_sources(ctx, NULL, sources, max_sources);
+}
+
+
+int riaps_ts_snapshot_r(riaps_ts_ctx* ctx, struct riaps_ts_tracking* trk, struct riaps_ts_source* sources,
+                        int max_sources)
+{
+    if (!trk) {
+        return -1;
+    }
+    return query_sources(ctx, trk, sources, max_sources);
+}
+
+
+int riaps_ts_sources(struct riaps_ts_source* sources, int max_sources)
+{
+    return riaps_ts_sources_r(riaps_ts_default_ctx(), sources, max_sources);
+}
+
+
+int riaps_ts_server_stats_r(riaps_ts_ctx* ctx, struct riaps_ts_server_stats* stats)
+{
+    chrony_xfer* xfer;
+    int ret = -1;
+
+    if (!ctx || !stats) {
+        return -1;
+    }
+    xfer = calloc(1, sizeof(chrony_xfer));
+    if (!xfer) {
+        return -1;
+    }
+
+    /* Newer chrony versions require padding for the largest (RPY_SERVER_STATS4) reply */
+    xfer->req.command = htons(REQ_SERVER_STATS);
+    xfer->req_len = REP_LENGTH(server_stats4);
+    xfer->rep_len = REP_HEADER_LENGTH + 5 * sizeof(uint32_t);
+    xfer->rep_id = CHRONY_REP_ANY;
+    if (chrony_request_many(&ctx->client, xfer, 1) || xfer->status != STT_SUCCESS) {
+        goto stats_end;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    switch (ntohs(xfer->rep.reply)) {
+    case RPY_SERVER_STATS: {
+        const rep_server_stats* rep = &xfer->rep.data.server_stats;
+        stats->ntp_hits = ntohl(rep->ntp_hits);
+        stats->cmd_hits = ntohl(rep->nke_hits);
+        stats->ntp_drops = ntohl(rep->cmd_hits);
+        stats->cmd_drops = ntohl(rep->ntp_drops);
+        stats->log_drops = ntohl(rep->nke_drops);
+        ret = 0;
+        break;
+    }
+    case RPY_SERVER_STATS2:
+    case RPY_SERVER_STATS3: {
+        const rep_server_stats* rep = &xfer->rep.data.server_stats;
+        if (xfer->rep_recv_len < offsetof(chrony_rep, data.server_stats.ntp_interleaved_hits)) {
+            break;
+        }
+        stats->ntp_hits = ntohl(rep->ntp_hits);
+        stats->nke_hits = ntohl(rep->nke_hits);
+        stats->cmd_hits = ntohl(rep->cmd_hits);
+        stats->ntp_drops = ntohl(rep->ntp_drops);
+        stats->nke_drops = ntohl(rep->nke_drops);
+        stats->cmd_drops = ntohl(rep->cmd_drops);
+        stats->log_drops = ntohl(rep->log_drops);
+        stats->ntp_auth_hits = ntohl(rep->ntp_auth_hits);
+        ret = 0;
+        break;
+    }
+    case RPY_SERVER_STATS4: {
+        const rep_server_stats4* rep = &xfer->rep.data.server_stats4;
+        if (xfer->rep_recv_len < REP_LENGTH(server_stats4)) {
+            break;
+        }
+        stats->ntp_hits = uint64_from_chrony_int64_t(&rep->ntp_hits);
+        stats->nke_hits = uint64_from_chrony_int64_t(&rep->nke_hits);
+        stats->cmd_hits = uint64_from_chrony_int64_t(&rep->cmd_hits);
+        stats->ntp_drops = uint64_from_chrony_int64_t(&rep->ntp_drops);
+        stats->nke_drops = uint64_from_chrony_int64_t(&rep->nke_drops);
+        stats->cmd_drops = uint64_from_chrony_int64_t(&rep->cmd_drops);
+        stats->log_drops = uint64_from_chrony_int64_t(&rep->log_drops);
+        stats->ntp_auth_hits = uint64_from_chrony_int64_t(&rep->ntp_auth_hits);
+        ret = 0;
+        break;
+    }
+    default:
+        break;
+    }
+
+stats_end:
+    free(xfer);
+    return ret;
+}
+
+
+int riaps_ts_server_stats(struct riaps_ts_server_stats* stats)
+{
+    return riaps_ts_server_stats_r(riaps_ts_default_ctx(), stats);
+}
+
+
+/* errno of a chrony status */
+static int errno_of_status(int status)
+{
+    switch (status) {
+    case STT_UNAUTH:
+        return EACCES;
+    case STT_INVALID:
+    case STT_INVALIDNAME:
+        return EINVAL;
+    case STT_NOSUCHSOURCE:
+        return ENOENT;
+    case STT_SOURCEALREADYKNOWN:
+        return EEXIST;
+    case STT_TOOMANYSOURCES:
+        return ENOSPC;
+    default:
+        return EIO;
+    }
+}
+
+
+/* Make a source (re)configuration request, which has no reply data */
+static int modify_sources(riaps_ts_ctx* ctx, chrony_xfer* xfer, int req_len)
+{
+    int ret;
+
+    xfer->req_len = req_len;
+    xfer->rep_len = REP_LENGTH(null);
+    xfer->rep_id = RPY_NULL;
+    ret = chrony_request_many(&ctx->client, xfer, 1);
+    if (ret == 0 && xfer->status != STT_SUCCESS) {
+        errno = errno_of_status(xfer->status);
+        ret = -1;
+    }
+    free(xfer);
+    return ret;
+}
+
+
+int riaps_ts_add_server_r(riaps_ts_ctx* ctx, const char* name, int flags)
+{
+    chrony_xfer* xfer;
+    req_ntp_source* src;
+    uint32_t src_flags = REQ_ADDSRC_ONLINE;
+
+    if (!ctx || !name || !name[0] || strlen(name) >= sizeof(src->name)) {
+        errno = EINVAL;
+        return -1;
+    }
+    xfer = calloc(1, sizeof(chrony_xfer));
+    if (!xfer) {
+        return -1;
+    }
+
+    /* Same defaults as the server directive of chrony.conf */
+    xfer->req.command = htons(REQ_ADD_SOURCE);
+    src = &xfer->req.data.ntp_source;
+    src->type = htonl(REQ_ADDSRC_SERVER);
+    strcpy((char*)src->name, name);
+    src->port = htonl(123);
+    src->minpoll = htonl(6);
+    src->maxpoll = htonl(10);
+    src->presend_minpoll = htonl(100);
+    src->poll_target = htonl(8);
+    src->max_sources = htonl(4);
+    src->min_samples = htonl(-1);
+    src->max_samples = htonl(-1);
+    src->nts_port = htonl(4460);
+    src->max_delay = chrony_float_t_from_double(3.0);
+    src->max_delay_ratio = chrony_float_t_from_double(0.0);
+    src->max_delay_dev_ratio = chrony_float_t_from_double(10.0);
+    src->min_delay = chrony_float_t_from_double(0.0);
+    src->asymmetry = chrony_float_t_from_double(1.0);
+    src->offset = chrony_float_t_from_double(0.0);
+
+    src_flags |= (flags & RIAPS_TS_ADD_IBURST) ? REQ_ADDSRC_IBURST : 0;
+    src_flags |= (flags & RIAPS_TS_ADD_PREFER) ? REQ_ADDSRC_PREFER : 0;
+    src_flags |= (flags & RIAPS_TS_ADD_NOSELECT) ? REQ_ADDSRC_NOSELECT : 0;
+    src_flags |= (flags & RIAPS_TS_ADD_TRUST) ? REQ_ADDSRC_TRUST : 0;
+    src_flags |= (flags & RIAPS_TS_ADD_REQUIRE) ? REQ_ADDSRC_REQUIRE : 0;
+    src->flags = htonl(src_flags);
+
+    return modify_sources(ctx, xfer, REQ_LENGTH(ntp_source));
+}
+
+
+int riaps_ts_add_server(const char* name, int flags)
+{
+    return riaps_ts_add_server_r(riaps_ts_default_ctx(), name, flags);
+}
+
+
+int riaps_ts_del_source_r(riaps_ts_ctx* ctx, const char* addr)
+{
+    chrony_xfer* xfer;
+    ipaddr_t* ip_addr;
+
+    if (!ctx || !addr) {
+        errno = EINVAL;
+        return -1;
+    }
+    xfer = calloc(1, sizeof(chrony_xfer));
+    if (!xfer) {
+        return -1;
+    }
+
+    xfer->req.command = htons(REQ_DEL_SOURCE);
+    ip_addr = &xfer->req.data.del_source.ip_addr;
+    if (inet_pton(AF_INET, addr, &ip_addr->addr.in4) == 1) {
+        ip_addr->family = htons(IPADDR_INET4);
+    }
+    else if (inet_pton(AF_INET6, addr, ip_addr->addr.in6) == 1) {
+        ip_addr->family = htons(IPADDR_INET6);
+    }
+    else {
+        free(xfer);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return modify_sources(ctx, xfer, REQ_LENGTH(del_source));
+}
+
+
+int riaps_ts_del_source(const char* addr)
+{
+    return riaps_ts_del_source_r(riaps_ts_default_ctx(), addr);
+}
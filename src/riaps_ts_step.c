@@ -0,0 +1,147 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_step.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Step- and leap-aware absolute sleeps (implementation).
+ *
+ * The sleeps are done on a timerfd armed with TFD_TIMER_CANCEL_ON_SET, so the kernel
+ * wakes them up (ECANCELED) whenever the system clock is set, stepped or a leap
+ * second is applied. The size of the step is the change of the offset between the
+ * system clock and CLOCK_MONOTONIC.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "riaps_ts.h"
+#include "riaps_ts_ctx.h"
+#include "riaps_ts_util.h"
+
+#define SECS_PER_DAY 86400LL
+
+
+/* A leap second is scheduled at the end of the current (UTC) day and the deadline is not before it */
+static int leap_pending(riaps_ts_ctx* ctx, int64_t deadline)
+{
+    const struct riaps_ts_tracking* trk;
+    int64_t day = SECS_PER_DAY * RIAPS_TS_NSEC_PER_SEC;
+    int64_t midnight = (riaps_ts_clock_ns(CLOCK_REALTIME) / day + 1) * day;
+
+    if (deadline < midnight) {
+        return 0;       /* No need to ask chrony */
+    }
+    trk = riaps_ts_cached_tracking(ctx);
+    return trk && (trk->leap_status == RIAPS_TS_LEAP_INSERT || trk->leap_status == RIAPS_TS_LEAP_DELETE);
+}
+
+
+int riaps_ts_sleep_until_r(riaps_ts_ctx* ctx, const struct riaps_ts_timespec* deadline, int policy,
+                           struct riaps_ts_wakeup* wakeup)
+{
+    struct riaps_ts_wakeup observed = {0, 0, {0, 0}};
+    int64_t target;
+    int ret;
+
+    if (!ctx || !deadline || policy < RIAPS_TS_REBASE_NONE || policy > RIAPS_TS_REBASE_RETURN) {
+        return EINVAL;
+    }
+    if (ctx->sleep_fd < 0) {
+        ctx->sleep_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+        if (ctx->sleep_fd < 0) {
+            return errno;
+        }
+    }
+
+    target = riaps_ts_ns_of_timespec(deadline);
+    if (target <= 0) {
+        target = 1;     /* A zero expiration would disarm the timer */
+    }
+    if (leap_pending(ctx, target)) {
+        observed.events |= RIAPS_TS_WAKE_LEAP_PENDING;
+    }
+
+    for (;;) {
+        struct itimerspec its = {{0, 0}, {0, 0}};
+        uint64_t expirations;
+        int64_t base, step;
+        int expired;
+
+        riaps_ts_posix_timespec_of_ns(target, &its.it_value);
+        base = riaps_ts_wall_offset_ns();
+        if (timerfd_settime(ctx->sleep_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL)) {
+            if (errno == ECANCELED) {
+                continue;   /* Stepped before this wait (the notification is consumed) */
+            }
+            ret = errno;
+            break;
+        }
+        expired = read(ctx->sleep_fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+        if (!expired && errno != ECANCELED) {
+            ret = errno;
+            break;
+        }
+        step = riaps_ts_wall_step_ns(base);
+        if (!step) {
+            if (expired) {
+                ret = 0;
+                break;
+            }
+            continue;   /* Late cancellation of an earlier step */
+        }
+
+        /* Stepped (a step past the deadline may expire the timer before cancelling it) */
+        observed.events |= RIAPS_TS_WAKE_STEPPED;
+        observed.step_ns += step;
+        if (policy == RIAPS_TS_REBASE_SHIFT) {
+            target += step;
+        }
+        else if (policy == RIAPS_TS_REBASE_RETURN) {
+            target += step;
+            ret = ECANCELED;
+            break;
+        }
+        else if (expired) {
+            ret = 0;
+            break;
+        }
+        /* Otherwise the timer is still armed for the same (absolute) instant */
+    }
+
+    if (wakeup) {
+        riaps_ts_timespec_of_ns(target, &observed.deadline);
+        *wakeup = observed;
+    }
+    return ret;
+}
+
+
+int riaps_ts_sleep_until(const struct riaps_ts_timespec* deadline, int policy, struct riaps_ts_wakeup* wakeup)
+{
+    riaps_ts_ctx* ctx = riaps_ts_default_ctx();
+
+    if (!ctx) {
+        return ENOMEM;
+    }
+    return riaps_ts_sleep_until_r(ctx, deadline, policy, wakeup);
+}
@@ -0,0 +1,453 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_timer.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Multiplexed timers aligned to the synchronized time (implementation).
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "riaps_ts_timer.h"
+#include "riaps_ts_util.h"
+
+#define TIMER_HEAP_INITIAL 16
+
+#define TIMER_QUEUED 0      /* Waiting in the heap */
+#define TIMER_FIRING 1      /* Its callback is running (periodic timers stay in the heap) */
+#define TIMER_CANCELLED 2   /* Cancelled while its callback is running */
+
+struct riaps_ts_timer {
+    int64_t deadline;       /* Next expiration (ns since the epoch) */
+    int64_t period;         /* Zero for one-shot timers */
+    int64_t phase;
+    unsigned long overruns;
+    int heap_index;
+    int state;
+    riaps_ts_timer_cb cb;
+    void* arg;
+};
+
+struct riaps_ts_timers {
+    int timer_fd;
+    int64_t armed;          /* Deadline the timerfd is armed for (0: disarmed) */
+    int64_t base;           /* Offset of the system clock at the last rebase @see riaps_ts_wall_offset_ns() */
+    int rebase;             /* Policy on clock steps (RIAPS_TS_REBASE_NONE or _SHIFT) */
+    riaps_ts_step_cb step_cb;
+    void* step_arg;
+    riaps_ts_timer** heap;  /* Binary min-heap ordered by deadline */
+    int heap_size;
+    int heap_capacity;
+    pthread_mutex_t lock;
+};
+
+
+static void heap_swap(riaps_ts_timers* timers, int i, int j)
+{
+    riaps_ts_timer* tmp = timers->heap[i];
+    timers->heap[i] = timers->heap[j];
+    timers->heap[j] = tmp;
+    timers->heap[i]->heap_index = i;
+    timers->heap[j]->heap_index = j;
+}
+
+static void heap_up(riaps_ts_timers* timers, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (timers->heap[parent]->deadline <= timers->heap[i]->deadline) {
+            break;
+        }
+        heap_swap(timers, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(riaps_ts_timers* timers, int i)
+{
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < timers->heap_size && timers->heap[left]->deadline < timers->heap[smallest]->deadline) {
+            smallest = left;
+        }
+        if (right < timers->heap_size && timers->heap[right]->deadline < timers->heap[smallest]->deadline) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        heap_swap(timers, i, smallest);
+        i = smallest;
+    }
+}
+
+static int heap_push(riaps_ts_timers* timers, riaps_ts_timer* timer)
+{
+    if (timers->heap_size == timers->heap_capacity) {
+        int capacity = timers->heap_capacity * 2;
+        riaps_ts_timer** heap = realloc(timers->heap, capacity * sizeof(riaps_ts_timer*));
+        if (!heap) {
+            return -1;
+        }
+        timers->heap = heap;
+        timers->heap_capacity = capacity;
+    }
+    timer->heap_index = timers->heap_size++;
+    timers->heap[timer->heap_index] = timer;
+    heap_up(timers, timer->heap_index);
+    return 0;
+}
+
+static void heap_remove(riaps_ts_timers* timers, riaps_ts_timer* timer)
+{
+    int i = timer->heap_index;
+
+    timers->heap_size--;
+    if (i != timers->heap_size) {
+        heap_swap(timers, i, timers->heap_size);
+        heap_down(timers, i);
+        heap_up(timers, i);
+    }
+    timer->heap_index = -1;
+}
+
+
+/* Arm the kernel timer for the earliest deadline (if changed), clock steps cancel it */
+static void rearm(riaps_ts_timers* timers)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    int64_t deadline = timers->heap_size ? timers->heap[0]->deadline : 0;
+
+    if (deadline == timers->armed) {
+        return;
+    }
+    if (deadline) {
+        riaps_ts_posix_timespec_of_ns(deadline, &its.it_value);
+    }
+    if (timerfd_settime(timers->timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) == 0) {
+        timers->armed = deadline;
+    }
+    else if (errno == ECANCELED) {
+        /* Stepped since the descriptor was read: expire right away, the dispatcher rebases */
+        its.it_value.tv_sec = 0;
+        its.it_value.tv_nsec = 1;
+        timerfd_settime(timers->timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+        timers->armed = 1;
+    }
+}
+
+
+/* First expiration of a periodic timer strictly after now */
+static int64_t next_deadline(int64_t now, int64_t period, int64_t phase)
+{
+    int64_t k = (now - phase) / period;
+    int64_t deadline = k * period + phase;
+
+    while (deadline <= now) {
+        deadline += period;
+    }
+    return deadline;
+}
+
+
+/* Move the deadlines after a step of the system clock according to the policy */
+static void rebase_timers(riaps_ts_timers* timers, int64_t step, int64_t now)
+{
+    int i;
+
+    for (i = 0; i < timers->heap_size; i++) {
+        riaps_ts_timer* timer = timers->heap[i];
+
+        if (timers->rebase == RIAPS_TS_REBASE_SHIFT) {
+            timer->deadline += step;
+            if (timer->period) {
+                timer->phase = ((timer->phase + step) % timer->period + timer->period) % timer->period;
+            }
+        }
+        else if (timer->period) {
+            /* Fire once if it was due before the step, otherwise continue at the next expiration */
+            int64_t next = next_deadline(now, timer->period, timer->phase);
+            timer->deadline = timer->deadline <= now - step ? next - timer->period : next;
+        }
+    }
+    for (i = timers->heap_size / 2 - 1; i >= 0; i--) {
+        heap_down(timers, i);
+    }
+}
+
+
+riaps_ts_timers* riaps_ts_timers_create()
+{
+    riaps_ts_timers* timers;
+
+    timers = calloc(1, sizeof(riaps_ts_timers));
+    if (!timers) {
+        return NULL;
+    }
+    pthread_mutex_init(&timers->lock, NULL);
+    timers->base = riaps_ts_wall_offset_ns();
+    timers->heap = malloc(TIMER_HEAP_INITIAL * sizeof(riaps_ts_timer*));
+    timers->heap_capacity = TIMER_HEAP_INITIAL;
+    timers->timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (!timers->heap || timers->timer_fd < 0) {
+        riaps_ts_timers_destroy(timers);
+        return NULL;
+    }
+    return timers;
+}
+
+
+void riaps_ts_timers_destroy(riaps_ts_timers* timers)
+{
+    int i;
+
+    if (!timers) {
+        return;
+    }
+    for (i = 0; i < timers->heap_size; i++) {
+        free(timers->heap[i]);
+    }
+    free(timers->heap);
+    if (timers->timer_fd >= 0) {
+        close(timers->timer_fd);
+    }
+    pthread_mutex_destroy(&timers->lock);
+    free(timers);
+}
+
+
+int riaps_ts_timers_fd(const riaps_ts_timers* timers)
+{
+    return timers->timer_fd;
+}
+
+
+int riaps_ts_timers_set_rebase(riaps_ts_timers* timers, int policy, riaps_ts_step_cb cb, void* arg)
+{
+    if (!timers || (policy != RIAPS_TS_REBASE_NONE && policy != RIAPS_TS_REBASE_SHIFT)) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&timers->lock);
+    timers->rebase = policy;
+    timers->step_cb = cb;
+    timers->step_arg = arg;
+    pthread_mutex_unlock(&timers->lock);
+    return 0;
+}
+
+
+static riaps_ts_timer* add_timer(riaps_ts_timers* timers, int64_t deadline, int64_t period, int64_t phase,
+                                 riaps_ts_timer_cb cb, void* arg)
+{
+    riaps_ts_timer* timer;
+
+    timer = calloc(1, sizeof(riaps_ts_timer));
+    if (!timer) {
+        return NULL;
+    }
+    timer->period = period;
+    timer->phase = phase;
+    timer->cb = cb;
+    timer->arg = arg;
+    timer->state = TIMER_QUEUED;
+
+    pthread_mutex_lock(&timers->lock);
+    timer->deadline = period ? next_deadline(riaps_ts_clock_ns(CLOCK_REALTIME), period, phase) : deadline;
+    if (heap_push(timers, timer)) {
+        pthread_mutex_unlock(&timers->lock);
+        free(timer);
+        return NULL;
+    }
+    rearm(timers);
+    pthread_mutex_unlock(&timers->lock);
+
+    return timer;
+}
+
+
+riaps_ts_timer* riaps_ts_timer_add(riaps_ts_timers* timers, const struct riaps_ts_timespec* period,
+                                   const struct riaps_ts_timespec* phase, riaps_ts_timer_cb cb, void* arg)
+{
+    int64_t period_ns, phase_ns;
+
+    if (!timers || !period || !cb) {
+        return NULL;
+    }
+    period_ns = riaps_ts_ns_of_timespec(period);
+    phase_ns = phase ? riaps_ts_ns_of_timespec(phase) : 0;
+    if (period_ns <= 0 || phase_ns < 0 || phase_ns >= period_ns) {
+        return NULL;
+    }
+    return add_timer(timers, 0, period_ns, phase_ns, cb, arg);
+}
+
+
+riaps_ts_timer* riaps_ts_timer_add_oneshot(riaps_ts_timers* timers, const struct riaps_ts_timespec* abstime,
+                                           riaps_ts_timer_cb cb, void* arg)
+{
+    int64_t deadline;
+
+    if (!timers || !abstime || !cb) {
+        return NULL;
+    }
+    deadline = riaps_ts_ns_of_timespec(abstime);
+    if (deadline <= 0) {
+        return NULL;
+    }
+    return add_timer(timers, deadline, 0, 0, cb, arg);
+}
+
+
+int riaps_ts_timer_cancel(riaps_ts_timers* timers, riaps_ts_timer* timer)
+{
+    if (!timers || !timer) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&timers->lock);
+    if (timer->state == TIMER_FIRING) {
+        /* Released by the dispatcher after the callback */
+        timer->state = TIMER_CANCELLED;
+        pthread_mutex_unlock(&timers->lock);
+        return 0;
+    }
+    if (timer->heap_index < 0 || timer->heap_index >= timers->heap_size ||
+        timers->heap[timer->heap_index] != timer) {
+        pthread_mutex_unlock(&timers->lock);
+        return -1;
+    }
+    heap_remove(timers, timer);
+    rearm(timers);
+    pthread_mutex_unlock(&timers->lock);
+
+    free(timer);
+    return 0;
+}
+
+
+unsigned long riaps_ts_timer_overruns(const riaps_ts_timer* timer)
+{
+    return timer->overruns;
+}
+
+
+int riaps_ts_timers_dispatch(riaps_ts_timers* timers)
+{
+    uint64_t expirations;
+    int64_t now, step;
+    int fired = 0;
+
+    if (!timers) {
+        return -1;
+    }
+
+    /* Reset the readable state of the descriptor (ECANCELED: the clock was stepped) */
+    while (read(timers->timer_fd, &expirations, sizeof(expirations)) > 0 || errno == ECANCELED);
+
+    pthread_mutex_lock(&timers->lock);
+    now = riaps_ts_clock_ns(CLOCK_REALTIME);
+    step = riaps_ts_wall_step_ns(timers->base);
+    /*
+     * The offset is checked, as a step past the deadline may expire the timer before
+     * cancelling it (the cancellation is reported by the next read then)
+     */
+    if (step) {
+        riaps_ts_step_cb step_cb = timers->step_cb;
+        void* step_arg = timers->step_arg;
+
+        timers->base += step;
+        rebase_timers(timers, step, now);
+        if (step_cb) {
+            pthread_mutex_unlock(&timers->lock);
+            step_cb(step, step_arg);
+            pthread_mutex_lock(&timers->lock);
+            now = riaps_ts_clock_ns(CLOCK_REALTIME);
+        }
+    }
+    timers->armed = 0;      /* Expired or about to be rearmed */
+    while (timers->heap_size > 0 && timers->heap[0]->deadline <= now) {
+        riaps_ts_timer* timer = timers->heap[0];
+        struct riaps_ts_timespec deadline;
+        unsigned long overruns = 0;
+        int oneshot = !timer->period;
+
+        riaps_ts_timespec_of_ns(timer->deadline, &deadline);
+        if (!oneshot) {
+            /* Periodic timers are rescheduled before the callback, it may run past the next deadline */
+            overruns = (now - timer->deadline) / timer->period;
+            timer->overruns += overruns;
+            timer->deadline += (overruns + 1) * timer->period;
+            heap_down(timers, 0);
+        }
+        else {
+            heap_remove(timers, timer);
+        }
+        /* A concurrent cancel only marks the timer, it is released here after the callback */
+        timer->state = TIMER_FIRING;
+
+        pthread_mutex_unlock(&timers->lock);
+        timer->cb(timer, &deadline, overruns, timer->arg);
+        fired++;
+        pthread_mutex_lock(&timers->lock);
+
+        if (oneshot || timer->state == TIMER_CANCELLED) {
+            if (!oneshot) {
+                heap_remove(timers, timer);
+            }
+            free(timer);
+        }
+        else {
+            timer->state = TIMER_QUEUED;
+        }
+        now = riaps_ts_clock_ns(CLOCK_REALTIME);
+    }
+    rearm(timers);
+    pthread_mutex_unlock(&timers->lock);
+
+    return fired;
+}
+
+
+int riaps_ts_timers_wait(riaps_ts_timers* timers, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    if (!timers) {
+        return -1;
+    }
+    pfd.fd = timers->timer_fd;
+    pfd.events = POLLIN;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    return ret ? riaps_ts_timers_dispatch(timers) : 0;
+}
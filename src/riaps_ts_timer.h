@@ -0,0 +1,186 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_TIMER_H_
+#define _RIAPS_TS_TIMER_H_
+
+
+/**
+ * @file riaps_ts_timer.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Multiplexed timers aligned to the synchronized time.
+ *
+ * A timer set hosts any number of periodic and one-shot timers on a single kernel
+ * timer (timerfd on the synchronized clock). Periodic timers fire at integer multiples
+ * of their period (counted from the epoch) plus a phase, e.g. every 20 ms at +3 ms
+ * after the second boundary (PPS), so they fire at the same instants on every
+ * synchronized node. The timer set is exposed as a single pollable descriptor and the
+ * callbacks are executed by the thread calling riaps_ts_timers_dispatch().
+ *
+ * Steps of the system clock (chrony's makestep, leap seconds) are detected by the
+ * kernel timer and the deadlines are rebased according to the policy of the set,
+ * see riaps_ts_timers_set_rebase().
+ */
+
+#include "riaps_ts.h"
+
+/**
+ * @brief Set of multiplexed timers
+ */
+typedef struct riaps_ts_timers riaps_ts_timers;
+
+/**
+ * @brief A periodic or one-shot timer in a timer set
+ */
+typedef struct riaps_ts_timer riaps_ts_timer;
+
+/**
+ * @brief Timer callback function
+ *
+ * @param timer The expired timer
+ * @param deadline The (synchronized) time instant the timer was scheduled for
+ * @param overruns Number of periods missed since the previous callback (periodic timers only)
+ * @param arg User argument given when the timer was added
+ */
+typedef void (*riaps_ts_timer_cb)(riaps_ts_timer* timer, const struct riaps_ts_timespec* deadline,
+                                  unsigned long overruns, void* arg);
+
+/**
+ * @brief Clock step callback function @see riaps_ts_timers_set_rebase()
+ *
+ * @param step_ns Size of the step (nanosecs, negative: the clock was set backwards)
+ * @param arg User argument given with the callback
+ */
+typedef void (*riaps_ts_step_cb)(long long step_ns, void* arg);
+
+/**
+ * @brief Create a new (empty) timer set.
+ *
+ * @return The timer set or NULL on failure.
+ */
+riaps_ts_timers* riaps_ts_timers_create();
+
+/**
+ * @brief Destroy a timer set including all of its timers.
+ *
+ * @param timers The timer set created by riaps_ts_timers_create()
+ */
+void riaps_ts_timers_destroy(riaps_ts_timers* timers);
+
+/**
+ * @brief Get the pollable descriptor of the timer set.
+ *
+ * The descriptor becomes readable when at least one timer has expired or the
+ * system clock was stepped, then riaps_ts_timers_dispatch() has to be called.
+ *
+ * @param timers The timer set
+ * @return The descriptor (valid for the lifetime of the timer set).
+ */
+int riaps_ts_timers_fd(const riaps_ts_timers* timers);
+
+/**
+ * @brief Select how the timers follow steps of the system clock.
+ *
+ * With @c RIAPS_TS_REBASE_NONE (the default) the timers stay on the absolute time
+ * grid: one-shot timers keep their instants and periodic timers continue at their
+ * first expiration after the new time, without a catch-up burst after forward steps
+ * (nor overruns counted for the skipped periods) and without stalling after backward
+ * ones. With @c RIAPS_TS_REBASE_SHIFT every deadline (and the phase of the periodic
+ * timers) is moved by the step, so the elapsed time between the expirations is kept.
+ * The callback (if any) is executed by the dispatching thread after the deadlines
+ * have been rebased.
+ *
+ * @param timers The timer set
+ * @param policy @c RIAPS_TS_REBASE_NONE or @c RIAPS_TS_REBASE_SHIFT
+ * @param cb Callback function to be notified of the steps (NULL for none)
+ * @param arg User argument of the callback
+ * @return Zero on success, -1 otherwise (@c errno is EINVAL for other policies).
+ */
+int riaps_ts_timers_set_rebase(riaps_ts_timers* timers, int policy, riaps_ts_step_cb cb, void* arg);
+
+/**
+ * @brief Add a periodic timer.
+ *
+ * The timer fires at every t = k * period + phase (k integer, t since the epoch), so
+ * periods dividing a second are aligned to the second boundaries.
+ *
+ * @param timers The timer set
+ * @param period Period of the timer (positive)
+ * @param phase Offset of the expirations within the period (0 <= phase < period)
+ * @param cb Callback function
+ * @param arg User argument of the callback
+ * @return The new timer or NULL on failure.
+ */
+riaps_ts_timer* riaps_ts_timer_add(riaps_ts_timers* timers, const struct riaps_ts_timespec* period,
+                                   const struct riaps_ts_timespec* phase, riaps_ts_timer_cb cb, void* arg);
+
+/**
+ * @brief Add a one-shot timer.
+ *
+ * The timer is released automatically after its callback has returned.
+ *
+ * @param timers The timer set
+ * @param abstime The (synchronized) time instant of the expiration
+ * @param cb Callback function
+ * @param arg User argument of the callback
+ * @return The new timer or NULL on failure.
+ */
+riaps_ts_timer* riaps_ts_timer_add_oneshot(riaps_ts_timers* timers, const struct riaps_ts_timespec* abstime,
+                                           riaps_ts_timer_cb cb, void* arg);
+
+/**
+ * @brief Cancel and release a timer.
+ *
+ * Can be called from callbacks (including the callback of the timer itself) and
+ * from other threads. A timer whose callback is running is released by the
+ * dispatcher once the callback returns.
+ *
+ * @param timers The timer set
+ * @param timer A timer of the set (one-shot timers only before or during their callback)
+ * @return Zero, if the timer was cancelled.
+ */
+int riaps_ts_timer_cancel(riaps_ts_timers* timers, riaps_ts_timer* timer);
+
+/**
+ * @brief Total number of missed periods of a timer.
+ *
+ * @param timer The timer
+ * @return The number of expirations not delivered due to late dispatching.
+ */
+unsigned long riaps_ts_timer_overruns(const riaps_ts_timer* timer);
+
+/**
+ * @brief Execute the callbacks of the expired timers without blocking.
+ *
+ * @param timers The timer set
+ * @return The number of executed callbacks or -1 on failure.
+ */
+int riaps_ts_timers_dispatch(riaps_ts_timers* timers);
+
+/**
+ * @brief Wait for the next expiration and execute the callbacks of the expired timers.
+ *
+ * @param timers The timer set
+ * @param timeout_ms Maximum waiting time (-1 for no limit)
+ * @return The number of executed callbacks or -1 on failure.
+ */
+int riaps_ts_timers_wait(riaps_ts_timers* timers, int timeout_ms);
+
+#endif // _RIAPS_TS_TIMER_H_
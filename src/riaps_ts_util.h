@@ -0,0 +1,155 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_UTIL_H_
+#define _RIAPS_TS_UTIL_H_
+
+
+/**
+ * @file riaps_ts_util.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Time conversion helpers.
+ *
+ * Times are handled as signed 64-bit nanosecond counts internally. The functions
+ * in this module are not supposed to be used by application level code.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_NSEC_PER_SEC 1000000000LL /**< Nanoseconds in a second */
+#define RIAPS_TS_STEP_MIN_NS 100000LL      /**< Smallest change of riaps_ts_wall_offset_ns() taken as a clock step */
+#define RIAPS_TS_WALL_OFFSET_READS 16      /**< Bracketed reads of the system clock per offset measurement (at most) */
+#define RIAPS_TS_WALL_OFFSET_WINDOW_NS 20000LL /**< Widest bracket of a precise offset measurement */
+
+/**
+ * @brief Read a clock in nanoseconds.
+ *
+ * @param clock_id The clock to be read (e.g. CLOCK_MONOTONIC)
+ * @return The current time of the clock in nanoseconds
+ */
+static inline int64_t riaps_ts_clock_ns(clockid_t clock_id)
+{
+    struct timespec tp;
+    clock_gettime(clock_id, &tp);
+    return (int64_t)tp.tv_sec * RIAPS_TS_NSEC_PER_SEC + tp.tv_nsec;
+}
+
+/**
+ * @brief Offset of the system clock (CLOCK_REALTIME) from CLOCK_MONOTONIC in nanoseconds.
+ *
+ * Both clocks are slewed together, so the offset changes only when the system clock
+ * is stepped (clock_settime, chrony's makestep, leap seconds). The system clock is
+ * read between two CLOCK_MONOTONIC reads and the tightest bracket is kept, reading
+ * again (up to @c RIAPS_TS_WALL_OFFSET_READS times) while it is wider than
+ * @c RIAPS_TS_WALL_OFFSET_WINDOW_NS, as preemption or an interrupt between the reads
+ * shifts the midpoint by half of the bracket.
+ *
+ * @param offset The offset (at the midpoint of the tightest bracket)
+ * @return Zero, if the bracket is within @c RIAPS_TS_WALL_OFFSET_WINDOW_NS.
+ */
+static inline int riaps_ts_wall_offset(int64_t* offset)
+{
+    int64_t window = -1;
+    int i;
+
+    for (i = 0; i < RIAPS_TS_WALL_OFFSET_READS; i++) {
+        int64_t before = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+        int64_t wall = riaps_ts_clock_ns(CLOCK_REALTIME);
+        int64_t after = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+
+        if (window < 0 || after - before < window) {
+            window = after - before;
+            *offset = wall - (before + window / 2);
+        }
+        if (window <= RIAPS_TS_WALL_OFFSET_WINDOW_NS) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Offset of the system clock from CLOCK_MONOTONIC (best effort) @see riaps_ts_wall_offset()
+ */
+static inline int64_t riaps_ts_wall_offset_ns()
+{
+    int64_t offset;
+    riaps_ts_wall_offset(&offset);
+    return offset;
+}
+
+/**
+ * @brief The step of the system clock since the offset was @p base.
+ *
+ * An imprecise measurement is discarded (it is not taken as a step), the caller
+ * checks again at its next wake-up.
+ *
+ * @param base A previous result of riaps_ts_wall_offset_ns()
+ * @return The change of the offset, if it is at least @c RIAPS_TS_STEP_MIN_NS, zero otherwise.
+ */
+static inline int64_t riaps_ts_wall_step_ns(int64_t base)
+{
+    int64_t offset;
+
+    if (riaps_ts_wall_offset(&offset) || llabs(offset - base) < RIAPS_TS_STEP_MIN_NS) {
+        return 0;
+    }
+    return offset - base;
+}
+
+/**
+ * @brief Convert a @c riaps_ts_timespec to nanoseconds.
+ */
+static inline int64_t riaps_ts_ns_of_timespec(const struct riaps_ts_timespec* ts)
+{
+    return (int64_t)ts->tv_sec * RIAPS_TS_NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/**
+ * @brief Convert nanoseconds to a @c riaps_ts_timespec (with non-negative tv_nsec).
+ */
+static inline void riaps_ts_timespec_of_ns(int64_t ns, struct riaps_ts_timespec* ts)
+{
+    int64_t sec = ns / RIAPS_TS_NSEC_PER_SEC;
+    int64_t nsec = ns % RIAPS_TS_NSEC_PER_SEC;
+    if (nsec < 0) {
+        nsec += RIAPS_TS_NSEC_PER_SEC;
+        sec--;
+    }
+    ts->tv_sec = sec;
+    ts->tv_nsec = nsec;
+}
+
+/**
+ * @brief Convert nanoseconds to a POSIX @c timespec (with non-negative tv_nsec).
+ */
+static inline void riaps_ts_posix_timespec_of_ns(int64_t ns, struct timespec* ts)
+{
+    struct riaps_ts_timespec rts;
+    riaps_ts_timespec_of_ns(ns, &rts);
+    ts->tv_sec = rts.tv_sec;
+    ts->tv_nsec = rts.tv_nsec;
+}
+
+#endif // _RIAPS_TS_UTIL_H_
@@ -0,0 +1,312 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+
+/**
+ * @file riaps_ts_watch.c
+ * @author Peter Volgyesi
+ * @brief RIAPS Timesync Service - Synchronization quality watches (implementation).
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "riaps_ts_watch.h"
+#include "riaps_ts_util.h"
+
+#define WATCH_MAX_EVENTS 5
+#define WATCH_THRESHOLDS (RIAPS_TS_WATCH_RMS_OFFSET | RIAPS_TS_WATCH_LAST_OFFSET | RIAPS_TS_WATCH_SERVICE)
+#define WATCH_ALL (WATCH_THRESHOLDS | RIAPS_TS_WATCH_REFERENCE | RIAPS_TS_WATCH_LEAP)
+
+struct riaps_ts_watcher {
+    struct riaps_ts_watch_params params;
+    riaps_ts_watch_cb cb;
+    void* arg;
+    int degraded;           /* RIAPS_TS_WATCH_... bits of the degraded conditions */
+    int reference;          /* Last seen reference (-1: none yet) */
+    int leap_status;        /* Last seen leap status (-1: none yet) */
+    _Atomic int removed;    /* Released by the poller */
+    riaps_ts_watcher* next;
+};
+
+/* The watches of the process and their poller thread */
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t watch_once = PTHREAD_ONCE_INIT;
+static pthread_cond_t poll_cond;        /* Wakes up the poller (on the monotonic clock) */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;    /* A callback has returned */
+static riaps_ts_watcher* watchers = NULL;
+static riaps_ts_watcher* running_watcher = NULL;    /* Its callback is running */
+static int n_watchers = 0;              /* Number of not removed watches */
+static int poller_running = 0;
+static pthread_t poller_thread;
+static _Atomic unsigned int watch_period_ms = RIAPS_TS_WATCH_PERIOD_MS;
+
+
+static void init_watch()
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&poll_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+/* New state of a threshold condition (with hysteresis) */
+static int over_threshold(int degraded, double value, double max, double hysteresis)
+{
+    if (!degraded) {
+        return value > max;
+    }
+    return value >= max * (1.0 - hysteresis);
+}
+
+
+/* Update the state of a watch with a new status, returns the number of notifications */
+static int evaluate(riaps_ts_watcher* w, int valid, const struct riaps_ts_tracking* trk,
+                    struct riaps_ts_watch_event* events)
+{
+    const struct riaps_ts_watch_params* p = &w->params;
+    int degraded = w->degraded;
+    int changed;
+    int n = 0;
+    int bit;
+
+    if (valid) {
+        degraded &= ~RIAPS_TS_WATCH_SERVICE;
+        if (over_threshold(degraded & RIAPS_TS_WATCH_RMS_OFFSET, trk->status.rms_offset,
+                           p->max_rms_offset, p->hysteresis)) {
+            degraded |= RIAPS_TS_WATCH_RMS_OFFSET;
+        }
+        else {
+            degraded &= ~RIAPS_TS_WATCH_RMS_OFFSET;
+        }
+        if (over_threshold(degraded & RIAPS_TS_WATCH_LAST_OFFSET, fabs(trk->status.last_offset),
+                           p->max_last_offset, p->hysteresis)) {
+            degraded |= RIAPS_TS_WATCH_LAST_OFFSET;
+        }
+        else {
+            degraded &= ~RIAPS_TS_WATCH_LAST_OFFSET;
+        }
+    }
+    else {
+        /* The other conditions keep their states while the service is unavailable */
+        degraded |= RIAPS_TS_WATCH_SERVICE;
+    }
+
+    changed = (degraded ^ w->degraded) & p->events;
+    w->degraded = degraded;
+    for (bit = 1; bit <= WATCH_ALL; bit <<= 1) {
+        if (changed & bit & WATCH_THRESHOLDS) {
+            events[n].event = bit;
+            events[n].degraded = (degraded & bit) != 0;
+            events[n].old_value = events[n].new_value = 0;
+            events[n].tracking = *trk;
+            n++;
+        }
+    }
+    if (!valid) {
+        return n;
+    }
+
+    if ((p->events & RIAPS_TS_WATCH_REFERENCE) && w->reference >= 0 &&
+        trk->status.reference != w->reference) {
+        events[n].event = RIAPS_TS_WATCH_REFERENCE;
+        events[n].degraded = trk->status.reference == RIAPS_TS_REF_NONE;
+        events[n].old_value = w->reference;
+        events[n].new_value = trk->status.reference;
+        events[n].tracking = *trk;
+        n++;
+    }
+    w->reference = trk->status.reference;
+
+    if ((p->events & RIAPS_TS_WATCH_LEAP) && w->leap_status >= 0 &&
+        trk->leap_status != w->leap_status) {
+        events[n].event = RIAPS_TS_WATCH_LEAP;
+        events[n].degraded = 0;
+        events[n].old_value = w->leap_status;
+        events[n].new_value = trk->leap_status;
+        events[n].tracking = *trk;
+        n++;
+    }
+    w->leap_status = trk->leap_status;
+
+    return n;
+}
+
+
+/* Release the removed watches (with the lock held) */
+static void sweep()
+{
+    riaps_ts_watcher** link = &watchers;
+
+    while (*link) {
+        riaps_ts_watcher* w = *link;
+        if (atomic_load(&w->removed)) {
+            *link = w->next;
+            free(w);
+        }
+        else {
+            link = &w->next;
+        }
+    }
+}
+
+
+static void* poll_watches(void* unused)
+{
+    struct riaps_ts_tracking trk = {0};
+    struct riaps_ts_watch_event events[WATCH_MAX_EVENTS];
+    int64_t next = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+
+    pthread_mutex_lock(&watch_lock);
+    while (n_watchers > 0) {
+        riaps_ts_watcher* w;
+        struct timespec deadline;
+        int valid;
+
+        /* A single status query for all the watches */
+        pthread_mutex_unlock(&watch_lock);
+        valid = riaps_ts_tracking(&trk) == 0;
+        pthread_mutex_lock(&watch_lock);
+
+        /* New watches are inserted at the head, removed ones are only marked meanwhile */
+        for (w = watchers; w; w = w->next) {
+            int n, i;
+
+            if (atomic_load(&w->removed)) {
+                continue;
+            }
+            n = evaluate(w, valid, &trk, events);
+            if (n == 0) {
+                continue;
+            }
+            running_watcher = w;
+            pthread_mutex_unlock(&watch_lock);
+            for (i = 0; i < n && !atomic_load(&w->removed); i++) {
+                w->cb(w, &events[i], w->arg);
+            }
+            pthread_mutex_lock(&watch_lock);
+            running_watcher = NULL;
+            pthread_cond_broadcast(&done_cond);
+        }
+        sweep();
+
+        /* Periods missed due to slow queries or callbacks are skipped */
+        next += (int64_t)atomic_load(&watch_period_ms) * 1000000;
+        if (next < riaps_ts_clock_ns(CLOCK_MONOTONIC)) {
+            next = riaps_ts_clock_ns(CLOCK_MONOTONIC);
+        }
+        riaps_ts_posix_timespec_of_ns(next, &deadline);
+        while (n_watchers > 0 && pthread_cond_timedwait(&poll_cond, &watch_lock, &deadline) != ETIMEDOUT);
+    }
+
+    sweep();
+    poller_running = 0;
+    pthread_mutex_unlock(&watch_lock);
+    return NULL;
+}
+
+
+riaps_ts_watcher* riaps_ts_watch(const struct riaps_ts_watch_params* params, riaps_ts_watch_cb cb, void* arg)
+{
+    riaps_ts_watcher* w;
+
+    if (!params || !cb || !params->events || (params->events & ~WATCH_ALL) ||
+        params->hysteresis < 0.0 || params->hysteresis >= 1.0 ||
+        ((params->events & RIAPS_TS_WATCH_RMS_OFFSET) && !(params->max_rms_offset > 0.0)) ||
+        ((params->events & RIAPS_TS_WATCH_LAST_OFFSET) && !(params->max_last_offset > 0.0))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    pthread_once(&watch_once, init_watch);
+
+    w = calloc(1, sizeof(riaps_ts_watcher));
+    if (!w) {
+        return NULL;
+    }
+    w->params = *params;
+    if (!(params->events & RIAPS_TS_WATCH_RMS_OFFSET)) {
+        w->params.max_rms_offset = INFINITY;
+    }
+    if (!(params->events & RIAPS_TS_WATCH_LAST_OFFSET)) {
+        w->params.max_last_offset = INFINITY;
+    }
+    w->cb = cb;
+    w->arg = arg;
+    w->reference = -1;
+    w->leap_status = -1;
+    atomic_init(&w->removed, 0);
+
+    pthread_mutex_lock(&watch_lock);
+    if (!poller_running) {
+        pthread_attr_t attr;
+        int ret;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&poller_thread, &attr, poll_watches, NULL);
+        pthread_attr_destroy(&attr);
+        if (ret) {
+            pthread_mutex_unlock(&watch_lock);
+            free(w);
+            errno = ret;
+            return NULL;
+        }
+        poller_running = 1;
+    }
+    w->next = watchers;
+    watchers = w;
+    n_watchers++;
+    pthread_mutex_unlock(&watch_lock);
+
+    return w;
+}
+
+
+int riaps_ts_unwatch(riaps_ts_watcher* watcher)
+{
+    if (!watcher) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&watch_lock);
+    atomic_store(&watcher->removed, 1);
+    n_watchers--;
+    if (!pthread_equal(pthread_self(), poller_thread)) {
+        while (running_watcher == watcher) {
+            pthread_cond_wait(&done_cond, &watch_lock);
+        }
+    }
+    /* The poller stops without watches */
+    pthread_cond_signal(&poll_cond);
+    pthread_mutex_unlock(&watch_lock);
+    return 0;
+}
+
+
+int riaps_ts_watch_set_period(unsigned int period_ms)
+{
+    atomic_store(&watch_period_ms, period_ms ? period_ms : RIAPS_TS_WATCH_PERIOD_MS);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/****************************************************************************
+ * Copyright (c) 2016-2024, Vanderbilt University.                          *
+ *                                                                          *
+ * Developed with the sponsorship of the                                    *
+ * Advanced Research Projects Agency – Energy (ARPA-E)                      *
+ * of the Department of Energy.                                             *
+ *                                                                          *
+ * Licensed under the Apache License, Version 2.0 (the "License");          *
+ * you may not use this file except in compliance with the License.         *
+ * You may obtain a copy of the License at                                  *
+ *                                                                          *
+ *      http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                          *
+ * Unless required by applicable law or agreed to in writing, software      *
+ * distributed under the License is distributed on an "AS IS" BASIS,        *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ * See the License for the specific language governing permissions and      *
+ * limitations under the License.                                           *
+ ****************************************************************************/
+#ifndef _RIAPS_TS_WATCH_H_
+#define _RIAPS_TS_WATCH_H_
+
+
+/**
+ * @file riaps_ts_watch.h
+ * @author Peter Volgyesi
+ *
+ * @brief RIAPS Timesync Service - Synchronization quality watches.
+ *
+ * A watch delivers a callback when the synchronization quality crosses a threshold
+ * (RMS or last offset), the timing reference changes (e.g. GPS to NONE), the leap
+ * second status changes or the service becomes (un)available. All the watches of a
+ * process are evaluated by a single background poller thread, which queries the
+ * status once per period (from the shared memory cache if @c riaps_tsd is running),
+ * so the load on chrony does not depend on the number of watches.
+ *
+ * The notifications are edge-triggered: a callback is executed only when the state
+ * of a condition changes. Offset thresholds have hysteresis: a degraded condition
+ * recovers only when the offset drops below (1 - hysteresis) times the threshold.
+ */
+
+#include "riaps_ts.h"
+
+#define RIAPS_TS_WATCH_RMS_OFFSET 0x1   /**< RMS offset above/below the threshold @see riaps_ts_watch_params */
+#define RIAPS_TS_WATCH_LAST_OFFSET 0x2  /**< Absolute last offset above/below the threshold */
+#define RIAPS_TS_WATCH_REFERENCE 0x4    /**< The timing reference changed @see RIAPS_TS_REF_NONE */
+#define RIAPS_TS_WATCH_LEAP 0x8         /**< The leap second status changed @see RIAPS_TS_LEAP_NORMAL */
+#define RIAPS_TS_WATCH_SERVICE 0x10     /**< The timesync service became (un)available */
+
+#define RIAPS_TS_WATCH_PERIOD_MS 250    /**< Default polling period of the watches */
+
+/**
+ * @brief A registered watch
+ */
+typedef struct riaps_ts_watcher riaps_ts_watcher;
+
+/**
+ * @brief Conditions of a watch
+ */
+struct riaps_ts_watch_params {
+    int events;                 /**< Bitwise OR of the watched conditions @see RIAPS_TS_WATCH_RMS_OFFSET */
+    double max_rms_offset;      /**< Threshold of the RMS offset (secs) */
+    double max_last_offset;     /**< Threshold of the absolute last offset (secs) */
+    double hysteresis;          /**< Relative hysteresis of the thresholds (0 <= hysteresis < 1) */
+};
+
+/**
+ * @brief Notification of a watch
+ */
+struct riaps_ts_watch_event {
+    int event;                  /**< The condition which changed (a single RIAPS_TS_WATCH_... bit) */
+    int degraded;               /**< Threshold and service conditions: non-zero if degraded, zero if recovered */
+    int old_value;              /**< Reference and leap conditions: the previous reference or leap status */
+    int new_value;              /**< Reference and leap conditions: the current reference or leap status */
+    struct riaps_ts_tracking tracking; /**< The triggering status (not valid for an unavailable service) */
+};
+
+/**
+ * @brief Watch callback function
+ *
+ * Executed by the poller thread. It may call riaps_ts_watch() and riaps_ts_unwatch(),
+ * but should return quickly, because it delays the other notifications.
+ *
+ * @param watcher The watch
+ * @param event Description of the change
+ * @param arg User argument given when the watch was registered
+ */
+typedef void (*riaps_ts_watch_cb)(riaps_ts_watcher* watcher, const struct riaps_ts_watch_event* event, void* arg);
+
+/**
+ * @brief Register a watch.
+ *
+ * The current state is evaluated at the next poll: degraded thresholds and an
+ * unavailable service are notified, the initial reference and leap status are not.
+ * The poller thread is started with the first watch.
+ *
+ * @param params The watched conditions and thresholds (copied)
+ * @param cb Callback function
+ * @param arg User argument of the callback
+ * @return The watch or NULL on failure.
+ */
+riaps_ts_watcher* riaps_ts_watch(const struct riaps_ts_watch_params* params, riaps_ts_watch_cb cb, void* arg);
+
+/**
+ * @brief Remove a watch.
+ *
+ * Once it returns, the callback of the watch is not running and will not be called
+ * (unless it is called from that callback itself). The poller thread stops with the
+ * last watch. The watch is released by the poller, the handle must not be used
+ * afterwards (not even for a second riaps_ts_unwatch()).
+ *
+ * @param watcher The watch returned by riaps_ts_watch()
+ * @return Zero, if the watch was removed.
+ */
+int riaps_ts_unwatch(riaps_ts_watcher* watcher);
+
+/**
+ * @brief Set the polling period of the watches (for all the watches of the process).
+ *
+ * @param period_ms The period in milliseconds (0 for @c RIAPS_TS_WATCH_PERIOD_MS)
+ * @return Zero, if the period is valid.
+ */
+int riaps_ts_watch_set_period(unsigned int period_ms);
+
+#endif // _RIAPS_TS_WATCH_H_
@@ -0,0 +1,107 @@
+/*
+    RIAPS Timesync Service - Status publisher
+
+    Polls chrony periodically and publishes the tracking information into the
+    node-wide shared memory cache used by riaps_ts_status().
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "riaps_ts.h"
+#include "riaps_ts_shm.h"
+#include "riaps_ts_history.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-p period_ms] [-H history_samples]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct riaps_ts_shm* shm;
+    struct riaps_ts_tracking trk;
+    riaps_ts_history* history;
+    int history_capacity = RIAPS_TS_HISTORY_CAPACITY;
+    unsigned int history_every, publishes = 0;
+    struct timespec next;
+    unsigned int period_ms = RIAPS_TS_SHM_PERIOD_MS;
+    int was_valid = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:H:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            period_ms = atoi(optarg);
+            if (period_ms == 0) {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        case 'H':
+            history_capacity = atoi(optarg);
+            if (history_capacity <= 0) {
+                usage(argv[0]);
+                exit(-1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    shm = riaps_ts_shm_create(period_ms);
+    if (!shm) {
+        perror("ERROR: riaps_ts_shm_create()");
+        exit(-1);
+    }
+    fprintf(stderr, "publishing status every %u ms\n", period_ms);
+
+    /* History samples are taken at (about) RIAPS_TS_HISTORY_PERIOD_MS */
+    history_every = (RIAPS_TS_HISTORY_PERIOD_MS + period_ms / 2) / period_ms;
+    history_every = history_every ? history_every : 1;
+    history = riaps_ts_history_create_shared(history_capacity, history_every * period_ms);
+    if (!history) {
+        perror("WARNING: riaps_ts_history_create_shared()");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (running) {
+        int valid = riaps_ts_tracking_direct(&trk) == 0;
+
+        riaps_ts_shm_publish(shm, &trk, valid);
+        if (history && valid && publishes % history_every == 0) {
+            riaps_ts_history_add(history, &trk);
+        }
+        publishes++;
+        if (valid != was_valid) {
+            fprintf(stderr, valid ? "chrony is available\n" : "chrony is not available\n");
+            was_valid = valid;
+        }
+
+        next.tv_nsec += (long)(period_ms % 1000) * 1000000L;
+        next.tv_sec += period_ms / 1000 + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    /* Readers will fall back to direct queries once the data gets stale */
+    riaps_ts_shm_destroy(shm);
+    riaps_ts_history_destroy(history);
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+    RIAPS Timesync Service - chrony communication under faults
+
+    Runs mock_chronyd with a series of fault profiles (dropped, delayed,
+    duplicated, reordered and misnumbered replies, restarts) and checks the
+    worst-case latency and the success rate of riaps_ts_status() under each.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "riaps_ts.h"
+#include "riaps_ts_shm.h"
+
+#define DEFAULT_REQUESTS 100
+#define REQUEST_INTERVAL_MS 10
+#define MOCK_START_TIMEOUT_MS 2000
+#define MAX_MOCK_ARGS 16
+#define QUERY_TIMEOUT_MS 500
+
+struct fault_profile {
+    const char* name;
+    const char* args[MAX_MOCK_ARGS];    /* Fault injection options of mock_chronyd */
+    double max_latency_ms;              /* Worst-case latency of a status query */
+    double min_success_rate;            /* Fraction of successful status queries */
+};
+
+/* A query may only fail if chrony is really unreachable (down) for its whole time budget */
+static const struct fault_profile profiles[] = {
+    {"clean",     {NULL},                         50.0, 1.00},
+    {"delay",     {"-D", "20", "-J", "30", NULL}, 100.0, 1.00},
+    {"drop",      {"-d", "0.2", NULL},           100.0, 1.00},
+    {"duplicate", {"-2", "0.3", NULL},            50.0, 1.00},
+    {"reorder",   {"-O", "0.2", NULL},           100.0, 1.00},
+    {"badseq",    {"-w", "0.2", NULL},           100.0, 1.00},
+    {"restart",   {"-r", "1000:300", NULL},      550.0, 1.00},
+};
+
+static double now_ms()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1e3 + tp.tv_nsec / 1e6;
+}
+
+static pid_t start_mock(const char* mock, const char* socket_path, const struct fault_profile* profile)
+{
+    const char* argv[MAX_MOCK_ARGS + 4];
+    struct stat st;
+    double deadline;
+    pid_t pid;
+    int n = 0;
+    int i;
+
+    argv[n++] = mock;
+    argv[n++] = "-s";
+    argv[n++] = socket_path;
+    for (i = 0; profile->args[i]; i++) {
+        argv[n++] = profile->args[i];
+    }
+    argv[n] = NULL;
+
+    unlink(socket_path);
+    pid = fork();
+    if (pid == 0) {
+        execv(mock, (char* const*)argv);
+        perror("ERROR: execv()");
+        _exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+
+    deadline = now_ms() + MOCK_START_TIMEOUT_MS;
+    while (stat(socket_path, &st) != 0) {
+        if (now_ms() > deadline || waitpid(pid, NULL, WNOHANG) == pid) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+        usleep(10000);
+    }
+    return pid;
+}
+
+static void stop_mock(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static int run_profile(const char* mock, const char* socket_path, const struct fault_profile* profile, int requests)
+{
+    struct riap_ts_status status;
+    double max_latency = 0.0;
+    double success_rate;
+    int succeeded = 0;
+    int passed;
+    pid_t pid;
+    int i;
+
+    pid = start_mock(mock, socket_path, profile);
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: cannot start %s\n", mock);
+        return -1;
+    }
+
+    for (i = 0; i < requests; i++) {
+        double start = now_ms();
+        double latency;
+
+        if (riaps_ts_status(&status) == 0) {
+            succeeded++;
+        }
+        latency = now_ms() - start;
+        if (latency > max_latency) {
+            max_latency = latency;
+        }
+        usleep(REQUEST_INTERVAL_MS * 1000);
+    }
+    stop_mock(pid);
+
+    success_rate = (double)succeeded / requests;
+    passed = max_latency <= profile->max_latency_ms && success_rate >= profile->min_success_rate;
+    printf("%-10s %10.1f %10.1f %9.1f%% %9.1f%%   %s\n", profile->name,
+           max_latency, profile->max_latency_ms,
+           success_rate * 100.0, profile->min_success_rate * 100.0,
+           passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    struct riaps_ts_tracking trk;
+    char mock[PATH_MAX];
+    char dir_template[] = "/tmp/riaps_ts_test.XXXXXX";
+    char socket_path[PATH_MAX];
+    char* dir;
+    int requests = DEFAULT_REQUESTS;
+    int failed = 0;
+    int opt;
+    int i;
+
+    snprintf(mock, sizeof(mock), "%s/mock_chronyd", dirname(strdup(argv[0])));
+    while ((opt = getopt(argc, argv, "m:n:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            snprintf(mock, sizeof(mock), "%s", optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m mock_chronyd] [-n requests]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    if (requests <= 0) {
+        fprintf(stderr, "ERROR: invalid number of requests\n");
+        exit(-1);
+    }
+
+    /* Status queries would be served by the publisher instead of the mock */
+    if (riaps_ts_shm_read(&trk) >= 0) {
+        fprintf(stderr, "ERROR: riaps_tsd is running, stop it before the test\n");
+        exit(-1);
+    }
+
+    dir = mkdtemp(dir_template);
+    if (!dir) {
+        perror("ERROR: mkdtemp()");
+        exit(-1);
+    }
+    snprintf(socket_path, sizeof(socket_path), "%s/chronyd.sock", dir);
+    riaps_ts_set_endpoint(socket_path);
+    riaps_ts_set_timeout(QUERY_TIMEOUT_MS);
+
+    printf("%-10s %10s %10s %10s %10s\n", "profile", "max[ms]", "limit[ms]", "success", "limit");
+    for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        int ret = run_profile(mock, socket_path, &profiles[i], requests);
+        if (ret < 0) {
+            failed = -1;
+            break;
+        }
+        failed += ret;
+    }
+
+    unlink(socket_path);
+    rmdir(dir);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,360 @@
+/*
+    RIAPS Timesync Service - cluster collector test
+
+    Serves the chrony command protocol on many UDP ports of the loopback
+    interface (a forked mock with one epoll loop) and checks the status of
+    every node, the per-node deadlines and the cluster-wide bounds collected
+    by riaps_ts_cluster_query(). Every tenth node is dead, ignores the first
+    attempt, refuses the query or is unsynchronized.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "chrony.h"
+#include "riaps_ts_cluster.h"
+
+#define DEFAULT_NODES 500
+#define DEFAULT_ROUNDS 5
+#define TIMEOUT_MS 200
+#define SLACK_MS 50
+
+enum node_kind { NODE_OK, NODE_UNSYNC, NODE_UNAUTH, NODE_DROP_FIRST, NODE_DEAD };
+
+
+static enum node_kind kind_of(int k)
+{
+    switch (k % 10) {
+    case 6:
+        return NODE_UNSYNC;
+    case 7:
+        return NODE_UNAUTH;
+    case 8:
+        return NODE_DROP_FIRST;
+    case 9:
+        return NODE_DEAD;
+    default:
+        return NODE_OK;
+    }
+}
+
+/* Deterministic tracking values of a node */
+static double correction_of(int k)
+{
+    return ((k * 37) % 201 - 100) * 1e-6;
+}
+
+static double delay_of(int k)
+{
+    return (k % 13 + 1) * 1e-5;
+}
+
+static double dispersion_of(int k)
+{
+    return (k % 7 + 1) * 1e-6;
+}
+
+/* Chrony's floating point type has a 25-bit coefficient */
+static int close_to(double x, double expected)
+{
+    return fabs(x - expected) <= 1e-6 * fabs(expected) + 1e-15;
+}
+
+static double monotonic(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+
+static void raise_fd_limit(int n)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)n + 64) {
+        rl.rlim_cur = (rlim_t)n + 64 < rl.rlim_max ? (rlim_t)n + 64 : rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+
+static void reply(int sock, int k, const chrony_req* req, const struct sockaddr_storage* addr, socklen_t addr_len)
+{
+    chrony_rep rep;
+    chrony_float_t* fields = &rep.data.tracking.current_correction;
+
+    memset(&rep, 0, sizeof(rep));
+    rep.version = PROTO_VERSION_NUMBER;
+    rep.pkt_type = PKT_TYPE_CMD_REPLY;
+    rep.command = req->command;
+    rep.sequence = req->sequence;
+    if (kind_of(k) == NODE_UNAUTH) {
+        rep.status = htons(STT_UNAUTH);
+        rep.reply = htons(RPY_NULL);
+    }
+    else {
+        rep.status = htons(STT_SUCCESS);
+        rep.reply = htons(RPY_TRACKING);
+        rep.data.tracking.ref_id = htonl(0x47505300);  /* "GPS" */
+        rep.data.tracking.stratum = htons(1);
+        rep.data.tracking.leap_status = htons(kind_of(k) == NODE_UNSYNC ? RIAPS_TS_LEAP_UNSYNC : 0);
+        fields[0] = chrony_float_t_from_double(correction_of(k));
+        fields[6] = chrony_float_t_from_double(delay_of(k));
+        fields[7] = chrony_float_t_from_double(dispersion_of(k));
+    }
+    sendto(sock, &rep, REP_LENGTH(tracking), 0, (const struct sockaddr*)addr, addr_len);
+}
+
+
+/* The mock nodes, reports their ports through the pipe and serves them until killed */
+static void serve(int n_nodes, int report_fd)
+{
+    struct epoll_event events[64];
+    int epoll_fd = epoll_create1(0);
+    int k;
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    for (k = 0; k < n_nodes; k++) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        struct epoll_event ev;
+        int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        unsigned short port;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) ||
+            getsockname(sock, (struct sockaddr*)&addr, &addr_len)) {
+            perror("mock: socket");
+            _exit(1);
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = ((uint64_t)k << 32) | (uint32_t)sock;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+        port = ntohs(addr.sin_port);
+        if (write(report_fd, &port, sizeof(port)) != sizeof(port)) {
+            _exit(1);
+        }
+    }
+    close(report_fd);
+
+    for (;;) {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        int i;
+
+        for (i = 0; i < n; i++) {
+            int k = events[i].data.u64 >> 32;
+            int sock = (int)(uint32_t)events[i].data.u64;
+            struct sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            chrony_req req;
+
+            while (recvfrom(sock, &req, sizeof(req), 0, (struct sockaddr*)&addr, &addr_len) > 0) {
+                if (kind_of(k) != NODE_DEAD && (kind_of(k) != NODE_DROP_FIRST || ntohs(req.attempt) > 0)) {
+                    reply(sock, k, &req, &addr, addr_len);
+                }
+                addr_len = sizeof(addr);
+            }
+        }
+    }
+}
+
+
+/* Check the status of the nodes of a round, returns the number of failures */
+static int check_round(const int* ids, const struct riaps_ts_node_status* status, int n_nodes)
+{
+    struct riaps_ts_cluster_bound bound;
+    double brute_bound = 0.0;
+    int n_sync = 0;
+    int failures = 0;
+    int i, j;
+
+    for (i = 0; i < n_nodes; i++) {
+        const struct riaps_ts_node_status* s = &status[i];
+        int k = ids[i];
+        int expected = kind_of(k) == NODE_DEAD ? ETIMEDOUT : kind_of(k) == NODE_UNAUTH ? EACCES : 0;
+
+        if (s->error != expected || s->valid != !expected) {
+            fprintf(stderr, "node %d: error %d (%s), expected %d\n", k, s->error, strerror(s->error), expected);
+            failures++;
+            continue;
+        }
+        if (!s->valid) {
+            continue;
+        }
+        if (s->synchronized != (kind_of(k) != NODE_UNSYNC) ||
+            !close_to(s->offset, -correction_of(k)) ||
+            !close_to(s->error_bound, delay_of(k) / 2 + dispersion_of(k))) {
+            fprintf(stderr, "node %d: offset %g, error bound %g\n", k, s->offset, s->error_bound);
+            failures++;
+        }
+        n_sync += s->synchronized;
+    }
+
+    /* The linear-time bound against all the pairs */
+    for (i = 0; i < n_nodes; i++) {
+        for (j = i + 1; j < n_nodes; j++) {
+            double b = riaps_ts_node_pair_bound(&status[i], &status[j]);
+            if (isfinite(b) && b > brute_bound) {
+                brute_bound = b;
+            }
+        }
+    }
+    riaps_ts_cluster_bound(status, n_nodes, &bound);
+    if (bound.n_nodes != n_sync || (n_sync >= 2 && fabs(bound.max_bound - brute_bound) > 1e-12) ||
+        (n_sync >= 2 && riaps_ts_node_pair_bound(&status[bound.ahead], &status[bound.behind]) != bound.max_bound)) {
+        fprintf(stderr, "cluster bound %g (%d nodes), expected %g (%d nodes)\n", bound.max_bound, bound.n_nodes,
+                brute_bound, n_sync);
+        failures++;
+    }
+    return failures;
+}
+
+
+/* Run rounds over a subset of the nodes, returns the number of failures */
+static int run(const char* name, unsigned short* ports, int n_all, int skip_dead, int rounds, double max_round)
+{
+    const char** endpoints = calloc(n_all, sizeof(char*));
+    struct riaps_ts_node_status* status = calloc(n_all, sizeof(struct riaps_ts_node_status));
+    int* ids = calloc(n_all, sizeof(int));
+    riaps_ts_cluster* cluster;
+    double worst = 0.0, total = 0.0;
+    int failures = 0;
+    int n_nodes = 0;
+    int k, r;
+
+    for (k = 0; k < n_all; k++) {
+        char* endpoint;
+
+        if (skip_dead && kind_of(k) == NODE_DEAD) {
+            continue;
+        }
+        if (asprintf(&endpoint, "127.0.0.1:%u", ports[k]) < 0) {
+            exit(-1);
+        }
+        endpoints[n_nodes] = endpoint;
+        ids[n_nodes++] = k;
+    }
+
+    cluster = riaps_ts_cluster_create(endpoints, n_nodes);
+    if (!cluster) {
+        perror("ERROR: riaps_ts_cluster_create()");
+        exit(-1);
+    }
+    riaps_ts_cluster_set_timeout(cluster, TIMEOUT_MS);
+    for (r = 0; r < rounds; r++) {
+        double start = monotonic();
+        double elapsed;
+        int answered = riaps_ts_cluster_query(cluster, status);
+
+        elapsed = monotonic() - start;
+        total += elapsed;
+        worst = elapsed > worst ? elapsed : worst;
+        if (answered < 0) {
+            perror("ERROR: riaps_ts_cluster_query()");
+            failures++;
+            break;
+        }
+        failures += check_round(ids, status, n_nodes);
+    }
+
+    if (worst > max_round) {
+        failures++;
+    }
+    printf("%-12s %5d nodes  round avg %7.2f ms  max %7.2f ms (limit %.0f ms)  %8.0f nodes/s  %s\n", name, n_nodes,
+           total / rounds * 1e3, worst * 1e3, max_round * 1e3, n_nodes * rounds / total,
+           failures ? "FAIL" : "PASS");
+
+    riaps_ts_cluster_destroy(cluster);
+    for (k = 0; k < n_nodes; k++) {
+        free((char*)endpoints[k]);
+    }
+    free(endpoints);
+    free(status);
+    free(ids);
+    return failures;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned short* ports;
+    int n_nodes = DEFAULT_NODES;
+    int rounds = DEFAULT_ROUNDS;
+    int report[2];
+    int failures = 0;
+    pid_t mock;
+    int opt;
+    int k;
+
+    while ((opt = getopt(argc, argv, "n:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_nodes = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n nodes] [-r rounds]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    if (n_nodes < 10 || rounds < 1) {
+        fprintf(stderr, "ERROR: at least 10 nodes and 1 round\n");
+        exit(-1);
+    }
+
+    raise_fd_limit(n_nodes);
+    ports = calloc(n_nodes, sizeof(unsigned short));
+    if (!ports || pipe(report)) {
+        perror("ERROR: pipe()");
+        exit(-1);
+    }
+    mock = fork();
+    if (mock < 0) {
+        perror("ERROR: fork()");
+        exit(-1);
+    }
+    if (mock == 0) {
+        close(report[0]);
+        serve(n_nodes, report[1]);
+    }
+    close(report[1]);
+    for (k = 0; k < n_nodes; k++) {
+        if (read(report[0], &ports[k], sizeof(ports[k])) != sizeof(ports[k])) {
+            fprintf(stderr, "ERROR: mock nodes failed to start\n");
+            kill(mock, SIGTERM);
+            exit(-1);
+        }
+    }
+    close(report[0]);
+
+    /* The dead nodes hold the round until the deadline, the responsive ones are collected much sooner */
+    failures += run("all", ports, n_nodes, 0, rounds, (TIMEOUT_MS + SLACK_MS) * 1e-3);
+    failures += run("responsive", ports, n_nodes, 1, rounds, TIMEOUT_MS / 2 * 1e-3);
+
+    kill(mock, SIGTERM);
+    waitpid(mock, NULL, 0);
+    free(ports);
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+/*
+    RIAPS Timesync Service - timestamp conversion test
+
+    Builds a clock map from a synthetic piecewise-linear mapping (drifting and
+    slewed segments and a clock step) and checks the conversion of sorted and
+    shuffled arrays against the exact mapping and the single conversions, then
+    measures the conversion rate and the accuracy of live maps of
+    CLOCK_MONOTONIC and CLOCK_BOOTTIME.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "riaps_ts_convert.h"
+
+#define DEFAULT_TIMESTAMPS 1000000
+#define N_SEGMENTS 64
+#define STEP_SEGMENT 40
+#define STEP_NS 500000000LL
+#define FOREIGN_BASE_NS 1000000000000LL
+#define SYNC_BASE_NS 1700000000000000000LL
+#define MAX_ERROR_NS 2
+#define LIVE_PAIRS 10
+#define LIVE_MAX_ERROR_NS 100000
+
+static double rates[N_SEGMENTS];    /* Rate difference of the segments of the synthetic mapping */
+
+
+/* The exact synthetic mapping */
+static long double exact(int64_t foreign)
+{
+    long double t = (long double)(foreign - FOREIGN_BASE_NS) / 1e9L;
+    long double sync = SYNC_BASE_NS;
+    int i;
+
+    if (t < 0) {
+        return sync + (foreign - FOREIGN_BASE_NS) * (1.0L + rates[0]);
+    }
+    for (i = 0; i < N_SEGMENTS - 1 && t >= 1.0L; i++, t -= 1.0L) {
+        sync += 1e9L * (1.0L + rates[i]);
+        if (i + 1 == STEP_SEGMENT) {
+            sync += STEP_NS;
+        }
+    }
+    return sync + t * 1e9L * (1.0L + rates[i]);
+}
+
+static double elapsed_ms(const struct timespec* begin)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - begin->tv_sec) * 1e3 + (now.tv_nsec - begin->tv_nsec) * 1e-6;
+}
+
+static int compare_ns(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+
+/* Check a converted array, returns the number of failures */
+static int check(riaps_ts_clockmap* map, const char* name, const int64_t* in, const int64_t* out, size_t n,
+                 double ms)
+{
+    int64_t max_error = 0;
+    size_t mismatches = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        int64_t error = llabs(out[i] - llrintl(exact(in[i])));
+        struct riaps_ts_timespec foreign, sync;
+
+        max_error = error > max_error ? error : max_error;
+        if (i % 97 == 0) {
+            foreign.tv_sec = in[i] / 1000000000LL;
+            foreign.tv_nsec = in[i] % 1000000000LL;
+            riaps_ts_clockmap_convert_timespec(map, &foreign, &sync);
+            mismatches += sync.tv_sec * 1000000000LL + sync.tv_nsec != out[i];
+        }
+    }
+    printf("%-10s %8zu timestamps in %7.2f ms (%6.1f M/s), max error %lld ns, %zu single mismatches: %s\n",
+           name, n, ms, n / ms * 1e-3, (long long)max_error, mismatches,
+           max_error <= MAX_ERROR_NS && !mismatches ? "PASS" : "FAIL");
+    return max_error > MAX_ERROR_NS || mismatches;
+}
+
+
+static int test_synthetic(size_t n)
+{
+    riaps_ts_clockmap* map = riaps_ts_clockmap_create(CLOCK_MONOTONIC, N_SEGMENTS);
+    struct riaps_ts_clockmap_info info;
+    struct timespec begin;
+    int64_t* in = malloc(n * sizeof(int64_t));
+    int64_t* out = malloc(n * sizeof(int64_t));
+    int failures = 0;
+    size_t i;
+
+    if (!map || !in || !out) {
+        perror("ERROR: riaps_ts_clockmap_create()");
+        exit(-1);
+    }
+
+    /* Drifting segments, a slewed one and a step (the segment before it keeps the rate) */
+    srand(1);
+    for (i = 0; i < N_SEGMENTS; i++) {
+        rates[i] = (rand() % 101 - 50) * 1e-6;
+    }
+    rates[10] = 500e-6;
+    rates[STEP_SEGMENT - 1] = rates[STEP_SEGMENT - 2];
+    rates[N_SEGMENTS - 1] = rates[N_SEGMENTS - 2];     /* Extrapolated with the latest segment */
+    for (i = 0; i < N_SEGMENTS; i++) {
+        int64_t foreign = FOREIGN_BASE_NS + i * 1000000000LL;
+        if (riaps_ts_clockmap_add(map, foreign, llrintl(exact(foreign)), 0)) {
+            perror("ERROR: riaps_ts_clockmap_add()");
+            exit(-1);
+        }
+    }
+    riaps_ts_clockmap_info(map, &info);
+    if (info.n_pairs != N_SEGMENTS || info.steps != 1) {
+        printf("map: %d pairs, %lu steps: FAIL\n", info.n_pairs, info.steps);
+        failures++;
+    }
+
+    /* Sorted timestamps over the map and beyond both ends */
+    for (i = 0; i < n; i++) {
+        in[i] = FOREIGN_BASE_NS - 2000000000LL + (int64_t)((N_SEGMENTS + 3) * 1e9 * ((double)rand() / RAND_MAX));
+    }
+    qsort(in, n, sizeof(int64_t), compare_ns);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    riaps_ts_clockmap_convert(map, in, out, n);
+    failures += check(map, "sorted", in, out, n, elapsed_ms(&begin));
+
+    /* Shuffled */
+    for (i = n - 1; i > 0; i--) {
+        size_t j = rand() % (i + 1);
+        int64_t x = in[i];
+        in[i] = in[j];
+        in[j] = x;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    riaps_ts_clockmap_convert(map, in, out, n);
+    failures += check(map, "shuffled", in, out, n, elapsed_ms(&begin));
+
+    riaps_ts_clockmap_destroy(map);
+    free(in);
+    free(out);
+    return failures;
+}
+
+
+static int test_live(clockid_t clock_id, const char* name)
+{
+    riaps_ts_clockmap* map = riaps_ts_clockmap_create(clock_id, 0);
+    struct riaps_ts_clockmap_info info;
+    int64_t max_error = 0;
+    int i;
+
+    if (!map) {
+        perror("ERROR: riaps_ts_clockmap_create()");
+        return 1;
+    }
+    for (i = 0; i < LIVE_PAIRS; i++) {
+        if (riaps_ts_clockmap_sample(map)) {
+            perror("ERROR: riaps_ts_clockmap_sample()");
+            return 1;
+        }
+        usleep(20000);
+    }
+
+    /* Timestamps of the recent past against the synchronized clock read at the same time */
+    for (i = 0; i < 1000; i++) {
+        struct timespec before, foreign, after;
+        struct riaps_ts_timespec ts, sync;
+        int64_t mid, error;
+
+        clock_gettime(CLOCK_REALTIME, &before);
+        clock_gettime(clock_id, &foreign);
+        clock_gettime(CLOCK_REALTIME, &after);
+        ts.tv_sec = foreign.tv_sec;
+        ts.tv_nsec = foreign.tv_nsec;
+        riaps_ts_clockmap_convert_timespec(map, &ts, &sync);
+        mid = (before.tv_sec + after.tv_sec) * 500000000LL + (before.tv_nsec + after.tv_nsec) / 2;
+        error = llabs(sync.tv_sec * 1000000000LL + sync.tv_nsec - mid);
+        max_error = error > max_error ? error : max_error;
+    }
+    riaps_ts_clockmap_info(map, &info);
+    printf("%-10s %d pairs, rate %+.3f ppm, pairing uncertainty %.0f ns, max error %lld ns: %s\n", name,
+           info.n_pairs, info.rate_ppm, info.max_uncertainty * 1e9, (long long)max_error,
+           max_error <= LIVE_MAX_ERROR_NS ? "PASS" : "FAIL");
+    riaps_ts_clockmap_destroy(map);
+    return max_error > LIVE_MAX_ERROR_NS;
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? (size_t)atol(argv[1]) : DEFAULT_TIMESTAMPS;
+    int failures = 0;
+
+    if (n == 0) {
+        fprintf(stderr, "usage: %s [n_timestamps]\n", argv[0]);
+        exit(-1);
+    }
+    failures += test_synthetic(n);
+    failures += test_live(CLOCK_MONOTONIC, "monotonic");
+    failures += test_live(CLOCK_BOOTTIME, "boottime");
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
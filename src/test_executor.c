@@ -0,0 +1,278 @@
+/*
+    RIAPS Timesync Service - time-triggered executor test
+
+    Runs a TDMA-style schedule (slots with busy-looping actions in a
+    hyperperiod, on one or more real-time workers) while optional load threads
+    keep every CPU busy, then prints the per-slot release jitter, execution
+    time and deadline misses. The rate of the missed deadlines depends on the
+    kernel (PREEMPT_RT) and the tuning of the node, so it is only checked
+    against a limit given with -m. With -r it prints the statistics published
+    by another (running) test.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "riaps_ts_executor.h"
+
+#define DEFAULT_HYPERPERIOD_US 10000
+#define DEFAULT_SLOTS 4
+#define DEFAULT_EXEC_US 200
+#define DEFAULT_DURATION_S 5
+#define MAX_LOAD_THREADS 64
+
+static volatile sig_atomic_t running = 1;
+static volatile int loading = 1;
+
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+
+static void busy_action(const struct riaps_ts_timespec* release, void* arg)
+{
+    long exec_ns = (long)(intptr_t)arg;
+    struct timespec begin, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - begin.tv_sec) * 1000000000L + now.tv_nsec - begin.tv_nsec < exec_ns);
+}
+
+
+static void* load_main(void* arg)
+{
+    volatile unsigned long x = 0;
+
+    while (loading) {
+        x++;
+    }
+    return NULL;
+}
+
+
+/* Print the statistics of every slot, returns the number of missed deadlines and releases */
+static void print_stats(const struct riaps_ts_executor_stats* stats, uint64_t* missed, uint64_t* releases)
+{
+    struct riaps_ts_slot_stats s;
+    int i;
+
+    *missed = *releases = 0;
+    printf("%4s %6s %10s %10s %10s %10s %10s %10s %8s %8s\n", "slot", "worker", "offset[us]", "dline[us]",
+           "releases", "jit_avg", "jit_max", "exec_avg", "misses", "skips");
+    for (i = 0; i < stats->n_slots; i++) {
+        if (riaps_ts_executor_read_slot(stats, i, &s)) {
+            printf("%4d (busy)\n", i);
+            continue;
+        }
+        printf("%4d %6d %10.1f %10.1f %10llu %10.2f %10.2f %10.2f %8llu %8llu\n", i, s.worker, s.offset_ns * 1e-3,
+               s.deadline_ns * 1e-3, (unsigned long long)s.releases,
+               s.releases ? s.jitter_sum_ns * 1e-3 / s.releases : 0.0, s.jitter_max_ns * 1e-3,
+               s.releases ? s.exec_sum_ns * 1e-3 / s.releases : 0.0,
+               (unsigned long long)s.misses, (unsigned long long)s.skips);
+        *missed += s.misses + s.skips;
+        *releases += s.releases + s.skips;
+    }
+}
+
+
+static int parse_policy(const char* name)
+{
+    if (strcmp(name, "fifo") == 0) {
+        return SCHED_FIFO;
+    }
+    if (strcmp(name, "deadline") == 0) {
+        return 6;   /* SCHED_DEADLINE */
+    }
+    if (strcmp(name, "other") == 0) {
+        return SCHED_OTHER;
+    }
+    return -1;
+}
+
+
+/* Real-time (PREEMPT_RT) kernel */
+static int rt_kernel()
+{
+    FILE* f = fopen("/sys/kernel/realtime", "r");
+    int rt = 0;
+
+    if (f) {
+        rt = fgetc(f) == '1';
+        fclose(f);
+    }
+    return rt;
+}
+
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-p fifo|deadline|other] [-P priority] [-w workers] [-c cpu[,cpu...]] "
+                    "[-H hyperperiod_us] [-n slots] [-e exec_us] [-S max_spin_ns] [-d duration_s] [-l load_threads] "
+                    "[-m max_miss_rate] [-s stats_name]\n"
+                    "       %s -r stats_name\n", prog, prog);
+}
+
+
+int main(int argc, char* argv[])
+{
+    struct riaps_ts_executor_attr attr;
+    struct riaps_ts_timespec hyperperiod;
+    struct riaps_ts_slot* slots;
+    pthread_t loaders[MAX_LOAD_THREADS];
+    riaps_ts_executor* executor;
+    const char* reader = NULL;
+    long hyperperiod_us = DEFAULT_HYPERPERIOD_US;
+    long exec_us = DEFAULT_EXEC_US;
+    int n_slots = DEFAULT_SLOTS;
+    int duration_s = DEFAULT_DURATION_S;
+    int n_loaders = 0;
+    double max_miss_rate = -1.0;   /* No limit: the rate is only reported */
+    uint64_t missed, releases;
+    char* cpu;
+    int opt;
+    int i;
+
+    riaps_ts_executor_attr_init(&attr);
+    while ((opt = getopt(argc, argv, "p:P:w:c:H:n:e:S:d:l:m:s:r:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            attr.policy = parse_policy(optarg);
+            break;
+        case 'P':
+            attr.priority = atoi(optarg);
+            break;
+        case 'w':
+            attr.n_workers = atoi(optarg);
+            break;
+        case 'c':
+            for (i = 0, cpu = strtok(optarg, ","); cpu && i < RIAPS_TS_EXECUTOR_MAX_WORKERS;
+                 cpu = strtok(NULL, ","), i++) {
+                attr.cpus[i] = atoi(cpu);
+            }
+            break;
+        case 'H':
+            hyperperiod_us = atol(optarg);
+            break;
+        case 'n':
+            n_slots = atoi(optarg);
+            break;
+        case 'e':
+            exec_us = atol(optarg);
+            break;
+        case 'S':
+            attr.max_spin_ns = atol(optarg);
+            break;
+        case 'd':
+            duration_s = atoi(optarg);
+            break;
+        case 'l':
+            n_loaders = atoi(optarg);
+            break;
+        case 'm':
+            max_miss_rate = atof(optarg);
+            break;
+        case 's':
+            attr.stats_name = optarg;
+            break;
+        case 'r':
+            reader = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (reader) {
+        const struct riaps_ts_executor_stats* stats = riaps_ts_executor_stats_attach(reader);
+        if (!stats) {
+            perror("ERROR: riaps_ts_executor_stats_attach()");
+            exit(-1);
+        }
+        printf("hyperperiod: %.1f us, %s\n", stats->hyperperiod_ns * 1e-3,
+               atomic_load(&stats->running) ? "running" : "stopped");
+        print_stats(stats, &missed, &releases);
+        riaps_ts_executor_stats_detach(stats);
+        return 0;
+    }
+
+    if (n_slots < 1 || hyperperiod_us <= 0 || n_loaders < 0 || n_loaders > MAX_LOAD_THREADS) {
+        usage(argv[0]);
+        exit(-1);
+    }
+
+    /* Evenly spaced slots, assigned to the workers round-robin */
+    slots = calloc(n_slots, sizeof(struct riaps_ts_slot));
+    if (!slots) {
+        perror("ERROR: calloc()");
+        exit(-1);
+    }
+    for (i = 0; i < n_slots; i++) {
+        long offset_ns = hyperperiod_us * 1000L * i / n_slots;
+
+        slots[i].offset.tv_sec = offset_ns / 1000000000L;
+        slots[i].offset.tv_nsec = offset_ns % 1000000000L;
+        slots[i].budget.tv_nsec = exec_us * 2000L;
+        slots[i].worker = i % (attr.n_workers > 0 ? attr.n_workers : 1);
+        slots[i].action = busy_action;
+        slots[i].arg = (void*)(intptr_t)(exec_us * 1000L);
+    }
+    hyperperiod.tv_sec = hyperperiod_us / 1000000L;
+    hyperperiod.tv_nsec = hyperperiod_us % 1000000L * 1000L;
+
+    executor = riaps_ts_executor_create(&hyperperiod, NULL, slots, n_slots, &attr);
+    if (!executor) {
+        perror("ERROR: riaps_ts_executor_create()");
+        exit(-1);
+    }
+    if (riaps_ts_executor_start(executor)) {
+        perror("ERROR: riaps_ts_executor_start()");
+        riaps_ts_executor_destroy(executor);
+        exit(-1);
+    }
+    for (i = 0; i < n_loaders; i++) {
+        if (pthread_create(&loaders[i], NULL, load_main, NULL)) {
+            n_loaders = i;
+            break;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    for (i = 0; i < duration_s * 10 && running; i++) {
+        usleep(100000);
+    }
+
+    riaps_ts_executor_stop(executor);
+    loading = 0;
+    for (i = 0; i < n_loaders; i++) {
+        pthread_join(loaders[i], NULL);
+    }
+    print_stats(riaps_ts_executor_stats(executor), &missed, &releases);
+    riaps_ts_executor_destroy(executor);
+    free(slots);
+
+    printf("%llu of %llu releases missed their deadlines (%.4f%%) with %d load threads on a%s kernel",
+           (unsigned long long)missed, (unsigned long long)releases, releases ? 100.0 * missed / releases : 0.0,
+           n_loaders, rt_kernel() ? " PREEMPT_RT" : " non-PREEMPT_RT");
+    if (max_miss_rate < 0.0) {
+        printf(": %s\n", releases ? "INFO" : "FAIL");
+        return releases ? 0 : 1;
+    }
+    printf(", limit %.4f%%: %s\n", 100.0 * max_miss_rate,
+           releases && missed <= max_miss_rate * releases ? "PASS" : "FAIL");
+    return releases && missed <= max_miss_rate * releases ? 0 : 1;
+}
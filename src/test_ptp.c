@@ -0,0 +1,105 @@
+/*
+    RIAPS Timesync Service - PTP status query
+
+    Prints the extended status (chrony tracking and ptp4l port state) once, or
+    periodically with -p period_ms.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "riaps_ts.h"
+#include "riaps_ts_ptp.h"
+
+static const char* reference_str[] = {
+    "NONE",
+    "GPS",
+    "NTP",
+    "PTP"
+};
+
+static const char* port_state_str[] = {
+    "-",
+    "INITIALIZING",
+    "FAULTY",
+    "DISABLED",
+    "LISTENING",
+    "PRE_MASTER",
+    "MASTER",
+    "PASSIVE",
+    "UNCALIBRATED",
+    "SLAVE"
+};
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-u chrony_endpoint] [-T ptp4l_socket] [-p period_ms]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct riaps_ts_status_ex stat;
+    int period_ms = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:T:p:h")) != -1) {
+        switch (opt) {
+        case 'u':
+            if (riaps_ts_set_endpoint(optarg)) {
+                fprintf(stderr, "ERROR: invalid chrony endpoint: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'T':
+            if (riaps_ts_set_ptp_endpoint(optarg)) {
+                fprintf(stderr, "ERROR: invalid ptp4l socket: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'p':
+            period_ms = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    do {
+        if (riaps_ts_status_ex(&stat)) {
+            perror("ERROR: riaps_ts_status_ex()");
+        }
+        else {
+            if (stat.tracking_valid) {
+                printf("reference: %s (stratum %d, offset %.9f secs)\n",
+                       reference_str[stat.tracking.status.reference], stat.tracking.stratum,
+                       stat.tracking.status.last_offset);
+            }
+            else {
+                printf("reference: (chrony is not available)\n");
+            }
+            if (stat.ptp_valid) {
+                printf("\tport: %d (%s, %d ports)\n"
+                       "\tmaster_offset: %.9f secs\n"
+                       "\tmean_path_delay: %.9f secs\n"
+                       "\tsteps_removed: %d\n"
+                       "\tparent: %s\n"
+                       "\tgrandmaster: %s (%s, class %d, accuracy 0x%02x, priority %d/%d)\n",
+                       stat.ptp.port_number, port_state_str[stat.ptp.port_state], stat.ptp.n_ports,
+                       stat.ptp.master_offset, stat.ptp.mean_path_delay, stat.ptp.steps_removed,
+                       stat.ptp.parent_port, stat.ptp.grandmaster,
+                       stat.ptp.gm_present ? "present" : "absent", stat.ptp.gm_clock_class,
+                       stat.ptp.gm_clock_accuracy, stat.ptp.gm_priority1, stat.ptp.gm_priority2);
+            }
+            else {
+                printf("\tptp4l is not available\n");
+            }
+        }
+        if (period_ms > 0) {
+            usleep(period_ms * 1000);
+        }
+    } while (period_ms > 0);
+    return 0;
+}
@@ -0,0 +1,338 @@
+/*
+    RIAPS Timesync Service - clock step test
+
+    Steps the system clock (requires root) while sleeping in riaps_ts_sleep_until()
+    while running periodic timers and a time-triggered executor, then checks the reported steps, the rebased
+    deadlines and that the timers stay evenly spaced (no stall, no burst). Every
+    step is undone right after the scenario. The last scenarios delay every third
+    CLOCK_MONOTONIC read (clock_gettime() is interposed) without stepping the clock,
+    like preemption between the reads of the step detection, and check that no step
+    is reported.
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "riaps_ts.h"
+#include "riaps_ts_executor.h"
+#include "riaps_ts_timer.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000LL
+#define STEP_TOLERANCE_NS NSEC_PER_MSEC
+#define WAKE_TOLERANCE_NS (20 * NSEC_PER_MSEC)
+#define TIMER_PERIOD_NS (100 * NSEC_PER_MSEC)
+#define TIMER_RUN_NS (1200 * NSEC_PER_MSEC)
+#define MAX_FIRES 64
+#define READ_DELAY_NS (300 * 1000LL)    /* Skews the midpoint of a bracket by more than RIAPS_TS_STEP_MIN_NS */
+
+struct stepper {
+    pthread_t thread;
+    int64_t delay_ns;   /* When to step (CLOCK_MONOTONIC, from the start) */
+    int64_t step_ns;
+    int error;
+};
+
+struct fires {
+    int64_t mono[MAX_FIRES];
+    int64_t deadline[MAX_FIRES];
+    unsigned long overruns;
+    int n;
+    int steps;
+    long long step_ns;
+};
+
+static _Atomic int64_t read_delay_ns = 0;
+static _Atomic unsigned long monotonic_reads = 0;
+
+
+/* Interposed for the library too, delays every third CLOCK_MONOTONIC read when enabled */
+int clock_gettime(clockid_t clock_id, struct timespec* tp)
+{
+    static int (*real_clock_gettime)(clockid_t, struct timespec*) = NULL;
+    int64_t delay = read_delay_ns;
+    struct timespec now;
+    int ret;
+
+    if (!real_clock_gettime) {
+        real_clock_gettime = (int (*)(clockid_t, struct timespec*))dlsym(RTLD_NEXT, "clock_gettime");
+    }
+    ret = real_clock_gettime(clock_id, tp);
+    if (delay && clock_id == CLOCK_MONOTONIC && ++monotonic_reads % 3 == 0) {
+        do {
+            real_clock_gettime(CLOCK_MONOTONIC, &now);
+        } while ((now.tv_sec - tp->tv_sec) * NSEC_PER_SEC + now.tv_nsec - tp->tv_nsec < delay);
+    }
+    return ret;
+}
+
+static int64_t clock_ns(clockid_t clock_id)
+{
+    struct timespec tp;
+
+    clock_gettime(clock_id, &tp);
+    return tp.tv_sec * NSEC_PER_SEC + tp.tv_nsec;
+}
+
+static int step_clock(int64_t step_ns)
+{
+    int64_t now = clock_ns(CLOCK_REALTIME) + step_ns;
+    struct timespec tp = {now / NSEC_PER_SEC, now % NSEC_PER_SEC};
+
+    return clock_settime(CLOCK_REALTIME, &tp) ? errno : 0;
+}
+
+static void* stepper_main(void* arg)
+{
+    struct stepper* stepper = arg;
+    struct timespec delay = {stepper->delay_ns / NSEC_PER_SEC, stepper->delay_ns % NSEC_PER_SEC};
+
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, NULL);
+    stepper->error = step_clock(stepper->step_ns);
+    return NULL;
+}
+
+static void stepper_start(struct stepper* stepper, int64_t delay_ns, int64_t step_ns)
+{
+    stepper->delay_ns = delay_ns;
+    stepper->step_ns = step_ns;
+    stepper->error = 0;
+    pthread_create(&stepper->thread, NULL, stepper_main, stepper);
+}
+
+/* Join the stepper and undo its step, returns non-zero on failure */
+static int stepper_finish(struct stepper* stepper)
+{
+    pthread_join(stepper->thread, NULL);
+    if (stepper->error) {
+        fprintf(stderr, "ERROR: clock_settime(): %s\n", strerror(stepper->error));
+        return 1;
+    }
+    return step_clock(-stepper->step_ns) != 0;
+}
+
+static int near(int64_t value, int64_t expected, int64_t tolerance)
+{
+    return llabs(value - expected) <= tolerance;
+}
+
+
+/* Sleep 'sleep_ns' ahead while the clock is stepped by 'step_ns' after 'delay_ns' */
+static int check_sleep(const char* name, int policy, int64_t sleep_ns, int64_t delay_ns, int64_t step_ns,
+                       int expected_ret, int64_t expected_elapsed_ns)
+{
+    struct stepper stepper;
+    struct riaps_ts_wakeup wakeup;
+    struct riaps_ts_timespec deadline;
+    int64_t start, target, elapsed, rebased;
+    int ret, ok;
+
+    target = clock_ns(CLOCK_REALTIME) + sleep_ns;
+    deadline.tv_sec = target / NSEC_PER_SEC;
+    deadline.tv_nsec = target % NSEC_PER_SEC;
+    start = clock_ns(CLOCK_MONOTONIC);
+    stepper_start(&stepper, delay_ns, step_ns);
+    ret = riaps_ts_sleep_until(&deadline, policy, &wakeup);
+    elapsed = clock_ns(CLOCK_MONOTONIC) - start;
+    if (stepper_finish(&stepper)) {
+        return 1;
+    }
+
+    rebased = wakeup.deadline.tv_sec * NSEC_PER_SEC + wakeup.deadline.tv_nsec;
+    ok = ret == expected_ret &&
+         (wakeup.events & RIAPS_TS_WAKE_STEPPED) == (step_ns ? RIAPS_TS_WAKE_STEPPED : 0) &&
+         near(wakeup.step_ns, step_ns, STEP_TOLERANCE_NS) &&
+         near(elapsed, expected_elapsed_ns, WAKE_TOLERANCE_NS) &&
+         near(rebased, policy == RIAPS_TS_REBASE_NONE ? target : target + step_ns, STEP_TOLERANCE_NS);
+    printf("%-12s ret: %d, events: 0x%x, step: %+.6f secs, elapsed: %.3f secs: %s\n", name, ret,
+           wakeup.events, wakeup.step_ns / 1e9, elapsed / 1e9, ok ? "PASS" : "FAIL");
+    return !ok;
+}
+
+
+static void on_timer(riaps_ts_timer* timer, const struct riaps_ts_timespec* deadline,
+                     unsigned long overruns, void* arg)
+{
+    struct fires* fires = arg;
+
+    if (fires->n < MAX_FIRES) {
+        fires->mono[fires->n] = clock_ns(CLOCK_MONOTONIC);
+        fires->deadline[fires->n] = deadline->tv_sec * NSEC_PER_SEC + deadline->tv_nsec;
+        fires->n++;
+    }
+    fires->overruns += overruns;
+}
+
+static void on_step(long long step_ns, void* arg)
+{
+    struct fires* fires = arg;
+
+    fires->steps++;
+    fires->step_ns += step_ns;
+}
+
+/* Run a periodic timer while the clock is stepped by 'step_ns' after 'delay_ns' */
+static int check_timers(const char* name, int policy, int64_t delay_ns, int64_t step_ns)
+{
+    struct riaps_ts_timespec period = {0, TIMER_PERIOD_NS};
+    struct stepper stepper;
+    struct fires fires;
+    riaps_ts_timers* timers;
+    int64_t start, gap, min_gap, max_gap, phase;
+    int i, ok;
+
+    memset(&fires, 0, sizeof(fires));
+    timers = riaps_ts_timers_create();
+    if (!timers || riaps_ts_timers_set_rebase(timers, policy, on_step, &fires) ||
+        !riaps_ts_timer_add(timers, &period, NULL, on_timer, &fires)) {
+        perror("ERROR: riaps_ts_timers");
+        return 1;
+    }
+
+    start = clock_ns(CLOCK_MONOTONIC);
+    stepper_start(&stepper, delay_ns, step_ns);
+    while (clock_ns(CLOCK_MONOTONIC) - start < TIMER_RUN_NS) {
+        riaps_ts_timers_wait(timers, 10);
+    }
+    riaps_ts_timers_destroy(timers);
+    if (stepper_finish(&stepper)) {
+        return 1;
+    }
+
+    min_gap = INT64_MAX;
+    max_gap = 0;
+    for (i = 1; i < fires.n; i++) {
+        gap = fires.mono[i] - fires.mono[i - 1];
+        min_gap = gap < min_gap ? gap : min_gap;
+        max_gap = gap > max_gap ? gap : max_gap;
+    }
+    /* The expirations after the step are on the rebased grid */
+    phase = policy == RIAPS_TS_REBASE_SHIFT ? ((step_ns % TIMER_PERIOD_NS) + TIMER_PERIOD_NS) % TIMER_PERIOD_NS : 0;
+
+    ok = fires.n >= TIMER_RUN_NS / TIMER_PERIOD_NS - 2 &&
+         fires.steps == (step_ns != 0) && near(fires.step_ns, step_ns, STEP_TOLERANCE_NS) &&
+         fires.overruns == 0 &&
+         min_gap >= TIMER_PERIOD_NS / 2 && max_gap <= TIMER_PERIOD_NS * 3 / 2 &&
+         fires.n > 0 && near(fires.deadline[fires.n - 1] % TIMER_PERIOD_NS, phase, STEP_TOLERANCE_NS);
+    printf("%-12s fires: %d, steps: %d (%+.6f secs), overruns: %lu, gaps: %.1f .. %.1f ms: %s\n", name,
+           fires.n, fires.steps, fires.step_ns / 1e9, fires.overruns, min_gap / 1e6, max_gap / 1e6,
+           ok ? "PASS" : "FAIL");
+    return !ok;
+}
+
+
+static void on_release(const struct riaps_ts_timespec* release, void* arg)
+{
+    struct fires* fires = arg;
+
+    if (fires->n < MAX_FIRES) {
+        fires->mono[fires->n] = clock_ns(CLOCK_MONOTONIC);
+        fires->deadline[fires->n] = release->tv_sec * NSEC_PER_SEC + release->tv_nsec;
+        fires->n++;
+    }
+}
+
+/* Run a one-slot executor while the clock is stepped by 'step_ns' after 'delay_ns' */
+static int check_executor(const char* name, int64_t delay_ns, int64_t step_ns)
+{
+    struct riaps_ts_timespec hyperperiod = {0, TIMER_PERIOD_NS};
+    struct riaps_ts_timespec phase = {0, 0};
+    struct riaps_ts_slot slot;
+    struct riaps_ts_executor_attr attr;
+    const struct riaps_ts_executor_stats* stats;
+    struct stepper stepper;
+    struct fires fires;
+    riaps_ts_executor* executor;
+    struct timespec run = {TIMER_RUN_NS / NSEC_PER_SEC, TIMER_RUN_NS % NSEC_PER_SEC};
+    int64_t gap, min_gap, max_gap;
+    unsigned long long skips;
+    int i, ok;
+
+    memset(&fires, 0, sizeof(fires));
+    memset(&slot, 0, sizeof(slot));
+    slot.action = on_release;
+    slot.arg = &fires;
+    riaps_ts_executor_attr_init(&attr);
+    attr.policy = SCHED_OTHER;
+    attr.lock_memory = 0;
+    executor = riaps_ts_executor_create(&hyperperiod, &phase, &slot, 1, &attr);
+    if (!executor || riaps_ts_executor_start(executor)) {
+        perror("ERROR: riaps_ts_executor");
+        return 1;
+    }
+
+    stepper_start(&stepper, delay_ns, step_ns);
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &run, NULL);
+    riaps_ts_executor_stop(executor);
+    stats = riaps_ts_executor_stats(executor);
+    skips = stats->slots[0].skips;
+    riaps_ts_executor_destroy(executor);
+    if (stepper_finish(&stepper)) {
+        return 1;
+    }
+
+    min_gap = INT64_MAX;
+    max_gap = 0;
+    for (i = 1; i < fires.n; i++) {
+        gap = fires.mono[i] - fires.mono[i - 1];
+        min_gap = gap < min_gap ? gap : min_gap;
+        max_gap = gap > max_gap ? gap : max_gap;
+    }
+    /* The releases after the step are on the grid of the new time */
+    ok = fires.n >= TIMER_RUN_NS / TIMER_PERIOD_NS - 4 && skips == 0 &&
+         min_gap >= TIMER_PERIOD_NS / 2 && max_gap <= TIMER_PERIOD_NS * 3 / 2 &&
+         fires.n > 0 && near(fires.deadline[fires.n - 1] % TIMER_PERIOD_NS, 0, STEP_TOLERANCE_NS);
+    printf("%-12s releases: %d, skips: %llu, gaps: %.1f .. %.1f ms: %s\n", name, fires.n, skips,
+           min_gap / 1e6, max_gap / 1e6, ok ? "PASS" : "FAIL");
+    return !ok;
+}
+
+
+int main(int argc, const char* argv[])
+{
+    int failures = 0;
+
+    if (step_clock(0)) {
+        perror("ERROR: clock_settime() (root is required)");
+        return 1;
+    }
+
+    /* Forward step: the absolute deadline comes earlier */
+    failures += check_sleep("sleep/none", RIAPS_TS_REBASE_NONE, 2 * NSEC_PER_SEC, NSEC_PER_SEC / 2,
+                            1500 * NSEC_PER_MSEC, 0, NSEC_PER_SEC / 2);
+    /* Backward step: the elapsed time is kept */
+    failures += check_sleep("sleep/shift", RIAPS_TS_REBASE_SHIFT, NSEC_PER_SEC, NSEC_PER_SEC / 2,
+                            -1500 * NSEC_PER_MSEC, 0, NSEC_PER_SEC);
+    /* The caller is notified at the step */
+    failures += check_sleep("sleep/return", RIAPS_TS_REBASE_RETURN, NSEC_PER_SEC, NSEC_PER_SEC / 2,
+                            -1500 * NSEC_PER_MSEC, ECANCELED, NSEC_PER_SEC / 2);
+
+    /* A backward step would stall a plain absolute timer (whole periods, so the grid keeps the spacing) */
+    failures += check_timers("timers/none", RIAPS_TS_REBASE_NONE, 550 * NSEC_PER_MSEC, -1500 * NSEC_PER_MSEC);
+    /* A forward step would skip periods */
+    failures += check_timers("timers/shift", RIAPS_TS_REBASE_SHIFT, 550 * NSEC_PER_MSEC, 1525 * NSEC_PER_MSEC);
+    /* A backward step would stall the workers, a forward one would overrun the releases */
+    failures += check_executor("executor/bwd", 550 * NSEC_PER_MSEC, -1500 * NSEC_PER_MSEC);
+    failures += check_executor("executor/fwd", 550 * NSEC_PER_MSEC, 1500 * NSEC_PER_MSEC);
+
+    /* Delayed reads (no step, the clock is only set to itself) must not be taken as steps */
+    read_delay_ns = READ_DELAY_NS;
+    failures += check_sleep("sleep/delay", RIAPS_TS_REBASE_RETURN, NSEC_PER_SEC, NSEC_PER_SEC / 2, 0, 0,
+                            NSEC_PER_SEC);
+    failures += check_timers("timers/delay", RIAPS_TS_REBASE_SHIFT, 550 * NSEC_PER_MSEC, 0);
+    failures += check_executor("exec/delay", 550 * NSEC_PER_MSEC, 0);
+    read_delay_ns = 0;
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
@@ -4,9 +4,11 @@
     Copyright (C) Vanderbilt University, ISIS 2016-2024
 
 */
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "riaps_ts.h"
+#include "riaps_ts_phc.h"
 
 const char* role_str[] = {
     "MASTER",
@@ -20,11 +22,30 @@ const char* reference_str[] = {
     "PTP"
 };
 
+const char* phc_method_str[] = {
+    "PRECISE",
+    "EXTENDED",
+    "BASIC",
+    "SOFTWARE"
+};
+
 int main(int argc, const char* argv[])
 {
     struct riaps_ts_timespec now;
     struct riaps_ts_timespec snooze;
     struct riap_ts_status status;
+    struct riaps_ts_phc_sample sample;
+    struct riaps_ts_wakeup wakeup;
+    riaps_ts_phc* phc = NULL;
+
+    // Optional PHC device, interface or "sw" (software stand-in clock)
+    if (argc > 1) {
+        phc = riaps_ts_phc_open(argv[1]);
+        if (!phc) {
+            perror("ERROR: riaps_ts_phc_open()");
+            exit(-1);
+        }
+    }
 
     if (riaps_ts_gettime(&now)) {
         perror("ERROR: riaps_ts_gettime()");
@@ -55,9 +76,34 @@ int main(int argc, const char* argv[])
                     status.rms_offset,
                     status.ppm);
         }
+        if (phc) {
+            if (riaps_ts_phc_sample(phc, &sample)) {
+                perror("ERROR: riaps_ts_phc_sample()");
+            }
+            else {
+                printf("\tphc: %lld.%09ld secs\n"
+                        "\tphc_offset: %lld nsecs (+/- %lld, %s)\n",
+                        (long long)sample.phc.tv_sec, (long)sample.phc.tv_nsec,
+                        sample.offset, sample.uncertainty,
+                        phc_method_str[sample.method]);
+            }
+        }
 
         snooze.tv_sec++;
-        riaps_ts_sleep(RIAPS_TS_ABSTIME, &snooze);
+        riaps_ts_gettime(&now);
+        if (snooze.tv_sec <= now.tv_sec || snooze.tv_sec > now.tv_sec + 1) {
+            // Stepped while not sleeping (e.g. during a slow status query)
+            snooze.tv_sec = now.tv_sec + 1;
+        }
+        while (riaps_ts_sleep_until(&snooze, RIAPS_TS_REBASE_RETURN, &wakeup) == ECANCELED) {
+            printf("clock stepped: %+.9f secs\n", wakeup.step_ns / 1e9);
+            // Realign to the next second boundary of the new time (no stall, no burst)
+            riaps_ts_gettime(&now);
+            snooze.tv_sec = now.tv_sec + 1;
+        }
+        if (wakeup.events & RIAPS_TS_WAKE_LEAP_PENDING) {
+            printf("leap second pending\n");
+        }
     }
     return 0;
 }
@@ -0,0 +1,75 @@
+/*
+    RIAPS Timesync Service - Synchronization quality watch
+
+    Prints the notifications of a watch on all the conditions.
+    usage: test_watch [max_rms_offset [max_last_offset [hysteresis]]]
+
+    Copyright (C) Vanderbilt University, ISIS 2016-2024
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "riaps_ts.h"
+#include "riaps_ts_watch.h"
+
+const char* reference_str[] = {
+    "NONE",
+    "GPS",
+    "NTP",
+    "PTP"
+};
+
+static void on_event(riaps_ts_watcher* watcher, const struct riaps_ts_watch_event* event, void* arg)
+{
+    const struct riap_ts_status* status = &event->tracking.status;
+
+    switch (event->event) {
+    case RIAPS_TS_WATCH_RMS_OFFSET:
+        printf("rms_offset %s: %.9f secs\n", event->degraded ? "DEGRADED" : "recovered", status->rms_offset);
+        break;
+    case RIAPS_TS_WATCH_LAST_OFFSET:
+        printf("last_offset %s: %.9f secs\n", event->degraded ? "DEGRADED" : "recovered", status->last_offset);
+        break;
+    case RIAPS_TS_WATCH_REFERENCE:
+        printf("reference: %s -> %s\n", reference_str[event->old_value], reference_str[event->new_value]);
+        break;
+    case RIAPS_TS_WATCH_LEAP:
+        printf("leap_status: %d -> %d\n", event->old_value, event->new_value);
+        break;
+    case RIAPS_TS_WATCH_SERVICE:
+        printf("service %s\n", event->degraded ? "UNAVAILABLE" : "available");
+        break;
+    }
+    fflush(stdout);
+}
+
+int main(int argc, const char* argv[])
+{
+    struct riaps_ts_watch_params params = {
+        .events = RIAPS_TS_WATCH_RMS_OFFSET | RIAPS_TS_WATCH_LAST_OFFSET | RIAPS_TS_WATCH_REFERENCE |
+                  RIAPS_TS_WATCH_LEAP | RIAPS_TS_WATCH_SERVICE,
+        .max_rms_offset = 1e-3,
+        .max_last_offset = 1e-3,
+        .hysteresis = 0.2
+    };
+
+    if (argc > 1) {
+        params.max_rms_offset = atof(argv[1]);
+    }
+    if (argc > 2) {
+        params.max_last_offset = atof(argv[2]);
+    }
+    if (argc > 3) {
+        params.hysteresis = atof(argv[3]);
+    }
+
+    if (!riaps_ts_watch(&params, on_event, NULL)) {
+        perror("ERROR: riaps_ts_watch()");
+        exit(-1);
+    }
+    for (;;) {
+        pause();
+    }
+    return 0;
+}